@@ -0,0 +1,604 @@
+// Host-native benchmark suite of the kernels that dominate tick processing.
+//
+// Usage: qubic_core_bench [--filter <substring>] [--repetitions <n>] [--min-time-ms <ms>] [--output <file>] [--list]
+//
+// Each benchmark is calibrated to run at least min-time-ms per repetition. The results are written as JSON with a
+// fixed order of benchmarks and keys, so outputs of different commits can be compared directly. They go to stdout by
+// default, which is shared with the console output of the node code, so use --output for machine-readable results.
+// Progress is printed to stderr.
+
+#define NO_UEFI
+#define DEFINE_VARIABLES_SHARED_BETWEEN_COMPILE_UNITS
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// workaround for name clash with stdlib
+#define system qubicSystemStruct
+
+#include "platform/m256.h"
+#include "platform/concurrency_impl.h"
+#include "platform/virtual_memory.h"
+#include "kangaroo_twelve.h"
+#include "four_q.h"
+#include "spectrum/spectrum.h"
+#include "assets/assets.h"
+#include "contract_core/qpi_hash_map_impl.h"
+#include "contract_core/qpi_collection_impl.h"
+#include "score.h"
+
+
+struct BenchmarkOptions
+{
+    std::string filter;
+    unsigned int repetitions = 5;
+    unsigned long long minTimeMs = 100;
+    const char* outputFileName = nullptr;
+    bool listOnly = false;
+};
+
+struct BenchmarkResult
+{
+    std::string name;
+    unsigned long long bytesPerOperation;
+    unsigned long long iterations;          // operations per repetition
+    std::vector<double> nanosecPerOperation; // per repetition, sorted
+};
+
+static BenchmarkOptions options;
+static std::vector<BenchmarkResult> results;
+
+// Used to keep the compiler from optimizing away the benchmarked operations
+static volatile unsigned long long benchmarkSink = 0;
+
+static bool isSelected(const char* name)
+{
+    return options.filter.empty() || std::strstr(name, options.filter.c_str()) != nullptr;
+}
+
+// Return if any of the benchmarks is selected, used to skip expensive setup of groups
+static bool isAnySelected(std::initializer_list<const char*> names)
+{
+    for (const char* name : names)
+    {
+        if (isSelected(name))
+            return true;
+    }
+    return false;
+}
+
+static long long measureNanosec(const std::function<void(unsigned long long)>& function, unsigned long long iterations)
+{
+    const auto start = std::chrono::steady_clock::now();
+    function(iterations);
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Run function(iterations), which has to perform the benchmarked operation iterations times. The number of iterations
+// is calibrated first (which also serves as warm-up), then the configured number of repetitions is measured.
+static void runBenchmark(const char* name, const std::function<void(unsigned long long)>& function, unsigned long long bytesPerOperation = 0)
+{
+    if (!isSelected(name))
+        return;
+    if (options.listOnly)
+    {
+        std::printf("%s\n", name);
+        return;
+    }
+
+    const long long minTimeNanosec = (long long)options.minTimeMs * 1000000LL;
+    unsigned long long iterations = 1;
+    while (true)
+    {
+        const long long nanosec = measureNanosec(function, iterations);
+        if (nanosec >= minTimeNanosec || iterations >= (1ULL << 40))
+            break;
+        if (nanosec <= minTimeNanosec / 100)
+            iterations *= 10;
+        else
+            iterations = std::max(iterations + 1, (unsigned long long)(iterations * 1.2 * minTimeNanosec / nanosec));
+    }
+
+    BenchmarkResult result;
+    result.name = name;
+    result.bytesPerOperation = bytesPerOperation;
+    result.iterations = iterations;
+    for (unsigned int i = 0; i < options.repetitions; ++i)
+        result.nanosecPerOperation.push_back(double(measureNanosec(function, iterations)) / double(iterations));
+    std::sort(result.nanosecPerOperation.begin(), result.nanosecPerOperation.end());
+
+    std::fprintf(stderr, "%-48s %14.1f ns/op (%llu iterations)\n", name,
+        result.nanosecPerOperation[result.nanosecPerOperation.size() / 2], iterations);
+    results.push_back(result);
+}
+
+static void fillRandom(void* buffer, unsigned long long size, std::mt19937_64& rnd64)
+{
+    unsigned char* bytes = (unsigned char*)buffer;
+    for (unsigned long long i = 0; i < size; ++i)
+        bytes[i] = (unsigned char)rnd64();
+}
+
+static m256i randomId(std::mt19937_64& rnd64)
+{
+    return m256i(rnd64(), rnd64(), rnd64(), rnd64());
+}
+
+
+static void runKangarooTwelveBenchmarks()
+{
+    std::mt19937_64 rnd64(1);
+    std::vector<unsigned char> input(1024 * 1024);
+    fillRandom(input.data(), input.size(), rnd64);
+
+    for (unsigned int size : { 64u, 1024u, 1024u * 1024u })
+    {
+        const std::string name = "KangarooTwelve/" + std::to_string(size) + "B";
+        runBenchmark(name.c_str(), [&](unsigned long long iterations)
+            {
+                m256i digest = m256i::zero();
+                for (unsigned long long i = 0; i < iterations; ++i)
+                {
+                    input[0] = (unsigned char)i;
+                    KangarooTwelve(input.data(), size, &digest, sizeof(digest));
+                }
+                benchmarkSink = benchmarkSink + digest.m256i_u64[0];
+            }, size);
+    }
+
+    runBenchmark("KangarooTwelve64To32", [&](unsigned long long iterations)
+        {
+            m256i data[2] = { randomId(rnd64), randomId(rnd64) };
+            for (unsigned long long i = 0; i < iterations; ++i)
+            {
+                // chain outputs like levels of a Merkle tree
+                KangarooTwelve64To32(data, &data[i & 1]);
+            }
+            benchmarkSink = benchmarkSink + data[0].m256i_u64[0];
+        }, 64);
+}
+
+static void runFourQBenchmarks()
+{
+    if (!isAnySelected({ "FourQ/sign", "FourQ/verify" }))
+        return;
+
+    unsigned char subseed[32], privateKey[32], publicKey[32];
+    if (!getSubseed((const unsigned char*)"benchmarkseedbenchmarkseedbenchmarkseedbenchmarkseedben", subseed))
+    {
+        std::fprintf(stderr, "FourQ: invalid seed\n");
+        return;
+    }
+    getPrivateKey(subseed, privateKey);
+    getPublicKey(privateKey, publicKey);
+
+    std::mt19937_64 rnd64(2);
+    m256i messageDigest = randomId(rnd64);
+    unsigned char signature[64];
+
+    runBenchmark("FourQ/sign", [&](unsigned long long iterations)
+        {
+            for (unsigned long long i = 0; i < iterations; ++i)
+            {
+                messageDigest.m256i_u64[0] = i;
+                sign(subseed, publicKey, messageDigest.m256i_u8, signature);
+            }
+            benchmarkSink = benchmarkSink + signature[0];
+        });
+
+    sign(subseed, publicKey, messageDigest.m256i_u8, signature);
+    runBenchmark("FourQ/verify", [&](unsigned long long iterations)
+        {
+            unsigned long long validSignatures = 0;
+            for (unsigned long long i = 0; i < iterations; ++i)
+                validSignatures += verify(publicKey, messageDigest.m256i_u8, signature);
+            benchmarkSink = benchmarkSink + validSignatures;
+        });
+}
+
+static void runSpectrumBenchmarks()
+{
+    if (!isAnySelected({ "Spectrum/spectrumIndex/existing", "Spectrum/spectrumIndex/missing", "Spectrum/increaseEnergy" }))
+        return;
+    if (!options.listOnly && (!initCommonBuffers() || !initSpectrum()))
+    {
+        std::fprintf(stderr, "Spectrum: initialization failed\n");
+        deinitCommonBuffers();
+        return;
+    }
+
+    // Quarter-full spectrum stays below the anti-dust threshold
+    std::mt19937_64 rnd64(3);
+    std::vector<m256i> publicKeys;
+    if (!options.listOnly)
+    {
+        const unsigned int numberOfEntities = SPECTRUM_CAPACITY / 4;
+        publicKeys.reserve(numberOfEntities);
+        for (unsigned int i = 0; i < numberOfEntities; ++i)
+        {
+            publicKeys.push_back(randomId(rnd64));
+            increaseEnergy(publicKeys.back(), 1 + rnd64() % 1000000);
+        }
+        std::shuffle(publicKeys.begin(), publicKeys.end(), rnd64);
+    }
+
+    runBenchmark("Spectrum/spectrumIndex/existing", [&](unsigned long long iterations)
+        {
+            long long indexSum = 0;
+            for (unsigned long long i = 0; i < iterations; ++i)
+                indexSum += spectrumIndex(publicKeys[i % publicKeys.size()]);
+            benchmarkSink = benchmarkSink + indexSum;
+        });
+
+    runBenchmark("Spectrum/spectrumIndex/missing", [&](unsigned long long iterations)
+        {
+            long long indexSum = 0;
+            m256i publicKey = randomId(rnd64);
+            for (unsigned long long i = 0; i < iterations; ++i)
+            {
+                publicKey.m256i_u64[1] = i;
+                indexSum += spectrumIndex(publicKey);
+            }
+            benchmarkSink = benchmarkSink + indexSum;
+        });
+
+    runBenchmark("Spectrum/increaseEnergy", [&](unsigned long long iterations)
+        {
+            for (unsigned long long i = 0; i < iterations; ++i)
+                increaseEnergy(publicKeys[i % publicKeys.size()], 1);
+        });
+
+    if (!options.listOnly)
+    {
+        deinitSpectrum();
+        deinitCommonBuffers();
+    }
+}
+
+static void runUniverseBenchmarks()
+{
+    if (!isAnySelected({ "Universe/getUniverseDigest/full", "Universe/getUniverseDigest/1024changes" }))
+        return;
+    if (!options.listOnly && !initAssets())
+    {
+        std::fprintf(stderr, "Universe: initialization failed\n");
+        deinitAssets();
+        return;
+    }
+
+    std::mt19937_64 rnd64(4);
+    if (!options.listOnly)
+        fillRandom(assets, ASSETS_CAPACITY * sizeof(AssetRecord), rnd64);
+
+    runBenchmark("Universe/getUniverseDigest/full", [&](unsigned long long iterations)
+        {
+            m256i digest;
+            for (unsigned long long i = 0; i < iterations; ++i)
+            {
+                setMem(assetChangeFlags, ASSETS_CAPACITY / 8, 0xFF);
+                getUniverseDigest(digest);
+            }
+            benchmarkSink = benchmarkSink + digest.m256i_u64[0];
+        });
+
+    runBenchmark("Universe/getUniverseDigest/1024changes", [&](unsigned long long iterations)
+        {
+            m256i digest;
+            for (unsigned long long i = 0; i < iterations; ++i)
+            {
+                for (unsigned int j = 0; j < 1024; ++j)
+                {
+                    const unsigned long long index = rnd64() & (ASSETS_CAPACITY - 1);
+                    assets[index].varStruct.issuance.numberOfDecimalPlaces++;
+                    assetChangeFlags[index >> 6] |= (1ULL << (index & 63));
+                }
+                getUniverseDigest(digest);
+            }
+            benchmarkSink = benchmarkSink + digest.m256i_u64[0];
+        });
+
+    if (!options.listOnly)
+        deinitAssets();
+}
+
+static void runQpiContainerBenchmarks()
+{
+    if (!isAnySelected({ "QPI::HashMap/get", "QPI::HashMap/set+removeByKey", "QPI::Collection/headIndex", "QPI::Collection/add+remove" }))
+        return;
+    if (!options.listOnly && !initCommonBuffers())
+    {
+        std::fprintf(stderr, "QPI: initialization failed\n");
+        deinitCommonBuffers();
+        return;
+    }
+
+    // Containers are half full, which is a typical load of contract states
+    constexpr unsigned long long capacity = 1 << 16;
+    std::mt19937_64 rnd64(5);
+    std::vector<QPI::id> keys(capacity / 2);
+    for (auto& key : keys)
+        key = randomId(rnd64);
+
+    auto hashMap = std::make_unique<QPI::HashMap<QPI::id, QPI::uint64, capacity>>();
+    hashMap->reset();
+    for (unsigned long long i = 0; i < keys.size(); ++i)
+        hashMap->set(keys[i], i);
+
+    runBenchmark("QPI::HashMap/get", [&](unsigned long long iterations)
+        {
+            QPI::uint64 valueSum = 0, value;
+            for (unsigned long long i = 0; i < iterations; ++i)
+            {
+                if (hashMap->get(keys[(i * 7919) % keys.size()], value))
+                    valueSum += value;
+            }
+            benchmarkSink = benchmarkSink + valueSum;
+        });
+
+    runBenchmark("QPI::HashMap/set+removeByKey", [&](unsigned long long iterations)
+        {
+            QPI::id key = randomId(rnd64);
+            for (unsigned long long i = 0; i < iterations; ++i)
+            {
+                key.u64._0 = i;
+                hashMap->set(key, i);
+                hashMap->removeByKey(key);
+                if ((i & 1023) == 1023)
+                    hashMap->cleanupIfNeeded();
+            }
+            hashMap->cleanupIfNeeded();
+        });
+    hashMap.reset();
+
+    constexpr unsigned long long numberOfPovs = 1024;
+    auto collection = std::make_unique<QPI::Collection<QPI::uint64, capacity>>();
+    collection->reset();
+    for (unsigned long long i = 0; i < keys.size(); ++i)
+        collection->add(keys[i % numberOfPovs], i, rnd64() % 1000000);
+
+    runBenchmark("QPI::Collection/headIndex", [&](unsigned long long iterations)
+        {
+            QPI::sint64 indexSum = 0;
+            for (unsigned long long i = 0; i < iterations; ++i)
+                indexSum += collection->headIndex(keys[i % numberOfPovs]);
+            benchmarkSink = benchmarkSink + indexSum;
+        });
+
+    runBenchmark("QPI::Collection/add+remove", [&](unsigned long long iterations)
+        {
+            for (unsigned long long i = 0; i < iterations; ++i)
+            {
+                const QPI::sint64 elementIndex = collection->add(keys[i % numberOfPovs], i, (QPI::sint64)(i % 1000000));
+                if (elementIndex != QPI::NULL_INDEX)
+                    collection->remove(elementIndex);
+                if ((i & 1023) == 1023)
+                    collection->cleanupIfNeeded();
+            }
+            collection->cleanupIfNeeded();
+        });
+    collection.reset();
+
+    if (!options.listOnly)
+        deinitCommonBuffers();
+}
+
+static void runScoreBenchmarks()
+{
+    if (!isAnySelected({ "ScoreFunction/computeScore" }))
+        return;
+
+    using ScoreFunctionType = ScoreFunction<
+        NUMBER_OF_INPUT_NEURONS,
+        NUMBER_OF_OUTPUT_NEURONS,
+        NUMBER_OF_TICKS,
+        NUMBER_OF_NEIGHBORS,
+        POPULATION_THRESHOLD,
+        NUMBER_OF_MUTATIONS,
+        SOLUTION_THRESHOLD_DEFAULT,
+        1
+    >;
+    std::unique_ptr<ScoreFunctionType> score;
+    std::mt19937_64 rnd64(6);
+    const m256i publicKey = randomId(rnd64);
+    m256i nonce = randomId(rnd64);
+    if (!options.listOnly)
+    {
+        score = std::make_unique<ScoreFunctionType>();
+        score->initMemory();
+        score->initMiningData(randomId(rnd64));
+    }
+
+    runBenchmark("ScoreFunction/computeScore", [&](unsigned long long iterations)
+        {
+            unsigned long long scoreSum = 0;
+            for (unsigned long long i = 0; i < iterations; ++i)
+            {
+                nonce.m256i_u64[0]++;
+                scoreSum += score->computeScore(0, publicKey, nonce);
+            }
+            benchmarkSink = benchmarkSink + scoreSum;
+        });
+}
+
+static void runVirtualMemoryBenchmarks()
+{
+    if (!isAnySelected({ "VirtualMemory/append", "VirtualMemory/get/recent", "VirtualMemory/get/random",
+        "VirtualMemory/getMany/sequential" }))
+        return;
+
+    // Small cache, so that random access has to load pages from disk
+    constexpr unsigned long long pageCapacity = 1 << 16;
+    constexpr unsigned long long numberOfCachePages = 8;
+    constexpr unsigned long long numberOfElements = 64 * pageCapacity;
+    using VirtualMemoryType = VirtualMemory<unsigned long long, 0x68636e6562ULL /* "bench" */, 0, pageCapacity, numberOfCachePages>;
+    std::unique_ptr<VirtualMemoryType> vm;
+    if (!options.listOnly)
+    {
+        initFilesystem();
+        registerAsynFileIO(NULL);
+        vm = std::make_unique<VirtualMemoryType>();
+        if (!vm->init())
+        {
+            std::fprintf(stderr, "VirtualMemory: initialization failed\n");
+            deInitFileSystem();
+            return;
+        }
+        for (unsigned long long i = 0; i < numberOfElements; ++i)
+            vm->append(i);
+    }
+
+    runBenchmark("VirtualMemory/append", [&](unsigned long long iterations)
+        {
+            for (unsigned long long i = 0; i < iterations; ++i)
+                vm->append(i);
+        }, sizeof(unsigned long long));
+
+    runBenchmark("VirtualMemory/get/recent", [&](unsigned long long iterations)
+        {
+            unsigned long long valueSum = 0;
+            const unsigned long long size = vm->size();
+            for (unsigned long long i = 0; i < iterations; ++i)
+                valueSum += vm->get(size - 1 - (i % pageCapacity));
+            benchmarkSink = benchmarkSink + valueSum;
+        }, sizeof(unsigned long long));
+
+    std::mt19937_64 rnd64(7);
+    runBenchmark("VirtualMemory/get/random", [&](unsigned long long iterations)
+        {
+            unsigned long long valueSum = 0;
+            for (unsigned long long i = 0; i < iterations; ++i)
+                valueSum += vm->get(rnd64() % numberOfElements);
+            benchmarkSink = benchmarkSink + valueSum;
+        }, sizeof(unsigned long long));
+
+    // Scan of old pages in chunks of a quarter page, benefits from read ahead
+    std::vector<unsigned long long> chunk(pageCapacity / 4);
+    unsigned long long scanOffset = 0;
+    runBenchmark("VirtualMemory/getMany/sequential", [&](unsigned long long iterations)
+        {
+            unsigned long long valueSum = 0;
+            for (unsigned long long i = 0; i < iterations; ++i)
+            {
+                vm->getMany(chunk.data(), scanOffset, chunk.size());
+                valueSum += chunk[0];
+                scanOffset = (scanOffset + 2 * chunk.size() <= numberOfElements) ? scanOffset + chunk.size() : 0;
+            }
+            benchmarkSink = benchmarkSink + valueSum;
+        }, chunk.size() * sizeof(unsigned long long));
+
+    if (!options.listOnly)
+    {
+        vm->deinit();
+        vm.reset();
+        deInitFileSystem();
+    }
+}
+
+static void writeJsonResults(FILE* file)
+{
+    std::fprintf(file, "{\n");
+    std::fprintf(file, "  \"context\": {\n");
+    std::fprintf(file, "    \"spectrum_depth\": %d,\n", SPECTRUM_DEPTH);
+    std::fprintf(file, "    \"assets_depth\": %d,\n", ASSETS_DEPTH);
+#if defined(__AVX512F__)
+    std::fprintf(file, "    \"avx512\": true,\n");
+#else
+    std::fprintf(file, "    \"avx512\": false,\n");
+#endif
+    std::fprintf(file, "    \"hardware_threads\": %u,\n", std::thread::hardware_concurrency());
+    std::fprintf(file, "    \"repetitions\": %u,\n", options.repetitions);
+    std::fprintf(file, "    \"min_time_ms\": %llu\n", options.minTimeMs);
+    std::fprintf(file, "  },\n");
+    std::fprintf(file, "  \"benchmarks\": [");
+    for (unsigned int i = 0; i < results.size(); ++i)
+    {
+        const BenchmarkResult& result = results[i];
+        const std::vector<double>& ns = result.nanosecPerOperation;
+        const double median = ns[ns.size() / 2];
+        std::fprintf(file, "%s\n    {\n", i ? "," : "");
+        std::fprintf(file, "      \"name\": \"%s\",\n", result.name.c_str());
+        std::fprintf(file, "      \"iterations\": %llu,\n", result.iterations);
+        std::fprintf(file, "      \"bytes_per_op\": %llu,\n", result.bytesPerOperation);
+        std::fprintf(file, "      \"median_ns_per_op\": %.1f,\n", median);
+        std::fprintf(file, "      \"min_ns_per_op\": %.1f,\n", ns.front());
+        std::fprintf(file, "      \"max_ns_per_op\": %.1f,\n", ns.back());
+        std::fprintf(file, "      \"ops_per_sec\": %.1f\n", median > 0.0 ? 1e9 / median : 0.0);
+        std::fprintf(file, "    }");
+    }
+    std::fprintf(file, "%s]\n}\n", results.empty() ? "" : "\n  ");
+}
+
+static bool parseArguments(int argc, char** argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const bool hasValue = (i + 1 < argc);
+        if (!std::strcmp(argv[i], "--filter") && hasValue)
+            options.filter = argv[++i];
+        else if (!std::strcmp(argv[i], "--repetitions") && hasValue)
+            options.repetitions = std::max(1, std::atoi(argv[++i]));
+        else if (!std::strcmp(argv[i], "--min-time-ms") && hasValue)
+            options.minTimeMs = std::strtoull(argv[++i], nullptr, 10);
+        else if (!std::strcmp(argv[i], "--output") && hasValue)
+            options.outputFileName = argv[++i];
+        else if (!std::strcmp(argv[i], "--list"))
+            options.listOnly = true;
+        else
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (!parseArguments(argc, argv))
+    {
+        std::fprintf(stderr, "Usage: %s [--filter <substring>] [--repetitions <n>] [--min-time-ms <ms>] [--output <file>] [--list]\n", argv[0]);
+        return 1;
+    }
+
+#if defined (__AVX512F__) && !GENERIC_K12
+    initAVX512KangarooTwelveConstants();
+#endif
+#if defined (__AVX512F__)
+    initAVX512FourQConstants();
+#endif
+
+    runKangarooTwelveBenchmarks();
+    runFourQBenchmarks();
+    runSpectrumBenchmarks();
+    runUniverseBenchmarks();
+    runQpiContainerBenchmarks();
+    runScoreBenchmarks();
+    runVirtualMemoryBenchmarks();
+
+    if (options.listOnly)
+        return 0;
+
+    FILE* file = stdout;
+    if (options.outputFileName)
+    {
+        file = std::fopen(options.outputFileName, "w");
+        if (!file)
+        {
+            std::fprintf(stderr, "Cannot open %s for writing\n", options.outputFileName);
+            return 1;
+        }
+    }
+    writeJsonResults(file);
+    if (file != stdout)
+        std::fclose(file);
+
+    return 0;
+}
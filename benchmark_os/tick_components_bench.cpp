@@ -0,0 +1,678 @@
+// Host-native microbenchmark of the core components on the path of a tick.
+//
+// Usage: qubic_tick_components_bench [--ticks <n>] [--tx-per-tick <n>] [--computors <n>] [--entities <n>]
+//                                    [--request-processors <n>] [--computor-threads <n>] [--output <file>]
+//
+// This is NOT a node simulation. tickProcessor(), requestProcessor(), contractProcessor() and the peer handling of
+// peers.h / tcp4.h in qubic.cpp are not run, because qubic.cpp still depends on EFI services and global state that
+// have no NO_UEFI replacement yet. Instead, a simplified tick loop in this file drives the core modules that the node
+// uses on the path of a tick, so their throughput can be measured together under a transaction load:
+// - Request handler threads verify signed transactions and votes taken from an in-process message queue (framed with
+//   RequestResponseHeader like messages from peers) and help with parallel work when idle.
+// - A load generator signs QU transfers of funded entities, scheduled a few ticks ahead like wallets do.
+// - Simulated computors sign tick votes on the etalon tick of the tick loop and send them through the queue.
+// - The tick loop waits for the scheduled transactions, builds the tick data from the pending transactions pool,
+//   executes the transfers with the TransferBatch, updates the spectrum and universe digests, and waits for a quorum
+//   of matching votes. Contracts, tick data / vote propagation between nodes, and saving state are not covered.
+// The duration of each phase is reported with ticks/s and tx/s. Numbers are an upper bound for the node, not an
+// end-to-end measurement of it.
+//
+// Build with reduced SPECTRUM_DEPTH / ASSETS_DEPTH (see benchmark_os/CMakeLists.txt) to run on normal machines.
+
+#define NO_UEFI
+#define DEFINE_VARIABLES_SHARED_BETWEEN_COMPILE_UNITS
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// workaround for name clash with stdlib
+#define system qubicSystemStruct
+
+#include "platform/m256.h"
+#include "platform/concurrency_impl.h"
+#include "network_messages/header.h"
+#include "network_messages/tick.h"
+#include "network_messages/transactions.h"
+#include "kangaroo_twelve.h"
+#include "four_q.h"
+#include "spectrum/spectrum.h"
+#include "assets/assets.h"
+#include "ticking/pending_txs_pool.h"
+#include "ticking/transfer_batch.h"
+
+
+struct BenchmarkOptions
+{
+    unsigned int numberOfTicks = 100;
+    unsigned int transactionsPerTick = 512;
+    unsigned int numberOfComputors = NUMBER_OF_COMPUTORS;
+    unsigned int numberOfEntities = SPECTRUM_CAPACITY / 4;
+    unsigned int numberOfRequestProcessors = std::max(2u, std::thread::hardware_concurrency()) - 1;
+    unsigned int numberOfComputorThreads = 1;
+    const char* outputFileName = nullptr;
+};
+
+static BenchmarkOptions options;
+
+// Number of ticks the load generator schedules transactions ahead of the tick loop
+static constexpr unsigned int scheduleAheadTicks = 3;
+
+// Per-tick counters are kept in rings, which must be larger than the range of ticks in flight
+static constexpr unsigned int tickRingSize = 8;
+static_assert(tickRingSize > scheduleAheadTicks + 1, "tickRingSize too small");
+
+static constexpr unsigned short simulatedEpoch = 150;
+static constexpr unsigned int simulatedInitialTick = 20000000;
+
+
+// In-process queue of messages sent to the request handler threads. Messages are RequestResponseHeader followed by the
+// payload, as they would be received from peers.
+class MessageQueue
+{
+    std::mutex mutex;
+    std::deque<std::vector<unsigned char>> messages;
+    unsigned long long numberOfMessages = 0;
+    unsigned long long numberOfBytes = 0;
+
+public:
+    template <typename PayloadType>
+    void send(unsigned char type, const PayloadType* payload, unsigned int payloadSize)
+    {
+        std::vector<unsigned char> message(sizeof(RequestResponseHeader) + payloadSize);
+        RequestResponseHeader* header = (RequestResponseHeader*)message.data();
+        header->checkAndSetSize((unsigned int)message.size());
+        header->setType(type);
+        header->setDejavu(0);
+        memcpy(header->getPayload<unsigned char>(), payload, payloadSize);
+
+        std::lock_guard<std::mutex> guard(mutex);
+        numberOfBytes += message.size();
+        numberOfMessages++;
+        messages.push_back(std::move(message));
+    }
+
+    // Pop next message if available
+    bool receive(std::vector<unsigned char>& message)
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (messages.empty())
+            return false;
+        message = std::move(messages.front());
+        messages.pop_front();
+        return true;
+    }
+
+    unsigned long long getNumberOfMessages()
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        return numberOfMessages;
+    }
+
+    unsigned long long getNumberOfBytes()
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        return numberOfBytes;
+    }
+};
+
+struct KeyPair
+{
+    m256i subseed;
+    m256i publicKey;
+};
+
+struct BenchmarkState
+{
+    MessageQueue messageQueue;
+
+    std::vector<KeyPair> computors;
+    std::vector<KeyPair> accounts; // funded entities used by the load generator
+
+    std::atomic<bool> stop{ false };
+
+    // Load generator and request handlers
+    std::atomic<unsigned int> generatedTick{ 0 };    // all transactions of ticks <= generatedTick have been sent
+    std::atomic<unsigned int> processingTick{ 0 };   // tick processed by the tick loop
+    std::atomic<unsigned int> sentTransactions[tickRingSize];
+    std::atomic<unsigned int> handledTransactions[tickRingSize];
+    std::atomic<unsigned long long> invalidTransactions{ 0 };
+    std::atomic<unsigned long long> rejectedTransactions{ 0 };
+
+    // Etalon ticks and votes, protected by etalonLock
+    volatile char etalonLock = 0;
+    Tick etalonTicks[tickRingSize];
+    unsigned int matchingVotes[tickRingSize];
+    std::atomic<unsigned int> publishedTick{ 0 }; // tick with etalon ready for voting
+    std::atomic<unsigned long long> votesReceived{ 0 };
+    std::atomic<unsigned long long> invalidVotes{ 0 };
+};
+
+static BenchmarkState* state = nullptr;
+
+// Buffers of the tick loop (tick data and the copy of the transactions of the tick)
+static TickData tickData;
+static unsigned char tickTransactions[NUMBER_OF_TRANSACTIONS_PER_TICK * MAX_TRANSACTION_SIZE];
+static const Transaction* tickTransactionPointers[NUMBER_OF_TRANSACTIONS_PER_TICK];
+static TransferBatch transferBatch;
+
+
+static KeyPair generateKeyPair(std::mt19937_64& rnd64)
+{
+    KeyPair keyPair;
+    keyPair.subseed = m256i(rnd64(), rnd64(), rnd64(), rnd64());
+    unsigned char privateKey[32];
+    getPrivateKey(keyPair.subseed.m256i_u8, privateKey);
+    getPublicKey(privateKey, keyPair.publicKey.m256i_u8);
+    return keyPair;
+}
+
+static unsigned int quorum()
+{
+    return options.numberOfComputors * 2 / 3 + 1;
+}
+
+// Load generator thread: signs QU transfers between funded entities, scheduled scheduleAheadTicks ahead
+static void loadGenerator()
+{
+    std::mt19937_64 rnd64(11);
+    const unsigned int lastTick = simulatedInitialTick + options.numberOfTicks - 1;
+    unsigned char message[sizeof(Transaction) + SIGNATURE_SIZE];
+    Transaction* transaction = (Transaction*)message;
+
+    for (unsigned int tick = simulatedInitialTick; tick <= lastTick && !state->stop; ++tick)
+    {
+        while (tick > state->processingTick + scheduleAheadTicks && !state->stop)
+            std::this_thread::yield();
+
+        const unsigned int slot = tick % tickRingSize;
+        state->sentTransactions[slot] = 0;
+        state->handledTransactions[slot] = 0;
+
+        // Each source only has one pending transaction at a time (see PendingTxsPool)
+        const unsigned int sourceOffset = (tick % (scheduleAheadTicks + 1)) * options.transactionsPerTick;
+        for (unsigned int i = 0; i < options.transactionsPerTick; ++i)
+        {
+            const KeyPair& source = state->accounts[sourceOffset + i];
+            transaction->sourcePublicKey = source.publicKey;
+            transaction->destinationPublicKey = state->accounts[rnd64() % state->accounts.size()].publicKey;
+            transaction->amount = 1 + rnd64() % 1000;
+            transaction->tick = tick;
+            transaction->inputType = 0;
+            transaction->inputSize = 0;
+
+            unsigned char digest[32];
+            KangarooTwelve(transaction, sizeof(Transaction), digest, sizeof(digest));
+            sign(source.subseed.m256i_u8, source.publicKey.m256i_u8, digest, message + sizeof(Transaction));
+
+            state->sentTransactions[slot]++;
+            state->messageQueue.send(BROADCAST_TRANSACTION, message, sizeof(message));
+        }
+        state->generatedTick = tick;
+    }
+}
+
+// Like processBroadcastTransaction() of the node, without relaying to peers
+static void processBroadcastTransaction(RequestResponseHeader* header)
+{
+    Transaction* request = header->getPayload<Transaction>();
+    const unsigned int transactionSize = request->totalSize();
+    if (!request->checkValidity() || !header->checkPayloadSize(transactionSize))
+    {
+        state->invalidTransactions++;
+        return;
+    }
+
+    unsigned char digest[32];
+    KangarooTwelve(request, transactionSize - SIGNATURE_SIZE, digest, sizeof(digest));
+    if (verify(request->sourcePublicKey.m256i_u8, digest, request->signaturePtr()))
+    {
+        m256i transactionDigest;
+        KangarooTwelve(request, transactionSize, &transactionDigest, sizeof(transactionDigest));
+        if (!PendingTxsPool::add(request, transactionDigest))
+            state->rejectedTransactions++;
+    }
+    else
+    {
+        state->invalidTransactions++;
+    }
+    state->handledTransactions[request->tick % tickRingSize]++;
+}
+
+// Like processBroadcastTick() of the node: verify the vote and count it if it matches the etalon tick
+static void processBroadcastTick(RequestResponseHeader* header)
+{
+    if (!header->checkPayloadSize(sizeof(BroadcastTick)))
+        return;
+    BroadcastTick* request = header->getPayload<BroadcastTick>();
+    if (request->tick.computorIndex >= options.numberOfComputors)
+    {
+        state->invalidVotes++;
+        return;
+    }
+
+    unsigned char digest[32];
+    request->tick.computorIndex ^= BroadcastTick::type;
+    KangarooTwelve(&request->tick, sizeof(Tick) - SIGNATURE_SIZE, digest, sizeof(digest));
+    request->tick.computorIndex ^= BroadcastTick::type;
+    if (!verify(state->computors[request->tick.computorIndex].publicKey.m256i_u8, digest, request->tick.signature))
+    {
+        state->invalidVotes++;
+        return;
+    }
+    state->votesReceived++;
+
+    const unsigned int slot = request->tick.tick % tickRingSize;
+    ACQUIRE(state->etalonLock);
+    const Tick& etalon = state->etalonTicks[slot];
+    if (etalon.tick == request->tick.tick
+        && etalon.prevSpectrumDigest == request->tick.prevSpectrumDigest
+        && etalon.prevUniverseDigest == request->tick.prevUniverseDigest
+        && etalon.transactionDigest == request->tick.transactionDigest)
+    {
+        state->matchingVotes[slot]++;
+    }
+    RELEASE(state->etalonLock);
+}
+
+// Request handler thread: handles messages of the queue and helps the tick loop when idle
+static void requestHandlerThread()
+{
+    std::vector<unsigned char> message;
+    while (!state->stop)
+    {
+        if (state->messageQueue.receive(message))
+        {
+            RequestResponseHeader* header = (RequestResponseHeader*)message.data();
+            switch (header->type())
+            {
+            case BROADCAST_TRANSACTION:
+                processBroadcastTransaction(header);
+                break;
+            case BroadcastTick::type:
+                processBroadcastTick(header);
+                break;
+            }
+        }
+        else
+        {
+            helpWithParallelWork();
+            std::this_thread::yield();
+        }
+    }
+}
+
+// Computor thread: signs the votes of the simulated computors with index % numberOfComputorThreads == threadIndex
+static void computorThread(unsigned int threadIndex)
+{
+    unsigned int lastVotedTick = 0;
+    BroadcastTick vote;
+    while (!state->stop)
+    {
+        const unsigned int tick = state->publishedTick;
+        if (tick == lastVotedTick)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        ACQUIRE(state->etalonLock);
+        vote.tick = state->etalonTicks[tick % tickRingSize];
+        RELEASE(state->etalonLock);
+
+        for (unsigned int computorIndex = threadIndex; computorIndex < options.numberOfComputors && !state->stop; computorIndex += options.numberOfComputorThreads)
+        {
+            const KeyPair& computor = state->computors[computorIndex];
+            vote.tick.computorIndex = computorIndex ^ BroadcastTick::type;
+            unsigned char digest[32];
+            KangarooTwelve(&vote.tick, sizeof(Tick) - SIGNATURE_SIZE, digest, sizeof(digest));
+            vote.tick.computorIndex = computorIndex;
+            sign(computor.subseed.m256i_u8, computor.publicKey.m256i_u8, digest, vote.tick.signature);
+            state->messageQueue.send(BroadcastTick::type, &vote, sizeof(vote));
+        }
+        lastVotedTick = tick;
+    }
+}
+
+
+enum TickPhase
+{
+    PhaseWaitTransactions,
+    PhaseTickData,
+    PhaseExecution,
+    PhaseDigests,
+    PhaseQuorum,
+    NumberOfPhases
+};
+
+static const char* phaseNames[NumberOfPhases] = { "waitTransactions", "tickData", "execution", "digests", "quorum" };
+
+// Build tick data of the tick from the pending transactions pool (like the tick leader) and copy the transactions
+static unsigned int buildTickData(unsigned int tick)
+{
+    setMem(&tickData, sizeof(tickData), 0);
+    tickData.computorIndex = tick % options.numberOfComputors;
+    tickData.epoch = simulatedEpoch;
+    tickData.tick = tick;
+    tickData.month = 1;
+    tickData.day = 1;
+    tickData.year = 25;
+
+    unsigned int numberOfTransactions = 0;
+    unsigned long long offset = 0;
+    PendingTxsPool::acquireLock();
+    for (unsigned int i = PendingTxsPool::getFirstTickTxIndex(tick);
+        i != PendingTxsPool::NO_TX_INDEX && numberOfTransactions < NUMBER_OF_TRANSACTIONS_PER_TICK;
+        i = PendingTxsPool::getNextTickTxIndex(i))
+    {
+        const Transaction* transaction = PendingTxsPool::getTx(i);
+        copyMem(tickTransactions + offset, transaction, transaction->totalSize());
+        tickTransactionPointers[numberOfTransactions] = (const Transaction*)(tickTransactions + offset);
+        tickData.transactionDigests[numberOfTransactions] = PendingTxsPool::getDigest(i);
+        offset += transaction->totalSize();
+        numberOfTransactions++;
+    }
+    PendingTxsPool::releaseLock();
+
+    // sign like the tick leader
+    const KeyPair& leader = state->computors[tickData.computorIndex];
+    unsigned char digest[32];
+    tickData.computorIndex ^= BroadcastFutureTickData::type;
+    KangarooTwelve(&tickData, sizeof(TickData) - SIGNATURE_SIZE, digest, sizeof(digest));
+    tickData.computorIndex ^= BroadcastFutureTickData::type;
+    sign(leader.subseed.m256i_u8, leader.publicKey.m256i_u8, digest, tickData.signature);
+
+    return numberOfTransactions;
+}
+
+// Execute the plain transfers of the tick like processTickTransferBatch()
+static unsigned int executeTransactions(unsigned int numberOfTransactions)
+{
+    unsigned int numberOfSucceeded = 0;
+    transferBatch.reset();
+    for (unsigned int i = 0; i < numberOfTransactions; ++i)
+        transferBatch.add(tickTransactionPointers[i], i);
+
+    if (!transferBatch.execute())
+    {
+        // may trigger anti-dust, so process transfers one by one
+        for (unsigned int i = 0; i < numberOfTransactions; ++i)
+        {
+            const Transaction* transaction = tickTransactionPointers[i];
+            const int index = spectrumIndex(transaction->sourcePublicKey);
+            if (index >= 0 && decreaseEnergy(index, transaction->amount))
+            {
+                increaseEnergy(transaction->destinationPublicKey, transaction->amount);
+                numberOfSucceeded++;
+            }
+        }
+        return numberOfSucceeded;
+    }
+
+    for (unsigned int i = 0; i < transferBatch.getNumberOfTransfers(); ++i)
+    {
+        if (transferBatch.getTransfer(i).sourceExists && transferBatch.commit(i))
+            numberOfSucceeded++;
+    }
+    return numberOfSucceeded;
+}
+
+static double percentile(std::vector<double> values, double p)
+{
+    if (values.empty())
+        return 0.0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+}
+
+static void writeJsonResults(FILE* file, double seconds, unsigned long long executedTransactions,
+    unsigned long long succeededTransactions, const std::vector<double> (&phaseMicrosec)[NumberOfPhases])
+{
+    std::fprintf(file, "{\n");
+    std::fprintf(file, "  \"config\": {\n");
+    std::fprintf(file, "    \"spectrum_depth\": %d,\n", SPECTRUM_DEPTH);
+    std::fprintf(file, "    \"assets_depth\": %d,\n", ASSETS_DEPTH);
+    std::fprintf(file, "    \"ticks\": %u,\n", options.numberOfTicks);
+    std::fprintf(file, "    \"tx_per_tick\": %u,\n", options.transactionsPerTick);
+    std::fprintf(file, "    \"computors\": %u,\n", options.numberOfComputors);
+    std::fprintf(file, "    \"quorum\": %u,\n", quorum());
+    std::fprintf(file, "    \"entities\": %u,\n", options.numberOfEntities);
+    std::fprintf(file, "    \"request_processors\": %u,\n", options.numberOfRequestProcessors);
+    std::fprintf(file, "    \"computor_threads\": %u\n", options.numberOfComputorThreads);
+    std::fprintf(file, "  },\n");
+    std::fprintf(file, "  \"results\": {\n");
+    std::fprintf(file, "    \"seconds\": %.3f,\n", seconds);
+    std::fprintf(file, "    \"ticks_per_sec\": %.3f,\n", options.numberOfTicks / seconds);
+    std::fprintf(file, "    \"tx_per_sec\": %.1f,\n", executedTransactions / seconds);
+    std::fprintf(file, "    \"executed_transactions\": %llu,\n", executedTransactions);
+    std::fprintf(file, "    \"succeeded_transactions\": %llu,\n", succeededTransactions);
+    std::fprintf(file, "    \"invalid_transactions\": %llu,\n", (unsigned long long)state->invalidTransactions);
+    std::fprintf(file, "    \"rejected_transactions\": %llu,\n", (unsigned long long)state->rejectedTransactions);
+    std::fprintf(file, "    \"votes_received\": %llu,\n", (unsigned long long)state->votesReceived);
+    std::fprintf(file, "    \"invalid_votes\": %llu,\n", (unsigned long long)state->invalidVotes);
+    std::fprintf(file, "    \"queued_messages\": %llu,\n", state->messageQueue.getNumberOfMessages());
+    std::fprintf(file, "    \"queued_bytes\": %llu\n", state->messageQueue.getNumberOfBytes());
+    std::fprintf(file, "  },\n");
+    std::fprintf(file, "  \"phases\": [");
+    for (unsigned int phase = 0; phase < NumberOfPhases; ++phase)
+    {
+        const std::vector<double>& values = phaseMicrosec[phase];
+        double sum = 0.0;
+        for (double value : values)
+            sum += value;
+        std::fprintf(file, "%s\n    {\n", phase ? "," : "");
+        std::fprintf(file, "      \"name\": \"%s\",\n", phaseNames[phase]);
+        std::fprintf(file, "      \"avg_us\": %.1f,\n", values.empty() ? 0.0 : sum / values.size());
+        std::fprintf(file, "      \"p50_us\": %.1f,\n", percentile(values, 0.5));
+        std::fprintf(file, "      \"p99_us\": %.1f,\n", percentile(values, 0.99));
+        std::fprintf(file, "      \"max_us\": %.1f\n", percentile(values, 1.0));
+        std::fprintf(file, "    }");
+    }
+    std::fprintf(file, "\n  ]\n}\n");
+}
+
+static bool parseArguments(int argc, char** argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (i + 1 >= argc)
+            return false;
+        const char* value = argv[i + 1];
+        if (!std::strcmp(argv[i], "--ticks"))
+            options.numberOfTicks = std::max(1, std::atoi(value));
+        else if (!std::strcmp(argv[i], "--tx-per-tick"))
+            options.transactionsPerTick = std::min(std::max(0, std::atoi(value)), NUMBER_OF_TRANSACTIONS_PER_TICK);
+        else if (!std::strcmp(argv[i], "--computors"))
+            options.numberOfComputors = std::min(std::max(1, std::atoi(value)), NUMBER_OF_COMPUTORS);
+        else if (!std::strcmp(argv[i], "--entities"))
+            options.numberOfEntities = std::min((unsigned int)std::max(0, std::atoi(value)), (unsigned int)(SPECTRUM_CAPACITY / 2));
+        else if (!std::strcmp(argv[i], "--request-processors"))
+            options.numberOfRequestProcessors = std::max(1, std::atoi(value));
+        else if (!std::strcmp(argv[i], "--computor-threads"))
+            options.numberOfComputorThreads = std::max(1, std::atoi(value));
+        else if (!std::strcmp(argv[i], "--output"))
+            options.outputFileName = value;
+        else
+            return false;
+        ++i;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (!parseArguments(argc, argv))
+    {
+        std::fprintf(stderr, "Usage: %s [--ticks <n>] [--tx-per-tick <n>] [--computors <n>] [--entities <n>] "
+            "[--request-processors <n>] [--computor-threads <n>] [--output <file>]\n", argv[0]);
+        return 1;
+    }
+
+#if defined (__AVX512F__) && !GENERIC_K12
+    initAVX512KangarooTwelveConstants();
+#endif
+#if defined (__AVX512F__)
+    initAVX512FourQConstants();
+#endif
+
+    system.epoch = simulatedEpoch;
+    system.initialTick = simulatedInitialTick;
+    system.tick = simulatedInitialTick;
+
+    if (!initCommonBuffers() || !initSpectrum() || !initAssets() || !PendingTxsPool::init())
+    {
+        std::fprintf(stderr, "Initialization failed\n");
+        return 1;
+    }
+    PendingTxsPool::beginEpoch(simulatedInitialTick);
+
+    state = new BenchmarkState;
+    for (unsigned int i = 0; i < tickRingSize; ++i)
+    {
+        state->sentTransactions[i] = 0;
+        state->handledTransactions[i] = 0;
+        state->matchingVotes[i] = 0;
+        setMem(&state->etalonTicks[i], sizeof(Tick), 0);
+    }
+    state->processingTick = simulatedInitialTick;
+
+    // Create computors, funded entities of the load generator, and other entities filling the spectrum
+    std::fprintf(stderr, "Setting up %u computors, %u entities ...\n", options.numberOfComputors, options.numberOfEntities);
+    std::mt19937_64 rnd64(10);
+    for (unsigned int i = 0; i < options.numberOfComputors; ++i)
+        state->computors.push_back(generateKeyPair(rnd64));
+    const unsigned int numberOfAccounts = std::max(1u, options.transactionsPerTick * (scheduleAheadTicks + 1));
+    for (unsigned int i = 0; i < numberOfAccounts; ++i)
+    {
+        state->accounts.push_back(generateKeyPair(rnd64));
+        increaseEnergy(state->accounts.back().publicKey, 1000000000LL);
+    }
+    for (unsigned int i = numberOfAccounts; i < options.numberOfEntities; ++i)
+        increaseEnergy(m256i(rnd64(), rnd64(), rnd64(), rnd64()), 1 + rnd64() % 1000000);
+
+    // Initial digests (not measured)
+    updateSpectrumDigests();
+    m256i universeDigest;
+    getUniverseDigest(universeDigest);
+
+    std::vector<std::thread> threads;
+    threads.emplace_back(loadGenerator);
+    for (unsigned int i = 0; i < options.numberOfRequestProcessors; ++i)
+        threads.emplace_back(requestHandlerThread);
+    for (unsigned int i = 0; i < options.numberOfComputorThreads; ++i)
+        threads.emplace_back(computorThread, i);
+
+    std::fprintf(stderr, "Running %u ticks with %u transactions each ...\n", options.numberOfTicks, options.transactionsPerTick);
+    std::vector<double> phaseMicrosec[NumberOfPhases];
+    unsigned long long executedTransactions = 0, succeededTransactions = 0;
+    const auto benchmarkStart = std::chrono::steady_clock::now();
+    auto phaseStart = benchmarkStart;
+    auto endPhase = [&phaseStart, &phaseMicrosec](TickPhase phase)
+        {
+            const auto now = std::chrono::steady_clock::now();
+            phaseMicrosec[phase].push_back(std::chrono::duration<double, std::micro>(now - phaseStart).count());
+            phaseStart = now;
+        };
+
+    for (unsigned int tick = simulatedInitialTick; tick < simulatedInitialTick + options.numberOfTicks; ++tick)
+    {
+        const unsigned int slot = tick % tickRingSize;
+        system.tick = tick;
+        state->processingTick = tick;
+        phaseStart = std::chrono::steady_clock::now();
+
+        // Wait until the transactions scheduled for this tick have been received (the tick leader would include all
+        // of them)
+        while (state->generatedTick < tick || state->handledTransactions[slot] < state->sentTransactions[slot])
+        {
+            helpWithParallelWork();
+            std::this_thread::yield();
+        }
+        endPhase(PhaseWaitTransactions);
+
+        const unsigned int numberOfTransactions = buildTickData(tick);
+        endPhase(PhaseTickData);
+
+        succeededTransactions += executeTransactions(numberOfTransactions);
+        executedTransactions += numberOfTransactions;
+        endPhase(PhaseExecution);
+
+        Tick etalon;
+        setMem(&etalon, sizeof(etalon), 0);
+        etalon.epoch = simulatedEpoch;
+        etalon.tick = tick;
+        etalon.month = 1;
+        etalon.day = 1;
+        etalon.year = 25;
+        updateSpectrumDigests();
+        etalon.prevSpectrumDigest = spectrumDigests[(SPECTRUM_CAPACITY * 2 - 1) - 1];
+        getUniverseDigest(etalon.prevUniverseDigest);
+        KangarooTwelve(&tickData, sizeof(TickData), &etalon.transactionDigest, sizeof(etalon.transactionDigest));
+        endPhase(PhaseDigests);
+
+        ACQUIRE(state->etalonLock);
+        state->etalonTicks[slot] = etalon;
+        state->matchingVotes[slot] = 0;
+        RELEASE(state->etalonLock);
+        state->publishedTick = tick;
+        while (true)
+        {
+            ACQUIRE(state->etalonLock);
+            const unsigned int votes = state->matchingVotes[slot];
+            RELEASE(state->etalonLock);
+            if (votes >= quorum())
+                break;
+            helpWithParallelWork();
+            std::this_thread::yield();
+        }
+        endPhase(PhaseQuorum);
+
+        PendingTxsPool::discardTicksBefore(tick + 1);
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - benchmarkStart).count();
+
+    state->stop = true;
+    for (auto& thread : threads)
+        thread.join();
+
+    std::fprintf(stderr, "%u ticks in %.3f s: %.3f ticks/s, %.1f tx/s\n", options.numberOfTicks, seconds,
+        options.numberOfTicks / seconds, executedTransactions / seconds);
+    for (unsigned int phase = 0; phase < NumberOfPhases; ++phase)
+    {
+        std::fprintf(stderr, "  %-18s p50 %12.1f us, p99 %12.1f us\n", phaseNames[phase],
+            percentile(phaseMicrosec[phase], 0.5), percentile(phaseMicrosec[phase], 0.99));
+    }
+
+    FILE* file = stdout;
+    if (options.outputFileName)
+    {
+        file = std::fopen(options.outputFileName, "w");
+        if (!file)
+        {
+            std::fprintf(stderr, "Cannot open %s for writing\n", options.outputFileName);
+            return 1;
+        }
+    }
+    writeJsonResults(file, seconds, executedTransactions, succeededTransactions, phaseMicrosec);
+    if (file != stdout)
+        std::fclose(file);
+
+    delete state;
+    PendingTxsPool::deinit();
+    deinitAssets();
+    deinitSpectrum();
+    deinitCommonBuffers();
+
+    return 0;
+}
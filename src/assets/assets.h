@@ -18,6 +18,7 @@
 #include "kangaroo_twelve.h"
 #include "four_q.h"
 #include "common_buffers.h"
+#include "platform/copy_on_write.h"
 
 
 // CAUTION: Currently, there is no locking of universeLock if contracts use the QPI asset iteration classes directly.
@@ -36,6 +37,10 @@ static constexpr unsigned long long assetDigestsSizeInBytes = (ASSETS_CAPACITY *
 GLOBAL_VAR_DECL unsigned long long* assetChangeFlags GLOBAL_VAR_INIT(nullptr);
 static constexpr char CONTRACT_ASSET_UNIT_OF_MEASUREMENT[7] = { 0, 0, 0, 0, 0, 0, 0 };
 
+// Copy-on-write snapshot for saving the universe without blocking asset transfers (region 0 is assets)
+static constexpr unsigned int universeSnapshotPoolPages = 4096;
+GLOBAL_VAR_DECL CopyOnWriteSnapshot<1> universeSnapshot;
+
 static constexpr unsigned int NO_ASSET_INDEX = 0xffffffff;
 
 
@@ -131,6 +136,74 @@ public: // TODO: make protected
     };
 
     inline static IndexLists indexLists;
+
+    // Lists (single-linked) of all ownership and possession records of each entity, used for answering queries by
+    // owner or possessor without probing the universe. The first record of each entity is found with a hash map
+    // keyed by the public key of the entity. Records are only added during the epoch, so a list that is being
+    // iterated without holding universeLock stays valid as long as numberOfRebuilds doesn't change.
+    struct EntityLists
+    {
+        // Hash map (open addressing with linear probing) of index of first record of the entity or NO_ASSET_INDEX
+        unsigned int entityFirstIdx[ASSETS_CAPACITY];
+
+        unsigned int nextIdx[ASSETS_CAPACITY];
+
+        unsigned long long numberOfRebuilds;
+
+        // Return slot of entity in entityFirstIdx (slot with NO_ASSET_INDEX if entity has no records)
+        unsigned int slot(const m256i& publicKey) const
+        {
+            unsigned int slotIdx = publicKey.m256i_u32[0] & (ASSETS_CAPACITY - 1);
+            while (entityFirstIdx[slotIdx] != NO_ASSET_INDEX
+                && assets[entityFirstIdx[slotIdx]].varStruct.ownership.publicKey != publicKey)
+            {
+                slotIdx = (slotIdx + 1) & (ASSETS_CAPACITY - 1);
+            }
+            return slotIdx;
+        }
+
+        // Return index of first ownership or possession record of the entity or NO_ASSET_INDEX
+        unsigned int firstIdx(const m256i& publicKey) const
+        {
+            return entityFirstIdx[slot(publicKey)];
+        }
+
+        // Add newRecordIdx (ownership or possession) as first element in linked list of the records of its entity
+        void add(unsigned int newRecordIdx)
+        {
+            ASSERT(newRecordIdx < ASSETS_CAPACITY);
+            ASSERT(assets[newRecordIdx].varStruct.ownership.type == OWNERSHIP || assets[newRecordIdx].varStruct.possession.type == POSSESSION);
+            const unsigned int slotIdx = slot(assets[newRecordIdx].varStruct.ownership.publicKey);
+            nextIdx[newRecordIdx] = entityFirstIdx[slotIdx];
+            entityFirstIdx[slotIdx] = newRecordIdx;
+        }
+
+        // Reset lists to empty
+        void reset()
+        {
+            static_assert(NO_ASSET_INDEX == 0xffffffff, "Following setMem() expects NO_ASSET_INDEX == 0xffffffff");
+            setMem(entityFirstIdx, sizeof(entityFirstIdx), 0xff);
+            setMem(nextIdx, sizeof(nextIdx), 0xff);
+            numberOfRebuilds++;
+        }
+
+        // Rebuild lists from assets array (includes reset)
+        void rebuild()
+        {
+            PROFILE_SCOPE();
+
+            reset();
+            for (unsigned int index = 0; index < ASSETS_CAPACITY; index++)
+            {
+                if (assets[index].varStruct.ownership.type == OWNERSHIP || assets[index].varStruct.possession.type == POSSESSION)
+                {
+                    add(index);
+                }
+            }
+        }
+    };
+
+    inline static EntityLists entityLists;
 };
 
 GLOBAL_VAR_DECL AssetStorage as;
@@ -167,7 +240,9 @@ static bool initAssets()
 {
     if (!allocPoolWithErrorLog(L"assets", ASSETS_CAPACITY * sizeof(AssetRecord), (void**)&assets, __LINE__)
         || !allocPoolWithErrorLog(L"assetDigets", assetDigestsSizeInBytes, (void**)&assetDigests, __LINE__)
-        || !allocPoolWithErrorLog(L"assetChangeFlags", ASSETS_CAPACITY / 8, (void**)&assetChangeFlags, __LINE__))
+        || !allocPoolWithErrorLog(L"assetChangeFlags", ASSETS_CAPACITY / 8, (void**)&assetChangeFlags, __LINE__)
+        || !universeSnapshot.init(universeSnapshotPoolPages)
+        || !universeSnapshot.initRegion(0, assets, ASSETS_CAPACITY * sizeof(AssetRecord)))
     {
         return false;
     }
@@ -177,6 +252,7 @@ static bool initAssets()
 
 static void deinitAssets()
 {
+    universeSnapshot.deinit();
     if (assetChangeFlags)
     {
         freePool(assetChangeFlags);
@@ -194,6 +270,12 @@ static void deinitAssets()
     }
 }
 
+// Must be called before changing the asset record at index, caller must hold universeLock
+static inline void beforeAssetRecordWrite(unsigned int index)
+{
+    universeSnapshot.beforeWrite(0, index * sizeof(AssetRecord), sizeof(AssetRecord));
+}
+
 static long long issueAsset(const m256i& issuerPublicKey, const char name[7], char numberOfDecimalPlaces, const char unitOfMeasurement[7], long long numberOfShares, unsigned short managingContractIndex,
     int* issuanceIndex, int* ownershipIndex, int* possessionIndex)
 {
@@ -206,6 +288,7 @@ static long long issueAsset(const m256i& issuerPublicKey, const char name[7], ch
 iteration:
     if (assets[*issuanceIndex].varStruct.issuance.type == EMPTY)
     {
+        beforeAssetRecordWrite(*issuanceIndex);
         assets[*issuanceIndex].varStruct.issuance.publicKey = issuerPublicKey;
         assets[*issuanceIndex].varStruct.issuance.type = ISSUANCE;
         copyMem(assets[*issuanceIndex].varStruct.issuance.name, name, sizeof(assets[*issuanceIndex].varStruct.issuance.name));
@@ -216,6 +299,7 @@ iteration:
     iteration2:
         if (assets[*ownershipIndex].varStruct.ownership.type == EMPTY)
         {
+            beforeAssetRecordWrite(*ownershipIndex);
             assets[*ownershipIndex].varStruct.ownership.publicKey = issuerPublicKey;
             assets[*ownershipIndex].varStruct.ownership.type = OWNERSHIP;
             assets[*ownershipIndex].varStruct.ownership.managingContractIndex = managingContractIndex;
@@ -226,6 +310,7 @@ iteration:
         iteration3:
             if (assets[*possessionIndex].varStruct.possession.type == EMPTY)
             {
+                beforeAssetRecordWrite(*possessionIndex);
                 assets[*possessionIndex].varStruct.possession.publicKey = issuerPublicKey;
                 assets[*possessionIndex].varStruct.possession.type = POSSESSION;
                 assets[*possessionIndex].varStruct.possession.managingContractIndex = managingContractIndex;
@@ -239,6 +324,8 @@ iteration:
                 as.indexLists.addIssuance(*issuanceIndex);
                 as.indexLists.addOwnership(*issuanceIndex, *ownershipIndex);
                 as.indexLists.addPossession(*ownershipIndex, *possessionIndex);
+                as.entityLists.add(*ownershipIndex);
+                as.entityLists.add(*possessionIndex);
 
                 RELEASE(universeLock);
 
@@ -360,6 +447,8 @@ iteration:
             && assets[destinationOwnershipIndex].varStruct.ownership.publicKey == ownershipPublicKey))
     {
         // found empty slot for ownership record or existing record to update
+        beforeAssetRecordWrite(sourceOwnershipIndex);
+        beforeAssetRecordWrite(destinationOwnershipIndex);
         assets[sourceOwnershipIndex].varStruct.ownership.numberOfShares -= numberOfShares;
 
         if (assets[destinationOwnershipIndex].varStruct.ownership.type == EMPTY)
@@ -370,6 +459,7 @@ iteration:
             assets[destinationOwnershipIndex].varStruct.ownership.issuanceIndex = issuanceIndex;
 
             as.indexLists.addOwnership(issuanceIndex, destinationOwnershipIndex);
+            as.entityLists.add(destinationOwnershipIndex);
         }
         assets[destinationOwnershipIndex].varStruct.ownership.numberOfShares += numberOfShares;
 
@@ -382,6 +472,8 @@ iteration:
                 && assets[destinationPossessionIndex].varStruct.possession.publicKey == possessionPublicKey))
         {
             // found empty slot for poss possession or existing record to update
+            beforeAssetRecordWrite(sourcePossessionIndex);
+            beforeAssetRecordWrite(destinationPossessionIndex);
             assets[sourcePossessionIndex].varStruct.possession.numberOfShares -= numberOfShares;
 
             if (assets[destinationPossessionIndex].varStruct.possession.type == EMPTY)
@@ -392,6 +484,7 @@ iteration:
                 assets[destinationPossessionIndex].varStruct.possession.ownershipIndex = destinationOwnershipIndex;
 
                 as.indexLists.addPossession(destinationOwnershipIndex, destinationPossessionIndex);
+                as.entityLists.add(destinationPossessionIndex);
             }
             assets[destinationPossessionIndex].varStruct.possession.numberOfShares += numberOfShares;
 
@@ -501,6 +594,8 @@ static bool transferShareOwnershipAndPossession(int sourceOwnershipIndex, int so
         }
 
         // Burn by subtracting shares from source records
+        beforeAssetRecordWrite(sourceOwnershipIndex);
+        beforeAssetRecordWrite(sourcePossessionIndex);
         assets[sourceOwnershipIndex].varStruct.ownership.numberOfShares -= numberOfShares;
         assets[sourcePossessionIndex].varStruct.possession.numberOfShares -= numberOfShares;
         assetChangeFlags[sourceOwnershipIndex >> 6] |= (1ULL << (sourceOwnershipIndex & 63));
@@ -545,6 +640,8 @@ iteration:
             && assets[*destinationOwnershipIndex].varStruct.ownership.issuanceIndex == assets[sourceOwnershipIndex].varStruct.ownership.issuanceIndex
             && assets[*destinationOwnershipIndex].varStruct.ownership.publicKey == destinationPublicKey))
     {
+        beforeAssetRecordWrite(sourceOwnershipIndex);
+        beforeAssetRecordWrite(*destinationOwnershipIndex);
         assets[sourceOwnershipIndex].varStruct.ownership.numberOfShares -= numberOfShares;
 
         if (assets[*destinationOwnershipIndex].varStruct.ownership.type == EMPTY)
@@ -555,6 +652,7 @@ iteration:
             assets[*destinationOwnershipIndex].varStruct.ownership.issuanceIndex = assets[sourceOwnershipIndex].varStruct.ownership.issuanceIndex;
 
             as.indexLists.addOwnership(assets[sourceOwnershipIndex].varStruct.ownership.issuanceIndex, *destinationOwnershipIndex);
+            as.entityLists.add(*destinationOwnershipIndex);
         }
         assets[*destinationOwnershipIndex].varStruct.ownership.numberOfShares += numberOfShares;
 
@@ -566,6 +664,8 @@ iteration:
                 && assets[*destinationPossessionIndex].varStruct.possession.ownershipIndex == *destinationOwnershipIndex
                 && assets[*destinationPossessionIndex].varStruct.possession.publicKey == destinationPublicKey))
         {
+            beforeAssetRecordWrite(sourcePossessionIndex);
+            beforeAssetRecordWrite(*destinationPossessionIndex);
             assets[sourcePossessionIndex].varStruct.possession.numberOfShares -= numberOfShares;
 
             if (assets[*destinationPossessionIndex].varStruct.possession.type == EMPTY)
@@ -576,6 +676,7 @@ iteration:
                 assets[*destinationPossessionIndex].varStruct.possession.ownershipIndex = *destinationOwnershipIndex;
 
                 as.indexLists.addPossession(*destinationOwnershipIndex, *destinationPossessionIndex);
+                as.entityLists.add(*destinationPossessionIndex);
             }
             assets[*destinationPossessionIndex].varStruct.possession.numberOfShares += numberOfShares;
 
@@ -722,18 +823,22 @@ static void getUniverseDigest(m256i& digest)
     }
     unsigned int previousLevelBeginning = 0;
     unsigned int numberOfLeafs = ASSETS_CAPACITY;
+    KangarooTwelve64To32Batch batch;
     while (numberOfLeafs > 1)
     {
         for (unsigned int i = 0; i < numberOfLeafs; i += 2)
         {
             if (assetChangeFlags[i >> 6] & (3ULL << (i & 63)))
             {
-                KangarooTwelve64To32(&assetDigests[previousLevelBeginning + i], &assetDigests[digestIndex]);
+                batch.add(&assetDigests[previousLevelBeginning + i], &assetDigests[digestIndex]);
                 assetChangeFlags[i >> 6] &= ~(3ULL << (i & 63));
                 assetChangeFlags[i >> 7] |= (1ULL << ((i >> 1) & 63));
             }
             digestIndex++;
         }
+        // The next level depends on the digests of this level
+        batch.flush();
+
         previousLevelBeginning += numberOfLeafs;
         numberOfLeafs >>= 1;
     }
@@ -743,28 +848,51 @@ static void getUniverseDigest(m256i& digest)
 }
 
 
+// Take snapshot of the current universe, which is saved by saveUniverseSnapshot() (or as delta segment if mode is
+// captureChanged) while assets are transferred
+static void beginUniverseSnapshot(CopyOnWriteSnapshot<1>::CaptureMode mode = CopyOnWriteSnapshot<1>::captureAll)
+{
+    ACQUIRE(universeLock);
+    universeSnapshot.begin(0, mode);
+    RELEASE(universeLock);
+}
+
+// Save snapshot taken by beginUniverseSnapshot(). The caller must hold snapshotBufferLock. Can be called by any
+// processor (files are written through asyncSave() if available), but doesn't log to console.
+static bool saveUniverseSnapshot(const CHAR16* fileName, const CHAR16* directory)
+{
+    const long long savedSize = universeSnapshot.captureAndSave(0, snapshotBuffer, fileName, directory);
+    return savedSize == ASSETS_CAPACITY * sizeof(AssetRecord);
+}
+
 static bool saveUniverse(const CHAR16* fileName = UNIVERSE_FILE_NAME, const CHAR16* directory = NULL)
 {
     PROFILE_SCOPE();
 
+    if (!TRY_ACQUIRE(snapshotBufferLock))
+    {
+        logToConsole(L"Cannot save universe while another snapshot is being saved.");
+        return false;
+    }
+
     logToConsole(L"Saving universe file...");
 
     const unsigned long long beginningTick = __rdtsc();
 
-    ACQUIRE(universeLock);
-    long long savedSize = save(fileName, ASSETS_CAPACITY * sizeof(AssetRecord), (unsigned char*)assets, directory);
-    RELEASE(universeLock);
+    beginUniverseSnapshot();
+    const bool saved = saveUniverseSnapshot(fileName, directory);
+
+    RELEASE(snapshotBufferLock);
 
-    if (savedSize == ASSETS_CAPACITY * sizeof(AssetRecord))
+    if (saved)
     {
-        setNumber(message, savedSize, TRUE);
+        setNumber(message, ASSETS_CAPACITY * sizeof(AssetRecord), TRUE);
         appendText(message, L" bytes of the universe data are saved (");
         appendNumber(message, (__rdtsc() - beginningTick) * 1000000 / frequency, TRUE);
         appendText(message, L" microseconds).");
         logToConsole(message);
-        return true;
     }
-    return false;
+    return saved;
 }
 
 static bool loadUniverse(const CHAR16* fileName = UNIVERSE_FILE_NAME, CHAR16* directory = NULL)
@@ -779,6 +907,7 @@ static bool loadUniverse(const CHAR16* fileName = UNIVERSE_FILE_NAME, CHAR16* di
         return false;
     }
     as.indexLists.rebuild();
+    as.entityLists.rebuild();
     return true;
 }
 
@@ -869,11 +998,13 @@ static void assetsEndEpoch()
             }
         }
     }
+    universeSnapshot.beforeWrite(0, 0, ASSETS_CAPACITY * sizeof(AssetRecord));
     copyMem(assets, reorgAssets, ASSETS_CAPACITY * sizeof(AssetRecord));
 
     setMem(assetChangeFlags, ASSETS_CAPACITY / 8, 0xFF);
 
     as.indexLists.rebuild();
+    as.entityLists.rebuild();
 
     RELEASE(universeLock);
 }
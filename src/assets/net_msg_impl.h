@@ -47,36 +47,31 @@ static void processRequestOwnedAssets(Peer* peer, RequestResponseHeader* header)
 
     RequestOwnedAssets* request = header->getPayload<RequestOwnedAssets>();
 
-    unsigned int universeIndex = request->publicKey.m256i_u32[0] & (ASSETS_CAPACITY - 1);
-
+    // Iterate the records of the entity. The lock is released while enqueuing a response, which is fine because
+    // records are only added to the lists until they are rebuilt at the end of the epoch.
     ACQUIRE(universeLock);
-
-iteration:
-    if (universeIndex >= ASSETS_CAPACITY
-        || assets[universeIndex].varStruct.issuance.type == EMPTY)
+    const unsigned long long numberOfRebuilds = as.entityLists.numberOfRebuilds;
+    unsigned int universeIndex = as.entityLists.firstIdx(request->publicKey);
+    while (universeIndex != NO_ASSET_INDEX && as.entityLists.numberOfRebuilds == numberOfRebuilds)
     {
-        enqueueResponse(peer, 0, EndResponse::type, header->dejavu(), NULL);
-    }
-    else
-    {
-        if (assets[universeIndex].varStruct.issuance.type == OWNERSHIP
-            && assets[universeIndex].varStruct.issuance.publicKey == request->publicKey)
+        const unsigned int recordIndex = universeIndex;
+        universeIndex = as.entityLists.nextIdx[recordIndex];
+        if (assets[recordIndex].varStruct.ownership.type == OWNERSHIP)
         {
-            copyMem(&response.asset, &assets[universeIndex], sizeof(AssetRecord));
-            copyMem(&response.issuanceAsset, &assets[assets[universeIndex].varStruct.ownership.issuanceIndex], sizeof(AssetRecord));
+            copyMem(&response.asset, &assets[recordIndex], sizeof(AssetRecord));
+            copyMem(&response.issuanceAsset, &assets[assets[recordIndex].varStruct.ownership.issuanceIndex], sizeof(AssetRecord));
             response.tick = system.tick;
-            response.universeIndex = universeIndex;
+            response.universeIndex = recordIndex;
             getSiblings<ASSETS_DEPTH>(response.universeIndex, assetDigests, response.siblings);
 
+            RELEASE(universeLock);
             enqueueResponse(peer, sizeof(response), RespondOwnedAssets::type, header->dejavu(), &response);
+            ACQUIRE(universeLock);
         }
-
-        universeIndex = (universeIndex + 1) & (ASSETS_CAPACITY - 1);
-
-        goto iteration;
     }
-
     RELEASE(universeLock);
+
+    enqueueResponse(peer, 0, EndResponse::type, header->dejavu(), NULL);
 }
 
 static void processRequestPossessedAssets(Peer* peer, RequestResponseHeader* header)
@@ -85,37 +80,31 @@ static void processRequestPossessedAssets(Peer* peer, RequestResponseHeader* hea
 
     RequestPossessedAssets* request = header->getPayload<RequestPossessedAssets>();
 
-    unsigned int universeIndex = request->publicKey.m256i_u32[0] & (ASSETS_CAPACITY - 1);
-
+    // Iterate the records of the entity, releasing the lock while enqueuing a response (see processRequestOwnedAssets())
     ACQUIRE(universeLock);
-
-iteration:
-    if (universeIndex >= ASSETS_CAPACITY
-        || assets[universeIndex].varStruct.issuance.type == EMPTY)
+    const unsigned long long numberOfRebuilds = as.entityLists.numberOfRebuilds;
+    unsigned int universeIndex = as.entityLists.firstIdx(request->publicKey);
+    while (universeIndex != NO_ASSET_INDEX && as.entityLists.numberOfRebuilds == numberOfRebuilds)
     {
-        enqueueResponse(peer, 0, EndResponse::type, header->dejavu(), NULL);
-    }
-    else
-    {
-        if (assets[universeIndex].varStruct.issuance.type == POSSESSION
-            && assets[universeIndex].varStruct.issuance.publicKey == request->publicKey)
+        const unsigned int recordIndex = universeIndex;
+        universeIndex = as.entityLists.nextIdx[recordIndex];
+        if (assets[recordIndex].varStruct.possession.type == POSSESSION)
         {
-            copyMem(&response.asset, &assets[universeIndex], sizeof(AssetRecord));
-            copyMem(&response.ownershipAsset, &assets[assets[universeIndex].varStruct.possession.ownershipIndex], sizeof(AssetRecord));
-            copyMem(&response.issuanceAsset, &assets[assets[assets[universeIndex].varStruct.possession.ownershipIndex].varStruct.ownership.issuanceIndex], sizeof(AssetRecord));
+            copyMem(&response.asset, &assets[recordIndex], sizeof(AssetRecord));
+            copyMem(&response.ownershipAsset, &assets[assets[recordIndex].varStruct.possession.ownershipIndex], sizeof(AssetRecord));
+            copyMem(&response.issuanceAsset, &assets[assets[assets[recordIndex].varStruct.possession.ownershipIndex].varStruct.ownership.issuanceIndex], sizeof(AssetRecord));
             response.tick = system.tick;
-            response.universeIndex = universeIndex;
+            response.universeIndex = recordIndex;
             getSiblings<ASSETS_DEPTH>(response.universeIndex, assetDigests, response.siblings);
 
+            RELEASE(universeLock);
             enqueueResponse(peer, sizeof(response), RespondPossessedAssets::type, header->dejavu(), &response);
+            ACQUIRE(universeLock);
         }
-
-        universeIndex = (universeIndex + 1) & (ASSETS_CAPACITY - 1);
-
-        goto iteration;
     }
-
     RELEASE(universeLock);
+
+    enqueueResponse(peer, 0, EndResponse::type, header->dejavu(), NULL);
 }
 
 static void processRequestAssetsSendRecord(Peer* peer, RequestResponseHeader* responseHeader, unsigned int universeIndex)
@@ -16,12 +16,22 @@ constexpr unsigned long long reorgBufferSize = (spectrumSizeInBytes >= universeS
 // Must be large enough to fit any contract, full spectrum, and full universe!
 GLOBAL_VAR_DECL void* reorgBuffer GLOBAL_VAR_INIT(nullptr);
 
+// Buffer that copy-on-write snapshots of spectrum, universe, or contract states are captured to before saving them.
+// Must be large enough to fit any contract, full spectrum, and full universe! Only one snapshot can be saved at a
+// time, which is ensured by snapshotBufferLock. The extra space fits the header and page indices of delta segments
+// (see node_state_delta.h) plus the padding of a partial last page.
+constexpr unsigned long long snapshotBufferSize = reorgBufferSize + reorgBufferSize / 1024 + 8192;
+GLOBAL_VAR_DECL unsigned char* snapshotBuffer GLOBAL_VAR_INIT(nullptr);
+GLOBAL_VAR_DECL volatile char snapshotBufferLock GLOBAL_VAR_INIT(0);
+
 static bool initCommonBuffers()
 {
-    if (!allocPoolWithErrorLog(L"reorgBuffer", reorgBufferSize, (void**)&reorgBuffer, __LINE__))
+    if (!allocPoolWithErrorLog(L"reorgBuffer", reorgBufferSize, (void**)&reorgBuffer, __LINE__)
+        || !allocPoolWithErrorLog(L"snapshotBuffer", snapshotBufferSize, (void**)&snapshotBuffer, __LINE__))
     {
         return false;
     }
+    snapshotBufferLock = 0;
 
     return true;
 }
@@ -33,6 +43,11 @@ static void deinitCommonBuffers()
         freePool(reorgBuffer);
         reorgBuffer = nullptr;
     }
+    if (snapshotBuffer)
+    {
+        freePool(snapshotBuffer);
+        snapshotBuffer = nullptr;
+    }
 }
 
 static void* __scratchpad()
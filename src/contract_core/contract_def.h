@@ -390,6 +390,8 @@ enum OtherEntryPointIDs
 
 GLOBAL_VAR_DECL SYSTEM_PROCEDURE contractSystemProcedures[contractCount][contractSystemProcedureCount];
 GLOBAL_VAR_DECL unsigned short contractSystemProcedureLocalsSizes[contractCount][contractSystemProcedureCount];
+// System procedures declared as isolated, such as with BEGIN_TICK_ISOLATED() (may run in parallel, see contract_exec.h)
+GLOBAL_VAR_DECL bool contractSystemProcedureIsolated[contractCount][contractSystemProcedureCount];
 
 
 #define REGISTER_CONTRACT_FUNCTIONS_AND_PROCEDURES(contractName) { \
@@ -404,6 +406,8 @@ if (!contractName::__beginTickEmpty) contractSystemProcedures[contractIndex][BEG
 contractSystemProcedureLocalsSizes[contractIndex][BEGIN_TICK] = contractName::__beginTickLocalsSize; \
 if (!contractName::__endTickEmpty) contractSystemProcedures[contractIndex][END_TICK] = (SYSTEM_PROCEDURE)contractName::__endTick;\
 contractSystemProcedureLocalsSizes[contractIndex][END_TICK] = contractName::__endTickLocalsSize; \
+contractSystemProcedureIsolated[contractIndex][BEGIN_TICK] = contractName::__beginTickIsolated; \
+contractSystemProcedureIsolated[contractIndex][END_TICK] = contractName::__endTickIsolated; \
 if (!contractName::__preAcquireSharesEmpty) contractSystemProcedures[contractIndex][PRE_ACQUIRE_SHARES] = (SYSTEM_PROCEDURE)contractName::__preAcquireShares;\
 contractSystemProcedureLocalsSizes[contractIndex][PRE_ACQUIRE_SHARES] = contractName::__preAcquireSharesLocalsSize; \
 if (!contractName::__preReleaseSharesEmpty) contractSystemProcedures[contractIndex][PRE_RELEASE_SHARES] = (SYSTEM_PROCEDURE)contractName::__preReleaseShares;\
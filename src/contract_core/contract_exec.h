@@ -8,6 +8,10 @@
 #include "platform/read_write_lock.h"
 #include "platform/debugging.h"
 #include "platform/memory.h"
+#include "platform/copy_on_write.h"
+#include "platform/parallel_work.h"
+
+#include "kangaroo_twelve_parallel.h"
 
 #include "contract_core/contract_def.h"
 #include "contract_core/stack_buffer.h"
@@ -32,6 +36,7 @@ enum ContractError
     ContractErrorTooManyActions,
     ContractErrorTimeout,
     ContractErrorStoppedToResolveDeadlock, // only returned by function call, not set to contractError
+    ContractErrorIsolationViolated,
 };
 
 // Used to store: locals and for first invocation level also input and output
@@ -53,6 +58,13 @@ GLOBAL_VAR_DECL ReadWriteLock contractStateLock[contractCount];
 GLOBAL_VAR_DECL unsigned char* contractStates[contractCount];
 GLOBAL_VAR_DECL volatile long long contractTotalExecutionTicks[contractCount];
 
+// Copy-on-write snapshot for saving contract states without blocking procedures (region i is the state of contract i)
+static constexpr unsigned int contractStateSnapshotPoolPages = 65536;
+GLOBAL_VAR_DECL CopyOnWriteSnapshot<contractCount> contractStateSnapshot;
+
+// Cached leaf chaining values of the K12 digests of the contract states, so only changed chunks are rehashed
+GLOBAL_VAR_DECL KangarooTwelveLeafCache contractStateDigestCaches[contractCount];
+
 // Contract error state, persistent and only set on error of procedure (TODO: only execute procedures if NoContractError)
 GLOBAL_VAR_DECL unsigned int contractError[contractCount];
 
@@ -175,6 +187,11 @@ static bool initContractExec()
     }
     setMem(contractStateChangeFlags, MAX_NUMBER_OF_CONTRACTS / 8, 0xFF);
 
+    if (!contractStateSnapshot.init(contractStateSnapshotPoolPages))
+    {
+        return false;
+    }
+
     contractCallbacksRunning = NoContractCallback;
 
     if (!contractActionTracker.allocBuffer())
@@ -185,6 +202,12 @@ static bool initContractExec()
 
 static void deinitContractExec()
 {
+    contractStateSnapshot.deinit();
+    for (unsigned int i = 0; i < contractCount; ++i)
+    {
+        contractStateDigestCaches[i].deinit();
+    }
+
     if (contractStateChangeFlags)
     {
         freePool(contractStateChangeFlags);
@@ -193,6 +216,34 @@ static void deinitContractExec()
     contractActionTracker.freeBuffer();
 }
 
+// Must be called before changing the state of a contract, caller must hold the write lock of the state. The whole
+// state is preserved, because procedures may change any part of it.
+static inline void beforeContractStateWrite(unsigned int contractIndex)
+{
+    contractStateSnapshot.beforeWrite(contractIndex, 0, contractDescriptions[contractIndex].stateSize);
+    contractStateDigestCaches[contractIndex].markAllDirty();
+}
+
+// Must be called before changing bytes [offset, offset + size) of the state of a contract. Use this instead of
+// beforeContractStateWrite(contractIndex) if the changed bytes are known, so the digest of the state is updated by
+// rehashing only the changed chunks.
+static inline void beforeContractStateWrite(unsigned int contractIndex, unsigned long long offset, unsigned long long size)
+{
+    contractStateSnapshot.beforeWrite(contractIndex, offset, size);
+    contractStateDigestCaches[contractIndex].markDirty(offset, size);
+}
+
+// Must be called after changing contract states without beforeContractStateWrite(), for example by loading them from
+// files. Makes sure that the digests of all states are recomputed completely.
+static void markAllContractStatesChanged()
+{
+    setMem(contractStateChangeFlags, MAX_NUMBER_OF_CONTRACTS / 8, 0xFF);
+    for (unsigned int i = 0; i < contractCount; ++i)
+    {
+        contractStateDigestCaches[i].markAllDirty();
+    }
+}
+
 // Acquire lock of an currently unused stack (may block if all in use)
 // stacksToIgnore > 0 can be passed by low priority tasks to keep some stacks reserved for high prio purposes.
 static void acquireContractLocalsStack(int& stackIdx, unsigned int stacksToIgnore = 0)
@@ -393,6 +444,10 @@ void* QPI::QpiContextFunctionCall::__qpiAcquireStateForReading(unsigned int cont
     ASSERT(contractIndex < contractCount);
     ASSERT(contractIndex <= _currentContractIndex);
 
+    // Other states may be changed by isolated procedures running in parallel
+    if (contractIndex != _currentContractIndex)
+        __qpiAbortIfIsolated();
+
     // Add rollback info for this lock to the stack
     auto rollbackInfo = reinterpret_cast<ContractRollbackInfo*>(contractLocalsStack[_stackIndex].allocateSpecial(sizeof(ContractRollbackInfo)));
     rollbackInfo->contractIndex = contractIndex;
@@ -516,6 +571,7 @@ void* QPI::QpiContextProcedureCall::__qpiAcquireStateForWriting(unsigned int con
     ASSERT(_entryPoint != USER_FUNCTION_CALL);
     ASSERT(contractIndex < contractCount);
     ASSERT(_stackIndex >= 0 && _stackIndex < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS);
+    __qpiAbortIfIsolated();
 
     // Add rollback info for this lock to the stack
     auto rollbackInfo = reinterpret_cast<ContractRollbackInfo*>(contractLocalsStack[_stackIndex].allocateSpecial(sizeof(ContractRollbackInfo)));
@@ -530,6 +586,7 @@ void* QPI::QpiContextProcedureCall::__qpiAcquireStateForWriting(unsigned int con
         ASSERT(contractIndex < _currentContractIndex);
         // this needs to be split in a loop considering all cases below, because a deadlock may also happen when the functions is already waiting here
         contractStateLock[contractIndex].acquireWrite();
+        beforeContractStateWrite(contractIndex);
         rollbackInfo->type = ContractRollbackInfo::ContractStateWriteLock;
     }
     else
@@ -560,6 +617,7 @@ void* QPI::QpiContextProcedureCall::__qpiAcquireStateForWriting(unsigned int con
             // -> if there is a deadlock with a request processor, the following acquireWrite()
             //    needs to wait until it gets resolved in __qpiAcquireStateForReading()
             contractStateLock[contractIndex].acquireWrite();
+            beforeContractStateWrite(contractIndex);
             rollbackInfo->type = ContractRollbackInfo::ContractStateWriteLock;
         }
     }
@@ -722,6 +780,15 @@ void QPI::QpiContextFunctionCall::__qpiAbort(unsigned int errorCode) const
     {
         // TODO: long jump can be also used for procedures
         contractError[_currentContractIndex] = errorCode;
+
+        // Isolated system procedures may run on idle processors helping with runParallelWork(), which must return,
+        // so jump back to QpiContextSystemProcedureCall::runCall(). This is done independently of whether the
+        // procedure actually runs in parallel, so the outcome is deterministic.
+        if (_entryPoint < contractSystemProcedureCount && contractSystemProcedureIsolated[_currentContractIndex][_entryPoint])
+        {
+            contractExecutionErrorData[_stackIndex].errorCode = errorCode;
+            LongJump(&contractExecutionErrorData[_stackIndex].longJumpBuffer, 1);
+        }
     }
 
     // TODO: How to do error handing in user functions? (request processor has no timeout / respawn)
@@ -734,6 +801,15 @@ void QPI::QpiContextFunctionCall::__qpiAbort(unsigned int errorCode) const
         _mm_pause();
 }
 
+// Abort if running in an isolated system procedure (such as BEGIN_TICK_ISOLATED()), which must only change the state
+// of its own contract. Called by all QPI features with other effects, regardless of whether the procedure is actually
+// running in parallel, so the outcome is deterministic.
+void QPI::QpiContextFunctionCall::__qpiAbortIfIsolated() const
+{
+    if (_entryPoint < contractSystemProcedureCount && contractSystemProcedureIsolated[_currentContractIndex][_entryPoint])
+        __qpiAbort(ContractErrorIsolationViolated);
+}
+
 // TODO: don't call faulty contracts
 
 //void QpiContextProcedureCall::__qpiRollbackContractTransaction()
@@ -787,7 +863,9 @@ struct QpiContextSystemProcedureCall : public QPI::QpiContextProcedureCall
 {
     QpiContextSystemProcedureCall(unsigned int contractIndex, SystemProcedureID systemProcId) : QPI::QpiContextProcedureCall(contractIndex, NULL_ID, 0, systemProcId)
     {
-        contractActionTracker.init();
+        // Isolated procedures may run in parallel and don't have actions to track
+        if (!contractSystemProcedureIsolated[contractIndex][systemProcId])
+            contractActionTracker.init();
     }
 
     // Run system procedure without input and output
@@ -804,6 +882,16 @@ struct QpiContextSystemProcedureCall : public QPI::QpiContextProcedureCall
         runCall(&noInOutData, &noInOutData);
     }
 
+    // Run isolated system procedure without input and output on the locals stack, which is owned by the caller
+    void callIsolated(int stackIndex)
+    {
+        ASSERT(_entryPoint < contractSystemProcedureCount && contractSystemProcedureIsolated[_currentContractIndex][_entryPoint]);
+        ASSERT(_stackIndex < 0 && stackIndex >= 0);
+        _stackIndex = stackIndex;
+        call();
+        _stackIndex = -1;
+    }
+
     // Run callback system procedure POST_INCOMING_TRANSFER
     void call(QPI::PostIncomingTransfer_input& input)
     {
@@ -826,12 +914,35 @@ private:
         if (!contractSystemProcedures[_currentContractIndex][systemProcId])
             return;
 
-        // reserve stack for this processor (may block), needed even if there are no locals, because procedure may call
-        // functions / procedures / notifications that create locals etc.
-        acquireContractLocalsStack(_stackIndex);
+        // reserve stack for this processor (may block) unless provided by caller, needed even if there are no locals,
+        // because procedure may call functions / procedures / notifications that create locals etc.
+        const bool ownStack = (_stackIndex < 0);
+        if (ownStack)
+            acquireContractLocalsStack(_stackIndex);
 
         // acquire state for writing (may block)
         contractStateLock[_currentContractIndex].acquireWrite();
+        beforeContractStateWrite(_currentContractIndex);
+
+        // set error handler for aborting isolated procedures (see __qpiAbort())
+        const bool isolated = contractSystemProcedureIsolated[_currentContractIndex][systemProcId];
+        if (isolated)
+        {
+            contractExecutionErrorData[_stackIndex].errorCode = NoContractError;
+            if (SetJump(&contractExecutionErrorData[_stackIndex].longJumpBuffer) > 0)
+            {
+                // error handling code (long jump returns to here from somewhere inside the call of
+                // contractSystemProcedures() below): release locks using stack unwinding and keep the changes of the
+                // state made before the abort, as if the procedure ended there
+                rollbackContractFunctionCall(_stackIndex);
+                ASSERT(contractLocalsStack[_stackIndex].size() == 0);
+                contractStateLock[_currentContractIndex].releaseWrite();
+                _InterlockedOr64((volatile long long*)&contractStateChangeFlags[_currentContractIndex >> 6], 1LL << (_currentContractIndex & 63));
+                if (ownStack)
+                    releaseContractLocalsStack(_stackIndex);
+                return;
+            }
+        }
 
         const unsigned long long startTick = __rdtsc();
         unsigned short localsSize = contractSystemProcedureLocalsSizes[_currentContractIndex][systemProcId];
@@ -858,15 +969,101 @@ private:
         }
         _interlockedadd64(&contractTotalExecutionTicks[_currentContractIndex], __rdtsc() - startTick);
 
-        // release lock of contract state and set state to changed
+        // release lock of contract state and set state to changed (atomically, because isolated procedures of other
+        // contracts may run in parallel)
         contractStateLock[_currentContractIndex].releaseWrite();
-        contractStateChangeFlags[_currentContractIndex >> 6] |= (1ULL << (_currentContractIndex & 63));
+        if (isolated)
+            _InterlockedOr64((volatile long long*)&contractStateChangeFlags[_currentContractIndex >> 6], 1LL << (_currentContractIndex & 63));
+        else
+            contractStateChangeFlags[_currentContractIndex >> 6] |= (1ULL << (_currentContractIndex & 63));
 
         // release stack
-        releaseContractLocalsStack(_stackIndex);
+        if (ownStack)
+            releaseContractLocalsStack(_stackIndex);
     }
 };
 
+// Contracts whose isolated system procedure is run in parallel by runTickSystemProcedures()
+struct IsolatedSystemProcedureGroup
+{
+    SystemProcedureID systemProcId;
+    unsigned int numberOfContracts;
+    volatile long nextContract;
+    unsigned int contractIndices[contractCount];
+};
+
+// Parallel work function of a worker running the isolated system procedures of the group in canonical order until all
+// contracts have been claimed. A contract whose log message buffer is full waits for the contracts before it (see
+// logContractMessage()) while holding its state lock and locals stack. The worker acquires its stack before claiming
+// contracts, so the contracts before always make progress, even if user functions waiting for the state lock of the
+// waiting contract hold all other stacks.
+static void runIsolatedSystemProcedures(void* context, unsigned long long beginIndex, unsigned long long endIndex)
+{
+    IsolatedSystemProcedureGroup* group = (IsolatedSystemProcedureGroup*)context;
+    int stackIndex = -1;
+    acquireContractLocalsStack(stackIndex);
+    while (true)
+    {
+        const unsigned int i = _InterlockedIncrement(&group->nextContract) - 1;
+        if (i >= group->numberOfContracts)
+            break;
+        QpiContextSystemProcedureCall qpiContext(group->contractIndices[i], group->systemProcId);
+        qpiContext.callIsolated(stackIndex);
+        logger.finishDeferringContractMessages(group->contractIndices[i]);
+    }
+    releaseContractLocalsStack(stackIndex);
+}
+
+// Run the isolated system procedures of the group in parallel with help of idle processors and log their contract
+// messages in the canonical order of the group. Resets the group.
+static void flushIsolatedSystemProcedureGroup(IsolatedSystemProcedureGroup& group)
+{
+    if (!group.numberOfContracts)
+        return;
+    logger.beginDeferringContractMessages(group.contractIndices, group.numberOfContracts);
+    group.nextContract = 0;
+
+    // leave stacks for user functions
+    const unsigned int numberOfWorkers = (group.numberOfContracts < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS - 1) ? group.numberOfContracts : NUMBER_OF_CONTRACT_EXECUTION_BUFFERS - 1;
+    if (numberOfWorkers > 1)
+        runParallelWork(runIsolatedSystemProcedures, &group, numberOfWorkers, 1);
+    else
+        runIsolatedSystemProcedures(&group, 0, 1);
+    logger.endDeferringContractMessages();
+    group.numberOfContracts = 0;
+}
+
+// Run system procedure BEGIN_TICK (in ascending contract index order) or END_TICK (in descending order) of all active
+// contracts. Consecutive contracts with isolated procedures (see BEGIN_TICK_ISOLATED()) run in parallel, because they
+// only change their own state and only read data that none of them changes. The other procedures run one by one in
+// between, so the resulting states, spectrum, universe, and log are the same as with running all one after another.
+static void runTickSystemProcedures(SystemProcedureID systemProcId)
+{
+    ASSERT(systemProcId == BEGIN_TICK || systemProcId == END_TICK);
+    IsolatedSystemProcedureGroup group;
+    group.systemProcId = systemProcId;
+    group.numberOfContracts = 0;
+    for (unsigned int i = 1; i < contractCount; i++)
+    {
+        const unsigned int contractIndex = (systemProcId == BEGIN_TICK) ? i : contractCount - i;
+        if (system.epoch >= contractDescriptions[contractIndex].constructionEpoch
+            && system.epoch < contractDescriptions[contractIndex].destructionEpoch)
+        {
+            if (contractSystemProcedures[contractIndex][systemProcId] && contractSystemProcedureIsolated[contractIndex][systemProcId])
+            {
+                group.contractIndices[group.numberOfContracts++] = contractIndex;
+            }
+            else
+            {
+                flushIsolatedSystemProcedureGroup(group);
+                QpiContextSystemProcedureCall qpiContext(contractIndex, systemProcId);
+                qpiContext.call();
+            }
+        }
+    }
+    flushIsolatedSystemProcedureGroup(group);
+}
+
 // QPI context used to call contract user procedure from qubic core (contract processor), after transfer of invocation reward
 struct QpiContextUserProcedureCall : public QPI::QpiContextProcedureCall
 {
@@ -954,6 +1151,7 @@ struct QpiContextUserProcedureCall : public QPI::QpiContextProcedureCall
 
         // acquire lock of contract state for writing (shouldn't block because 1 stack is not used by functions and thus kept free for procedures)
         contractStateLock[_currentContractIndex].acquireWrite();
+        beforeContractStateWrite(_currentContractIndex);
 
         // run procedure
         const unsigned long long startTick = __rdtsc();
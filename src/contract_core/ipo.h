@@ -42,6 +42,7 @@ static long long bidInContractIPO(long long price, unsigned short quantity, cons
             registeredBids = 0;
             numberOfReleasedEntities = 0;
             contractStateLock[contractIndex].acquireWrite();
+            beforeContractStateWrite(contractIndex);
             IPO* ipo = (IPO*)contractStates[contractIndex];
             for (unsigned int i = 0; i < quantity; i++)
             {
@@ -379,6 +379,8 @@ sint64 QPI::QpiContextProcedureCall::acquireShares(
     uint16 sourceOwnershipManagingContractIndex, uint16 sourcePossessionManagingContractIndex,
     sint64 offeredTransferFee) const
 {
+    __qpiAbortIfIsolated();
+
     // prevent nested calling of management rights transfer from callbacks
     if (contractCallbacksRunning & ContractCallbackManagementRightsTransfer)
     {
@@ -462,6 +464,8 @@ sint64 QPI::QpiContextProcedureCall::acquireShares(
 
 bool QPI::QpiContextProcedureCall::distributeDividends(long long amountPerShare) const
 {
+    __qpiAbortIfIsolated();
+
     if (contractCallbacksRunning & ContractCallbackPostIncomingTransfer)
     {
         return false;
@@ -538,6 +542,8 @@ bool QPI::QpiContextProcedureCall::distributeDividends(long long amountPerShare)
 
 long long QPI::QpiContextProcedureCall::issueAsset(unsigned long long name, const QPI::id& issuer, signed char numberOfDecimalPlaces, long long numberOfShares, unsigned long long unitOfMeasurement) const
 {
+    __qpiAbortIfIsolated();
+
     if (((unsigned char)name) < 'A' || ((unsigned char)name) > 'Z'
         || name > 0xFFFFFFFFFFFFFF)
     {
@@ -613,6 +619,8 @@ sint64 QPI::QpiContextProcedureCall::releaseShares(
     uint16 destinationOwnershipManagingContractIndex, uint16 destinationPossessionManagingContractIndex,
     sint64 offeredTransferFee) const
 {
+    __qpiAbortIfIsolated();
+
     // prevent nested calling of management rights transfer from callbacks
     if (contractCallbacksRunning & ContractCallbackManagementRightsTransfer)
     {
@@ -693,6 +701,8 @@ sint64 QPI::QpiContextProcedureCall::releaseShares(
 
 long long QPI::QpiContextProcedureCall::transferShareOwnershipAndPossession(unsigned long long assetName, const m256i& issuer, const m256i& owner, const m256i& possessor, long long numberOfShares, const m256i& newOwnerAndPossessor) const
 {
+    __qpiAbortIfIsolated();
+
     if (numberOfShares <= 0 || numberOfShares > MAX_AMOUNT)
     {
         return -((long long)(MAX_AMOUNT + 1));
@@ -4,6 +4,8 @@
 
 QPI::sint64 QPI::QpiContextProcedureCall::bidInIPO(unsigned int IPOContractIndex, long long price, unsigned int quantity) const
 {
+    __qpiAbortIfIsolated();
+
     if (contractCallbacksRunning != NoContractCallback)
         return -1;
 
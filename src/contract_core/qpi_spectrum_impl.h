@@ -6,7 +6,22 @@
 
 bool QPI::QpiContextFunctionCall::getEntity(const m256i& id, QPI::Entity& entity) const
 {
-    int index = spectrumIndex(id);
+    // Read without lock, retried if the entity has been moved by reorganizeSpectrum() after looking up its index
+    int index;
+    EntityRecord record;
+    while (true)
+    {
+        index = spectrumIndex(id);
+        if (index < 0)
+        {
+            break;
+        }
+        readSpectrumRecord(index, record);
+        if (record.publicKey == id)
+        {
+            break;
+        }
+    }
     if (index < 0)
     {
         entity.publicKey = id;
@@ -21,13 +36,13 @@ bool QPI::QpiContextFunctionCall::getEntity(const m256i& id, QPI::Entity& entity
     }
     else
     {
-        entity.publicKey = spectrum[index].publicKey;
-        entity.incomingAmount = spectrum[index].incomingAmount;
-        entity.outgoingAmount = spectrum[index].outgoingAmount;
-        entity.numberOfIncomingTransfers = spectrum[index].numberOfIncomingTransfers;
-        entity.numberOfOutgoingTransfers = spectrum[index].numberOfOutgoingTransfers;
-        entity.latestIncomingTransferTick = spectrum[index].latestIncomingTransferTick;
-        entity.latestOutgoingTransferTick = spectrum[index].latestOutgoingTransferTick;
+        entity.publicKey = record.publicKey;
+        entity.incomingAmount = record.incomingAmount;
+        entity.outgoingAmount = record.outgoingAmount;
+        entity.numberOfIncomingTransfers = record.numberOfIncomingTransfers;
+        entity.numberOfOutgoingTransfers = record.numberOfOutgoingTransfers;
+        entity.latestIncomingTransferTick = record.latestIncomingTransferTick;
+        entity.latestOutgoingTransferTick = record.latestOutgoingTransferTick;
 
         return true;
     }
@@ -37,11 +52,15 @@ bool QPI::QpiContextFunctionCall::getEntity(const m256i& id, QPI::Entity& entity
 static long long& contractFeeReserve(unsigned int contractIndex)
 {
     contractStateChangeFlags[0] |= 1ULL;
-    return ((Contract0State*)contractStates[0])->contractFeeReserves[contractIndex];
+    long long& feeReserve = ((Contract0State*)contractStates[0])->contractFeeReserves[contractIndex];
+    beforeContractStateWrite(0, (unsigned char*)&feeReserve - contractStates[0], sizeof(feeReserve));
+    return feeReserve;
 }
 
 long long QPI::QpiContextProcedureCall::burn(long long amount) const
 {
+    __qpiAbortIfIsolated();
+
     if (amount < 0 || amount > MAX_AMOUNT)
     {
         return -((long long)(MAX_AMOUNT + 1));
@@ -76,6 +95,8 @@ long long QPI::QpiContextProcedureCall::burn(long long amount) const
 
 long long QPI::QpiContextProcedureCall::transfer(const m256i& destination, long long amount) const
 {
+    __qpiAbortIfIsolated();
+
     if (contractCallbacksRunning & ContractCallbackPostIncomingTransfer)
     {
         return INVALID_AMOUNT;
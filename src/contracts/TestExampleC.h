@@ -191,6 +191,70 @@ public:
 		output = qpi.bidInIPO(input.ipoContractIndex, input.pricePerShare, input.numberOfShares);
 	}
 
+	//---------------------------------------------------------------
+	// ISOLATED TICK PROCEDURES (may run in parallel to the ones of other contracts)
+
+	struct IsolatedTickMessage
+	{
+		uint32 _contractIndex;
+		uint32 _type;
+		uint64 value;
+		uint32 counter;
+		sint8 _terminator;
+	};
+
+protected:
+	uint32 isolatedTickNumberOfMessages;
+	bit isolatedTickViolateIsolation;
+	uint32 isolatedTickCounter;
+	uint64 isolatedTickValue;
+
+	struct BEGIN_TICK_locals
+	{
+		IsolatedTickMessage message;
+		uint32 i;
+	};
+
+	BEGIN_TICK_ISOLATED_WITH_LOCALS()
+	{
+		for (locals.i = 0; locals.i < state.isolatedTickNumberOfMessages; ++locals.i)
+		{
+			state.isolatedTickCounter++;
+			state.isolatedTickValue = state.isolatedTickValue * 6364136223846793005ull + SELF_INDEX;
+			locals.message._type = 1;
+			locals.message.value = state.isolatedTickValue;
+			locals.message.counter = state.isolatedTickCounter;
+			LOG_INFO(locals.message);
+		}
+
+		// aborts with ContractErrorIsolationViolated
+		if (state.isolatedTickViolateIsolation)
+			qpi.transfer(SELF, 1);
+	}
+
+	struct END_TICK_locals
+	{
+		IsolatedTickMessage message;
+		uint32 i;
+	};
+
+	END_TICK_ISOLATED_WITH_LOCALS()
+	{
+		for (locals.i = 0; locals.i < state.isolatedTickNumberOfMessages; ++locals.i)
+		{
+			state.isolatedTickCounter++;
+			state.isolatedTickValue = state.isolatedTickValue * 1442695040888963407ull + SELF_INDEX;
+			locals.message._type = 2;
+			locals.message.value = state.isolatedTickValue;
+			locals.message.counter = state.isolatedTickCounter;
+			LOG_INFO(locals.message);
+		}
+
+		// aborts with ContractErrorIsolationViolated
+		if (state.isolatedTickViolateIsolation)
+			qpi.transfer(SELF, 1);
+	}
+
 	//---------------------------------------------------------------
 	// COMMON PARTS
 
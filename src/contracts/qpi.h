@@ -1915,6 +1915,7 @@ namespace QPI
 		inline void * __qpiAcquireStateForReading(unsigned int contractIndex) const;
 		inline void __qpiReleaseStateForReading(unsigned int contractIndex) const;
 		inline void __qpiAbort(unsigned int errorCode) const;
+		inline void __qpiAbortIfIsolated() const;
 
 	protected:
 		// Construction is done in core, not allowed in contracts
@@ -2078,6 +2079,7 @@ namespace QPI
 		static void __beginTick(const QpiContextProcedureCall&, void*, void*, void*) {}
 		enum { __endTickEmpty = 1, __endTickLocalsSize = sizeof(NoData) };
 		static void __endTick(const QpiContextProcedureCall&, void*, void*, void*) {}
+		enum { __beginTickIsolated = 0, __endTickIsolated = 0 };
 		enum { __preAcquireSharesEmpty = 1, __preAcquireSharesLocalsSize = sizeof(NoData) };
 		static void __preAcquireShares(const QpiContextProcedureCall&, void*, void*, void*) {}
 		enum { __preReleaseSharesEmpty = 1, __preReleaseSharesLocalsSize = sizeof(NoData) };
@@ -2146,6 +2148,22 @@ namespace QPI
 	// Define contract system procedure called at end of each tick, provides zeroed instance of BEGIN_TICK_locals struct
 	#define END_TICK_WITH_LOCALS() NO_IO_SYSTEM_PROC_WITH_LOCALS(END_TICK, __endTick, NoData, NoData)
 
+	// Define isolated BEGIN_TICK, which only changes the state of its own contract and may run in parallel with the
+	// BEGIN_TICK of other contracts. It must not transfer QUs, change assets, or call other contracts. See
+	// `doc/contracts.md` for details.
+	#define BEGIN_TICK_ISOLATED() public: enum { __beginTickIsolated = 1 }; BEGIN_TICK()
+
+	// Define isolated BEGIN_TICK (see BEGIN_TICK_ISOLATED()), provides zeroed instance of BEGIN_TICK_locals struct
+	#define BEGIN_TICK_ISOLATED_WITH_LOCALS() public: enum { __beginTickIsolated = 1 }; BEGIN_TICK_WITH_LOCALS()
+
+	// Define isolated END_TICK, which only changes the state of its own contract and may run in parallel with the
+	// END_TICK of other contracts. It must not transfer QUs, change assets, or call other contracts. See
+	// `doc/contracts.md` for details.
+	#define END_TICK_ISOLATED() public: enum { __endTickIsolated = 1 }; END_TICK()
+
+	// Define isolated END_TICK (see END_TICK_ISOLATED()), provides zeroed instance of END_TICK_locals struct
+	#define END_TICK_ISOLATED_WITH_LOCALS() public: enum { __endTickIsolated = 1 }; END_TICK_WITH_LOCALS()
+
 	// Define contract system procedure called before asset management rights transfer with `qpi.releaseShares(). See
 	// `doc/contracts.md` for details.
 	#define PRE_ACQUIRE_SHARES() \
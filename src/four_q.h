@@ -733,21 +733,29 @@ static void Montgomery_multiply_mod_order(const unsigned long long* ma, const un
     }
 }
 
-static void eccnorm(point_extproj_t P, point_t Q)
-{ // Normalize a projective point (X1:Y1:Z1), including full reduction
+static void fpinv1271(felm_t a)
+{ // Field inversion, a = a^-1 = a^(p-2) mod p
+    felm_t t;
+    fpexp1251(a, t);
+    fpsqr1271(t, t);
+    fpsqr1271(t, t);
+    fpmul1271(a, t, a);
+}
+
+static void eccnorm_z_norm(point_extproj_t P, felm_t n)
+{ // Norm of Z1 over GF(p), n = Z1[0]^2 + Z1[1]^2, which needs to be inverted for normalizing P
+    felm_t t;
+    fpsqr1271(P->z[0], n);
+    fpsqr1271(P->z[1], t);
+    fpadd1271(n, t, n);
+}
 
+static void eccnorm_with_inverted_z_norm(point_extproj_t P, felm_t invertedNorm, point_t Q)
+{ // Normalize a projective point (X1:Y1:Z1), including full reduction, given the inverted norm of Z1
     // Z1 = Z1^-1
-    f2elm_t t1;
-    fpsqr1271(P->z[0], t1[0]);
-    fpsqr1271(P->z[1], t1[1]);
-    fpadd1271(t1[0], t1[1], t1[0]);
-    fpexp1251(t1[0], t1[1]);
-    fpsqr1271(t1[1], t1[1]);
-    fpsqr1271(t1[1], t1[1]);
-    fpmul1271(t1[0], t1[1], t1[0]);
     fpneg1271(P->z[1]);
-    fpmul1271(P->z[0], t1[0], P->z[0]);
-    fpmul1271(P->z[1], t1[0], P->z[1]);
+    fpmul1271(P->z[0], invertedNorm, P->z[0]);
+    fpmul1271(P->z[1], invertedNorm, P->z[1]);
 
     fp2mul1271(P->x, P->z, Q->x);          // X1 = X1/Z1
     fp2mul1271(P->y, P->z, Q->y);          // Y1 = Y1/Z1
@@ -757,6 +765,14 @@ static void eccnorm(point_extproj_t P, point_t Q)
     mod1271(Q->y[1]);
 }
 
+static void eccnorm(point_extproj_t P, point_t Q)
+{ // Normalize a projective point (X1:Y1:Z1), including full reduction
+    felm_t n;
+    eccnorm_z_norm(P, n);
+    fpinv1271(n);
+    eccnorm_with_inverted_z_norm(P, n, Q);
+}
+
 static void R1_to_R2(point_extproj_t P, point_extproj_precomp_t Q)
 { // Conversion from representation (X,Y,Z,Ta,Tb) to (X+Y,Y-X,2Z,2dT), where T = Ta*Tb
     fp2add1271(P->ta, P->ta, Q->t2);                  // T = 2*Ta
@@ -1315,14 +1331,14 @@ static void ecc_precomp_double(point_extproj_t P, point_extproj_precomp_t* Table
     R1_to_R2(Q, Table[3]);                  // Converting from (X,Y,Z,Ta,Tb) to (X+Y,Y-X,2Z,2dT)
 }
 
-static bool ecc_mul_double(unsigned long long* k, unsigned long long* l, point_t Q)
-{ // Double scalar multiplication R = k*G + l*Q, where the G is the generator
+static bool ecc_mul_double_extproj(unsigned long long* k, unsigned long long* l, point_t Q, point_extproj_t T)
+{ // Double scalar multiplication T = k*G + l*Q, where the G is the generator, without normalizing the result T
   // Uses DOUBLE_SCALAR_TABLE, which contains multiples of G, Phi(G), Psi(G) and Phi(Psi(G))
   // The function uses wNAF with interleaving.
     char digits_k1[65], digits_k2[65], digits_k3[65], digits_k4[65];
     char digits_l1[65], digits_l2[65], digits_l3[65], digits_l4[65];
     point_precomp_t V;
-    point_extproj_t Q1, Q2, Q3, Q4, T;
+    point_extproj_t Q1, Q2, Q3, Q4;
     point_extproj_precomp_t U, Q_table1[4], Q_table2[4], Q_table3[4], Q_table4[4];
     unsigned long long k_scalars[4], l_scalars[4];
 
@@ -1457,6 +1473,17 @@ static bool ecc_mul_double(unsigned long long* k, unsigned long long* l, point_t
         }
     }
 
+    return true;
+}
+
+static bool ecc_mul_double(unsigned long long* k, unsigned long long* l, point_t Q)
+{ // Double scalar multiplication R = k*G + l*Q, where the G is the generator
+    point_extproj_t T;
+    if (!ecc_mul_double_extproj(k, l, Q, T))
+    {
+        return false;
+    }
+
     eccnorm(T, Q);
 
     return true;
@@ -1904,3 +1931,111 @@ static bool verify(const unsigned char* publicKey, const unsigned char* messageD
     encode(A, (unsigned char*)A);
     return *((__m256i*)A) == *((__m256i*)signature);
 }
+
+// Number of signatures that verifyBatch() normalizes with a single field inversion
+static constexpr unsigned int VERIFY_BATCH_SIZE = 16;
+
+static void verifyBatch(unsigned int count, const unsigned char* const* publicKeys, const unsigned char* const* messageDigests, const unsigned char* const* signatures, bool* results)
+{ // SchnorrQ verification of a batch of signatures, results[i] is the same as verify(publicKeys[i], messageDigests[i], signatures[i])
+  // The field inversions needed for normalizing the points s*G + h*A of all signatures of a batch are replaced by a single one
+  // using Montgomery's simultaneous inversion trick.
+  // Notice: The common batch verification equation with random weights (sum of z_i * (s_i*G + h_i*A_i - R_i) == 0) is not used,
+  // because it may accept signatures that are rejected by the cofactorless verify() (if points have small-order components).
+  // Nodes have to agree on the set of valid signatures, so only exact optimizations are applied here.
+    point_extproj_t T[VERIFY_BATCH_SIZE];
+    felm_t norms[VERIFY_BATCH_SIZE], products[VERIFY_BATCH_SIZE];
+    unsigned int indices[VERIFY_BATCH_SIZE];
+    bool zeroNorm[VERIFY_BATCH_SIZE];
+
+    for (unsigned int batchBegin = 0; batchBegin < count; batchBegin += VERIFY_BATCH_SIZE)
+    {
+        const unsigned int batchEnd = (count - batchBegin > VERIFY_BATCH_SIZE) ? batchBegin + VERIFY_BATCH_SIZE : count;
+
+        // Compute s*G + h*A in projective coordinates for all signatures passing the preliminary checks
+        unsigned int n = 0;
+        for (unsigned int i = batchBegin; i < batchEnd; i++)
+        {
+            const unsigned char* publicKey = publicKeys[i];
+            const unsigned char* signature = signatures[i];
+            point_t A;
+            unsigned char temp[32 + 64], h[64];
+
+            results[i] = false;
+
+            if ((publicKey[15] & 0x80) || (signature[15] & 0x80) || (signature[62] & 0xC0) || signature[63])
+            {
+                continue;
+            }
+
+            if (!decode(publicKey, A))
+            {
+                continue;
+            }
+
+            *((__m256i*)temp) = *((__m256i*)signature);
+            *((__m256i*)(temp + 32)) = *((__m256i*)publicKey);
+            *((__m256i*)(temp + 64)) = *((__m256i*)messageDigests[i]);
+
+            KangarooTwelve(temp, 32 + 64, h, 64);
+
+            if (!ecc_mul_double_extproj((unsigned long long*)(signature + 32), (unsigned long long*)h, A, T[n]))
+            {
+                continue;
+            }
+
+            // Norms that are zero are excluded from the inversion (as in eccnorm(), their "inverse" is zero)
+            eccnorm_z_norm(T[n], norms[n]);
+            products[n][0] = norms[n][0];
+            products[n][1] = norms[n][1];
+            mod1271(products[n]);
+            zeroNorm[n] = !products[n][0] && !products[n][1];
+            if (zeroNorm[n])
+            {
+                norms[n][0] = 1;
+                norms[n][1] = 0;
+            }
+            indices[n++] = i;
+        }
+        if (!n)
+        {
+            continue;
+        }
+
+        // products[j] = norms[0] * ... * norms[j]
+        products[0][0] = norms[0][0];
+        products[0][1] = norms[0][1];
+        for (unsigned int j = 1; j < n; j++)
+        {
+            fpmul1271(products[j - 1], norms[j], products[j]);
+        }
+
+        // Invert product of all norms, then derive the individual inverses from back to front
+        felm_t inverse, invertedNorm;
+        inverse[0] = products[n - 1][0];
+        inverse[1] = products[n - 1][1];
+        fpinv1271(inverse);
+        for (unsigned int j = n; j--; )
+        {
+            if (j)
+            {
+                fpmul1271(inverse, products[j - 1], invertedNorm);
+                fpmul1271(inverse, norms[j], inverse);
+            }
+            else
+            {
+                invertedNorm[0] = inverse[0];
+                invertedNorm[1] = inverse[1];
+            }
+            if (zeroNorm[j])
+            {
+                invertedNorm[0] = 0;
+                invertedNorm[1] = 0;
+            }
+
+            point_t R;
+            eccnorm_with_inverted_z_norm(T[j], invertedNorm, R);
+            encode(R, (unsigned char*)R);
+            results[indices[j]] = *((__m256i*)R) == *((__m256i*)signatures[indices[j]]);
+        }
+    }
+}
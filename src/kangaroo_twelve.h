@@ -2495,6 +2495,494 @@ static void KangarooTwelve64To32(const void* input, void* output)
     KangarooTwelve64To32((const unsigned char*)input, (unsigned char*)output);
 }
 
+////////// Multi-lane KangarooTwelve64To32 \\\\\\\\\\
+
+// KangarooTwelve64To32 of several independent inputs (such as pairs of child nodes of a Merkle tree) can be computed
+// at once by interleaving their states, so each SIMD instruction processes the same 64-bit word of
+// K12_64TO32_LANES states.
+
+#if defined (__AVX512F__)
+
+#define K12_64TO32_LANES 8
+
+typedef __m512i K12LanesVector;
+
+#define K12LanesXor(a, b) _mm512_xor_si512(a, b)
+#define K12LanesAndNot(a, b) _mm512_andnot_si512(a, b)
+#define K12LanesRol(a, offset) _mm512_rol_epi64(a, offset)
+#define K12LanesConst(c) _mm512_set1_epi64(c)
+
+#else
+
+#define K12_64TO32_LANES 4
+
+typedef __m256i K12LanesVector;
+
+#define K12LanesXor(a, b) _mm256_xor_si256(a, b)
+#define K12LanesAndNot(a, b) _mm256_andnot_si256(a, b)
+#define K12LanesRol(a, offset) _mm256_or_si256(_mm256_slli_epi64(a, offset), _mm256_srli_epi64(a, 64 - (offset)))
+#define K12LanesConst(c) _mm256_set1_epi64x(c)
+
+#endif
+
+#define thetaRhoPiChiIotaPrepareThetaLanes(i, A, E)                         \
+    Da = K12LanesXor(Cu, K12LanesRol(Ce, 1));                               \
+    De = K12LanesXor(Ca, K12LanesRol(Ci, 1));                               \
+    Di = K12LanesXor(Ce, K12LanesRol(Co, 1));                               \
+    Do = K12LanesXor(Ci, K12LanesRol(Cu, 1));                               \
+    Du = K12LanesXor(Co, K12LanesRol(Ca, 1));                               \
+    A##ba = K12LanesXor(A##ba, Da);                                         \
+    Bba = A##ba;                                                            \
+    A##ge = K12LanesXor(A##ge, De);                                         \
+    Bbe = K12LanesRol(A##ge, 44);                                           \
+    A##ki = K12LanesXor(A##ki, Di);                                         \
+    Bbi = K12LanesRol(A##ki, 43);                                           \
+    A##mo = K12LanesXor(A##mo, Do);                                         \
+    Bbo = K12LanesRol(A##mo, 21);                                           \
+    A##su = K12LanesXor(A##su, Du);                                         \
+    Bbu = K12LanesRol(A##su, 14);                                           \
+    E##ba = K12LanesXor(Bba, K12LanesAndNot(Bbe, Bbi));                     \
+    E##ba = K12LanesXor(E##ba, K12LanesConst(KeccakF1600RoundConstant##i)); \
+    Ca = E##ba;                                                             \
+    E##be = K12LanesXor(Bbe, K12LanesAndNot(Bbi, Bbo));                     \
+    Ce = E##be;                                                             \
+    E##bi = K12LanesXor(Bbi, K12LanesAndNot(Bbo, Bbu));                     \
+    Ci = E##bi;                                                             \
+    E##bo = K12LanesXor(Bbo, K12LanesAndNot(Bbu, Bba));                     \
+    Co = E##bo;                                                             \
+    E##bu = K12LanesXor(Bbu, K12LanesAndNot(Bba, Bbe));                     \
+    Cu = E##bu;                                                             \
+    A##bo = K12LanesXor(A##bo, Do);                                         \
+    Bga = K12LanesRol(A##bo, 28);                                           \
+    A##gu = K12LanesXor(A##gu, Du);                                         \
+    Bge = K12LanesRol(A##gu, 20);                                           \
+    A##ka = K12LanesXor(A##ka, Da);                                         \
+    Bgi = K12LanesRol(A##ka, 3);                                            \
+    A##me = K12LanesXor(A##me, De);                                         \
+    Bgo = K12LanesRol(A##me, 45);                                           \
+    A##si = K12LanesXor(A##si, Di);                                         \
+    Bgu = K12LanesRol(A##si, 61);                                           \
+    E##ga = K12LanesXor(Bga, K12LanesAndNot(Bge, Bgi));                     \
+    Ca = K12LanesXor(Ca, E##ga);                                            \
+    E##ge = K12LanesXor(Bge, K12LanesAndNot(Bgi, Bgo));                     \
+    Ce = K12LanesXor(Ce, E##ge);                                            \
+    E##gi = K12LanesXor(Bgi, K12LanesAndNot(Bgo, Bgu));                     \
+    Ci = K12LanesXor(Ci, E##gi);                                            \
+    E##go = K12LanesXor(Bgo, K12LanesAndNot(Bgu, Bga));                     \
+    Co = K12LanesXor(Co, E##go);                                            \
+    E##gu = K12LanesXor(Bgu, K12LanesAndNot(Bga, Bge));                     \
+    Cu = K12LanesXor(Cu, E##gu);                                            \
+    A##be = K12LanesXor(A##be, De);                                         \
+    Bka = K12LanesRol(A##be, 1);                                            \
+    A##gi = K12LanesXor(A##gi, Di);                                         \
+    Bke = K12LanesRol(A##gi, 6);                                            \
+    A##ko = K12LanesXor(A##ko, Do);                                         \
+    Bki = K12LanesRol(A##ko, 25);                                           \
+    A##mu = K12LanesXor(A##mu, Du);                                         \
+    Bko = K12LanesRol(A##mu, 8);                                            \
+    A##sa = K12LanesXor(A##sa, Da);                                         \
+    Bku = K12LanesRol(A##sa, 18);                                           \
+    E##ka = K12LanesXor(Bka, K12LanesAndNot(Bke, Bki));                     \
+    Ca = K12LanesXor(Ca, E##ka);                                            \
+    E##ke = K12LanesXor(Bke, K12LanesAndNot(Bki, Bko));                     \
+    Ce = K12LanesXor(Ce, E##ke);                                            \
+    E##ki = K12LanesXor(Bki, K12LanesAndNot(Bko, Bku));                     \
+    Ci = K12LanesXor(Ci, E##ki);                                            \
+    E##ko = K12LanesXor(Bko, K12LanesAndNot(Bku, Bka));                     \
+    Co = K12LanesXor(Co, E##ko);                                            \
+    E##ku = K12LanesXor(Bku, K12LanesAndNot(Bka, Bke));                     \
+    Cu = K12LanesXor(Cu, E##ku);                                            \
+    A##bu = K12LanesXor(A##bu, Du);                                         \
+    Bma = K12LanesRol(A##bu, 27);                                           \
+    A##ga = K12LanesXor(A##ga, Da);                                         \
+    Bme = K12LanesRol(A##ga, 36);                                           \
+    A##ke = K12LanesXor(A##ke, De);                                         \
+    Bmi = K12LanesRol(A##ke, 10);                                           \
+    A##mi = K12LanesXor(A##mi, Di);                                         \
+    Bmo = K12LanesRol(A##mi, 15);                                           \
+    A##so = K12LanesXor(A##so, Do);                                         \
+    Bmu = K12LanesRol(A##so, 56);                                           \
+    E##ma = K12LanesXor(Bma, K12LanesAndNot(Bme, Bmi));                     \
+    Ca = K12LanesXor(Ca, E##ma);                                            \
+    E##me = K12LanesXor(Bme, K12LanesAndNot(Bmi, Bmo));                     \
+    Ce = K12LanesXor(Ce, E##me);                                            \
+    E##mi = K12LanesXor(Bmi, K12LanesAndNot(Bmo, Bmu));                     \
+    Ci = K12LanesXor(Ci, E##mi);                                            \
+    E##mo = K12LanesXor(Bmo, K12LanesAndNot(Bmu, Bma));                     \
+    Co = K12LanesXor(Co, E##mo);                                            \
+    E##mu = K12LanesXor(Bmu, K12LanesAndNot(Bma, Bme));                     \
+    Cu = K12LanesXor(Cu, E##mu);                                            \
+    A##bi = K12LanesXor(A##bi, Di);                                         \
+    Bsa = K12LanesRol(A##bi, 62);                                           \
+    A##go = K12LanesXor(A##go, Do);                                         \
+    Bse = K12LanesRol(A##go, 55);                                           \
+    A##ku = K12LanesXor(A##ku, Du);                                         \
+    Bsi = K12LanesRol(A##ku, 39);                                           \
+    A##ma = K12LanesXor(A##ma, Da);                                         \
+    Bso = K12LanesRol(A##ma, 41);                                           \
+    A##se = K12LanesXor(A##se, De);                                         \
+    Bsu = K12LanesRol(A##se, 2);                                            \
+    E##sa = K12LanesXor(Bsa, K12LanesAndNot(Bse, Bsi));                     \
+    Ca = K12LanesXor(Ca, E##sa);                                            \
+    E##se = K12LanesXor(Bse, K12LanesAndNot(Bsi, Bso));                     \
+    Ce = K12LanesXor(Ce, E##se);                                            \
+    E##si = K12LanesXor(Bsi, K12LanesAndNot(Bso, Bsu));                     \
+    Ci = K12LanesXor(Ci, E##si);                                            \
+    E##so = K12LanesXor(Bso, K12LanesAndNot(Bsu, Bsa));                     \
+    Co = K12LanesXor(Co, E##so);                                            \
+    E##su = K12LanesXor(Bsu, K12LanesAndNot(Bsa, Bse));                     \
+    Cu = K12LanesXor(Cu, E##su);
+
+#define rounds12Lanes                                                                 \
+    Ca = K12LanesXor(K12LanesXor(K12LanesXor(Aba, Aga), K12LanesXor(Aka, Ama)), Asa); \
+    Ce = K12LanesXor(K12LanesXor(K12LanesXor(Abe, Age), K12LanesXor(Ake, Ame)), Ase); \
+    Ci = K12LanesXor(K12LanesXor(K12LanesXor(Abi, Agi), K12LanesXor(Aki, Ami)), Asi); \
+    Co = K12LanesXor(K12LanesXor(K12LanesXor(Abo, Ago), K12LanesXor(Ako, Amo)), Aso); \
+    Cu = K12LanesXor(K12LanesXor(K12LanesXor(Abu, Agu), K12LanesXor(Aku, Amu)), Asu); \
+    thetaRhoPiChiIotaPrepareThetaLanes(0, A, E)                                       \
+    thetaRhoPiChiIotaPrepareThetaLanes(1, E, A)                                       \
+    thetaRhoPiChiIotaPrepareThetaLanes(2, A, E)                                       \
+    thetaRhoPiChiIotaPrepareThetaLanes(3, E, A)                                       \
+    thetaRhoPiChiIotaPrepareThetaLanes(4, A, E)                                       \
+    thetaRhoPiChiIotaPrepareThetaLanes(5, E, A)                                       \
+    thetaRhoPiChiIotaPrepareThetaLanes(6, A, E)                                       \
+    thetaRhoPiChiIotaPrepareThetaLanes(7, E, A)                                       \
+    thetaRhoPiChiIotaPrepareThetaLanes(8, A, E)                                       \
+    thetaRhoPiChiIotaPrepareThetaLanes(9, E, A)                                       \
+    thetaRhoPiChiIotaPrepareThetaLanes(10, A, E)                                      \
+    Da = K12LanesXor(Cu, K12LanesRol(Ce, 1));                                         \
+    De = K12LanesXor(Ca, K12LanesRol(Ci, 1));                                         \
+    Di = K12LanesXor(Ce, K12LanesRol(Co, 1));                                         \
+    Do = K12LanesXor(Ci, K12LanesRol(Cu, 1));                                         \
+    Du = K12LanesXor(Co, K12LanesRol(Ca, 1));                                         \
+    Eba = K12LanesXor(Eba, Da);                                                       \
+    Bba = Eba;                                                                        \
+    Ege = K12LanesXor(Ege, De);                                                       \
+    Bbe = K12LanesRol(Ege, 44);                                                       \
+    Eki = K12LanesXor(Eki, Di);                                                       \
+    Bbi = K12LanesRol(Eki, 43);                                                       \
+    Emo = K12LanesXor(Emo, Do);                                                       \
+    Bbo = K12LanesRol(Emo, 21);                                                       \
+    Esu = K12LanesXor(Esu, Du);                                                       \
+    Bbu = K12LanesRol(Esu, 14);                                                       \
+    Aba = K12LanesXor(Bba, K12LanesAndNot(Bbe, Bbi));                                 \
+    Aba = K12LanesXor(Aba, K12LanesConst(0x8000000080008008ULL));                     \
+    Abe = K12LanesXor(Bbe, K12LanesAndNot(Bbi, Bbo));                                 \
+    Abi = K12LanesXor(Bbi, K12LanesAndNot(Bbo, Bbu));                                 \
+    Abo = K12LanesXor(Bbo, K12LanesAndNot(Bbu, Bba));                                 \
+    Abu = K12LanesXor(Bbu, K12LanesAndNot(Bba, Bbe));                                 \
+    Ebo = K12LanesXor(Ebo, Do);                                                       \
+    Bga = K12LanesRol(Ebo, 28);                                                       \
+    Egu = K12LanesXor(Egu, Du);                                                       \
+    Bge = K12LanesRol(Egu, 20);                                                       \
+    Eka = K12LanesXor(Eka, Da);                                                       \
+    Bgi = K12LanesRol(Eka, 3);                                                        \
+    Eme = K12LanesXor(Eme, De);                                                       \
+    Bgo = K12LanesRol(Eme, 45);                                                       \
+    Esi = K12LanesXor(Esi, Di);                                                       \
+    Bgu = K12LanesRol(Esi, 61);                                                       \
+    Aga = K12LanesXor(Bga, K12LanesAndNot(Bge, Bgi));                                 \
+    Age = K12LanesXor(Bge, K12LanesAndNot(Bgi, Bgo));                                 \
+    Agi = K12LanesXor(Bgi, K12LanesAndNot(Bgo, Bgu));                                 \
+    Ago = K12LanesXor(Bgo, K12LanesAndNot(Bgu, Bga));                                 \
+    Agu = K12LanesXor(Bgu, K12LanesAndNot(Bga, Bge));                                 \
+    Ebe = K12LanesXor(Ebe, De);                                                       \
+    Bka = K12LanesRol(Ebe, 1);                                                        \
+    Egi = K12LanesXor(Egi, Di);                                                       \
+    Bke = K12LanesRol(Egi, 6);                                                        \
+    Eko = K12LanesXor(Eko, Do);                                                       \
+    Bki = K12LanesRol(Eko, 25);                                                       \
+    Emu = K12LanesXor(Emu, Du);                                                       \
+    Bko = K12LanesRol(Emu, 8);                                                        \
+    Esa = K12LanesXor(Esa, Da);                                                       \
+    Bku = K12LanesRol(Esa, 18);                                                       \
+    Aka = K12LanesXor(Bka, K12LanesAndNot(Bke, Bki));                                 \
+    Ake = K12LanesXor(Bke, K12LanesAndNot(Bki, Bko));                                 \
+    Aki = K12LanesXor(Bki, K12LanesAndNot(Bko, Bku));                                 \
+    Ako = K12LanesXor(Bko, K12LanesAndNot(Bku, Bka));                                 \
+    Aku = K12LanesXor(Bku, K12LanesAndNot(Bka, Bke));                                 \
+    Ebu = K12LanesXor(Ebu, Du);                                                       \
+    Bma = K12LanesRol(Ebu, 27);                                                       \
+    Ega = K12LanesXor(Ega, Da);                                                       \
+    Bme = K12LanesRol(Ega, 36);                                                       \
+    Eke = K12LanesXor(Eke, De);                                                       \
+    Bmi = K12LanesRol(Eke, 10);                                                       \
+    Emi = K12LanesXor(Emi, Di);                                                       \
+    Bmo = K12LanesRol(Emi, 15);                                                       \
+    Eso = K12LanesXor(Eso, Do);                                                       \
+    Bmu = K12LanesRol(Eso, 56);                                                       \
+    Ama = K12LanesXor(Bma, K12LanesAndNot(Bme, Bmi));                                 \
+    Ame = K12LanesXor(Bme, K12LanesAndNot(Bmi, Bmo));                                 \
+    Ami = K12LanesXor(Bmi, K12LanesAndNot(Bmo, Bmu));                                 \
+    Amo = K12LanesXor(Bmo, K12LanesAndNot(Bmu, Bma));                                 \
+    Amu = K12LanesXor(Bmu, K12LanesAndNot(Bma, Bme));                                 \
+    Ebi = K12LanesXor(Ebi, Di);                                                       \
+    Bsa = K12LanesRol(Ebi, 62);                                                       \
+    Ego = K12LanesXor(Ego, Do);                                                       \
+    Bse = K12LanesRol(Ego, 55);                                                       \
+    Eku = K12LanesXor(Eku, Du);                                                       \
+    Bsi = K12LanesRol(Eku, 39);                                                       \
+    Ema = K12LanesXor(Ema, Da);                                                       \
+    Bso = K12LanesRol(Ema, 41);                                                       \
+    Ese = K12LanesXor(Ese, De);                                                       \
+    Bsu = K12LanesRol(Ese, 2);                                                        \
+    Asa = K12LanesXor(Bsa, K12LanesAndNot(Bse, Bsi));                                 \
+    Ase = K12LanesXor(Bse, K12LanesAndNot(Bsi, Bso));                                 \
+    Asi = K12LanesXor(Bsi, K12LanesAndNot(Bso, Bsu));                                 \
+    Aso = K12LanesXor(Bso, K12LanesAndNot(Bsu, Bsa));                                 \
+    Asu = K12LanesXor(Bsu, K12LanesAndNot(Bsa, Bse));
+
+// Transpose 4x4 matrix of 64-bit words given as 4 rows
+static inline void transposeK12Lanes4x4(__m256i& row0, __m256i& row1, __m256i& row2, __m256i& row3)
+{
+    const __m256i t0 = _mm256_unpacklo_epi64(row0, row1);
+    const __m256i t1 = _mm256_unpackhi_epi64(row0, row1);
+    const __m256i t2 = _mm256_unpacklo_epi64(row2, row3);
+    const __m256i t3 = _mm256_unpackhi_epi64(row2, row3);
+    row0 = _mm256_permute2x128_si256(t0, t2, 0x20);
+    row1 = _mm256_permute2x128_si256(t1, t3, 0x20);
+    row2 = _mm256_permute2x128_si256(t0, t2, 0x31);
+    row3 = _mm256_permute2x128_si256(t1, t3, 0x31);
+}
+
+// Load the 8 words of 4 inputs interleaved, so words[i] holds word i of all 4 inputs
+static inline void loadK12Lanes4(const unsigned char* const* inputs, __m256i* words)
+{
+    for (unsigned int half = 0; half < 2; half++)
+    {
+        __m256i row0 = _mm256_loadu_si256((const __m256i*)(inputs[0] + half * 32));
+        __m256i row1 = _mm256_loadu_si256((const __m256i*)(inputs[1] + half * 32));
+        __m256i row2 = _mm256_loadu_si256((const __m256i*)(inputs[2] + half * 32));
+        __m256i row3 = _mm256_loadu_si256((const __m256i*)(inputs[3] + half * 32));
+        transposeK12Lanes4x4(row0, row1, row2, row3);
+        words[half * 4 + 0] = row0;
+        words[half * 4 + 1] = row1;
+        words[half * 4 + 2] = row2;
+        words[half * 4 + 3] = row3;
+    }
+}
+
+// Store the first 4 words of 4 interleaved states to the outputs
+static inline void storeK12Lanes4(unsigned char* const* outputs, __m256i word0, __m256i word1, __m256i word2, __m256i word3)
+{
+    transposeK12Lanes4x4(word0, word1, word2, word3);
+    _mm256_storeu_si256((__m256i*)outputs[0], word0);
+    _mm256_storeu_si256((__m256i*)outputs[1], word1);
+    _mm256_storeu_si256((__m256i*)outputs[2], word2);
+    _mm256_storeu_si256((__m256i*)outputs[3], word3);
+}
+
+// Compute KangarooTwelve64To32(inputs[i], outputs[i]) for i < K12_64TO32_LANES at once
+static void KangarooTwelve64To32xLanes(const unsigned char* const* inputs, unsigned char* const* outputs)
+{
+    K12LanesVector Aba, Abe, Abi, Abo, Abu;
+    K12LanesVector Aga, Age, Agi, Ago, Agu;
+    K12LanesVector Aka, Ake, Aki, Ako, Aku;
+    K12LanesVector Ama, Ame, Ami, Amo, Amu;
+    K12LanesVector Asa, Ase, Asi, Aso, Asu;
+    K12LanesVector Bba, Bbe, Bbi, Bbo, Bbu;
+    K12LanesVector Bga, Bge, Bgi, Bgo, Bgu;
+    K12LanesVector Bka, Bke, Bki, Bko, Bku;
+    K12LanesVector Bma, Bme, Bmi, Bmo, Bmu;
+    K12LanesVector Bsa, Bse, Bsi, Bso, Bsu;
+    K12LanesVector Ca, Ce, Ci, Co, Cu;
+    K12LanesVector Da, De, Di, Do, Du;
+    K12LanesVector Eba, Ebe, Ebi, Ebo, Ebu;
+    K12LanesVector Ega, Ege, Egi, Ego, Egu;
+    K12LanesVector Eka, Eke, Eki, Eko, Eku;
+    K12LanesVector Ema, Eme, Emi, Emo, Emu;
+    K12LanesVector Esa, Ese, Esi, Eso, Esu;
+
+#if defined (__AVX512F__)
+    __m256i wordsLow[8], wordsHigh[8];
+    loadK12Lanes4(inputs, wordsLow);
+    loadK12Lanes4(inputs + 4, wordsHigh);
+    K12LanesVector words[8];
+    for (unsigned int i = 0; i < 8; i++)
+    {
+        words[i] = _mm512_inserti64x4(_mm512_castsi256_si512(wordsLow[i]), wordsHigh[i], 1);
+    }
+#else
+    K12LanesVector words[8];
+    loadK12Lanes4(inputs, words);
+#endif
+
+    // State after absorbing the 64 bytes of input, the empty customization string and the padding (see the
+    // scalar implementation of KangarooTwelve64To32)
+    const K12LanesVector zero = K12LanesConst(0);
+    Aba = words[0]; Abe = words[1]; Abi = words[2]; Abo = words[3]; Abu = words[4];
+    Aga = words[5]; Age = words[6]; Agi = words[7]; Ago = K12LanesConst(0x0700); Agu = zero;
+    Aka = zero; Ake = zero; Aki = zero; Ako = zero; Aku = zero;
+    Ama = zero; Ame = zero; Ami = zero; Amo = zero; Amu = zero;
+    Asa = K12LanesConst(0x8000000000000000ULL); Ase = zero; Asi = zero; Aso = zero; Asu = zero;
+
+    rounds12Lanes
+
+#if defined (__AVX512F__)
+    storeK12Lanes4(outputs, _mm512_castsi512_si256(Aba), _mm512_castsi512_si256(Abe), _mm512_castsi512_si256(Abi), _mm512_castsi512_si256(Abo));
+    storeK12Lanes4(outputs + 4, _mm512_extracti64x4_epi64(Aba, 1), _mm512_extracti64x4_epi64(Abe, 1), _mm512_extracti64x4_epi64(Abi, 1), _mm512_extracti64x4_epi64(Abo, 1));
+#else
+    storeK12Lanes4(outputs, Aba, Abe, Abi, Abo);
+#endif
+}
+
+// Collects inputs of KangarooTwelve64To32 and hashes them K12_64TO32_LANES at a time. The outputs are only valid
+// after calling flush().
+struct KangarooTwelve64To32Batch
+{
+    const unsigned char* inputs[K12_64TO32_LANES];
+    unsigned char* outputs[K12_64TO32_LANES];
+    unsigned int count = 0;
+
+    void add(const void* input, void* output)
+    {
+        inputs[count] = (const unsigned char*)input;
+        outputs[count] = (unsigned char*)output;
+        if (++count == K12_64TO32_LANES)
+        {
+            KangarooTwelve64To32xLanes(inputs, outputs);
+            count = 0;
+        }
+    }
+
+    void flush()
+    {
+        if (count == 1)
+        {
+            KangarooTwelve64To32(inputs[0], outputs[0]);
+        }
+        else if (count)
+        {
+            // Fill unused lanes with the last input (its output is just written several times)
+            for (unsigned int i = count; i < K12_64TO32_LANES; i++)
+            {
+                inputs[i] = inputs[count - 1];
+                outputs[i] = outputs[count - 1];
+            }
+            KangarooTwelve64To32xLanes(inputs, outputs);
+        }
+        count = 0;
+    }
+};
+
+// Compute KangarooTwelve64To32 of numberOfInputs 64-byte inputs stored contiguously, writing the 32-byte outputs
+// contiguously (in the same order)
+static void KangarooTwelve64To32xN(const void* input, void* output, unsigned long long numberOfInputs)
+{
+    KangarooTwelve64To32Batch batch;
+    for (unsigned long long i = 0; i < numberOfInputs; i++)
+    {
+        batch.add((const unsigned char*)input + i * 64, (unsigned char*)output + i * 32);
+    }
+    batch.flush();
+}
+
+#if defined (__AVX512F__)
+#define K12LanesGatherWord(block, offsets, word) _mm512_i64gather_epi64(offsets, (const void*)((block) + 8 * (word)), 1)
+#else
+#define K12LanesGatherWord(block, offsets, word) _mm256_i64gather_epi64((const long long*)((block) + 8 * (word)), offsets, 1)
+#endif
+
+static_assert(K12_chunkSize % K12_rateInBytes == 16 * 8, "Unexpected number of words in last block of leaf");
+
+// Compute the chaining values of K12_64TO32_LANES consecutive leaves of K12_chunkSize bytes each at once (leaves of
+// the KangarooTwelve tree are independent). The 32-byte chaining values are written contiguously to cvs.
+static void KangarooTwelveLeavesxLanes(const unsigned char* leaves, unsigned char* cvs)
+{
+    K12LanesVector Aba, Abe, Abi, Abo, Abu;
+    K12LanesVector Aga, Age, Agi, Ago, Agu;
+    K12LanesVector Aka, Ake, Aki, Ako, Aku;
+    K12LanesVector Ama, Ame, Ami, Amo, Amu;
+    K12LanesVector Asa, Ase, Asi, Aso, Asu;
+    K12LanesVector Bba, Bbe, Bbi, Bbo, Bbu;
+    K12LanesVector Bga, Bge, Bgi, Bgo, Bgu;
+    K12LanesVector Bka, Bke, Bki, Bko, Bku;
+    K12LanesVector Bma, Bme, Bmi, Bmo, Bmu;
+    K12LanesVector Bsa, Bse, Bsi, Bso, Bsu;
+    K12LanesVector Ca, Ce, Ci, Co, Cu;
+    K12LanesVector Da, De, Di, Do, Du;
+    K12LanesVector Eba, Ebe, Ebi, Ebo, Ebu;
+    K12LanesVector Ega, Ege, Egi, Ego, Egu;
+    K12LanesVector Eka, Eke, Eki, Eko, Eku;
+    K12LanesVector Ema, Eme, Emi, Emo, Emu;
+    K12LanesVector Esa, Ese, Esi, Eso, Esu;
+
+    // offset of each leaf, so lane i of a gathered vector holds a word of leaf i
+#if defined (__AVX512F__)
+    const K12LanesVector offsets = _mm512_set_epi64(7 * K12_chunkSize, 6 * K12_chunkSize, 5 * K12_chunkSize, 4 * K12_chunkSize,
+        3 * K12_chunkSize, 2 * K12_chunkSize, K12_chunkSize, 0);
+#else
+    const K12LanesVector offsets = _mm256_set_epi64x(3 * K12_chunkSize, 2 * K12_chunkSize, K12_chunkSize, 0);
+#endif
+
+    const K12LanesVector zero = K12LanesConst(0);
+    Aba = zero; Abe = zero; Abi = zero; Abo = zero; Abu = zero;
+    Aga = zero; Age = zero; Agi = zero; Ago = zero; Agu = zero;
+    Aka = zero; Ake = zero; Aki = zero; Ako = zero; Aku = zero;
+    Ama = zero; Ame = zero; Ami = zero; Amo = zero; Amu = zero;
+    Asa = zero; Ase = zero; Asi = zero; Aso = zero; Asu = zero;
+
+    // full blocks of 21 words
+    const unsigned char* block = leaves;
+    for (unsigned int i = 0; i < K12_chunkSize / K12_rateInBytes; i++, block += K12_rateInBytes)
+    {
+        Aba = K12LanesXor(Aba, K12LanesGatherWord(block, offsets, 0));
+        Abe = K12LanesXor(Abe, K12LanesGatherWord(block, offsets, 1));
+        Abi = K12LanesXor(Abi, K12LanesGatherWord(block, offsets, 2));
+        Abo = K12LanesXor(Abo, K12LanesGatherWord(block, offsets, 3));
+        Abu = K12LanesXor(Abu, K12LanesGatherWord(block, offsets, 4));
+        Aga = K12LanesXor(Aga, K12LanesGatherWord(block, offsets, 5));
+        Age = K12LanesXor(Age, K12LanesGatherWord(block, offsets, 6));
+        Agi = K12LanesXor(Agi, K12LanesGatherWord(block, offsets, 7));
+        Ago = K12LanesXor(Ago, K12LanesGatherWord(block, offsets, 8));
+        Agu = K12LanesXor(Agu, K12LanesGatherWord(block, offsets, 9));
+        Aka = K12LanesXor(Aka, K12LanesGatherWord(block, offsets, 10));
+        Ake = K12LanesXor(Ake, K12LanesGatherWord(block, offsets, 11));
+        Aki = K12LanesXor(Aki, K12LanesGatherWord(block, offsets, 12));
+        Ako = K12LanesXor(Ako, K12LanesGatherWord(block, offsets, 13));
+        Aku = K12LanesXor(Aku, K12LanesGatherWord(block, offsets, 14));
+        Ama = K12LanesXor(Ama, K12LanesGatherWord(block, offsets, 15));
+        Ame = K12LanesXor(Ame, K12LanesGatherWord(block, offsets, 16));
+        Ami = K12LanesXor(Ami, K12LanesGatherWord(block, offsets, 17));
+        Amo = K12LanesXor(Amo, K12LanesGatherWord(block, offsets, 18));
+        Amu = K12LanesXor(Amu, K12LanesGatherWord(block, offsets, 19));
+        Asa = K12LanesXor(Asa, K12LanesGatherWord(block, offsets, 20));
+
+        rounds12Lanes
+    }
+
+    // last block with 16 words, leaf suffix, and padding (see the queue node in KangarooTwelve())
+    Aba = K12LanesXor(Aba, K12LanesGatherWord(block, offsets, 0));
+    Abe = K12LanesXor(Abe, K12LanesGatherWord(block, offsets, 1));
+    Abi = K12LanesXor(Abi, K12LanesGatherWord(block, offsets, 2));
+    Abo = K12LanesXor(Abo, K12LanesGatherWord(block, offsets, 3));
+    Abu = K12LanesXor(Abu, K12LanesGatherWord(block, offsets, 4));
+    Aga = K12LanesXor(Aga, K12LanesGatherWord(block, offsets, 5));
+    Age = K12LanesXor(Age, K12LanesGatherWord(block, offsets, 6));
+    Agi = K12LanesXor(Agi, K12LanesGatherWord(block, offsets, 7));
+    Ago = K12LanesXor(Ago, K12LanesGatherWord(block, offsets, 8));
+    Agu = K12LanesXor(Agu, K12LanesGatherWord(block, offsets, 9));
+    Aka = K12LanesXor(Aka, K12LanesGatherWord(block, offsets, 10));
+    Ake = K12LanesXor(Ake, K12LanesGatherWord(block, offsets, 11));
+    Aki = K12LanesXor(Aki, K12LanesGatherWord(block, offsets, 12));
+    Ako = K12LanesXor(Ako, K12LanesGatherWord(block, offsets, 13));
+    Aku = K12LanesXor(Aku, K12LanesGatherWord(block, offsets, 14));
+    Ama = K12LanesXor(Ama, K12LanesGatherWord(block, offsets, 15));
+    Ame = K12LanesXor(Ame, K12LanesConst(K12_suffixLeaf));
+    Asa = K12LanesXor(Asa, K12LanesConst(0x8000000000000000ULL));
+
+    rounds12Lanes
+
+#if defined (__AVX512F__)
+    unsigned char* outputs[8] = { cvs, cvs + 32, cvs + 64, cvs + 96, cvs + 128, cvs + 160, cvs + 192, cvs + 224 };
+    storeK12Lanes4(outputs, _mm512_castsi512_si256(Aba), _mm512_castsi512_si256(Abe), _mm512_castsi512_si256(Abi), _mm512_castsi512_si256(Abo));
+    storeK12Lanes4(outputs + 4, _mm512_extracti64x4_epi64(Aba, 1), _mm512_extracti64x4_epi64(Abe, 1), _mm512_extracti64x4_epi64(Abi, 1), _mm512_extracti64x4_epi64(Abo, 1));
+#else
+    unsigned char* outputs[4] = { cvs, cvs + 32, cvs + 64, cvs + 96 };
+    storeK12Lanes4(outputs, Aba, Abe, Abi, Abo);
+#endif
+}
+
 static void random(const unsigned char* publicKey, const unsigned char* nonce, unsigned char* output, unsigned long long outputSize)
 {
     unsigned char state[200];
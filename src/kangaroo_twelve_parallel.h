@@ -0,0 +1,312 @@
+#pragma once
+
+#include "platform/memory_util.h"
+#include "platform/parallel_work.h"
+
+#include "kangaroo_twelve.h"
+
+
+// KangarooTwelve of large inputs (such as contract states) with the leaves of the tree hash computed in parallel by
+// idle processors (see runParallelWork()) and several leaves at once with SIMD (KangarooTwelveLeavesxLanes()). The
+// digest is identical to KangarooTwelve().
+
+// Inputs smaller than this are hashed serially, because the overhead of distributing the work would outweigh the gain
+static constexpr unsigned long long K12_parallelMinInputSize = 64 * K12_chunkSize;
+
+// Number of leaves whose chaining values are computed in one round of parallel work and then absorbed in order
+static constexpr unsigned int K12_parallelLeavesPerRound = 512;
+
+struct KangarooTwelveParallelLeaves
+{
+    const unsigned char* leaves;
+    unsigned char* cvs;
+};
+
+// Compute chaining value of a leaf of up to K12_chunkSize bytes
+static void KangarooTwelveLeaf(const unsigned char* data, unsigned int dataByteLen, unsigned char* cv)
+{
+    KangarooTwelve_F queueNode;
+    setMem(&queueNode, sizeof(KangarooTwelve_F), 0);
+    KangarooTwelve_F_Absorb(&queueNode, data, dataByteLen);
+    queueNode.state[queueNode.byteIOIndex] ^= K12_suffixLeaf;
+    queueNode.state[K12_rateInBytes - 1] ^= 0x80;
+    KeccakP1600_Permute_12rounds(queueNode.state);
+    copyMem(cv, queueNode.state, K12_capacityInBytes);
+}
+
+// Parallel work function computing the chaining values of the full leaves [beginIndex, endIndex)
+static void computeKangarooTwelveLeaves(void* context, unsigned long long beginIndex, unsigned long long endIndex)
+{
+    const KangarooTwelveParallelLeaves* work = (const KangarooTwelveParallelLeaves*)context;
+    unsigned long long i = beginIndex;
+    for (; i + K12_64TO32_LANES <= endIndex; i += K12_64TO32_LANES)
+    {
+        KangarooTwelveLeavesxLanes(work->leaves + i * K12_chunkSize, work->cvs + i * K12_capacityInBytes);
+    }
+    for (; i < endIndex; i++)
+    {
+        KangarooTwelveLeaf(work->leaves + i * K12_chunkSize, K12_chunkSize, work->cvs + i * K12_capacityInBytes);
+    }
+}
+
+// Init final node of the tree and absorb the first chunk of the input, which must be at least K12_chunkSize bytes
+static void KangarooTwelveBeginFinalNode(KangarooTwelve_F& finalNode, const unsigned char* data)
+{
+    setMem(&finalNode, sizeof(KangarooTwelve_F), 0);
+    KangarooTwelve_F_Absorb(&finalNode, data, K12_chunkSize);
+    finalNode.state[finalNode.byteIOIndex] ^= 0x03;
+    if (++finalNode.byteIOIndex == K12_rateInBytes)
+    {
+        KeccakP1600_Permute_12rounds(finalNode.state);
+        finalNode.byteIOIndex = 0;
+    }
+    else
+    {
+        finalNode.byteIOIndex = (finalNode.byteIOIndex + 7) & ~7;
+    }
+}
+
+// Compute chaining value of the last leaf, which holds the remaining input bytes (may be none) and the zero byte of
+// the empty customization string
+static void KangarooTwelveLastLeaf(const unsigned char* data, unsigned int dataByteLen, unsigned char* cv)
+{
+    KangarooTwelve_F queueNode;
+    setMem(&queueNode, sizeof(KangarooTwelve_F), 0);
+    KangarooTwelve_F_Absorb(&queueNode, data, dataByteLen);
+    if (++queueNode.byteIOIndex == K12_rateInBytes)
+    {
+        KeccakP1600_Permute_12rounds(queueNode.state);
+        queueNode.byteIOIndex = 0;
+    }
+    queueNode.state[queueNode.byteIOIndex] ^= K12_suffixLeaf;
+    queueNode.state[K12_rateInBytes - 1] ^= 0x80;
+    KeccakP1600_Permute_12rounds(queueNode.state);
+    copyMem(cv, queueNode.state, K12_capacityInBytes);
+}
+
+// Absorb encoded number of leaves and padding into final node and write digest to output
+static void KangarooTwelveEndFinalNode(KangarooTwelve_F& finalNode, unsigned long long numberOfLeaves, void* output, unsigned int outputByteLen)
+{
+    unsigned int n = 0;
+    for (unsigned long long v = numberOfLeaves; v && (n < sizeof(unsigned long long)); ++n, v >>= 8)
+    {
+    }
+    unsigned char encbuf[sizeof(unsigned long long) + 1 + 2];
+    for (unsigned int i = 1; i <= n; ++i)
+    {
+        encbuf[i - 1] = (unsigned char)(numberOfLeaves >> (8 * (n - i)));
+    }
+    encbuf[n] = (unsigned char)n;
+    encbuf[++n] = 0xFF;
+    encbuf[++n] = 0xFF;
+    KangarooTwelve_F_Absorb(&finalNode, encbuf, ++n);
+    finalNode.state[finalNode.byteIOIndex] ^= 0x06;
+    finalNode.state[K12_rateInBytes - 1] ^= 0x80;
+    KeccakP1600_Permute_12rounds(finalNode.state);
+    copyMem(output, finalNode.state, outputByteLen);
+}
+
+// Compute KangarooTwelve of input (up to 4 GB) with help of idle processors. Must not be called by a processor that
+// helps with parallel work.
+static void KangarooTwelveParallel(const void* input, unsigned long long inputByteLen, void* output, unsigned int outputByteLen)
+{
+    if (inputByteLen < K12_parallelMinInputSize)
+    {
+        KangarooTwelve(input, (unsigned int)inputByteLen, output, outputByteLen);
+        return;
+    }
+
+    // The message is the input followed by the empty customization string, which is encoded as one zero byte. The
+    // first chunk goes to the final node, all following chunks are leaves whose chaining values are absorbed by the
+    // final node in order (see KangarooTwelve()).
+    const unsigned char* data = (const unsigned char*)input;
+    KangarooTwelve_F finalNode;
+    KangarooTwelveBeginFinalNode(finalNode, data);
+
+    // Leaves consisting of input bytes only are hashed in parallel
+    const unsigned long long numberOfFullLeaves = (inputByteLen - K12_chunkSize) / K12_chunkSize;
+    unsigned char cvs[K12_parallelLeavesPerRound * K12_capacityInBytes];
+    KangarooTwelveParallelLeaves work;
+    work.cvs = cvs;
+    for (unsigned long long firstLeaf = 0; firstLeaf < numberOfFullLeaves; firstLeaf += K12_parallelLeavesPerRound)
+    {
+        const unsigned long long numberOfLeaves = (numberOfFullLeaves - firstLeaf < K12_parallelLeavesPerRound) ? numberOfFullLeaves - firstLeaf : K12_parallelLeavesPerRound;
+        work.leaves = data + (firstLeaf + 1) * K12_chunkSize;
+        runParallelWork(computeKangarooTwelveLeaves, &work, numberOfLeaves, K12_64TO32_LANES);
+        KangarooTwelve_F_Absorb(&finalNode, cvs, numberOfLeaves * K12_capacityInBytes);
+    }
+
+    const unsigned long long lastLeafOffset = (numberOfFullLeaves + 1) * K12_chunkSize;
+    KangarooTwelveLastLeaf(data + lastLeafOffset, (unsigned int)(inputByteLen - lastLeafOffset), cvs);
+    KangarooTwelve_F_Absorb(&finalNode, cvs, K12_capacityInBytes);
+
+    KangarooTwelveEndFinalNode(finalNode, numberOfFullLeaves + 1, output, outputByteLen);
+}
+
+// Minimum number of changed leaves for rehashing them with help of idle processors
+static constexpr unsigned long long K12_parallelMinDirtyLeaves = 64;
+
+// Cache of the leaf chaining values of KangarooTwelve of a memory region that is changed in place. Writers report
+// the bytes they change with markDirty(), so digest() only rehashes the leaves (chunks of K12_chunkSize bytes) that
+// have been changed since the last call. The digest is identical to KangarooTwelve() of the region.
+class KangarooTwelveLeafCache
+{
+    const unsigned char* data;
+    unsigned long long size;
+
+    // Number of leaves including the last one (0 if the region is too small for the tree mode)
+    unsigned long long numberOfLeaves;
+    unsigned char* cvs;
+    volatile long long* dirtyLeafFlags;
+
+    bool isDirty(unsigned long long leaf) const
+    {
+        return (dirtyLeafFlags[leaf >> 6] >> (leaf & 63)) & 1;
+    }
+
+    // Parallel work function rehashing the changed full leaves in [beginIndex, endIndex)
+    static void rehashDirtyLeaves(void* context, unsigned long long beginIndex, unsigned long long endIndex)
+    {
+        const KangarooTwelveLeafCache* cache = (const KangarooTwelveLeafCache*)context;
+        const unsigned char* leaves = cache->data + K12_chunkSize;
+        unsigned long long i = beginIndex;
+        while (i < endIndex)
+        {
+            const unsigned long long flags = cache->dirtyLeafFlags[i >> 6];
+            if (!flags)
+            {
+                i = (i | 63) + 1;
+                continue;
+            }
+            constexpr unsigned long long lanesMask = (1ULL << K12_64TO32_LANES) - 1;
+            if ((i % K12_64TO32_LANES) == 0 && i + K12_64TO32_LANES <= endIndex && ((flags >> (i & 63)) & lanesMask) == lanesMask)
+            {
+                KangarooTwelveLeavesxLanes(leaves + i * K12_chunkSize, cache->cvs + i * K12_capacityInBytes);
+                i += K12_64TO32_LANES;
+                continue;
+            }
+            if ((flags >> (i & 63)) & 1)
+            {
+                KangarooTwelveLeaf(leaves + i * K12_chunkSize, K12_chunkSize, cache->cvs + i * K12_capacityInBytes);
+            }
+            ++i;
+        }
+    }
+
+public:
+    // Allocate cache for region and mark all leaves as changed, return false if allocation failed
+    bool init(const void* regionData, unsigned long long regionSize)
+    {
+        data = (const unsigned char*)regionData;
+        size = regionSize;
+        numberOfLeaves = (size >= K12_chunkSize) ? (size - K12_chunkSize) / K12_chunkSize + 1 : 0;
+        cvs = nullptr;
+        dirtyLeafFlags = nullptr;
+        if (!numberOfLeaves)
+        {
+            return true;
+        }
+        if (!allocPoolWithErrorLog(L"k12LeafCacheCvs", numberOfLeaves * K12_capacityInBytes, (void**)&cvs, __LINE__)
+            || !allocPoolWithErrorLog(L"k12LeafCacheDirtyFlags", (numberOfLeaves + 63) / 64 * 8, (void**)&dirtyLeafFlags, __LINE__))
+        {
+            return false;
+        }
+        markAllDirty();
+        return true;
+    }
+
+    // Free memory
+    void deinit()
+    {
+        if (cvs)
+        {
+            freePool(cvs);
+            cvs = nullptr;
+        }
+        if (dirtyLeafFlags)
+        {
+            freePool((void*)dirtyLeafFlags);
+            dirtyLeafFlags = nullptr;
+        }
+    }
+
+    // Must be called when bytes [offset, offset + byteCount) of the region are changed. May be called concurrently.
+    void markDirty(unsigned long long offset, unsigned long long byteCount)
+    {
+        // The first chunk is part of the final node, which is always rehashed
+        if (!numberOfLeaves || !byteCount || offset + byteCount <= K12_chunkSize)
+        {
+            return;
+        }
+        const unsigned long long firstLeaf = (offset < K12_chunkSize) ? 0 : (offset - K12_chunkSize) / K12_chunkSize;
+        const unsigned long long lastLeaf = (offset + byteCount - 1 - K12_chunkSize) / K12_chunkSize;
+        for (unsigned long long leaf = firstLeaf; leaf <= lastLeaf; ++leaf)
+        {
+            if (!isDirty(leaf))
+            {
+                _InterlockedOr64(&dirtyLeafFlags[leaf >> 6], 1LL << (leaf & 63));
+            }
+        }
+    }
+
+    // Mark the whole region as changed
+    void markAllDirty()
+    {
+        if (numberOfLeaves)
+        {
+            setMem((void*)dirtyLeafFlags, (numberOfLeaves + 63) / 64 * 8, 0xFF);
+        }
+    }
+
+    // Return number of leaves that will be rehashed by the next call of digest()
+    unsigned long long getNumberOfDirtyLeaves() const
+    {
+        unsigned long long count = 0;
+        for (unsigned long long i = 0; i < numberOfLeaves / 64; ++i)
+        {
+            count += _mm_popcnt_u64(dirtyLeafFlags[i]);
+        }
+        if (numberOfLeaves & 63)
+        {
+            count += _mm_popcnt_u64(dirtyLeafFlags[numberOfLeaves / 64] & ((1ULL << (numberOfLeaves & 63)) - 1));
+        }
+        return count;
+    }
+
+    // Compute KangarooTwelve of the region, rehashing changed leaves (with help of idle processors if there are many of
+    // them). The region must not be changed concurrently. Must not be called by a processor that helps with parallel
+    // work.
+    void digest(void* output, unsigned int outputByteLen)
+    {
+        if (!numberOfLeaves)
+        {
+            KangarooTwelve(data, (unsigned int)size, output, outputByteLen);
+            return;
+        }
+
+        const unsigned long long numberOfFullLeaves = numberOfLeaves - 1;
+        if (numberOfFullLeaves)
+        {
+            const unsigned long long numberOfDirtyLeaves = getNumberOfDirtyLeaves();
+            if (numberOfDirtyLeaves >= K12_parallelMinDirtyLeaves)
+            {
+                runParallelWork(rehashDirtyLeaves, this, numberOfFullLeaves, 64);
+            }
+            else if (numberOfDirtyLeaves)
+            {
+                rehashDirtyLeaves(this, 0, numberOfFullLeaves);
+            }
+        }
+        if (isDirty(numberOfFullLeaves))
+        {
+            const unsigned long long lastLeafOffset = numberOfLeaves * K12_chunkSize;
+            KangarooTwelveLastLeaf(data + lastLeafOffset, (unsigned int)(size - lastLeafOffset), cvs + numberOfFullLeaves * K12_capacityInBytes);
+        }
+        setMem((void*)dirtyLeafFlags, (numberOfLeaves + 63) / 64 * 8, 0);
+
+        KangarooTwelve_F finalNode;
+        KangarooTwelveBeginFinalNode(finalNode, data);
+        KangarooTwelve_F_Absorb(&finalNode, cvs, numberOfLeaves * K12_capacityInBytes);
+        KangarooTwelveEndFinalNode(finalNode, numberOfLeaves, output, outputByteLen);
+    }
+};
@@ -42,6 +42,7 @@ struct Peer;
 
 // Logger defines
 #define LOG_HEADER_SIZE 26 // 2 bytes epoch + 4 bytes tick + 4 bytes log size/types + 8 bytes log id + 8 bytes log digest
+#define LOG_DEFERRED_CONTRACT_MESSAGES_SIZE 65536 // bytes of contract messages deferred per isolated system procedure call before waiting to log directly
 
 #define QU_TRANSFER 0
 #define ASSET_ISSUANCE 1
@@ -284,6 +285,24 @@ private:
     inline static unsigned int currentTxId;
     inline static unsigned int currentTick;
 
+    // Contract messages of a group of isolated system procedures (which may run in parallel) are deferred to a buffer
+    // per contract and logged in the canonical order of the group as soon as all contracts before have finished. If the
+    // buffer of a contract is full, the contract waits until all contracts before are logged and continues logging
+    // directly, while the contracts after it keep deferring. So no message is dropped and the order is always the same.
+    struct DeferredContractMessages
+    {
+        unsigned char* buffer;
+        unsigned int size;
+        unsigned int groupPosition;
+        bool deferring;
+        volatile bool finished;
+    };
+    inline static DeferredContractMessages deferredContractMessages[MAX_NUMBER_OF_CONTRACTS];
+    inline static const unsigned int* deferredContractGroup = nullptr;
+    inline static unsigned int deferredContractGroupSize = 0;
+    inline static volatile unsigned int numberOfLoggedDeferredContracts = 0; // contracts at begin of group completely logged
+    inline static volatile char deferredContractMessagesLock = 0;
+
     static unsigned long long getLogId(const char* ptr)
     {
         // first 10 bytes are: epoch(2) + tick(4)+ size/type(4)
@@ -357,7 +376,129 @@ private:
 #endif
 #endif
     }
+
+    // Log the deferred messages of the contract and stop deferring
+    static void logDeferredContractMessages(DeferredContractMessages& deferred)
+    {
+        for (unsigned int offset = 0; offset < deferred.size; )
+        {
+            const unsigned int messageSize = *((unsigned int*)(deferred.buffer + offset));
+            logMessage(messageSize, deferred.buffer[offset + 4], deferred.buffer + offset + 5);
+            offset += 5 + messageSize;
+        }
+        deferred.size = 0;
+        deferred.deferring = false;
+    }
+
+    // Log the deferred messages of the finished contracts at the begin of the group, caller must hold
+    // deferredContractMessagesLock
+    static void logFinishedDeferredContractMessages()
+    {
+        while (numberOfLoggedDeferredContracts < deferredContractGroupSize)
+        {
+            DeferredContractMessages& deferred = deferredContractMessages[deferredContractGroup[numberOfLoggedDeferredContracts]];
+            if (!deferred.finished)
+                break;
+            logDeferredContractMessages(deferred);
+            numberOfLoggedDeferredContracts = numberOfLoggedDeferredContracts + 1;
+        }
+    }
+
+    // Log contract message or defer it if deferring is active for the contract
+    static void logContractMessage(unsigned int contractIndex, unsigned int messageSize, unsigned char messageType, const void* message)
+    {
+        DeferredContractMessages& deferred = deferredContractMessages[contractIndex];
+        if (deferred.deferring)
+        {
+            if (deferred.buffer && deferred.size + 5 + messageSize <= LOG_DEFERRED_CONTRACT_MESSAGES_SIZE)
+            {
+                *((unsigned int*)(deferred.buffer + deferred.size)) = messageSize;
+                deferred.buffer[deferred.size + 4] = messageType;
+                copyMem(deferred.buffer + deferred.size + 5, message, messageSize);
+                deferred.size += 5 + messageSize;
+                return;
+            }
+
+            // Buffer is full: wait until all contracts before in the group are logged (they only wait for contracts
+            // before them), then log own deferred messages and continue logging directly
+            WAIT_WHILE(numberOfLoggedDeferredContracts < deferred.groupPosition);
+            ACQUIRE(deferredContractMessagesLock);
+            logDeferredContractMessages(deferred);
+            RELEASE(deferredContractMessagesLock);
+        }
+        logMessage(messageSize, messageType, message);
+    }
+
 public:
+    // Allocate buffer for deferring contract messages of the contract, return false if allocation failed
+    static bool initDeferredContractMessages(unsigned int contractIndex)
+    {
+#if LOG_CONTRACTS
+        DeferredContractMessages& deferred = deferredContractMessages[contractIndex];
+        deferred.size = 0;
+        deferred.deferring = false;
+        if (!deferred.buffer && !allocPoolWithErrorLog(L"deferredContractMessages", LOG_DEFERRED_CONTRACT_MESSAGES_SIZE, (void**)&deferred.buffer, __LINE__))
+        {
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    static void deinitDeferredContractMessages()
+    {
+        for (unsigned int i = 0; i < MAX_NUMBER_OF_CONTRACTS; ++i)
+        {
+            if (deferredContractMessages[i].buffer)
+            {
+                freePool(deferredContractMessages[i].buffer);
+                deferredContractMessages[i].buffer = nullptr;
+            }
+            deferredContractMessages[i].deferring = false;
+        }
+        deferredContractGroupSize = 0;
+    }
+
+    // Defer the following contract messages of the group of contracts (in canonical order) until the contracts are
+    // marked as finished with finishDeferringContractMessages(). Contracts without buffer allocated with
+    // initDeferredContractMessages() log directly as soon as they are first in order. The array of contract indices
+    // must be kept until endDeferringContractMessages() is called.
+    static void beginDeferringContractMessages(const unsigned int* contractIndices, unsigned int numberOfContracts)
+    {
+        ASSERT(deferredContractGroupSize == 0);
+        for (unsigned int i = 0; i < numberOfContracts; ++i)
+        {
+            DeferredContractMessages& deferred = deferredContractMessages[contractIndices[i]];
+            deferred.size = 0;
+            deferred.groupPosition = i;
+            deferred.deferring = true;
+            deferred.finished = false;
+        }
+        deferredContractGroup = contractIndices;
+        numberOfLoggedDeferredContracts = 0;
+        deferredContractGroupSize = numberOfContracts;
+    }
+
+    // Mark contract of the group as finished and log the deferred messages that are next in order. Called by the
+    // thread that ran the contract.
+    static void finishDeferringContractMessages(unsigned int contractIndex)
+    {
+        deferredContractMessages[contractIndex].finished = true;
+        ACQUIRE(deferredContractMessagesLock);
+        logFinishedDeferredContractMessages();
+        RELEASE(deferredContractMessagesLock);
+    }
+
+    // End deferring after all contracts of the group are finished (all messages have been logged then)
+    static void endDeferringContractMessages()
+    {
+        ACQUIRE(deferredContractMessagesLock);
+        logFinishedDeferredContractMessages();
+        ASSERT(numberOfLoggedDeferredContracts == deferredContractGroupSize);
+        deferredContractGroupSize = 0;
+        RELEASE(deferredContractMessagesLock);
+    }
+
     // 5 special txs for 5 special events in qubic
     static constexpr unsigned int SC_INITIALIZE_TX = NUMBER_OF_TRANSACTIONS_PER_TICK + 0;
     static constexpr unsigned int SC_BEGIN_EPOCH_TX = NUMBER_OF_TRANSACTIONS_PER_TICK + 1;
@@ -560,6 +701,7 @@ public:
         logBuf.deinit();
         tx.deinit();
 #endif
+        deinitDeferredContractMessages();
     }
 
     static void reset(unsigned int _tickBegin)
@@ -768,7 +910,7 @@ public:
 
 #if LOG_CONTRACT_ERROR_MESSAGES
         * ((unsigned int*)&message) = contractIndex;
-        logMessage(offsetof(T, _terminator), CONTRACT_ERROR_MESSAGE, &message);
+        logContractMessage(contractIndex, offsetof(T, _terminator), CONTRACT_ERROR_MESSAGE, &message);
 #endif
 
         // In order to keep state changes consistent independently of (a) whether logging is enabled and
@@ -783,7 +925,7 @@ public:
 
 #if LOG_CONTRACT_WARNING_MESSAGES
         * ((unsigned int*)&message) = contractIndex;
-        logMessage(offsetof(T, _terminator), CONTRACT_WARNING_MESSAGE, &message);
+        logContractMessage(contractIndex, offsetof(T, _terminator), CONTRACT_WARNING_MESSAGE, &message);
 #endif
 
         // In order to keep state changes consistent independently of (a) whether logging is enabled and
@@ -798,7 +940,7 @@ public:
 
 #if LOG_CONTRACT_INFO_MESSAGES
         * ((unsigned int*)&message) = contractIndex;
-        logMessage(offsetof(T, _terminator), CONTRACT_INFORMATION_MESSAGE, &message);
+        logContractMessage(contractIndex, offsetof(T, _terminator), CONTRACT_INFORMATION_MESSAGE, &message);
 #endif
 
         // In order to keep state changes consistent independently of (a) whether logging is enabled and
@@ -813,7 +955,7 @@ public:
 
 #if LOG_CONTRACT_DEBUG_MESSAGES
         * ((unsigned int*)&message) = contractIndex;
-        logMessage(offsetof(T, _terminator), CONTRACT_DEBUG_MESSAGE, &message);
+        logContractMessage(contractIndex, offsetof(T, _terminator), CONTRACT_DEBUG_MESSAGE, &message);
 #endif
 
         // In order to keep state changes consistent independently of (a) whether logging is enabled and
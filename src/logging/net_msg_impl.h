@@ -35,9 +35,17 @@ void qLogger::processRequestLog(unsigned long long processorNumber, Peer* peer,
             }
             if (length < maxPayloadSize)
             {
-                char* rBuffer = responseBuffers[processorNumber];
-                logBuffer.getMany(rBuffer, startFrom, length);
-                enqueueResponse(peer, (unsigned int)(length), RespondLog::type, header->dejavu(), rBuffer);
+                // serialize log events directly into the response queue
+                unsigned int shardIndex;
+                RequestResponseHeader* responseHeader = reserveResponse(peer, (unsigned int)(sizeof(RequestResponseHeader) + length), shardIndex);
+                if (responseHeader)
+                {
+                    responseHeader->checkAndSetSize((unsigned int)(sizeof(RequestResponseHeader) + length));
+                    responseHeader->setType(RespondLog::type);
+                    responseHeader->setDejavu(header->dejavu());
+                    logBuffer.getMany((char*)(responseHeader + 1), startFrom, length);
+                    commitResponse(shardIndex);
+                }
             }
             else
             {
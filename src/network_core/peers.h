@@ -14,6 +14,8 @@
 #include "network_messages/common_response.h"
 
 #include "tcp4.h"
+#include "request_queue.h"
+#include "response_queue.h"
 #include "kangaroo_twelve.h"
 
 #include "text_output.h"
@@ -25,9 +27,10 @@
 #define NUMBER_OF_INCOMING_CONNECTIONS 88
 #define MAX_NUMBER_OF_PUBLIC_PEERS 1024
 #define REQUEST_QUEUE_BUFFER_SIZE 1073741824
-#define REQUEST_QUEUE_LENGTH 65536 // Must be 65536
-#define RESPONSE_QUEUE_BUFFER_SIZE 1073741824
-#define RESPONSE_QUEUE_LENGTH 65536 // Must be 65536
+#define REQUEST_QUEUE_LENGTH 65536 // Must be power of 2
+#define RESPONSE_QUEUE_NUMBER_OF_SHARDS 32 // One per processor (MAX_NUMBER_OF_PROCESSORS)
+#define RESPONSE_QUEUE_SHARD_BUFFER_SIZE 33554432 // Must be power of 2 and fit the largest message
+#define RESPONSE_QUEUE_SHARD_LENGTH 8192 // Must be power of 2
 #define NUMBER_OF_PUBLIC_PEERS_TO_KEEP 10
 #define NUMBER_OF_WHITE_LIST_PEERS sizeof(whiteListPeers) / sizeof(whiteListPeers[0])
 #define NUMBER_OF_INCOMING_CONNECTIONS_RESERVED_FOR_WHITELIST_IPS 16
@@ -41,7 +44,17 @@ struct Peer
     EFI_TCP4_PROTOCOL* tcp4Protocol;
     EFI_TCP4_LISTEN_TOKEN connectAcceptToken;
     IPv4Address address;
+
+    // Circular buffer of BUFFER_SIZE bytes for receiving. Received data is in [receiveReadPosition, receiveWritePosition)
+    // and packets are passed to the request queue by reference (if they don't wrap around the end of the buffer). The
+    // memory of those packets can be reused when the request queue sets receiveReleasedPosition to their end. The
+    // positions are counters that wrap around at 2^32 and are not reset on reconnect, so releasing packets of a
+    // former connection of this slot still works. All positions except receiveReleasedPosition are main thread only.
     void* receiveBuffer;
+    unsigned int receiveWritePosition;      // end of received data
+    unsigned int receiveReadPosition;       // start of first packet that hasn't been completely received
+    unsigned int receiveHandedOffPosition;  // end of last packet passed to request queue by reference
+    volatile unsigned int receiveReleasedPosition; // end of last packet by reference released by request queue
     EFI_TCP4_RECEIVE_DATA receiveData;
     EFI_TCP4_IO_TOKEN receiveToken;
     EFI_TCP4_TRANSMIT_DATA transmitData;
@@ -66,6 +79,14 @@ struct Peer
     long trackRequestedCounter; // "long" to discard warning from intrin.h
     unsigned int lastActiveTick; // indicate the tick number that this peer transfer valid tick/vote data
 
+    // Return position up to which the receive buffer is in use (data before may be overwritten)
+    unsigned int receiveUsedPosition() const
+    {
+        // if all packets passed by reference have been released, only unprocessed data is in use
+        const unsigned int releasedPosition = receiveReleasedPosition;
+        return (releasedPosition == receiveHandedOffPosition) ? receiveReadPosition : releasedPosition;
+    }
+
     bool isFullNode() const
     {
         return (lastActiveTick >= system.tick - 100);
@@ -108,6 +129,7 @@ struct Peer
         isClosing = FALSE;
         isIncommingConnection = FALSE;
         dataToTransmitSize = 0;
+        receiveReadPosition = receiveWritePosition; // drop incomplete packet
         lastActiveTick = 0;
         trackRequestedCounter = 0;
         setMem(trackRequestedTick, sizeof(trackRequestedTick), 0);
@@ -131,6 +153,11 @@ static volatile char publicPeersLock = 0;
 static unsigned int numberOfPublicPeers = 0;
 static PublicPeer publicPeers[MAX_NUMBER_OF_PUBLIC_PEERS];
 
+static_assert((BUFFER_SIZE & (BUFFER_SIZE - 1)) == 0, "Receive buffer size must be a power of 2");
+
+// Main thread buffer for packets that wrap around the end of the circular receive buffer of a peer
+static unsigned char* wrappedPacketBuffer = NULL;
+
 static unsigned long long* dejavu0 = NULL;
 static unsigned long long* dejavu1 = NULL;
 static unsigned int dejavuSwapCounter = DEJAVU_SWAP_LIMIT;
@@ -140,27 +167,9 @@ static volatile long long numberOfDiscardedRequests = 0, prevNumberOfDiscardedRe
 static volatile long long numberOfDuplicateRequests = 0, prevNumberOfDuplicateRequests = 0;
 static volatile long long numberOfDisseminatedRequests = 0, prevNumberOfDisseminatedRequests = 0;
 
-static unsigned char* requestQueueBuffer = NULL;
-static unsigned char* responseQueueBuffer = NULL;
-
-static struct Request
-{
-    Peer* peer;
-    unsigned int offset;
-} requestQueueElements[REQUEST_QUEUE_LENGTH];
-
-static struct Response
-{
-    Peer* peer;
-    unsigned int offset;
-} responseQueueElements[RESPONSE_QUEUE_LENGTH];
-
-static volatile unsigned int requestQueueBufferHead = 0, requestQueueBufferTail = 0;
-static volatile unsigned int responseQueueBufferHead = 0, responseQueueBufferTail = 0;
-static volatile unsigned short requestQueueElementHead = 0, requestQueueElementTail = 0;
-static volatile unsigned short responseQueueElementHead = 0, responseQueueElementTail = 0;
-static volatile char requestQueueTailLock = 0;
-static volatile char responseQueueHeadLock = 0;
+static RequestQueue<REQUEST_QUEUE_LENGTH, REQUEST_QUEUE_BUFFER_SIZE> requestQueue;
+static ResponseQueue<RESPONSE_QUEUE_NUMBER_OF_SHARDS, RESPONSE_QUEUE_SHARD_LENGTH, RESPONSE_QUEUE_SHARD_BUFFER_SIZE> responseQueue;
+static_assert(RESPONSE_QUEUE_SHARD_BUFFER_SIZE >= RequestResponseHeader::max_size, "Response queue shard must fit the largest message");
 static volatile unsigned long long queueProcessingNumerator = 0, queueProcessingDenominator = 0;
 static volatile unsigned long long tickerLoopNumerator = 0, tickerLoopDenominator = 0;
 
@@ -343,32 +352,29 @@ static void pushToFullNodes(RequestResponseHeader* requestResponseHeader, int nu
     }
 }
 
+// Reserve space for a message of up to maxSize bytes (including header) in the response queue of the running
+// processor, so the response can be serialized in place. Returns nullptr if the queue is full (the response is
+// dropped then). Otherwise, the header and payload have to be written to the returned memory and the message has to
+// be passed to commitResponse() with the returned shardIndex. If peer is NULL, it will be sent to random peers. Can be
+// called from any thread.
+static RequestResponseHeader* reserveResponse(Peer* peer, unsigned int maxSize, unsigned int& shardIndex)
+{
+    shardIndex = responseQueue.shardOfProcessor(getRunningProcessorID());
+    return responseQueue.reserve(shardIndex, peer, maxSize);
+}
+
+// Publish response written to the memory returned by reserveResponse()
+static void commitResponse(unsigned int shardIndex)
+{
+    responseQueue.commit(shardIndex);
+}
+
 // Add message to response queue of specific peer. If peer is NULL, it will be sent to random peers. Can be called from any thread.
 static void enqueueResponse(Peer* peer, RequestResponseHeader* responseHeader)
 {
     PROFILE_SCOPE();
 
-    ACQUIRE(responseQueueHeadLock);
-
-    if ((responseQueueBufferHead >= responseQueueBufferTail || responseQueueBufferHead + responseHeader->size() < responseQueueBufferTail)
-        && (unsigned short)(responseQueueElementHead + 1) != responseQueueElementTail)
-    {
-        ASSERT(responseQueueElementHead < RESPONSE_QUEUE_LENGTH);
-        ASSERT(responseQueueBufferHead < RESPONSE_QUEUE_BUFFER_SIZE);
-        ASSERT(responseQueueBufferHead + responseHeader->size() < RESPONSE_QUEUE_BUFFER_SIZE);
-
-        responseQueueElements[responseQueueElementHead].offset = responseQueueBufferHead;
-        copyMem(&responseQueueBuffer[responseQueueBufferHead], responseHeader, responseHeader->size());
-        responseQueueBufferHead += responseHeader->size();
-        responseQueueElements[responseQueueElementHead].peer = peer;
-        if (responseQueueBufferHead > RESPONSE_QUEUE_BUFFER_SIZE - BUFFER_SIZE)
-        {
-            responseQueueBufferHead = 0;
-        }
-        responseQueueElementHead++;
-    }
-
-    RELEASE(responseQueueHeadLock);
+    responseQueue.enqueue(responseQueue.shardOfProcessor(getRunningProcessorID()), peer, responseHeader);
 }
 
 // Add message to response queue of specific peer. If peer is NULL, it will be sent to random peers. Can be called from any thread.
@@ -376,39 +382,27 @@ static void enqueueResponse(Peer* peer, unsigned int dataSize, unsigned char typ
 {
     PROFILE_SCOPE();
 
-    ACQUIRE(responseQueueHeadLock);
-
-    if ((responseQueueBufferHead >= responseQueueBufferTail || responseQueueBufferHead + sizeof(RequestResponseHeader) + dataSize < responseQueueBufferTail)
-        && (unsigned short)(responseQueueElementHead + 1) != responseQueueElementTail)
+    if (sizeof(RequestResponseHeader) + dataSize > RequestResponseHeader::max_size)
     {
-        ASSERT(responseQueueElementHead < RESPONSE_QUEUE_LENGTH);
-        ASSERT(responseQueueBufferHead < RESPONSE_QUEUE_BUFFER_SIZE);
-        ASSERT(responseQueueBufferHead + sizeof(RequestResponseHeader) + dataSize < RESPONSE_QUEUE_BUFFER_SIZE);
-
-        responseQueueElements[responseQueueElementHead].offset = responseQueueBufferHead;
-        RequestResponseHeader* responseHeader = (RequestResponseHeader*)&responseQueueBuffer[responseQueueBufferHead];
-        if (!responseHeader->checkAndSetSize(sizeof(RequestResponseHeader) + dataSize))
-        {
 #ifndef NDEBUG
-            addDebugMessage(L"Error: Message size exceeds maximum message size!");
+        addDebugMessage(L"Error: Message size exceeds maximum message size!");
 #endif
-        }
+        return;
+    }
+
+    unsigned int shardIndex;
+    RequestResponseHeader* responseHeader = reserveResponse(peer, sizeof(RequestResponseHeader) + dataSize, shardIndex);
+    if (responseHeader)
+    {
+        responseHeader->checkAndSetSize(sizeof(RequestResponseHeader) + dataSize);
         responseHeader->setType(type);
         responseHeader->setDejavu(dejavu);
         if (data)
         {
-            copyMem(&responseQueueBuffer[responseQueueBufferHead + sizeof(RequestResponseHeader)], data, dataSize);
-        }
-        responseQueueBufferHead += responseHeader->size();
-        responseQueueElements[responseQueueElementHead].peer = peer;
-        if (responseQueueBufferHead > RESPONSE_QUEUE_BUFFER_SIZE - BUFFER_SIZE)
-        {
-            responseQueueBufferHead = 0;
+            copyMem(responseHeader + 1, data, dataSize);
         }
-        responseQueueElementHead++;
+        commitResponse(shardIndex);
     }
-
-    RELEASE(responseQueueHeadLock);
 }
 
 /**
@@ -656,9 +650,10 @@ static bool peerConnectionNewlyEstablished(unsigned int i)
     return false;
 }
 
-// This function process all data that arrive in FragmentBuffer.
+// This function process all data that arrive in the circular receive buffer of the peer.
 // based on RequestResponseHeader to determine whether the received packet is completed or not
-// if it receives a completed packet, it will copy the packet to requestQueueElements to process later in requestProcessors
+// if it receives a completed packet, it will pass the packet to requestQueue to process later in requestProcessors
+// (by reference without copying, unless the packet wraps around the end of the receive buffer)
 static void processReceivedData(unsigned int i, unsigned int salt)
 {
     PROFILE_SCOPE();
@@ -683,15 +678,28 @@ static void processReceivedData(unsigned int i, unsigned int salt)
                 else
                 {
                     numberOfReceivedBytes += peers[i].receiveData.DataLength;
-                    *((unsigned long long*) & peers[i].receiveData.FragmentTable[0].FragmentBuffer) += peers[i].receiveData.DataLength;
+                    peers[i].receiveWritePosition += peers[i].receiveData.DataLength;
 
-                iteration:
-                    unsigned int receivedDataSize = (unsigned int)(((unsigned long long)peers[i].receiveData.FragmentTable[0].FragmentBuffer) - ((unsigned long long)peers[i].receiveBuffer));
-
-                    if (receivedDataSize >= sizeof(RequestResponseHeader))
+                    unsigned char* receiveBuffer = (unsigned char*)peers[i].receiveBuffer;
+                    while (peers[i].receiveWritePosition - peers[i].receiveReadPosition >= sizeof(RequestResponseHeader))
                     {
-                        RequestResponseHeader* requestResponseHeader = (RequestResponseHeader*)peers[i].receiveBuffer;
-                        if (requestResponseHeader->size() < sizeof(RequestResponseHeader))
+                        const unsigned int receivedDataSize = peers[i].receiveWritePosition - peers[i].receiveReadPosition;
+                        const unsigned int offset = peers[i].receiveReadPosition & (BUFFER_SIZE - 1);
+
+                        // header may wrap around the end of the buffer
+                        RequestResponseHeader packetHeader;
+                        if (offset + sizeof(RequestResponseHeader) <= BUFFER_SIZE)
+                        {
+                            copyMem(&packetHeader, receiveBuffer + offset, sizeof(RequestResponseHeader));
+                        }
+                        else
+                        {
+                            copyMem(&packetHeader, receiveBuffer + offset, BUFFER_SIZE - offset);
+                            copyMem(((unsigned char*)&packetHeader) + (BUFFER_SIZE - offset), receiveBuffer, sizeof(RequestResponseHeader) - (BUFFER_SIZE - offset));
+                        }
+
+                        const unsigned int packetSize = packetHeader.size();
+                        if (packetSize < sizeof(RequestResponseHeader))
                         {
                             // protocol violation -> forget peer
                             setText(message, L"Forgetting ");
@@ -700,72 +708,84 @@ static void processReceivedData(unsigned int i, unsigned int salt)
                             logToConsole(message);
                             forgetPublicPeer(peers[i].address);
                             closePeer(&peers[i]);
+                            break;
+                        }
+                        if (receivedDataSize < packetSize)
+                        {
+                            // wait for rest of packet
+                            break;
+                        }
+
+                        // Packets are processed in place in the receive buffer. Only a packet wrapping around the end of
+                        // the buffer (at most one per BUFFER_SIZE bytes received) needs to be copied to be contiguous.
+                        const bool isContiguous = (offset + packetSize <= BUFFER_SIZE);
+                        RequestResponseHeader* requestResponseHeader;
+                        if (isContiguous)
+                        {
+                            requestResponseHeader = (RequestResponseHeader*)(receiveBuffer + offset);
                         }
                         else
                         {
-                            if (receivedDataSize >= requestResponseHeader->size())
+                            copyMem(wrappedPacketBuffer, receiveBuffer + offset, BUFFER_SIZE - offset);
+                            copyMem(wrappedPacketBuffer + (BUFFER_SIZE - offset), receiveBuffer, packetSize - (BUFFER_SIZE - offset));
+                            requestResponseHeader = (RequestResponseHeader*)wrappedPacketBuffer;
+                        }
+                        const unsigned int packetEndPosition = peers[i].receiveReadPosition + packetSize;
+
+                        // Compute saltId of packet with K12 of payload and header (size + type temporarily
+                        // overwritten with salt). This is used recognized and skip packet duplicates with
+                        // dejavu0 (checking/setting flag for received package). After receiving a certain
+                        // number of packages (DEJAVU_SWAP_LIMIT), dejavu0 is moved to dejavu1 for checking
+                        // and dejavu0 is initialized with an empty buffer for checking/setting.
+                        unsigned int saltedId;
+                        const unsigned int header = *((unsigned int*)requestResponseHeader);
+                        *((unsigned int*)requestResponseHeader) = salt;
+                        KangarooTwelve(requestResponseHeader, header & 0xFFFFFF, &saltedId, sizeof(saltedId));
+                        *((unsigned int*)requestResponseHeader) = header;
+
+                        // Initiate transfer of already received packet to processing thread
+                        // (or drop it without processing if Dejavu filter tells to ignore it)
+                        if (!((dejavu0[saltedId >> 6] | dejavu1[saltedId >> 6]) & (1ULL << (saltedId & 63))))
+                        {
+                            bool enqueued;
+                            if (isContiguous)
                             {
-                                // Compute saltId of packet with K12 of payload and header (size + type temporarily
-                                // overwritten with salt). This is used recognized and skip packet duplicates with
-                                // dejavu0 (checking/setting flag for received package). After receiving a certain
-                                // number of packages (DEJAVU_SWAP_LIMIT), dejavu0 is moved to dejavu1 for checking
-                                // and dejavu0 is initialized with an empty buffer for checking/setting.
-                                unsigned int saltedId;
-                                const unsigned int header = *((unsigned int*)requestResponseHeader);
-                                *((unsigned int*)requestResponseHeader) = salt;
-                                KangarooTwelve(requestResponseHeader, header & 0xFFFFFF, &saltedId, sizeof(saltedId));
-                                *((unsigned int*)requestResponseHeader) = header;
-
-                                // Initiate transfer of already received packet to processing thread
-                                // (or drop it without processing if Dejavu filter tells to ignore it)
-                                if (!((dejavu0[saltedId >> 6] | dejavu1[saltedId >> 6]) & (1ULL << (saltedId & 63))))
+                                enqueued = requestQueue.enqueueReference(&peers[i], requestResponseHeader, &peers[i].receiveReleasedPosition, packetEndPosition);
+                                if (enqueued)
                                 {
-                                    if ((requestQueueBufferHead >= requestQueueBufferTail || requestQueueBufferHead + requestResponseHeader->size() < requestQueueBufferTail)
-                                        && (unsigned short)(requestQueueElementHead + 1) != requestQueueElementTail)
-                                    {
-                                        dejavu0[saltedId >> 6] |= (1ULL << (saltedId & 63));
-
-                                        ASSERT(requestQueueElementHead < REQUEST_QUEUE_LENGTH);
-                                        ASSERT(requestQueueBufferHead < REQUEST_QUEUE_BUFFER_SIZE);
-                                        ASSERT(requestQueueBufferHead + requestResponseHeader->size() < REQUEST_QUEUE_BUFFER_SIZE);
-
-                                        requestQueueElements[requestQueueElementHead].offset = requestQueueBufferHead;
-                                        copyMem(&requestQueueBuffer[requestQueueBufferHead], peers[i].receiveBuffer, requestResponseHeader->size());
-                                        requestQueueBufferHead += requestResponseHeader->size();
-                                        requestQueueElements[requestQueueElementHead].peer = &peers[i];
-                                        if (requestQueueBufferHead > REQUEST_QUEUE_BUFFER_SIZE - BUFFER_SIZE)
-                                        {
-                                            requestQueueBufferHead = 0;
-                                        }
-                                        // TODO: Place a fence
-                                        requestQueueElementHead++;
-
-                                        if (!(--dejavuSwapCounter))
-                                        {
-                                            unsigned long long* tmp = dejavu1;
-                                            dejavu1 = dejavu0;
-                                            setMem(dejavu0 = tmp, 536870912, 0);
-                                            dejavuSwapCounter = DEJAVU_SWAP_LIMIT;
-                                        }
-                                    }
-                                    else
-                                    {
-                                        _InterlockedIncrement64(&numberOfDiscardedRequests);
-
-                                        enqueueResponse(&peers[i], 0, TryAgain::type, requestResponseHeader->dejavu(), NULL);
-                                    }
+                                    peers[i].receiveHandedOffPosition = packetEndPosition;
                                 }
-                                else
+                            }
+                            else
+                            {
+                                enqueued = requestQueue.enqueue(&peers[i], requestResponseHeader);
+                            }
+
+                            if (enqueued)
+                            {
+                                dejavu0[saltedId >> 6] |= (1ULL << (saltedId & 63));
+
+                                if (!(--dejavuSwapCounter))
                                 {
-                                    _InterlockedIncrement64(&numberOfDuplicateRequests);
+                                    unsigned long long* tmp = dejavu1;
+                                    dejavu1 = dejavu0;
+                                    setMem(dejavu0 = tmp, 536870912, 0);
+                                    dejavuSwapCounter = DEJAVU_SWAP_LIMIT;
                                 }
+                            }
+                            else
+                            {
+                                _InterlockedIncrement64(&numberOfDiscardedRequests);
 
-                                copyMem(peers[i].receiveBuffer, ((char*)peers[i].receiveBuffer) + requestResponseHeader->size(), receivedDataSize -= requestResponseHeader->size());
-                                peers[i].receiveData.FragmentTable[0].FragmentBuffer = ((char*)peers[i].receiveBuffer) + receivedDataSize;
-
-                                goto iteration;
+                                enqueueResponse(&peers[i], 0, TryAgain::type, packetHeader.dejavu(), NULL);
                             }
                         }
+                        else
+                        {
+                            _InterlockedIncrement64(&numberOfDuplicateRequests);
+                        }
+
+                        peers[i].receiveReadPosition = packetEndPosition;
                     }
                 }
             }
@@ -783,10 +803,18 @@ static void receiveData(unsigned int i, unsigned int salt)
     {
         if (!peers[i].isReceiving && peers[i].isConnectedAccepted && !peers[i].isClosing)
         {
-            // check that receive buffer has enough space (less than BUFFER_SIZE is used)
-            if ((((unsigned long long)peers[i].receiveData.FragmentTable[0].FragmentBuffer) - ((unsigned long long)peers[i].receiveBuffer)) < BUFFER_SIZE)
+            // check that receive buffer has enough space (less than BUFFER_SIZE is used), receive into the free space
+            // after the received data up to the end of the buffer
+            const unsigned int usedSize = peers[i].receiveWritePosition - peers[i].receiveUsedPosition();
+            if (usedSize < BUFFER_SIZE)
             {
-                unsigned int receiveSize = BUFFER_SIZE - (unsigned int)(((unsigned long long)peers[i].receiveData.FragmentTable[0].FragmentBuffer) - ((unsigned long long)peers[i].receiveBuffer));
+                const unsigned int offset = peers[i].receiveWritePosition & (BUFFER_SIZE - 1);
+                unsigned int receiveSize = BUFFER_SIZE - usedSize;
+                if (receiveSize > BUFFER_SIZE - offset)
+                {
+                    receiveSize = BUFFER_SIZE - offset;
+                }
+                peers[i].receiveData.FragmentTable[0].FragmentBuffer = ((char*)peers[i].receiveBuffer) + offset;
                 peers[i].receiveData.DataLength = receiveSize;
                 peers[i].receiveData.FragmentTable[0].FragmentLength = receiveSize;
                 if (peers[i].receiveData.DataLength)
@@ -937,8 +965,6 @@ static void peerReconnectIfInactive(unsigned int i, unsigned short port)
                 {
                     if (peers[i].connectAcceptToken.NewChildHandle = getTcp4Protocol(peers[i].address.u8, port, &peers[i].tcp4Protocol))
                     {
-                        peers[i].receiveData.FragmentTable[0].FragmentBuffer = peers[i].receiveBuffer;
-
                         if (status = peers[i].tcp4Protocol->Connect(peers[i].tcp4Protocol, (EFI_TCP4_CONNECTION_TOKEN*)&peers[i].connectAcceptToken))
                         {
                             logStatusToConsole(L"EFI_TCP4_PROTOCOL.Connect() fails", status, __LINE__);
@@ -966,7 +992,6 @@ static void peerReconnectIfInactive(unsigned int i, unsigned short port)
             if (!listOfPeersIsStatic)
             {
                 peers[i].isIncommingConnection = TRUE;
-                peers[i].receiveData.FragmentTable[0].FragmentBuffer = peers[i].receiveBuffer;
 
                 if (status = peerTcp4Protocol->Accept(peerTcp4Protocol, &peers[i].connectAcceptToken))
                 {
@@ -0,0 +1,360 @@
+#pragma once
+
+#include "platform/memory_util.h"
+#include "platform/concurrency.h"
+#include "platform/debugging.h"
+
+#include "network_messages/header.h"
+
+struct Peer;
+
+// Bounded multi-producer/multi-consumer queue of requests received from peers. The requests are stored contiguously
+// in a ring buffer of bytes and referenced by a ring of elements. Each element has a sequence number telling which
+// step of its life cycle it is in, so producers and consumers can claim elements with a single compare-and-exchange
+// without any lock (for the element enqueued/dequeued at position p):
+// - sequence == p:                 free, may be claimed by the producer enqueuing at position p
+// - sequence == p + 1:             filled, may be claimed by the consumer dequeuing at position p
+// - sequence == p + 2:             processed and released by the consumer
+// - sequence == p + queueLength:   recycled, free for the producer enqueuing at position p + queueLength
+//
+// Requests can also be enqueued by reference, so they stay in the memory of the producer (such as the receive buffer
+// of a peer) without being copied. The producer passes a release position variable and value, which is set when the
+// element is recycled. As elements are recycled in order, the producer knows that all of its referenced requests up
+// to the value have been processed and it can reuse their memory.
+//
+// Consumers process requests in place without copying them. Requests may be released in any order, but the space
+// in the byte ring buffer can only be reused in order of the positions. Thus, released elements are recycled in
+// order by the consumer that releases the element at the recycling position. The other consumers never wait for
+// this, they just skip recycling if it is already done by another thread.
+//
+// Positions and byte positions are counters that wrap around at 2^32. The offset in the ring buffers is the counter
+// modulo the (power of 2) size.
+template <unsigned int queueLength, unsigned int bufferSize>
+class RequestQueue
+{
+    static_assert(queueLength >= 4 && queueLength <= (1U << 30) && (queueLength & (queueLength - 1)) == 0, "Queue length must be a power of 2");
+    static_assert(bufferSize >= 1024 && bufferSize <= (1U << 31) && (bufferSize & (bufferSize - 1)) == 0, "Buffer size must be a power of 2");
+
+    struct Element
+    {
+        volatile long sequence;
+        unsigned int endPosition;   // byte position after the request (buffer space before it is free after recycling)
+        RequestResponseHeader* request;
+        Peer* peer;
+        volatile unsigned int* releasedPosition;    // set to releasedValue when recycled (nullptr if request is copied)
+        unsigned int releasedValue;
+    };
+
+    // Allocated byte ring buffer with bufferSize bytes
+    unsigned char* buffer;
+
+    // Allocated element ring buffer with queueLength elements
+    Element* elements;
+
+    // Producer state: position of next element to enqueue (high 32 bits) and byte position for next request (low 32
+    // bits). Both are updated together with one compare-and-exchange, so the order of the requests in the byte ring
+    // buffer is the same as the order of positions. The counters are on separate cache lines to avoid false sharing.
+    volatile long long enqueueState;
+    char paddingEnqueue[64 - sizeof(long long)];
+
+    // Position of next element to dequeue
+    volatile long dequeuePosition;
+    char paddingDequeue[64 - sizeof(long)];
+
+    // Position of next element to recycle and byte position up to which the buffer space has been recycled
+    volatile long recyclePosition;
+    volatile unsigned int recycledBytePosition;
+    volatile char recycleFlag;
+
+    // Recycle released elements in order of their position. Only one thread recycles at a time, all others skip it.
+    void recycle()
+    {
+        while (TRY_ACQUIRE(recycleFlag))
+        {
+            unsigned int position = (unsigned int)recyclePosition;
+            while (true)
+            {
+                Element& element = elements[position & (queueLength - 1)];
+                if ((unsigned int)element.sequence != position + 2)
+                    break;
+                recycledBytePosition = element.endPosition;
+                if (element.releasedPosition)
+                    *element.releasedPosition = element.releasedValue;
+                _InterlockedExchange(&element.sequence, (long)(position + queueLength));
+                ++position;
+            }
+            recyclePosition = (long)position;
+            RELEASE(recycleFlag);
+
+            // Check again, because the element at the recycling position may have been released by another thread
+            // after the check above, but before releasing the flag (the other thread skipped recycling then)
+            if ((unsigned int)elements[position & (queueLength - 1)].sequence != position + 2)
+                break;
+        }
+    }
+
+    // Claim next element and copy request to the byte ring buffer (if copy is true) or reference it (otherwise)
+    bool enqueueElement(Peer* peer, const RequestResponseHeader* request, bool copy, volatile unsigned int* releasedPosition, unsigned int releasedValue)
+    {
+        const unsigned int size = (copy) ? request->size() : 0;
+        if (size > bufferSize)
+            return false;
+
+        while (true)
+        {
+            const long long state = enqueueState;
+            const unsigned int position = (unsigned int)(((unsigned long long)state) >> 32);
+            unsigned int bytePosition = (unsigned int)state;
+
+            Element& element = elements[position & (queueLength - 1)];
+            const int diff = (int)((unsigned int)element.sequence - position);
+            if (diff < 0)
+            {
+                // element hasn't been recycled yet -> queue is full
+                return false;
+            }
+            if (diff > 0)
+            {
+                // state is outdated, because another producer has been faster -> retry
+                continue;
+            }
+
+            // Requests are stored contiguously, so skip the end of the buffer if the request does not fit
+            const unsigned int offset = bytePosition & (bufferSize - 1);
+            if (offset + size > bufferSize)
+                bytePosition += bufferSize - offset;
+            const unsigned int endPosition = bytePosition + size;
+            if (endPosition - recycledBytePosition > bufferSize)
+            {
+                // not enough space in buffer
+                return false;
+            }
+
+            const long long newState = (long long)((((unsigned long long)(position + 1)) << 32) | endPosition);
+            if (_InterlockedCompareExchange64(&enqueueState, newState, state) == state)
+            {
+                element.endPosition = endPosition;
+                element.peer = peer;
+                element.releasedPosition = releasedPosition;
+                element.releasedValue = releasedValue;
+                if (copy)
+                {
+                    element.request = (RequestResponseHeader*)(buffer + (bytePosition & (bufferSize - 1)));
+                    copyMem(element.request, request, size);
+                }
+                else
+                {
+                    element.request = (RequestResponseHeader*)request;
+                }
+
+                // publish request to consumers
+                _InterlockedExchange(&element.sequence, (long)(position + 1));
+                return true;
+            }
+        }
+    }
+
+public:
+    // Allocate memory and init empty queue, return false if allocation failed
+    bool init()
+    {
+        if (!allocPoolWithErrorLog(L"requestQueueBuffer", bufferSize, (void**)&buffer, __LINE__)
+            || !allocPoolWithErrorLog(L"requestQueueElements", queueLength * sizeof(Element), (void**)&elements, __LINE__))
+        {
+            return false;
+        }
+        reset();
+        return true;
+    }
+
+    // Free memory
+    void deinit()
+    {
+        if (buffer)
+        {
+            freePool(buffer);
+            buffer = nullptr;
+        }
+        if (elements)
+        {
+            freePool(elements);
+            elements = nullptr;
+        }
+    }
+
+    // Discard all requests. Must not be called concurrently with any other function.
+    void reset()
+    {
+        for (unsigned int i = 0; i < queueLength; ++i)
+        {
+            elements[i].sequence = (long)i;
+        }
+        enqueueState = 0;
+        dequeuePosition = 0;
+        recyclePosition = 0;
+        recycledBytePosition = 0;
+        recycleFlag = 0;
+    }
+
+    // Copy request to the queue. Returns false if the queue is full. May be called concurrently by multiple threads.
+    bool enqueue(Peer* peer, const RequestResponseHeader* request)
+    {
+        return enqueueElement(peer, request, true, nullptr, 0);
+    }
+
+    // Enqueue request without copying it. The request memory must stay valid until *releasedPosition is set to
+    // releasedValue, which happens when the element is recycled (after the request and all requests enqueued before
+    // it have been released). Returns false if the queue is full. May be called concurrently by multiple threads.
+    bool enqueueReference(Peer* peer, RequestResponseHeader* request, volatile unsigned int* releasedPosition, unsigned int releasedValue)
+    {
+        return enqueueElement(peer, request, false, releasedPosition, releasedValue);
+    }
+
+    // Claim next request for processing (without blocking). Returns false if the queue is empty. Otherwise, the
+    // position of the request is returned in the parameter. The request can be accessed with getRequest() and
+    // getPeer() until it is released with release(). May be called concurrently by multiple threads.
+    bool tryDequeue(unsigned int& position)
+    {
+        while (true)
+        {
+            const long currentDequeuePosition = dequeuePosition;
+            const unsigned int currentPosition = (unsigned int)currentDequeuePosition;
+            const Element& element = elements[currentPosition & (queueLength - 1)];
+            const int diff = (int)((unsigned int)element.sequence - (currentPosition + 1));
+            if (diff < 0)
+            {
+                // element hasn't been filled yet -> queue is empty
+                return false;
+            }
+            if (diff == 0 && _InterlockedCompareExchange(&dequeuePosition, currentDequeuePosition + 1, currentDequeuePosition) == currentDequeuePosition)
+            {
+                position = currentPosition;
+                return true;
+            }
+            // otherwise another consumer has been faster -> retry
+        }
+    }
+
+    // Get request claimed by tryDequeue()
+    RequestResponseHeader* getRequest(unsigned int position) const
+    {
+        ASSERT((unsigned int)elements[position & (queueLength - 1)].sequence == position + 1);
+        return elements[position & (queueLength - 1)].request;
+    }
+
+    // Get peer that sent the request claimed by tryDequeue()
+    Peer* getPeer(unsigned int position) const
+    {
+        ASSERT((unsigned int)elements[position & (queueLength - 1)].sequence == position + 1);
+        return elements[position & (queueLength - 1)].peer;
+    }
+
+    // Release request claimed by tryDequeue() after processing it, so its memory can be reused
+    void release(unsigned int position)
+    {
+        Element& element = elements[position & (queueLength - 1)];
+        ASSERT((unsigned int)element.sequence == position + 1);
+        _InterlockedExchange(&element.sequence, (long)(position + 2));
+        recycle();
+    }
+
+    // Return if there is no request that can be dequeued (only a hint if called concurrently)
+    bool isEmpty() const
+    {
+        const unsigned int position = (unsigned int)dequeuePosition;
+        return (unsigned int)elements[position & (queueLength - 1)].sequence != position + 1;
+    }
+
+    // Return number of requests in queue, including requests that are dequeued but not released yet
+    unsigned int getNumberOfRequests() const
+    {
+        return (unsigned int)(((unsigned long long)enqueueState) >> 32) - (unsigned int)recyclePosition;
+    }
+
+    // Return number of bytes of the buffer used for requests in queue, including dequeued requests that are not
+    // released yet
+    unsigned int getNumberOfBytes() const
+    {
+        return (unsigned int)enqueueState - recycledBytePosition;
+    }
+};
+
+// Requests taken from a RequestQueue by one consumer for processing them one after another, such as signed requests
+// taken together for verifying their signatures in a batch. The requests are processed in place in the queue (unless
+// copied with copyAndReleaseRequest()). As the queue recycles elements in order, held requests block recycling of all
+// requests enqueued after them. Thus, the consumer must not do anything that may take long (such as computing scores)
+// before all held requests have been passed on and released, which is the case if isEmpty() returns true.
+template <class Queue, unsigned int capacity>
+class RequestQueueBatch
+{
+    unsigned int positions[capacity];
+    RequestResponseHeader* requests[capacity];
+    unsigned int numberOfRequests = 0;
+    unsigned int nextRequest = 0;
+
+public:
+    // Return if there are no held requests, that is all requests taken have been passed on with takeNext()
+    bool isEmpty() const
+    {
+        return nextRequest == numberOfRequests;
+    }
+
+    // Take requests from the queue until the batch is full, the queue is empty, or continueTaking(request) returns
+    // false for the request taken last. Must only be called if isEmpty(). Returns the number of requests taken.
+    template <typename ContinueTaking>
+    unsigned int take(Queue& queue, ContinueTaking continueTaking)
+    {
+        ASSERT(isEmpty());
+        numberOfRequests = nextRequest = 0;
+        unsigned int position;
+        while (numberOfRequests < capacity && queue.tryDequeue(position))
+        {
+            positions[numberOfRequests] = position;
+            requests[numberOfRequests] = queue.getRequest(position);
+            if (!continueTaking(requests[numberOfRequests++]))
+                break;
+        }
+        return numberOfRequests;
+    }
+
+    // Return number of requests taken by the last call of take()
+    unsigned int size() const
+    {
+        return numberOfRequests;
+    }
+
+    // Return requests taken by the last call of take()
+    RequestResponseHeader* const* getRequests() const
+    {
+        return requests;
+    }
+
+    // Pass on next held request and return its index in the batch. Its position in the queue is returned in the
+    // parameter. The caller has to release it after processing.
+    unsigned int takeNext(unsigned int& position)
+    {
+        ASSERT(!isEmpty());
+        position = positions[nextRequest];
+        return nextRequest++;
+    }
+
+    // Release all held requests without processing them
+    void releaseAll(Queue& queue)
+    {
+        while (nextRequest < numberOfRequests)
+            queue.release(positions[nextRequest++]);
+        numberOfRequests = nextRequest = 0;
+    }
+};
+
+// Copy request at position of the queue to buffer and release it, so that processing it doesn't block recycling the
+// requests enqueued after it (such as a request whose processing may take long). The peer of the request has to be
+// retrieved before. Returns the copy of the request.
+template <class Queue>
+static RequestResponseHeader* copyAndReleaseRequest(Queue& queue, unsigned int position, void* buffer)
+{
+    const RequestResponseHeader* request = queue.getRequest(position);
+    copyMem(buffer, request, request->size());
+    queue.release(position);
+    return (RequestResponseHeader*)buffer;
+}
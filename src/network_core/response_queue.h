@@ -0,0 +1,241 @@
+#pragma once
+
+#include "platform/memory_util.h"
+#include "platform/concurrency.h"
+#include "platform/debugging.h"
+
+#include "network_messages/header.h"
+
+struct Peer;
+
+// Queue of responses to be sent to peers, split into shards to avoid contention between the processors that enqueue
+// responses. Each shard is a ring buffer of bytes with a ring of elements referencing the responses. A producer
+// always uses the shard of its processor, so the lock of the shard is usually uncontended (it is only needed if
+// multiple threads map to the same shard). There is a single consumer (the main loop), which takes the responses of
+// the shards round-robin and doesn't acquire any lock.
+//
+// Responses can be serialized directly into the ring buffer: reserve() returns space for a message, which is made
+// visible to the consumer with commit(). The lock of the shard is held in between, so other threads of the same
+// shard wait until the response is committed.
+//
+// Positions and byte positions are counters that wrap around at 2^32. The offset in the ring buffers is the counter
+// modulo the (power of 2) size.
+template <unsigned int numberOfShards, unsigned int shardLength, unsigned int shardBufferSize>
+class ResponseQueue
+{
+    static_assert(numberOfShards >= 1, "Number of shards must be at least 1");
+    static_assert(shardLength >= 4 && shardLength <= (1U << 30) && (shardLength & (shardLength - 1)) == 0, "Shard length must be a power of 2");
+    static_assert(shardBufferSize >= 1024 && shardBufferSize <= (1U << 31) && (shardBufferSize & (shardBufferSize - 1)) == 0, "Shard buffer size must be a power of 2");
+
+    struct Element
+    {
+        Peer* peer;
+        unsigned int offset;        // offset of response in buffer
+        unsigned int endPosition;   // byte position after the response (buffer space before it is free after dequeuing)
+    };
+
+    struct Shard
+    {
+        // Allocated byte ring buffer with shardBufferSize bytes and element ring buffer with shardLength elements
+        unsigned char* buffer;
+        Element* elements;
+
+        // Producer state, only accessed while holding lock (except for enqueuePosition, which is read by the consumer)
+        volatile char lock;
+        unsigned int enqueueBytePosition;
+        unsigned int reservedSize;
+        volatile long enqueuePosition;
+        char paddingEnqueue[64 - 2 * sizeof(void*) - 3 * sizeof(unsigned int) - sizeof(long)];
+
+        // Consumer state, only written by the consumer
+        volatile long dequeuePosition;
+        volatile unsigned int dequeueBytePosition;
+        char paddingDequeue[64 - sizeof(long) - sizeof(unsigned int)];
+    };
+
+    Shard shards[numberOfShards];
+
+    // Shard to take the next response from (consumer state)
+    unsigned int nextShard;
+
+public:
+    // Allocate memory and init empty queue, return false if allocation failed
+    bool init()
+    {
+        for (unsigned int i = 0; i < numberOfShards; ++i)
+        {
+            if (!allocPoolWithErrorLog(L"responseQueueBuffer", shardBufferSize, (void**)&shards[i].buffer, __LINE__)
+                || !allocPoolWithErrorLog(L"responseQueueElements", shardLength * sizeof(Element), (void**)&shards[i].elements, __LINE__))
+            {
+                return false;
+            }
+        }
+        reset();
+        return true;
+    }
+
+    // Free memory
+    void deinit()
+    {
+        for (unsigned int i = 0; i < numberOfShards; ++i)
+        {
+            if (shards[i].buffer)
+            {
+                freePool(shards[i].buffer);
+                shards[i].buffer = nullptr;
+            }
+            if (shards[i].elements)
+            {
+                freePool(shards[i].elements);
+                shards[i].elements = nullptr;
+            }
+        }
+    }
+
+    // Discard all responses. Must not be called concurrently with any other function.
+    void reset()
+    {
+        for (unsigned int i = 0; i < numberOfShards; ++i)
+        {
+            shards[i].lock = 0;
+            shards[i].enqueueBytePosition = 0;
+            shards[i].reservedSize = 0;
+            shards[i].enqueuePosition = 0;
+            shards[i].dequeuePosition = 0;
+            shards[i].dequeueBytePosition = 0;
+        }
+        nextShard = 0;
+    }
+
+    // Return shard to be used by the given processor
+    static unsigned int shardOfProcessor(unsigned long long processorNumber)
+    {
+        return (unsigned int)(processorNumber % numberOfShards);
+    }
+
+    // Reserve space for a response of up to maxSize bytes in the shard. Returns nullptr if the shard is full.
+    // Otherwise, the response has to be written to the returned memory (including the header with the actual size)
+    // and published with commit() or dropped with cancel(). May be called concurrently by multiple threads.
+    RequestResponseHeader* reserve(unsigned int shardIndex, Peer* peer, unsigned int maxSize)
+    {
+        ASSERT(shardIndex < numberOfShards);
+        if (maxSize > RequestResponseHeader::max_size || maxSize > shardBufferSize || maxSize < sizeof(RequestResponseHeader))
+            return nullptr;
+
+        Shard& shard = shards[shardIndex];
+        ACQUIRE(shard.lock);
+
+        const unsigned int position = (unsigned int)shard.enqueuePosition;
+        if (position - (unsigned int)shard.dequeuePosition >= shardLength)
+        {
+            // no free element
+            RELEASE(shard.lock);
+            return nullptr;
+        }
+
+        // Responses are stored contiguously, so skip the end of the buffer if the response does not fit
+        unsigned int bytePosition = shard.enqueueBytePosition;
+        const unsigned int offset = bytePosition & (shardBufferSize - 1);
+        if (offset + maxSize > shardBufferSize)
+            bytePosition += shardBufferSize - offset;
+        if (bytePosition + maxSize - shard.dequeueBytePosition > shardBufferSize)
+        {
+            // not enough space in buffer
+            RELEASE(shard.lock);
+            return nullptr;
+        }
+
+        Element& element = shard.elements[position & (shardLength - 1)];
+        element.peer = peer;
+        element.offset = bytePosition & (shardBufferSize - 1);
+        shard.enqueueBytePosition = bytePosition;
+        shard.reservedSize = maxSize;
+        return (RequestResponseHeader*)(shard.buffer + element.offset);
+    }
+
+    // Publish response written to the memory returned by reserve(), which releases the shard
+    void commit(unsigned int shardIndex)
+    {
+        Shard& shard = shards[shardIndex];
+        const unsigned int position = (unsigned int)shard.enqueuePosition;
+        Element& element = shard.elements[position & (shardLength - 1)];
+        const unsigned int size = ((RequestResponseHeader*)(shard.buffer + element.offset))->size();
+        ASSERT(size >= sizeof(RequestResponseHeader) && size <= shard.reservedSize);
+        shard.enqueueBytePosition += size;
+        element.endPosition = shard.enqueueBytePosition;
+
+        // publish response to consumer
+        _InterlockedExchange(&shard.enqueuePosition, (long)(position + 1));
+        RELEASE(shard.lock);
+    }
+
+    // Drop response reserved by reserve(), which releases the shard
+    void cancel(unsigned int shardIndex)
+    {
+        RELEASE(shards[shardIndex].lock);
+    }
+
+    // Copy response to the shard. Returns false if the shard is full. May be called concurrently by multiple threads.
+    bool enqueue(unsigned int shardIndex, Peer* peer, const RequestResponseHeader* response)
+    {
+        RequestResponseHeader* dst = reserve(shardIndex, peer, response->size());
+        if (!dst)
+            return false;
+        copyMem(dst, response, response->size());
+        commit(shardIndex);
+        return true;
+    }
+
+    // Get next response, taking the shards round-robin. Returns nullptr if the queue is empty. Otherwise, the response
+    // is valid until calling popFront() with the returned shard index. Must only be called by the consumer thread.
+    RequestResponseHeader* front(Peer*& peer, unsigned int& shardIndex)
+    {
+        for (unsigned int i = 0; i < numberOfShards; ++i)
+        {
+            const unsigned int currentShard = (nextShard + i) % numberOfShards;
+            const Shard& shard = shards[currentShard];
+            const unsigned int position = (unsigned int)shard.dequeuePosition;
+            if (position != (unsigned int)shard.enqueuePosition)
+            {
+                const Element& element = shard.elements[position & (shardLength - 1)];
+                peer = element.peer;
+                shardIndex = currentShard;
+                return (RequestResponseHeader*)(shard.buffer + element.offset);
+            }
+        }
+        return nullptr;
+    }
+
+    // Remove response returned by front(), so its memory can be reused. Must only be called by the consumer thread.
+    void popFront(unsigned int shardIndex)
+    {
+        Shard& shard = shards[shardIndex];
+        const unsigned int position = (unsigned int)shard.dequeuePosition;
+        ASSERT(position != (unsigned int)shard.enqueuePosition);
+        shard.dequeueBytePosition = shard.elements[position & (shardLength - 1)].endPosition;
+        _InterlockedExchange(&shard.dequeuePosition, (long)(position + 1));
+        nextShard = (shardIndex + 1) % numberOfShards;
+    }
+
+    // Return number of responses in queue (only a hint if called concurrently)
+    unsigned int getNumberOfResponses() const
+    {
+        unsigned int count = 0;
+        for (unsigned int i = 0; i < numberOfShards; ++i)
+        {
+            count += (unsigned int)shards[i].enqueuePosition - (unsigned int)shards[i].dequeuePosition;
+        }
+        return count;
+    }
+
+    // Return number of bytes of the buffers used for responses in queue (only a hint if called concurrently)
+    unsigned long long getNumberOfBytes() const
+    {
+        unsigned long long count = 0;
+        for (unsigned int i = 0; i < numberOfShards; ++i)
+        {
+            count += shards[i].enqueueBytePosition - shards[i].dequeueBytePosition;
+        }
+        return count;
+    }
+};
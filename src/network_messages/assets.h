@@ -213,4 +213,5 @@ struct RespondAssetsWithSiblings : public RespondAssets
     m256i siblings[ASSETS_DEPTH];
 };
 
-static_assert(sizeof(RespondAssetsWithSiblings) == 824, "Something is wrong with the struct size.");
+static_assert(sizeof(RespondAssetsWithSiblings) == sizeof(RespondAssets) + 32 * ASSETS_DEPTH, "Something is wrong with the struct size.");
+static_assert(ASSETS_DEPTH != 24 || sizeof(RespondAssetsWithSiblings) == 824, "Something is wrong with the struct size.");
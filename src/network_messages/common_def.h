@@ -8,11 +8,17 @@
 #define QUORUM (NUMBER_OF_COMPUTORS * 2 / 3 + 1)
 #define NUMBER_OF_EXCHANGED_PEERS 4
 
+// SPECTRUM_DEPTH and ASSETS_DEPTH may be reduced by defining them before (for example in simulations that don't need
+// the memory of a real node), but only the default values are compatible with the network.
+#ifndef SPECTRUM_DEPTH
 #define SPECTRUM_DEPTH 24 // Defines SPECTRUM_CAPACITY (1 << SPECTRUM_DEPTH)
+#endif
 #define SPECTRUM_CAPACITY (1ULL << SPECTRUM_DEPTH) // Must be 2^N
 
-#define ASSETS_CAPACITY 0x1000000ULL // Must be 2^N
-#define ASSETS_DEPTH 24 // Is derived from ASSETS_CAPACITY (=N)
+#ifndef ASSETS_DEPTH
+#define ASSETS_DEPTH 24 // Defines ASSETS_CAPACITY (1 << ASSETS_DEPTH)
+#endif
+#define ASSETS_CAPACITY (1ULL << ASSETS_DEPTH) // Must be 2^N
 
 #define MAX_INPUT_SIZE 1024ULL
 #define ISSUANCE_RATE 1000000000000LL
@@ -85,4 +85,80 @@ struct SpecialCommandSetConsoleLoggingModeRequestAndResponse
     unsigned char padding[7];
 };
 
+// Request profiling data aggregated over all processors (only available if the node is built with ENABLE_PROFILING).
+// The node responds with one or more SpecialCommandGetProfilingDataResponse messages. The last one has
+// firstEntryIndex + numberOfEntries == totalNumberOfEntries. Run-times are given in microseconds.
+#define SPECIAL_COMMAND_GET_PROFILING_DATA 18ULL
+struct SpecialCommandGetProfilingDataResponse
+{
+    struct Entry
+    {
+        char name[64]; // zero-terminated, truncated if longer
+        unsigned long long line;
+        unsigned long long numOfExec;
+        unsigned long long runtimeSum;
+        unsigned long long runtimeMin;
+        unsigned long long runtimeMax;
+        unsigned long long runtimeP50;
+        unsigned long long runtimeP99;
+        unsigned long long runtimeP999;
+    };
+
+    static constexpr unsigned int maxNumberOfEntries = 128;
+
+    unsigned long long everIncreasingNonceAndCommandType;
+    unsigned int totalNumberOfEntries;
+    unsigned int firstEntryIndex;
+    unsigned int numberOfEntries;
+    unsigned int padding;
+    Entry entries[maxNumberOfEntries]; // only numberOfEntries are sent
+};
+
+// Request lock contention statistics (only available if the node is built with ENABLE_LOCK_PROFILING, see
+// src/platform/lock_profiling.h). The node responds with one or more SpecialCommandGetLockProfilingDataResponse
+// messages. The last one has firstEntryIndex + numberOfEntries == totalNumberOfEntries. Waiting times are given in
+// TSC ticks (see tscFrequency). Histogram bucket 0 counts value 0, bucket i counts [2^(i-1), 2^i).
+#define SPECIAL_COMMAND_GET_LOCK_PROFILING_DATA 19ULL
+struct SpecialCommandGetLockProfilingDataResponse
+{
+    struct Site
+    {
+        char file[48]; // zero-terminated, beginning truncated if longer
+        unsigned int line;
+        unsigned int padding;
+    };
+
+    struct HolderSite
+    {
+        Site site;
+        unsigned long long waitCount;
+        unsigned long long waitTscSum;
+    };
+
+    struct Entry
+    {
+        char name[64]; // expression passed to ACQUIRE() at first acquisition, zero-terminated
+        Site firstSite;
+        unsigned long long acquireCount;
+        unsigned long long contendedCount;
+        unsigned long long spinSum;
+        unsigned long long waitTscSum;
+        unsigned long long waitTscMax;
+        unsigned long long otherHolderSitesWaitTscSum;
+        unsigned long long spinHistogram[40];
+        unsigned long long waitTscHistogram[40];
+        HolderSite holderSites[8]; // sites holding the lock while others started waiting (site.line == 0 if unused)
+    };
+
+    static constexpr unsigned int maxNumberOfEntries = 16;
+
+    unsigned long long everIncreasingNonceAndCommandType;
+    unsigned long long tscFrequency;
+    unsigned int totalNumberOfEntries;
+    unsigned int firstEntryIndex;
+    unsigned int numberOfEntries;
+    unsigned int padding;
+    Entry entries[maxNumberOfEntries]; // only numberOfEntries are sent
+};
+
 #pragma pack(pop)
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "platform/m256.h"
+#include "platform/memory_util.h"
+#include "platform/file_io.h"
+#include "platform/copy_on_write.h"
+
+#include "kangaroo_twelve.h"
+
+
+// Node states (spectrum, universe, contract states) are persisted as a base image (the full files) followed by a
+// chain of delta segments. Each delta segment contains the pages of one memory region that have been changed since
+// the previous save. When loading, the base image is loaded first and the segments are replayed in order.
+//
+// File layout of a delta segment: NodeStateDeltaHeader, page indices (unsigned int each), page data (pageSize bytes
+// per page). The checksum is the K12 of page indices and page data.
+struct NodeStateDeltaHeader
+{
+    unsigned long long regionSize;
+    unsigned int epoch;
+    unsigned int baseTick;          // tick of the base image that the segment belongs to
+    unsigned int tick;              // tick at which the changes have been captured
+    unsigned int deltaIndex;        // 1 for the first segment after the base image
+    unsigned int numberOfPages;
+    unsigned int _padding;
+    m256i checksum;
+};
+
+// Information about the delta segments saved with the node states, used to check which segments need to be replayed
+struct NodeStateDeltaChain
+{
+    unsigned int epoch;
+    unsigned int baseTick;
+    unsigned int numberOfDeltas;
+    unsigned int _padding;
+};
+
+static constexpr unsigned long long nodeStateDeltaPageSize = CopyOnWriteSnapshot<1>::pageSize;
+
+// Return size of delta segment file with given number of pages
+static constexpr unsigned long long nodeStateDeltaSize(unsigned long long numberOfPages)
+{
+    return sizeof(NodeStateDeltaHeader) + numberOfPages * (sizeof(unsigned int) + nodeStateDeltaPageSize);
+}
+
+// Get file name of delta segment with given index for the file name of the base image (for example "spectrum.000.d3")
+static void getNodeStateDeltaFileName(CHAR16* deltaFileName, const CHAR16* baseFileName, unsigned int deltaIndex)
+{
+    setText(deltaFileName, baseFileName);
+    appendText(deltaFileName, L".d");
+    appendNumber(deltaFileName, deltaIndex, FALSE);
+}
+
+// Capture the pages of the region that have been changed since the previous save (snapshot started with begin()
+// using captureChanged) and save them as delta segment. The buffer must fit nodeStateDeltaSize() of
+// getNumberOfCapturedPages() pages. Can be called by any processor (files are written through asyncSave() if available).
+// Returns false on error.
+template <unsigned int maxRegions>
+static bool saveNodeStateDelta(CopyOnWriteSnapshot<maxRegions>& snapshot, unsigned int regionIndex, unsigned char* buffer,
+    unsigned int epoch, unsigned int baseTick, unsigned int tick, unsigned int deltaIndex, const CHAR16* fileName, const CHAR16* directory)
+{
+    const unsigned long long numberOfPages = snapshot.getNumberOfCapturedPages(regionIndex);
+    NodeStateDeltaHeader* header = (NodeStateDeltaHeader*)buffer;
+    unsigned int* pageIndices = (unsigned int*)(buffer + sizeof(NodeStateDeltaHeader));
+    unsigned char* pageData = (unsigned char*)(pageIndices + numberOfPages);
+    snapshot.captureChangedPages(regionIndex, pageIndices, pageData);
+
+    const unsigned long long size = nodeStateDeltaSize(numberOfPages);
+    setMem(header, sizeof(NodeStateDeltaHeader), 0);
+    header->regionSize = snapshot.getRegionSize(regionIndex);
+    header->epoch = epoch;
+    header->baseTick = baseTick;
+    header->tick = tick;
+    header->deltaIndex = deltaIndex;
+    header->numberOfPages = (unsigned int)numberOfPages;
+    KangarooTwelve(pageIndices, (unsigned int)(size - sizeof(NodeStateDeltaHeader)), &header->checksum, sizeof(header->checksum));
+
+    const long long savedSize = (gAsyncFileIO) ? asyncSave(fileName, size, buffer, directory) : save(fileName, size, buffer, directory);
+    return savedSize == (long long)size;
+}
+
+// Load delta segment from file and apply it to the region. The segment must belong to the chain of the base image
+// with given epoch and tick and have the given index. The buffer is used for loading the file. Returns false if the
+// file is missing or invalid.
+static bool loadNodeStateDelta(unsigned char* regionData, unsigned long long regionSize, unsigned char* buffer, unsigned long long bufferSize,
+    unsigned int epoch, unsigned int baseTick, unsigned int deltaIndex, CHAR16* fileName, CHAR16* directory)
+{
+    const long long fileSize = getFileSize(fileName, directory);
+    const unsigned long long numberOfRegionPages = (regionSize + nodeStateDeltaPageSize - 1) / nodeStateDeltaPageSize;
+    if (fileSize < (long long)sizeof(NodeStateDeltaHeader) || (unsigned long long)fileSize > nodeStateDeltaSize(numberOfRegionPages)
+        || (unsigned long long)fileSize > bufferSize)
+    {
+        return false;
+    }
+    if (load(fileName, fileSize, buffer, directory) != fileSize)
+    {
+        return false;
+    }
+
+    const NodeStateDeltaHeader* header = (const NodeStateDeltaHeader*)buffer;
+    if (header->regionSize != regionSize || header->epoch != epoch || header->baseTick != baseTick
+        || header->deltaIndex != deltaIndex || nodeStateDeltaSize(header->numberOfPages) != (unsigned long long)fileSize)
+    {
+        return false;
+    }
+    const unsigned int* pageIndices = (const unsigned int*)(buffer + sizeof(NodeStateDeltaHeader));
+    const unsigned char* pageData = (const unsigned char*)(pageIndices + header->numberOfPages);
+    m256i checksum;
+    KangarooTwelve(pageIndices, (unsigned int)(fileSize - sizeof(NodeStateDeltaHeader)), &checksum, sizeof(checksum));
+    if (checksum != header->checksum)
+    {
+        return false;
+    }
+    for (unsigned int i = 0; i < header->numberOfPages; ++i)
+    {
+        if (pageIndices[i] >= numberOfRegionPages)
+        {
+            return false;
+        }
+    }
+
+    for (unsigned int i = 0; i < header->numberOfPages; ++i)
+    {
+        const unsigned long long offset = pageIndices[i] * nodeStateDeltaPageSize;
+        const unsigned long long bytes = (regionSize - offset < nodeStateDeltaPageSize) ? regionSize - offset : nodeStateDeltaPageSize;
+        copyMem(regionData + offset, pageData + i * nodeStateDeltaPageSize, bytes);
+    }
+    return true;
+}
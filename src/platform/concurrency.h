@@ -37,6 +37,20 @@ public:
 
 #endif
 
+#ifdef ENABLE_LOCK_PROFILING
+
+#include "lock_profiling.h"
+
+// Acquire lock, may block, records contention statistics in gLockProfiler (replaces logging of long waiting in debug
+// builds)
+#undef ACQUIRE
+#define ACQUIRE(lock) { \
+        static const LockSite __lockSite = { #lock, __FILE__, __LINE__ }; \
+        acquireWithLockProfiling(lock, &__lockSite); \
+    }
+
+#endif
+
 // Try to acquire lock and return if successful (without blocking)
 #define TRY_ACQUIRE(lock) (_InterlockedCompareExchange8(&lock, 1, 0) == 0)
 
@@ -0,0 +1,366 @@
+#pragma once
+
+#include "memory_util.h"
+#include "concurrency.h"
+#include "debugging.h"
+#include "file_io.h"
+
+// Consistent snapshot of memory regions that is saved to disk while the regions are modified (copy-on-write).
+// When capturing a region begins, all its pages are marked as pending. Before changing the region, writers call
+// beforeWrite(), which copies pending pages to a pool. The saver copies the pages to a buffer in order with
+// capture(), taking each page from the pool if a writer has copied it before or from the region otherwise. So
+// writers never wait for the disk. They only wait if the pool is exhausted, until the saver has copied the page.
+//
+// beforeWrite() also records which pages have been changed since the last capture of mode captureBase or
+// captureChanged. Capturing with captureChanged only marks these pages as pending, so they can be saved as a delta
+// to the previous capture with captureChangedPages().
+//
+// States of a page:
+// - clean:     not part of a running capture or already captured, may be changed
+// - pending:   not captured yet, the region contains the data of the snapshot
+// - copying:   being copied by a writer or the saver
+// - copied:    the pool contains the data of the snapshot, the region may have been changed
+template <unsigned int maxRegions>
+class CopyOnWriteSnapshot
+{
+public:
+    static constexpr unsigned long long pageSize = 4096;
+
+private:
+    enum PageState
+    {
+        pageClean = 0,
+        pagePending,
+        pageCopying,
+        pageCopied,
+    };
+
+    struct Region
+    {
+        unsigned char* data;
+        unsigned long long size;
+        unsigned long long numberOfPages;
+        volatile char* pageStates;
+        unsigned int* pagePoolSlots;
+        volatile long long* changedPageFlags;
+        unsigned long long numberOfCapturedPages;
+        volatile char capturing;
+    };
+
+    Region regions[maxRegions];
+
+    // Pool of pages copied by writers and stack of free slots in the pool
+    unsigned char* pool;
+    unsigned int* freePoolSlots;
+    unsigned int numberOfFreePoolSlots;
+    volatile char poolLock;
+
+    bool allocatePoolSlot(unsigned int& slot)
+    {
+        bool allocated = false;
+        ACQUIRE(poolLock);
+        if (numberOfFreePoolSlots)
+        {
+            slot = freePoolSlots[--numberOfFreePoolSlots];
+            allocated = true;
+        }
+        RELEASE(poolLock);
+        return allocated;
+    }
+
+    void freePoolSlot(unsigned int slot)
+    {
+        ACQUIRE(poolLock);
+        freePoolSlots[numberOfFreePoolSlots++] = slot;
+        RELEASE(poolLock);
+    }
+
+    static unsigned long long pageBytes(const Region& region, unsigned long long page)
+    {
+        const unsigned long long offset = page * pageSize;
+        return (region.size - offset < pageSize) ? region.size - offset : pageSize;
+    }
+
+    // Copy page of the snapshot to dest, taking it from the region or the pool
+    void capturePage(Region& region, unsigned long long page, unsigned char* dest)
+    {
+        const unsigned long long bytes = pageBytes(region, page);
+        while (true)
+        {
+            const char state = region.pageStates[page];
+            if (state == pagePending && _InterlockedCompareExchange8(&region.pageStates[page], pageCopying, pagePending) == pagePending)
+            {
+                copyMem(dest, region.data + page * pageSize, bytes);
+                ATOMIC_STORE8(region.pageStates[page], pageClean);
+                return;
+            }
+            if (state == pageCopied)
+            {
+                const unsigned int slot = region.pagePoolSlots[page];
+                copyMem(dest, pool + slot * pageSize, bytes);
+                ATOMIC_STORE8(region.pageStates[page], pageClean);
+                freePoolSlot(slot);
+                return;
+            }
+            ASSERT(state != pageClean);
+            _mm_pause();
+        }
+    }
+
+    // Make sure that the data of the snapshot is preserved before the page is changed
+    void preservePage(Region& region, unsigned long long page)
+    {
+        while (true)
+        {
+            const char state = region.pageStates[page];
+            if (state == pageClean || state == pageCopied)
+            {
+                return;
+            }
+            if (state == pagePending && _InterlockedCompareExchange8(&region.pageStates[page], pageCopying, pagePending) == pagePending)
+            {
+                unsigned int slot;
+                if (allocatePoolSlot(slot))
+                {
+                    copyMem(pool + slot * pageSize, region.data + page * pageSize, pageBytes(region, page));
+                    region.pagePoolSlots[page] = slot;
+                    ATOMIC_STORE8(region.pageStates[page], pageCopied);
+                    _InterlockedIncrement64(&numberOfCopiedPages);
+                    return;
+                }
+
+                // Pool is exhausted -> wait until the saver has captured the page
+                ATOMIC_STORE8(region.pageStates[page], pagePending);
+                _InterlockedIncrement64(&numberOfWaitsForSaver);
+                WAIT_WHILE(region.pageStates[page] != pageClean);
+                return;
+            }
+            _mm_pause();
+        }
+    }
+
+public:
+    enum CaptureMode
+    {
+        captureAll = 0,     // capture all pages, don't touch the record of changed pages
+        captureBase,        // capture all pages and start recording changed pages from here
+        captureChanged,     // capture pages changed since last captureBase or captureChanged
+    };
+
+    // Statistics since init()
+    volatile long long numberOfCopiedPages;
+    volatile long long numberOfWaitsForSaver;
+
+    // Allocate pool for copying the given number of pages and init without regions, return false if allocation failed
+    bool init(unsigned int poolPages)
+    {
+        setMem(regions, sizeof(regions), 0);
+        if (!allocPoolWithErrorLog(L"copyOnWritePool", poolPages * pageSize, (void**)&pool, __LINE__)
+            || !allocPoolWithErrorLog(L"copyOnWriteFreePoolSlots", poolPages * sizeof(unsigned int), (void**)&freePoolSlots, __LINE__))
+        {
+            return false;
+        }
+        for (unsigned int i = 0; i < poolPages; ++i)
+        {
+            freePoolSlots[i] = poolPages - 1 - i;
+        }
+        numberOfFreePoolSlots = poolPages;
+        poolLock = 0;
+        numberOfCopiedPages = 0;
+        numberOfWaitsForSaver = 0;
+        return true;
+    }
+
+    // Register memory that can be captured as region with given index, return false if allocation failed
+    bool initRegion(unsigned int regionIndex, void* data, unsigned long long size)
+    {
+        ASSERT(regionIndex < maxRegions);
+        Region& region = regions[regionIndex];
+        region.data = (unsigned char*)data;
+        region.size = size;
+        region.numberOfPages = (size + pageSize - 1) / pageSize;
+        region.capturing = 0;
+        if (!region.numberOfPages)
+        {
+            return true;
+        }
+        return allocPoolWithErrorLog(L"copyOnWritePageStates", region.numberOfPages, (void**)&region.pageStates, __LINE__)
+            && allocPoolWithErrorLog(L"copyOnWritePagePoolSlots", region.numberOfPages * sizeof(unsigned int), (void**)&region.pagePoolSlots, __LINE__)
+            && allocPoolWithErrorLog(L"copyOnWriteChangedPageFlags", (region.numberOfPages + 63) / 64 * 8, (void**)&region.changedPageFlags, __LINE__);
+    }
+
+    // Free memory
+    void deinit()
+    {
+        for (unsigned int i = 0; i < maxRegions; ++i)
+        {
+            if (regions[i].pageStates)
+            {
+                freePool((void*)regions[i].pageStates);
+                regions[i].pageStates = nullptr;
+            }
+            if (regions[i].pagePoolSlots)
+            {
+                freePool(regions[i].pagePoolSlots);
+                regions[i].pagePoolSlots = nullptr;
+            }
+            if (regions[i].changedPageFlags)
+            {
+                freePool((void*)regions[i].changedPageFlags);
+                regions[i].changedPageFlags = nullptr;
+            }
+        }
+        if (pool)
+        {
+            freePool(pool);
+            pool = nullptr;
+        }
+        if (freePoolSlots)
+        {
+            freePool(freePoolSlots);
+            freePoolSlots = nullptr;
+        }
+    }
+
+    // Take snapshot of the current content of the region (all pages or only the changed pages, see CaptureMode).
+    // Caller must make sure that the region isn't changed concurrently (by holding the lock that writers acquire)
+    // and that the region isn't being captured already.
+    void begin(unsigned int regionIndex, CaptureMode mode = captureAll)
+    {
+        Region& region = regions[regionIndex];
+        ASSERT(!region.capturing);
+        if (mode == captureChanged)
+        {
+            region.numberOfCapturedPages = 0;
+            for (unsigned long long page = 0; page < region.numberOfPages; ++page)
+            {
+                const bool changed = (region.changedPageFlags[page >> 6] >> (page & 63)) & 1;
+                region.pageStates[page] = (changed) ? pagePending : pageClean;
+                region.numberOfCapturedPages += changed;
+            }
+        }
+        else
+        {
+            setMem((void*)region.pageStates, region.numberOfPages, pagePending);
+            region.numberOfCapturedPages = region.numberOfPages;
+        }
+        if (mode != captureAll)
+        {
+            setMem((void*)region.changedPageFlags, (region.numberOfPages + 63) / 64 * 8, 0);
+        }
+        ATOMIC_STORE8(region.capturing, 1);
+    }
+
+    // Return number of pages changed since last capture with mode captureBase or captureChanged (only a hint if the
+    // region is changed concurrently)
+    unsigned long long getNumberOfChangedPages(unsigned int regionIndex) const
+    {
+        const Region& region = regions[regionIndex];
+        unsigned long long count = 0;
+        for (unsigned long long i = 0; i < (region.numberOfPages + 63) / 64; ++i)
+        {
+            count += _mm_popcnt_u64(region.changedPageFlags[i]);
+        }
+        return count;
+    }
+
+    // Return number of pages captured by the capture started with the last call of begin()
+    unsigned long long getNumberOfCapturedPages(unsigned int regionIndex) const
+    {
+        return regions[regionIndex].numberOfCapturedPages;
+    }
+
+    // Return size of region in bytes
+    unsigned long long getRegionSize(unsigned int regionIndex) const
+    {
+        return regions[regionIndex].size;
+    }
+
+    // Return if the snapshot of the region hasn't been captured completely yet
+    bool isCapturing(unsigned int regionIndex) const
+    {
+        return regions[regionIndex].capturing;
+    }
+
+    // Must be called before changing bytes [offset, offset + size) of the region (by any processor). Does nothing if
+    // the region has not been initialized with initRegion() (such as contract states in tests).
+    void beforeWrite(unsigned int regionIndex, unsigned long long offset, unsigned long long size)
+    {
+        Region& region = regions[regionIndex];
+        if (!size || !region.changedPageFlags)
+        {
+            return;
+        }
+        const unsigned long long firstPage = offset / pageSize;
+        const unsigned long long lastPage = (offset + size - 1) / pageSize;
+        for (unsigned long long page = firstPage; page <= lastPage; ++page)
+        {
+            if (!((region.changedPageFlags[page >> 6] >> (page & 63)) & 1))
+            {
+                _InterlockedOr64(&region.changedPageFlags[page >> 6], 1LL << (page & 63));
+            }
+        }
+        if (!region.capturing)
+        {
+            return;
+        }
+        for (unsigned long long page = firstPage; page <= lastPage; ++page)
+        {
+            if (region.pageStates[page] != pageClean)
+            {
+                preservePage(region, page);
+            }
+        }
+    }
+
+    // Copy the snapshot of the region taken by begin() with mode captureAll or captureBase to the buffer, which
+    // needs to be large enough to fit the whole region. Afterwards, writers don't need to copy pages anymore.
+    void capture(unsigned int regionIndex, unsigned char* buffer)
+    {
+        Region& region = regions[regionIndex];
+        ASSERT(region.capturing);
+        for (unsigned long long page = 0; page < region.numberOfPages; ++page)
+        {
+            capturePage(region, page, buffer + page * pageSize);
+        }
+        ATOMIC_STORE8(region.capturing, 0);
+    }
+
+    // Copy the pages captured by begin() with mode captureChanged in ascending order to pageData (pageSize bytes per
+    // page, the rest of the partial last page of the region is zeroed) and their indices to pageIndices. The buffers
+    // need to fit getNumberOfCapturedPages() pages. Works for the other modes too, but capture() is more efficient.
+    void captureChangedPages(unsigned int regionIndex, unsigned int* pageIndices, unsigned char* pageData)
+    {
+        Region& region = regions[regionIndex];
+        ASSERT(region.capturing);
+        unsigned long long capturedPages = 0;
+        for (unsigned long long page = 0; page < region.numberOfPages; ++page)
+        {
+            // pages that are clean at this point haven't been changed before begin()
+            if (region.pageStates[page] != pageClean)
+            {
+                unsigned char* dest = pageData + capturedPages * pageSize;
+                if (pageBytes(region, page) < pageSize)
+                {
+                    setMem(dest, pageSize, 0);
+                }
+                capturePage(region, page, dest);
+                pageIndices[capturedPages++] = (unsigned int)page;
+            }
+        }
+        ASSERT(capturedPages == region.numberOfCapturedPages);
+        ATOMIC_STORE8(region.capturing, 0);
+    }
+
+    // Capture the region to the buffer and save it to a file. Can be called by any processor, files are written by
+    // the main processor (see asyncSave()). Returns the number of bytes saved or a negative value on error.
+    long long captureAndSave(unsigned int regionIndex, unsigned char* buffer, const CHAR16* fileName, const CHAR16* directory = nullptr)
+    {
+        capture(regionIndex, buffer);
+        if (!gAsyncFileIO)
+        {
+            return save(fileName, regions[regionIndex].size, buffer, directory);
+        }
+        return asyncSave(fileName, regions[regionIndex].size, buffer, directory);
+    }
+};
@@ -935,6 +935,50 @@ public:
         return (long long)totalSize;
     }
 
+    // Function to schedule load without waiting for it. Returns the queue item that needs to be passed to
+    // finishLoad() after isLoadFinished() returned true, or NULL if the load cannot be scheduled. Make sure the buffer
+    // is untouched until the load is finished.
+    FileItem* asyncLoadNonBlocking(const CHAR16* fileName, unsigned long long totalSize, unsigned char* buffer, const CHAR16* directory = NULL)
+    {
+        // Stop already. Don't process further
+        if (mIsStop)
+        {
+            return NULL;
+        }
+
+        FileItem* pFileItem = mFileBlockingReadQueue.requestFreeSlot(totalSize);
+        if (pFileItem == NULL)
+        {
+            return NULL;
+        }
+
+        // Load operation will be execute later in main thread
+        pFileItem->set(fileName, totalSize, directory);
+        pFileItem->mpBuffer = buffer;
+        pFileItem->mState = FileItem::kBlockingWait;
+        return pFileItem;
+    }
+
+    // Check if load scheduled with asyncLoadNonBlocking() is finished. In case of main thread, read immediately.
+    bool isLoadFinished(FileItem* pFileItem)
+    {
+        if (!pFileItem->isProcessed() && !mIsStop && isMainThread())
+        {
+            mFileBlockingReadQueue.flushRead();
+        }
+        return pFileItem->isProcessed() || mIsStop;
+    }
+
+    // Free queue item of load scheduled with asyncLoadNonBlocking(). Returns loaded size or kStop if the load has
+    // been dropped.
+    long long finishLoad(FileItem* pFileItem)
+    {
+        const bool processed = pFileItem->isProcessed();
+        const unsigned long long totalSize = pFileItem->mSize;
+        pFileItem->mState = FileItem::kFree;
+        return processed ? (long long)totalSize : kStop;
+    }
+
     void flushRem()
     {
         ACQUIRE(mRemoveFilePathQueueLock);
@@ -1096,6 +1140,38 @@ static long long asyncLoad(const CHAR16* fileName, unsigned long long totalSize,
     return 0;
 }
 
+// Asynchorous load a file without waiting for it
+// This function can be called from any thread and returns NULL if the load cannot be scheduled
+// Poll isAsyncLoadFinished() and call finishAsyncLoad() afterwards. The actual load happens in flushAsyncFileIOBuffer
+static FileItem* asyncLoadNonBlocking(const CHAR16* fileName, unsigned long long totalSize, unsigned char* buffer, const CHAR16* directory = NULL)
+{
+    if (gAsyncFileIO)
+    {
+        return gAsyncFileIO->asyncLoadNonBlocking(fileName, totalSize, buffer, directory);
+    }
+    return NULL;
+}
+
+// Check if load scheduled with asyncLoadNonBlocking() is finished
+static bool isAsyncLoadFinished(FileItem* pFileItem)
+{
+    if (gAsyncFileIO)
+    {
+        return gAsyncFileIO->isLoadFinished(pFileItem);
+    }
+    return true;
+}
+
+// Free queue item of load scheduled with asyncLoadNonBlocking(), returns loaded size
+static long long finishAsyncLoad(FileItem* pFileItem)
+{
+    if (gAsyncFileIO)
+    {
+        return gAsyncFileIO->finishLoad(pFileItem);
+    }
+    return (long long)AsyncFileIO::kUnknown;
+}
+
 // Asynchorous remove a file
 // This function can be called from any thread and is a blocking function
 // To avoid lock and the actual remove happen, flushAsyncFileIOBuffer must be called in main thread
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <lib/platform_common/qintrin.h>
+
+#include "global_var.h"
+
+// Lock contention profiling, enabled by defining ENABLE_LOCK_PROFILING. Then ACQUIRE() collects per-lock statistics:
+// number of acquisitions, how often the lock was contended, histograms of spin iterations and waiting time (TSC ticks),
+// and the sites (ACQUIRE() calls in the code) that held the lock while others were waiting.
+//
+// Locks are identified by their address and named by the expression passed to ACQUIRE() at the first acquisition.
+// All data of a lock is written while holding the lock, so the statistics don't need atomic operations. Only the
+// registration of a new lock in the table is done with compare-and-swap. Readers may see slightly inconsistent data.
+
+// Site in the code acquiring a lock (ACQUIRE() creates one static instance per call)
+struct LockSite
+{
+    const char* expr;
+    const char* file;
+    unsigned int line;
+};
+
+struct LockProfilingData
+{
+    // Histograms have one bucket per power of 2: bucket 0 counts value 0, bucket i counts [2^(i-1), 2^i), the last
+    // bucket also counts all larger values
+    static constexpr unsigned int histogramSize = 40;
+    static constexpr unsigned int maxHolderSites = 8;
+
+    struct HolderSite
+    {
+        const LockSite* site;           // nullptr if unused
+        unsigned long long waitCount;   // number of times others started waiting while the lock was held by site
+        unsigned long long waitTscSum;  // sum of waiting time of the others
+    };
+
+    volatile char* lock;                // address of lock, nullptr if unused
+    const LockSite* firstSite;          // site of first acquisition, providing the name
+    const LockSite* volatile holder;    // site of last acquisition (holding the lock if locked)
+    unsigned long long acquireCount;
+    unsigned long long contendedCount;
+    unsigned long long spinSum;
+    unsigned long long waitTscSum;
+    unsigned long long waitTscMax;
+    unsigned long long otherHolderSitesWaitTscSum; // waiting time caused by sites not fitting into holderSites
+    unsigned long long spinHistogram[histogramSize];
+    unsigned long long waitTscHistogram[histogramSize];
+    HolderSite holderSites[maxHolderSites];
+
+    static unsigned int histogramBucket(unsigned long long value)
+    {
+        const unsigned int bucket = (unsigned int)(64 - __lzcnt64(value));
+        return (bucket < histogramSize) ? bucket : histogramSize - 1;
+    }
+
+    // Return upper bound of the value that numerator / denominator of the counts in histogram didn't exceed
+    static unsigned long long histogramQuantile(const unsigned long long* histogram, unsigned long long numerator, unsigned long long denominator)
+    {
+        unsigned long long total = 0;
+        for (unsigned int i = 0; i < histogramSize; ++i)
+            total += histogram[i];
+        if (!total)
+            return 0;
+        unsigned long long rank = (total * numerator + denominator - 1) / denominator;
+        if (rank == 0)
+            rank = 1;
+        unsigned long long count = 0;
+        for (unsigned int i = 0; i < histogramSize; ++i)
+        {
+            count += histogram[i];
+            if (count >= rank)
+                return (i == 0) ? 0 : (1ull << i) - 1;
+        }
+        return (1ull << (histogramSize - 1)) - 1;
+    }
+
+    // Record waiting for the lock, called after acquiring it
+    void addContention(unsigned long long spins, unsigned long long waitTsc, const LockSite* previousHolder)
+    {
+        ++contendedCount;
+        spinSum += spins;
+        waitTscSum += waitTsc;
+        if (waitTscMax < waitTsc)
+            waitTscMax = waitTsc;
+        ++spinHistogram[histogramBucket(spins)];
+        ++waitTscHistogram[histogramBucket(waitTsc)];
+
+        for (unsigned int i = 0; i < maxHolderSites; ++i)
+        {
+            HolderSite& holderSite = holderSites[i];
+            if (holderSite.site == previousHolder || !holderSite.site)
+            {
+                holderSite.site = previousHolder;
+                ++holderSite.waitCount;
+                holderSite.waitTscSum += waitTsc;
+                return;
+            }
+        }
+        otherHolderSitesWaitTscSum += waitTsc;
+    }
+};
+
+class LockProfiler
+{
+public:
+    // Well above the number of lock addresses in the node (including lock arrays such as ticksLocks and the shards of
+    // ScoreCache), so the table doesn't fill up
+    static constexpr unsigned int capacityBits = 12;
+    static constexpr unsigned int capacity = 1 << capacityBits;
+
+    // Maximum number of entries checked per lookup, which bounds the overhead of ACQUIRE() even if the table is full
+    static constexpr unsigned int maxProbes = 16;
+
+    // Index of the first entry checked for the lock
+    static unsigned int homeIndex(volatile char* lock)
+    {
+        return (unsigned int)(((unsigned long long)lock * 0x9E3779B97F4A7C15ull) >> (64 - capacityBits));
+    }
+
+    // Return data of lock, registering it on first call. Returns nullptr if the maxProbes entries starting at
+    // homeIndex(lock) are used by other locks.
+    LockProfilingData* getData(volatile char* lock, const LockSite* site)
+    {
+        unsigned int i = homeIndex(lock);
+        for (unsigned int probes = 0; probes < maxProbes; ++probes, i = (i + 1) & (capacity - 1))
+        {
+            LockProfilingData& data = mData[i];
+            volatile char* key = data.lock;
+            if (key == lock)
+                return &data;
+            if (!key)
+            {
+                key = (volatile char*)_InterlockedCompareExchange64((volatile long long*)&data.lock, (long long)lock, 0);
+                if (!key)
+                {
+                    data.firstSite = site;
+                    return &data;
+                }
+                if (key == lock)
+                    return &data;
+            }
+        }
+        _InterlockedIncrement64(&mDroppedAcquisitions);
+        return nullptr;
+    }
+
+    // Return entry of index < capacity, lock is nullptr if unused. Data may change concurrently.
+    const LockProfilingData& getEntry(unsigned int index) const
+    {
+        return mData[index];
+    }
+
+    // Number of acquisitions not recorded because no entry was found within maxProbes
+    unsigned long long getDroppedAcquisitions() const
+    {
+        return mDroppedAcquisitions;
+    }
+
+protected:
+    LockProfilingData mData[capacity];
+    volatile long long mDroppedAcquisitions;
+};
+
+// Global lock profiler used by ACQUIRE() if ENABLE_LOCK_PROFILING is defined
+GLOBAL_VAR_DECL LockProfiler gLockProfiler;
+
+// Acquire lock and record statistics (used by ACQUIRE() if ENABLE_LOCK_PROFILING is defined)
+static inline void acquireWithLockProfiling(volatile char& lock, const LockSite* site)
+{
+    if (_InterlockedCompareExchange8(&lock, 1, 0))
+    {
+        LockProfilingData* data = gLockProfiler.getData(&lock, site);
+        const LockSite* previousHolder = (data) ? data->holder : nullptr;
+        const unsigned long long startTsc = __rdtsc();
+        unsigned long long spins = 0;
+        while (_InterlockedCompareExchange8(&lock, 1, 0))
+        {
+            ++spins;
+            _mm_pause();
+        }
+        if (data)
+        {
+            data->addContention(spins, __rdtsc() - startTsc, previousHolder);
+            ++data->acquireCount;
+            data->holder = site;
+        }
+    }
+    else
+    {
+        LockProfilingData* data = gLockProfiler.getData(&lock, site);
+        if (data)
+        {
+            ++data->acquireCount;
+            data->holder = site;
+        }
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "concurrency.h"
+#include "debugging.h"
+
+// Function processing the work items [beginIndex, endIndex) with the given context
+typedef void (*ParallelWorkFunction)(void* context, unsigned long long beginIndex, unsigned long long endIndex);
+
+// Work that is split into chunks of items, which are processed in parallel by the thread that runs the work with
+// runParallelWork() and by idle processors that call helpWithParallelWork() regularly (request processors do this
+// in their main loop).
+struct ParallelWork
+{
+    ParallelWorkFunction function;
+    void* context;
+    unsigned long long numberOfItems;
+    unsigned long long chunkSize;
+    volatile long long nextItem;
+    volatile long long numberOfFinishedItems;
+
+    // Process chunks until all chunks have been claimed
+    void processChunks()
+    {
+        while (true)
+        {
+            const unsigned long long beginIndex = _InterlockedExchangeAdd64(&nextItem, chunkSize);
+            if (beginIndex >= numberOfItems)
+                break;
+            const unsigned long long endIndex = (beginIndex + chunkSize < numberOfItems) ? beginIndex + chunkSize : numberOfItems;
+            function(context, beginIndex, endIndex);
+            _InterlockedExchangeAdd64(&numberOfFinishedItems, endIndex - beginIndex);
+        }
+    }
+};
+
+// Work that idle processors may help with (nullptr if there is none)
+static ParallelWork* volatile currentParallelWork = nullptr;
+
+// Number of helpers that may currently access currentParallelWork
+static volatile long numberOfParallelWorkHelpers = 0;
+
+// Only one thread may run parallel work at a time
+static volatile char parallelWorkLock = 0;
+
+// Process items [0, numberOfItems) with function, using idle processors for help. Returns after all items have been
+// processed. If no other processor helps, all items are processed by the calling thread.
+static void runParallelWork(ParallelWorkFunction function, void* context, unsigned long long numberOfItems, unsigned long long chunkSize)
+{
+    ASSERT(chunkSize > 0);
+
+    ParallelWork work;
+    work.function = function;
+    work.context = context;
+    work.numberOfItems = numberOfItems;
+    work.chunkSize = chunkSize;
+    work.nextItem = 0;
+    work.numberOfFinishedItems = 0;
+
+    ACQUIRE(parallelWorkLock);
+
+    currentParallelWork = &work;
+    work.processChunks();
+
+    // Wait until the chunks claimed by helpers are finished
+    WAIT_WHILE(work.numberOfFinishedItems < (long long)numberOfItems);
+
+    // Wait until no helper accesses the work anymore, because it is invalid after returning. The interlocked exchange
+    // is a full barrier, so the store cannot be reordered after reading numberOfParallelWorkHelpers (a helper that is
+    // not counted yet is then guaranteed to read nullptr after incrementing the counter).
+    _InterlockedExchangePointer((void* volatile*)&currentParallelWork, nullptr);
+    WAIT_WHILE(numberOfParallelWorkHelpers);
+
+    RELEASE(parallelWorkLock);
+}
+
+// Help processing the current parallel work if there is any. Called regularly by idle processors.
+static void helpWithParallelWork()
+{
+    if (currentParallelWork)
+    {
+        _InterlockedIncrement(&numberOfParallelWorkHelpers);
+        ParallelWork* work = currentParallelWork;
+        if (work)
+            work->processChunks();
+        _InterlockedDecrement(&numberOfParallelWorkHelpers);
+    }
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <lib/platform_common/processor.h>
+
 #include "global_var.h"
 #include "assert.h"
 #include "memory_util.h"
@@ -8,15 +10,41 @@
 
 struct ProfilingData
 {
+    // Log-linear histogram of run-time in TSC ticks: 4 buckets per power of 2 (exact below 8 ticks, relative
+    // resolution of 25% above). The last bucket also counts all run-times above 2^41 ticks.
+    static constexpr unsigned int histogramSize = 160;
+
     const char* name;
     unsigned long long line;
     unsigned long long numOfExec;
     unsigned long long runtimeSum;
     unsigned long long runtimeMax;
     unsigned long long runtimeMin;
+    unsigned long long histogram[histogramSize];
+
+    // Return histogram bucket of run-time
+    static unsigned int histogramBucket(unsigned long long ticks)
+    {
+        if (ticks < 4)
+            return (unsigned int)ticks;
+        const unsigned int msb = 63 - (unsigned int)__lzcnt64(ticks);
+        const unsigned int bucket = (msb - 1) * 4 + (unsigned int)((ticks >> (msb - 2)) & 3);
+        return (bucket < histogramSize) ? bucket : histogramSize - 1;
+    }
+
+    // Return highest run-time counted in histogram bucket (excluding the overflow of the last bucket)
+    static unsigned long long histogramBucketMax(unsigned int bucket)
+    {
+        if (bucket < 4)
+            return bucket;
+        const unsigned int msb = bucket / 4 + 1;
+        const unsigned long long lowest = (4ull + (bucket & 3)) << (msb - 2);
+        return lowest + (1ull << (msb - 2)) - 1;
+    }
 };
 
-class ProfilingDataCollector
+// Hash map of ProfilingData, used by ProfilingDataCollector
+class ProfilingDataTable
 {
 public:
     // Init buffer (optional). This reduces the number of allocations.
@@ -52,24 +80,17 @@ public:
         RELEASE(mLock);
     }
 
-    // Add run-time measurement to profiling entry of given key (= name + line).
+    // Add run-time measurement dt (in TSC ticks) to profiling entry of given key (= name + line).
     // For fast access, the address of the name is used to identify the measurement. Using string literals here is recommended.
     // Using a pointer to a dynamic buffer probably cuases problems.
-    // The time stamp counter values startTsc and endTsc should be measured on the same processor, because TSC of
-    // different processors may be not synchronized.
-    void addMeasurement(const char* name, unsigned long long line, unsigned long long startTsc, unsigned long long endTsc)
+    void addMeasurement(const char* name, unsigned long long line, unsigned long long dt)
     {
-        // Discard measurement on overflow of time stamp counter register
-        if (endTsc < startTsc)
-            return;
-
         ACQUIRE_WITHOUT_DEBUG_LOGGING(mLock);
 
         // Make sure hash map is initialized
         if (mDataPtr || doInit())
         {
             // Fill entry
-            const unsigned long long dt = endTsc - startTsc;
             ProfilingData& newEntry = getEntry(name, line);
             newEntry.numOfExec += 1;
             newEntry.runtimeSum += dt;
@@ -77,105 +98,41 @@ public:
                 newEntry.runtimeMin = dt;
             if (newEntry.runtimeMax < dt)
                 newEntry.runtimeMax = dt;
+            newEntry.histogram[ProfilingData::histogramBucket(dt)] += 1;
         }
 
         RELEASE(mLock);
     }
-    
-    // Write CSV file with ProfilingData and hash function values (to check distribution)
-    bool writeToFile()
-    {
-        ASSERT(isMainProcessor());
-
-        // Init time stamp counter frequency if needed
-        if (!frequency)
-        {
-            initTimeStampCounter();
-#ifdef NO_UEFI
-            const unsigned long long secondsOverflow = 0xffffffffffffffffllu / frequency;
-            std::cout << "runtimeSum overflow after " << secondsOverflow << " sconds = " << secondsOverflow / 3600 << " hours" << std::endl;
-#endif
-        }
-        ASSERT(frequency);
-
-        // TODO: define file object in platform lib, including writeStringToFile()
-#ifdef NO_UEFI
-        FILE* file = fopen("profiling.csv", "wb");
-        if (!file)
-            return false;
-#else
-        ASSERT(root);
-        EFI_STATUS status;
-        EFI_FILE_PROTOCOL* file;
-        if (status = root->Open(root, (void**)&file, (CHAR16*)L"profiling.csv", EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, 0))
-        {
-            logStatusToConsole(L"EFI_FILE_PROTOCOL::Open() failed in ProfilingDataCollector::writeToFile()", status, __LINE__);
-            return false;
-        }
-#endif
 
+    // Add all entries of this table to target table
+    bool mergeInto(ProfilingDataTable& target)
+    {
+        bool okay = true;
         ACQUIRE_WITHOUT_DEBUG_LOGGING(mLock);
-
-        // output hash for each entry?
-        bool okay = writeStringToFile(file, L"idx,name,line,count,sum_microseconds,avg_microseconds,min_microseconds,max_microseconds\r\n");
         for (unsigned int i = 0; i < mDataSize; ++i)
         {
             if (mDataPtr[i].name)
-            {
-                unsigned long long runtimeSumMicroseconds = ticksToMicroseconds(mDataPtr[i].runtimeSum);
-                setNumber(message, i, false);
-                appendText(message, ",\"");
-                appendText(message, mDataPtr[i].name);
-                appendText(message, "\",");
-                appendNumber(message, mDataPtr[i].line, false);
-                appendText(message, ",");
-                appendNumber(message, mDataPtr[i].numOfExec, false);
-                appendText(message, ",");
-                appendNumber(message, runtimeSumMicroseconds, false);
-                appendText(message, ",");
-                appendNumber(message, (mDataPtr[i].numOfExec > 0) ? runtimeSumMicroseconds / mDataPtr[i].numOfExec : 0, false);
-                appendText(message, ",");
-                appendNumber(message, ticksToMicroseconds(mDataPtr[i].runtimeMin), false);
-                appendText(message, ",");
-                appendNumber(message, ticksToMicroseconds(mDataPtr[i].runtimeMax), false);
-                appendText(message, "\r\n");
-                okay &= writeStringToFile(file, message);
-            }
+                okay &= target.addData(mDataPtr[i]);
         }
-
         RELEASE(mLock);
+        return okay;
+    }
 
-#ifdef NO_UEFI
-        fclose(file);
-#else
-        file->Close(file);
-#endif
+    // Direct access to hash map of getSize() elements, where entries with name == nullptr are unused. The caller
+    // has to make sure that the table isn't changed concurrently.
+    const ProfilingData* getData() const
+    {
+        return mDataPtr;
+    }
 
-        return okay;
+    unsigned int getSize() const
+    {
+        return mDataSize;
     }
 
-    static unsigned long long ticksToMicroseconds(unsigned long long ticks)
+    unsigned int getUsedEntryCount() const
     {
-        ASSERT(frequency);
-        if (ticks <= (0xffffffffffffffffllu / 1000000llu))
-        {
-            return (ticks * 1000000llu) / frequency;
-        }
-        else
-        {
-            // prevent overflow of ticks * 1000000llu
-            unsigned long long seconds = ticks / frequency;
-            if (seconds <= (0xffffffffffffffffllu / 1000000llu))
-            {
-                // tolerate inaccuracy
-                return seconds * 1000000llu;
-            }
-            else
-            {
-                // number of microseconds does not fit in type -> max value
-                return 0xffffffffffffffffllu;
-            }
-        }
+        return mDataUsedEntryCount;
     }
 
 protected:
@@ -187,6 +144,29 @@ protected:
     // Lock preventing concurrent access (acquired and released in public functions)
     volatile char mLock = 0;
 
+    // Add counts of data to the entry with the same key
+    bool addData(const ProfilingData& data)
+    {
+        ACQUIRE_WITHOUT_DEBUG_LOGGING(mLock);
+        const bool okay = (mDataPtr || doInit());
+        if (okay)
+            addDataToEntry(getEntry(data.name, data.line), data);
+        RELEASE(mLock);
+        return okay;
+    }
+
+    static void addDataToEntry(ProfilingData& entry, const ProfilingData& data)
+    {
+        entry.numOfExec += data.numOfExec;
+        entry.runtimeSum += data.runtimeSum;
+        if (entry.runtimeMin > data.runtimeMin)
+            entry.runtimeMin = data.runtimeMin;
+        if (entry.runtimeMax < data.runtimeMax)
+            entry.runtimeMax = data.runtimeMax;
+        for (unsigned int i = 0; i < ProfilingData::histogramSize; ++i)
+            entry.histogram[i] += data.histogram[i];
+    }
+
     // Init buffer. Assumes caller has acquired mLock.
     bool doInit(unsigned int expectedProfilingDataItems = 8)
     {
@@ -220,10 +200,7 @@ protected:
                 {
                     const ProfilingData& oldEntry = oldDataPtr[i];
                     ProfilingData& newEntry = getEntry(oldEntry.name, oldEntry.line);
-                    newEntry.numOfExec = oldEntry.numOfExec;
-                    newEntry.runtimeSum = oldEntry.runtimeSum;
-                    newEntry.runtimeMin = oldEntry.runtimeMin;
-                    newEntry.runtimeMax = oldEntry.runtimeMax;
+                    addDataToEntry(newEntry, oldEntry);
                 }
             }
             ASSERT(mDataUsedEntryCount == oldDataUsedEntryCount);
@@ -284,6 +261,207 @@ protected:
     {
         return (((unsigned long long)name) ^ line);
     }
+};
+
+// Collects profiling data in one table per processor, so measurements of different processors don't contend for a
+// lock. The lock of each table is only contended while the tables are merged for reading with acquireMergedData().
+class ProfilingDataCollector
+{
+public:
+    static constexpr unsigned int numberOfTables = 32; // One per processor (MAX_NUMBER_OF_PROCESSORS)
+
+    // Init buffers (optional). This reduces the number of allocations. Should be called before starting other
+    // processors, because growing the tables later requires memory allocation on the measuring processor.
+    bool init(unsigned int expectedProfilingDataItems = 8)
+    {
+        bool okay = true;
+        for (unsigned int i = 0; i < numberOfTables; ++i)
+            okay &= mTables[i].init(expectedProfilingDataItems);
+        ACQUIRE_WITHOUT_DEBUG_LOGGING(mMergedLock);
+        okay &= mMerged.init(expectedProfilingDataItems);
+        RELEASE(mMergedLock);
+        return okay;
+    }
+
+    // Clear buffers, discarding all measurements
+    void clear()
+    {
+        for (unsigned int i = 0; i < numberOfTables; ++i)
+            mTables[i].clear();
+    }
+
+    // Free buffers
+    void deinit()
+    {
+        for (unsigned int i = 0; i < numberOfTables; ++i)
+            mTables[i].deinit();
+        ACQUIRE_WITHOUT_DEBUG_LOGGING(mMergedLock);
+        mMerged.deinit();
+        RELEASE(mMergedLock);
+    }
+
+    // Add run-time measurement to profiling entry of given key (= name + line) in the table of the running processor.
+    // For fast access, the address of the name is used to identify the measurement. Using string literals here is recommended.
+    // Using a pointer to a dynamic buffer probably cuases problems.
+    // The time stamp counter values startTsc and endTsc should be measured on the same processor, because TSC of
+    // different processors may be not synchronized.
+    void addMeasurement(const char* name, unsigned long long line, unsigned long long startTsc, unsigned long long endTsc)
+    {
+        // Discard measurement on overflow of time stamp counter register
+        if (endTsc < startTsc)
+            return;
+
+        mTables[getRunningProcessorID() % numberOfTables].addMeasurement(name, line, endTsc - startTsc);
+    }
+
+    // Merge the tables of all processors and return the result. The caller must call releaseMergedData() when done.
+    const ProfilingDataTable& acquireMergedData()
+    {
+        ACQUIRE_WITHOUT_DEBUG_LOGGING(mMergedLock);
+        mMerged.clear();
+        for (unsigned int i = 0; i < numberOfTables; ++i)
+            mTables[i].mergeInto(mMerged);
+        return mMerged;
+    }
+
+    void releaseMergedData()
+    {
+        RELEASE(mMergedLock);
+    }
+    
+    // Write CSV file with merged ProfilingData
+    bool writeToFile()
+    {
+        ASSERT(isMainProcessor());
+
+        // Init time stamp counter frequency if needed
+        if (!frequency)
+        {
+            initTimeStampCounter();
+#ifdef NO_UEFI
+            const unsigned long long secondsOverflow = 0xffffffffffffffffllu / frequency;
+            std::cout << "runtimeSum overflow after " << secondsOverflow << " sconds = " << secondsOverflow / 3600 << " hours" << std::endl;
+#endif
+        }
+        ASSERT(frequency);
+
+        // TODO: define file object in platform lib, including writeStringToFile()
+#ifdef NO_UEFI
+        FILE* file = fopen("profiling.csv", "wb");
+        if (!file)
+            return false;
+#else
+        ASSERT(root);
+        EFI_STATUS status;
+        EFI_FILE_PROTOCOL* file;
+        if (status = root->Open(root, (void**)&file, (CHAR16*)L"profiling.csv", EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, 0))
+        {
+            logStatusToConsole(L"EFI_FILE_PROTOCOL::Open() failed in ProfilingDataCollector::writeToFile()", status, __LINE__);
+            return false;
+        }
+#endif
+
+        const ProfilingDataTable& merged = acquireMergedData();
+        const ProfilingData* dataPtr = merged.getData();
+
+        // output hash for each entry?
+        bool okay = writeStringToFile(file, L"idx,name,line,count,sum_microseconds,avg_microseconds,min_microseconds,max_microseconds,p50_microseconds,p99_microseconds,p999_microseconds\r\n");
+        for (unsigned int i = 0; i < merged.getSize(); ++i)
+        {
+            if (dataPtr[i].name)
+            {
+                unsigned long long runtimeSumMicroseconds = ticksToMicroseconds(dataPtr[i].runtimeSum);
+                setNumber(message, i, false);
+                appendText(message, ",\"");
+                appendText(message, dataPtr[i].name);
+                appendText(message, "\",");
+                appendNumber(message, dataPtr[i].line, false);
+                appendText(message, ",");
+                appendNumber(message, dataPtr[i].numOfExec, false);
+                appendText(message, ",");
+                appendNumber(message, runtimeSumMicroseconds, false);
+                appendText(message, ",");
+                appendNumber(message, (dataPtr[i].numOfExec > 0) ? runtimeSumMicroseconds / dataPtr[i].numOfExec : 0, false);
+                appendText(message, ",");
+                appendNumber(message, ticksToMicroseconds(dataPtr[i].runtimeMin), false);
+                appendText(message, ",");
+                appendNumber(message, ticksToMicroseconds(dataPtr[i].runtimeMax), false);
+                appendText(message, ",");
+                appendNumber(message, ticksToMicroseconds(runtimeQuantile(dataPtr[i], 50, 100)), false);
+                appendText(message, ",");
+                appendNumber(message, ticksToMicroseconds(runtimeQuantile(dataPtr[i], 99, 100)), false);
+                appendText(message, ",");
+                appendNumber(message, ticksToMicroseconds(runtimeQuantile(dataPtr[i], 999, 1000)), false);
+                appendText(message, "\r\n");
+                okay &= writeStringToFile(file, message);
+            }
+        }
+
+        releaseMergedData();
+
+#ifdef NO_UEFI
+        fclose(file);
+#else
+        file->Close(file);
+#endif
+
+        return okay;
+    }
+
+    // Return upper bound of the run-time (in TSC ticks) that numerator / denominator of the measurements didn't
+    // exceed, estimated from the histogram (accurate up to the bucket resolution)
+    static unsigned long long runtimeQuantile(const ProfilingData& data, unsigned long long numerator, unsigned long long denominator)
+    {
+        if (!data.numOfExec)
+            return 0;
+        unsigned long long rank = (data.numOfExec * numerator + denominator - 1) / denominator;
+        if (rank == 0)
+            rank = 1;
+        unsigned long long count = 0;
+        for (unsigned int i = 0; i < ProfilingData::histogramSize; ++i)
+        {
+            count += data.histogram[i];
+            if (count >= rank)
+            {
+                const unsigned long long bucketMax = ProfilingData::histogramBucketMax(i);
+                if (bucketMax < data.runtimeMin)
+                    return data.runtimeMin;
+                return (bucketMax < data.runtimeMax && i < ProfilingData::histogramSize - 1) ? bucketMax : data.runtimeMax;
+            }
+        }
+        return data.runtimeMax;
+    }
+
+    static unsigned long long ticksToMicroseconds(unsigned long long ticks)
+    {
+        ASSERT(frequency);
+        if (ticks <= (0xffffffffffffffffllu / 1000000llu))
+        {
+            return (ticks * 1000000llu) / frequency;
+        }
+        else
+        {
+            // prevent overflow of ticks * 1000000llu
+            unsigned long long seconds = ticks / frequency;
+            if (seconds <= (0xffffffffffffffffllu / 1000000llu))
+            {
+                // tolerate inaccuracy
+                return seconds * 1000000llu;
+            }
+            else
+            {
+                // number of microseconds does not fit in type -> max value
+                return 0xffffffffffffffffllu;
+            }
+        }
+    }
+
+protected:
+    ProfilingDataTable mTables[numberOfTables];
+
+    // Result of merging the tables, protected by mMergedLock until releaseMergedData()
+    ProfilingDataTable mMerged;
+    volatile char mMergedLock = 0;
 
 #ifdef NO_UEFI
     static bool writeStringToFile(FILE* file, const CHAR16* str)
@@ -29,22 +29,41 @@ inline constexpr const T& min(const T& left, const T& right)
 // pageCapacity is number of items (T) inside a page
 // it stores (numCachePage) pages on RAM for faster loading (the strategy mimics CPU cache lines)
 // this class can be used to debug illegal memory access issue
+//
+// concurrency: appends are serialized by appendLock, readers don't take it. Items below size() never change until
+// their page is rolled over, so readers copy from the current page directly and detect a concurrent rollover with the
+// seqlock counter currentPageVersion. Older pages are read from cache slots, which are pinned lock-free by readers.
+// cacheLock is only held for selecting a slot to (re)fill with CLOCK, never during disk IO. On sequential access, the
+// next page is read ahead asynchronously into a cache slot.
 template <typename T, unsigned long long prefixName, unsigned long long pageDirectory, unsigned long long pageCapacity = 100000, unsigned long long numCachePage = 128>
 class VirtualMemory
 {
     const unsigned long long pageSize = sizeof(T) * pageCapacity;
+    static constexpr unsigned long long NO_PAGE = 0xffffffffffffffffULL;
 private:
     // on RAM
     T* currentPage = NULL; // current page is cache[0]
     T* cache[numCachePage + 1];
     CHAR16* pageDir = NULL;
 
-    unsigned long long cachePageId[numCachePage + 1];
-    unsigned long long lastAccessedTimestamp[numCachePage + 1]; // in millisecond
-    unsigned long long currentId; // total items in this array, aka: latest item index + 1
-    unsigned long long currentPageId; // current page index that's written on
+    // state of cache slots 1 ... numCachePage (index 0 is unused)
+    volatile unsigned long long cachePageId[numCachePage + 1]; // NO_PAGE if slot is empty
+    volatile long cachePinCount[numCachePage + 1]; // number of readers using the slot, -1 while the slot is (re)filled
+    volatile char cacheReferenced[numCachePage + 1]; // reference bit of CLOCK eviction
+    unsigned long long clockHand; // protected by cacheLock
 
-    volatile char memLock; // every read/write needs a memory lock, can optimize later
+    // page read ahead asynchronously, protected by prefetchLock
+    FileItem* prefetchItem;
+    volatile int prefetchSlot; // -1 if there is no read ahead in flight
+    volatile unsigned long long lastAccessedPageId; // for detecting sequential access
+
+    volatile unsigned long long currentId; // total items in this array, aka: latest item index + 1, set after items are copied
+    volatile unsigned long long currentPageId; // current page index that's written on
+    volatile long long currentPageVersion; // odd while current page is rolled over
+
+    volatile char appendLock; // serializes writers (append, state load/dump)
+    volatile char cacheLock; // serializes selection of cache slots to fill
+    volatile char prefetchLock;
 
     void generatePageName(CHAR16 pageName[64], unsigned long long page_id)
     {
@@ -93,31 +112,125 @@ private:
 #endif
     }
 
-    // return the most outdated cache page
-    int getMostOutdatedCachePage()
+    // return cache slot holding the page or -1 (slot may be filling)
+    int findCachePage(unsigned long long requested_page_id)
     {
-        // i = 1 because 0 is used for current page
-        int min_index = 1;
         for (int i = 1; i <= numCachePage; i++)
         {
-            if (lastAccessedTimestamp[i] == 0)
+            if (cachePageId[i] == requested_page_id)
             {
                 return i;
             }
-            if ((lastAccessedTimestamp[i] < lastAccessedTimestamp[min_index]) || (lastAccessedTimestamp[i] == lastAccessedTimestamp[min_index] && cachePageId[i] < cachePageId[min_index]))
+        }
+        return -1;
+    }
+
+    // select cache slot to refill with CLOCK and lock it exclusively (pin count -1), return -1 if all slots are in use
+    // only call with cacheLock acquired
+    int lockCacheSlotForRefill()
+    {
+        for (unsigned long long i = 0; i < 2 * numCachePage; i++)
+        {
+            clockHand = clockHand % numCachePage + 1;
+            const int slot = (int)clockHand;
+            if (cachePinCount[slot] != 0)
+            {
+                continue;
+            }
+            if (cacheReferenced[slot])
+            {
+                // second chance
+                cacheReferenced[slot] = 0;
+                continue;
+            }
+            if (_InterlockedCompareExchange(&cachePinCount[slot], -1, 0) == 0)
+            {
+                return slot;
+            }
+        }
+        return -1;
+    }
+
+    // unlock slot locked by lockCacheSlotForRefill() and set pin count (0 or 1 if the caller keeps using the slot)
+    void unlockCacheSlot(int slot, bool loaded, long pinCount)
+    {
+        if (!loaded)
+        {
+            cachePageId[slot] = NO_PAGE;
+            pinCount = 0;
+        }
+        _InterlockedExchange(&cachePinCount[slot], pinCount);
+    }
+
+    void unpinCacheSlot(int slot)
+    {
+        ASSERT(cachePinCount[slot] > 0);
+        _InterlockedDecrement(&cachePinCount[slot]);
+    }
+
+    // pin cache slot holding the page and return it, or return -1 if page isn't in cache
+    // waits if the page is being loaded by another thread
+    int pinCachePage(unsigned long long pageId)
+    {
+        int slot = findCachePage(pageId);
+        while (slot != -1)
+        {
+            const long pinCount = cachePinCount[slot];
+            if (pinCount < 0)
+            {
+                // filling, the slot may also be refilled with another page after this
+                finishPrefetch();
+                _mm_pause();
+            }
+            else if (_InterlockedCompareExchange(&cachePinCount[slot], pinCount + 1, pinCount) == pinCount)
             {
-                min_index = i;
+                if (cachePageId[slot] == pageId)
+                {
+                    // avoid writing the shared cache line on every hit
+                    if (!cacheReferenced[slot])
+                    {
+                        cacheReferenced[slot] = 1;
+                    }
+                    return slot;
+                }
+                unpinCacheSlot(slot);
+            }
+            if (cachePageId[slot] != pageId)
+            {
+                slot = findCachePage(pageId);
             }
         }
-        return min_index;
+        return -1;
+    }
+
+    // lock a free or evictable cache slot for loading the page, return -1 if page is already in cache or being loaded
+    int lockCacheSlotForPage(unsigned long long pageId)
+    {
+        int slot = -1;
+        ACQUIRE(cacheLock);
+        if (findCachePage(pageId) == -1)
+        {
+            slot = lockCacheSlotForRefill();
+            if (slot != -1)
+            {
+                cachePageId[slot] = pageId;
+            }
+        }
+        RELEASE(cacheLock);
+        return slot;
     }
 
     void copyCurrentPageToCache()
     {
-        int cache_slot_idx = getMostOutdatedCachePage();
+        // skip if all slots are in use instead of waiting for readers, the page is on disk anyway
+        int cache_slot_idx = lockCacheSlotForPage(currentPageId);
+        if (cache_slot_idx == -1)
+        {
+            return;
+        }
         copyMem(cache[cache_slot_idx], currentPage, pageSize);
-        lastAccessedTimestamp[cache_slot_idx] = now_ms();
-        cachePageId[cache_slot_idx] = currentPageId;
+        cacheReferenced[cache_slot_idx] = 1;
+        unlockCacheSlot(cache_slot_idx, true, 0);
 #ifndef NDEBUG
         {
             CHAR16 debugMsg[128];
@@ -141,41 +254,13 @@ private:
         setMem(currentPage, pageSize, 0);
     }
 
-    // return cache id given cache_page_id
-    int findCachePage(unsigned long long requested_page_id)
+    // load a page from disk into locked cache slot, return true on success
+    bool loadPageFromDisk(unsigned long long pageId, int cache_page_id)
     {
-        // TODO: consider implementing a tree here for faster search
-        for (int i = 0; i <= numCachePage; i++)
-        {
-            if (cachePageId[i] == requested_page_id)
-            {
-#ifdef NO_UEFI
-#else
-                lastAccessedTimestamp[i] = now_ms();
-#endif
-                return i;
-            }
-        }
-        return -1;
-    }
-
-    // load a page from disk to cache
-    // if page is already on cache, return the id
-    // return cache index
-    int loadPageToCache(unsigned long long pageId)
-    {
-        int cache_page_id = findCachePage(pageId);
-
-        if (cache_page_id != -1)
-        {
-            return cache_page_id;
-        }
         CHAR16 pageName[64];
         generatePageName(pageName, pageId);
-        cache_page_id = getMostOutdatedCachePage();
 #ifdef NO_UEFI
         auto sz = load(pageName, pageSize, (unsigned char*)cache[cache_page_id], pageDir);
-        lastAccessedTimestamp[cache_page_id] = 0;
 #else
 #if !defined(NDEBUG)
         {
@@ -186,16 +271,14 @@ private:
         }
 #endif
         auto sz = asyncLoad(pageName, pageSize, (unsigned char*)cache[cache_page_id], pageDir);
+#endif
         if (sz != pageSize)
         {
 #if !defined(NDEBUG)
             addDebugMessage(L"Failed to load virtualMemory from disk");
 #endif
-            return -1;
+            return false;
         }
-        lastAccessedTimestamp[cache_page_id] = now_ms();
-#endif
-        cachePageId[cache_page_id] = pageId;
 #if !defined(NDEBUG)
         {
             CHAR16 debugMsg[128];
@@ -212,7 +295,149 @@ private:
             addDebugMessage(debugMsg);
         }
 #endif
-        return cache_page_id;
+        return true;
+    }
+
+    // unlock the slot of the read ahead page if its load is finished
+    void finishPrefetch()
+    {
+        if (prefetchSlot == -1 || !TRY_ACQUIRE(prefetchLock))
+        {
+            return;
+        }
+        if (prefetchSlot != -1 && isAsyncLoadFinished(prefetchItem))
+        {
+            const bool loaded = finishAsyncLoad(prefetchItem) == pageSize;
+            // not referenced yet, so it is evicted first if the reader doesn't continue
+            unlockCacheSlot(prefetchSlot, loaded, 0);
+            prefetchItem = NULL;
+            prefetchSlot = -1;
+        }
+        RELEASE(prefetchLock);
+    }
+
+    // start loading the page into cache without waiting for it (one page at a time)
+    void prefetchPage(unsigned long long pageId)
+    {
+        // current page isn't on disk, read ahead page would evict the page in use with a single slot
+        if (pageId >= currentPageId || numCachePage < 2)
+        {
+            return;
+        }
+        finishPrefetch();
+        if (prefetchSlot != -1 || !TRY_ACQUIRE(prefetchLock))
+        {
+            return;
+        }
+        if (prefetchSlot == -1)
+        {
+            const int slot = lockCacheSlotForPage(pageId);
+            if (slot != -1)
+            {
+#ifdef NO_UEFI
+                // no asynchronous file IO in this build, so load right away
+                unlockCacheSlot(slot, loadPageFromDisk(pageId, slot), 0);
+#else
+                CHAR16 pageName[64];
+                generatePageName(pageName, pageId);
+                prefetchItem = asyncLoadNonBlocking(pageName, pageSize, (unsigned char*)cache[slot], pageDir);
+                if (prefetchItem)
+                {
+                    prefetchSlot = slot;
+                }
+                else
+                {
+                    unlockCacheSlot(slot, false, 0);
+                }
+#endif
+            }
+        }
+        RELEASE(prefetchLock);
+    }
+
+    // pin cache slot holding the page, loading the page from disk if needed
+    // if prefetchNextPage or page access is sequential, the next page is read ahead
+    // return cache index or -1 if page cannot be loaded
+    int loadPageToCache(unsigned long long pageId, bool prefetchNextPage)
+    {
+        // only written when moving to another page, to avoid contention between readers
+        if (lastAccessedPageId != pageId)
+        {
+            prefetchNextPage |= (lastAccessedPageId + 1 == pageId);
+            lastAccessedPageId = pageId;
+        }
+        while (true)
+        {
+            int cache_page_id = pinCachePage(pageId);
+            if (cache_page_id != -1)
+            {
+                if (prefetchNextPage)
+                {
+                    prefetchPage(pageId + 1);
+                }
+                return cache_page_id;
+            }
+
+            // miss: read ahead before loading, so that both pages are loaded in the same IO flush
+            if (prefetchNextPage)
+            {
+                prefetchPage(pageId + 1);
+            }
+
+            cache_page_id = lockCacheSlotForPage(pageId);
+            if (cache_page_id == -1)
+            {
+                // page is loaded by another thread or all slots are pinned
+                finishPrefetch();
+                _mm_pause();
+                continue;
+            }
+            const bool loaded = loadPageFromDisk(pageId, cache_page_id);
+            cacheReferenced[cache_page_id] = loaded;
+            unlockCacheSlot(cache_page_id, loaded, 1);
+            return (loaded) ? cache_page_id : -1;
+        }
+    }
+
+    // copy [pageOffset, pageOffset + numItems) of page if it is the current page, return false otherwise
+    bool copyFromCurrentPage(T* dst, unsigned long long pageId, unsigned long long pageOffset, unsigned long long numItems)
+    {
+        while (true)
+        {
+            const long long version = currentPageVersion;
+            if (pageId != currentPageId)
+            {
+                return false;
+            }
+            if ((version & 1) == 0)
+            {
+                copyMem(dst, currentPage + pageOffset, numItems * sizeof(T));
+                if (ATOMIC_LOAD64(currentPageVersion) == version)
+                {
+                    return true;
+                }
+            }
+            _mm_pause();
+        }
+    }
+
+    // copy items [index, index + numItems) that are in the same page, return false if page cannot be loaded
+    bool copyFromPage(T* dst, unsigned long long index, unsigned long long numItems, bool prefetchNextPage)
+    {
+        const unsigned long long pageId = index / pageCapacity;
+        const unsigned long long pageOffset = index % pageCapacity;
+        if (copyFromCurrentPage(dst, pageId, pageOffset, numItems))
+        {
+            return true;
+        }
+        int cache_page_idx = loadPageToCache(pageId, prefetchNextPage);
+        if (cache_page_idx == -1)
+        {
+            return false;
+        }
+        copyMem(dst, cache[cache_page_idx] + pageOffset, numItems * sizeof(T));
+        unpinCacheSlot(cache_page_idx);
+        return true;
     }
 
     // only call after append
@@ -225,36 +450,66 @@ private:
         {
             writeCurrentPageToDisk();
             copyCurrentPageToCache();
+            // readers of the full page switch to cache or disk before it is cleaned
+            ATOMIC_INC64(currentPageVersion);
+            currentPageId = currentPageId + 1;
             cleanCurrentPage();
-            cachePageId[0] = currentId / pageCapacity;
-            currentPageId++;
+            ATOMIC_INC64(currentPageVersion);
         }
     }
 
+    // drop all pages from cache, skipping slots in use
+    void invalidateCache()
+    {
+        finishPrefetch();
+        ACQUIRE(cacheLock);
+        for (int i = 1; i <= numCachePage; i++)
+        {
+            if (_InterlockedCompareExchange(&cachePinCount[i], -1, 0) == 0)
+            {
+                cacheReferenced[i] = 0;
+                unlockCacheSlot(i, false, 0);
+            }
+        }
+        RELEASE(cacheLock);
+    }
+
     void reset()
     {
         setMem(currentPage, pageSize * (numCachePage + 1), 0);
-        setMem(cachePageId, sizeof(cachePageId), 0xff);
-        setMem(lastAccessedTimestamp, sizeof(lastAccessedTimestamp), 0);
-        cachePageId[0] = 0;
+        for (int i = 0; i <= numCachePage; i++)
+        {
+            cachePageId[i] = NO_PAGE;
+            cachePinCount[i] = 0;
+            cacheReferenced[i] = 0;
+        }
+        clockHand = 0;
+        prefetchItem = NULL;
+        prefetchSlot = -1;
+        lastAccessedPageId = NO_PAGE;
         currentId = 0;
         currentPageId = 0;
-        memLock = 0;
+        currentPageVersion = 0;
+        cacheLock = 0;
+        prefetchLock = 0;
     }
 
 public:
     VirtualMemory()
     {
-        memLock = 0;
+        appendLock = 0;
+        cacheLock = 0;
+        prefetchLock = 0;
     }
 
     bool init()
     {
-        ACQUIRE(memLock);
+        ACQUIRE(appendLock);
         if (currentPage == NULL)
         {
             if (!allocPoolWithErrorLog(L"VirtualMemory.Page", pageSize * (numCachePage + 1), (void**)&currentPage, __LINE__))
             {
+                RELEASE(appendLock);
                 return false;
             }
             cache[0] = currentPage;
@@ -270,6 +525,7 @@ public:
             {
                 if (!allocPoolWithErrorLog(L"PageDir", 32, (void**)&pageDir, __LINE__))
                 {
+                    RELEASE(appendLock);
                     return false;
                 }
                 setMem(pageDir, sizeof(pageDir), 0);
@@ -300,11 +556,17 @@ public:
         }
 
         reset();
-        RELEASE(memLock);
+        RELEASE(appendLock);
         return true;
     }
     void deinit()
     {
+        // a page read ahead must not be loaded into freed memory
+        while (prefetchSlot != -1)
+        {
+            finishPrefetch();
+            _mm_pause();
+        }
         if (currentPage != NULL)
         {
             freePool(currentPage);
@@ -323,90 +585,34 @@ public:
     // return number of items has been copied
     unsigned long long getMany(T* dst, unsigned long long offset, unsigned long long numItems)
     {
-        ACQUIRE(memLock);
         ASSERT(offset + numItems - 1 < currentId);
         if (offset + numItems - 1 >= currentId)
         {
-            RELEASE(memLock);
             return 0;
         }
-        RELEASE(memLock);
 
-        // processing
+        // copy page by page:
+        // [     PAGE N    ] [ PAGE N + 1] [ PAGE N + 2] ... [ PAGE N + K-1 ] [ PAGE N + K ]
+        //        ^[                REQUESTED MEMORY REGION                        ]^
+        // pages following in the requested region are read ahead while copying the current one
         unsigned long long c_bytes = 0;
-        unsigned long long p_start = offset;
-        unsigned long long p_end = offset + numItems;
-
-        // visualizer:
-        // [     PAGE N    ] [ PAGE N + 1] [ PAGE N + 2] [ PAGE N + 3] ... [ PAGE N + K-2 ] [ PAGE N + K-1 ] [ PAGE N + K ]
-        //        ^[                        REQUESTED MEMORY REGION                               ]^
-        //         [HEAD   ] [                            BODY                            ] [TAIL ]
-
-        // HEAD
-        unsigned long long hs = offset; // head start
-        unsigned long long rhs = (hs / pageCapacity) * pageCapacity; // rounded hs
-        unsigned long long r_page_id = rhs / pageCapacity;
-        unsigned long long he = min(rhs + pageCapacity, offset + numItems); // head end
-        unsigned long long n_item = he - hs; // copy [hs, he)
-        ACQUIRE(memLock);
-        int cache_page_idx = loadPageToCache(r_page_id);
-        if (cache_page_idx == -1)
+        const unsigned long long p_end = offset + numItems;
+        T* p_dst = dst;
+        for (unsigned long long index = offset; index < p_end; )
         {
-#if !defined(NDEBUG)
-            addDebugMessage(L"Invalid cache page index, return zeroes array");
-#endif
-            setMem(dst, numItems * sizeof(T), 0);
-            RELEASE(memLock);
-            return 0;
-        }
-        copyMem(dst, cache[cache_page_idx] + (hs % pageCapacity), n_item * sizeof(T));
-        dst += n_item;
-        c_bytes += n_item * sizeof(T);
-        RELEASE(memLock);
-        // BODY
-        unsigned long long bs = he; //bodystart
-        if (he < p_end && (p_end - he) >= pageCapacity) // need to copy fullpage in the "middle"
-        {
-            for (bs = he; bs + pageCapacity <= p_end; bs += pageCapacity)
-            {
-                r_page_id = bs / pageCapacity;
-                ACQUIRE(memLock);
-                cache_page_idx = loadPageToCache(r_page_id);
-                if (cache_page_idx == -1)
-                {
-#if !defined(NDEBUG)
-                    addDebugMessage(L"Invalid cache page index, return zeroes array");
-#endif
-                    setMem(dst, numItems * sizeof(T), 0);
-                    RELEASE(memLock);
-                    return 0;
-                }
-                copyMem(dst, cache[cache_page_idx], pageSize);
-                dst += pageCapacity;
-                c_bytes += pageSize;
-                RELEASE(memLock);
-            }
-        }
-        // TAIL
-        if (bs < p_end)
-        {
-            r_page_id = bs / pageCapacity;
-            n_item = p_end - bs; // copy [bs, p_end)
-            ACQUIRE(memLock);
-            int cache_page_idx = loadPageToCache(r_page_id);
-            if (cache_page_idx == -1)
+            const unsigned long long pageEnd = (index / pageCapacity + 1) * pageCapacity;
+            const unsigned long long n_item = min(pageEnd, p_end) - index;
+            if (!copyFromPage(p_dst, index, n_item, pageEnd < p_end))
             {
 #if !defined(NDEBUG)
                 addDebugMessage(L"Invalid cache page index, return zeroes array");
 #endif
                 setMem(dst, numItems * sizeof(T), 0);
-                RELEASE(memLock);
                 return 0;
             }
-            copyMem(dst, cache[cache_page_idx], n_item * sizeof(T));
-            dst += n_item;
+            p_dst += n_item;
+            index += n_item;
             c_bytes += n_item * sizeof(T);
-            RELEASE(memLock);
         }
         return c_bytes;
     }
@@ -416,104 +622,50 @@ public:
     // return number of items has been copied
     unsigned long long appendMany(T* src, unsigned long long numItems)
     {
-        ACQUIRE(memLock);
+        ACQUIRE(appendLock);
         unsigned long long c_bytes = 0;
-        unsigned long long p_start = currentId;
-        unsigned long long p_end = currentId + numItems;
-
-        // HEAD
-        unsigned long long hs = currentId; // head start
-        unsigned long long rhs = (hs / pageCapacity) * pageCapacity; // rounded hs
-        unsigned long long r_page_id = rhs / pageCapacity;
-        unsigned long long he = min(rhs + pageCapacity, p_end); // head end
-        unsigned long long n_item = he - hs; // copy [hs, he)
-        copyMem(currentPage + (currentId % pageCapacity), src, n_item * sizeof(T));
-        currentId += n_item;
-        src += n_item;
-        c_bytes += n_item * sizeof(T);
-        tryPersistingPage();
-        // BODY
-        unsigned long long bs = he; //bodystart
-        if (currentId < p_end && (p_end - currentId) >= pageCapacity)
+        while (numItems > 0)
         {
-            for (bs = he; bs + pageCapacity <= p_end; bs += pageCapacity)
-            {
-                copyMem(currentPage, src, pageSize);
-                currentId += pageCapacity;
-                src += pageCapacity;
-                c_bytes += pageSize;
-                tryPersistingPage();
-            }
-        }
-        // TAIL
-        if (bs < p_end)
-        {
-            n_item = p_end - bs; // copy [bs, p_end)
-            copyMem(currentPage, src, n_item * sizeof(T));
-            currentId += n_item;
+            const unsigned long long pageOffset = currentId % pageCapacity;
+            const unsigned long long n_item = min(pageCapacity - pageOffset, numItems);
+            copyMem(currentPage + pageOffset, src, n_item * sizeof(T));
+            currentId = currentId + n_item;
             src += n_item;
+            numItems -= n_item;
             c_bytes += n_item * sizeof(T);
             tryPersistingPage();
         }
-        RELEASE(memLock);
+        RELEASE(appendLock);
         return c_bytes;
     }
 
     // return array[index]
     // if index is not in current page it will try to find it in cache
-    // if index is not in cache it will load the page to most outdated cache
+    // if index is not in cache it will load the page to cache, evicting a page not used recently
     T get(unsigned long long index)
     {
         T result;
-        ACQUIRE(memLock);
-        if (index >= currentId) // out of bound
-        {
-            setMem(&result, sizeof(T), 0);
-            RELEASE(memLock);
-            return result;
-        }
-        unsigned long long requested_page_id = index / pageCapacity;
-        int cache_page_idx = loadPageToCache(requested_page_id);
-        if (cache_page_idx == -1)
-        {
-#if !defined(NDEBUG)
-            addDebugMessage(L"Invalid cache page index, return zeroes array");
-#endif
-            setMem(&result, sizeof(T), 0);
-            RELEASE(memLock);
-            return result;
-        }
-        result = cache[cache_page_idx][index % pageCapacity];
-        RELEASE(memLock);
+        getOne(index, &result);
         return result;
     }
 
     // return array[index]
     // if index is not in current page it will try to find it in cache
-    // if index is not in cache it will load the page to most outdated cache
+    // if index is not in cache it will load the page to cache, evicting a page not used recently
     void getOne(unsigned long long index, T* result)
     {
-        ACQUIRE(memLock);
         if (index >= currentId) // out of bound
         {
             setMem(result, sizeof(T), 0);
-            RELEASE(memLock);
             return;
         }
-        unsigned long long requested_page_id = index / pageCapacity;
-        int cache_page_idx = loadPageToCache(requested_page_id);
-        if (cache_page_idx == -1)
+        if (!copyFromPage(result, index, 1, false))
         {
 #if !defined(NDEBUG)
             addDebugMessage(L"Invalid cache page index, return zeroes array");
 #endif
             setMem(result, sizeof(T), 0);
-            RELEASE(memLock);
-            return;
         }
-        copyMem(result, &(cache[cache_page_idx][index % pageCapacity]), sizeof(T));
-        RELEASE(memLock);
-        return;
     }
 
     T operator[](unsigned long long index)
@@ -529,11 +681,11 @@ public:
     void append(const T& data)
     {
         ASSERT(currentPage != NULL);
-        ACQUIRE(memLock);
+        ACQUIRE(appendLock);
         copyMem(&currentPage[currentId % pageCapacity], &data, sizeof(T));
-        currentId++;
+        currentId = currentId + 1;
         tryPersistingPage();
-        RELEASE(memLock);
+        RELEASE(appendLock);
     }
 
     unsigned long long size()
@@ -550,12 +702,8 @@ public:
         }
         CHAR16 pageName[64];
         generatePageName(pageName, pageId);
-        ACQUIRE(memLock);
-        bool success = (asyncRemoveFile(pageName, pageDir)) == 0;
-        RELEASE(memLock);
-        return success;
+        return (asyncRemoveFile(pageName, pageDir)) == 0;
     }
-
     // delete pages data on disk given (fromId, toId)
     // Since we store the whole page on disk, pageId will be rounded up for fromId and rounded down for toId
     // fromPageId = (fromId + pageCapacity - 1) // pageCapacity
@@ -620,7 +768,7 @@ public:
 
     unsigned long long dumpVMState(unsigned char* buffer)
     {
-        ACQUIRE(memLock);
+        ACQUIRE(appendLock);
         unsigned long long ret = 0;
         copyMem(buffer, currentPage, pageSize);
         ret += pageSize;
@@ -633,13 +781,14 @@ public:
         *((unsigned long long*)buffer) = currentPageId;
         buffer += 8;
         ret += 8;
-        RELEASE(memLock);
+        RELEASE(appendLock);
         return ret;
     }
 
     unsigned long long loadVMState(unsigned char* buffer)
     {
-        ACQUIRE(memLock);
+        ACQUIRE(appendLock);
+        ATOMIC_INC64(currentPageVersion);
         unsigned long long ret = 0;
         copyMem(currentPage, buffer, pageSize);
         ret += pageSize;
@@ -652,10 +801,10 @@ public:
         currentPageId = *((unsigned long long*)buffer);
         buffer += 8;
         ret += 8;
+        ATOMIC_INC64(currentPageVersion);
 
-        cachePageId[0] = currentPageId;
-        lastAccessedTimestamp[0] = now_ms();
-        RELEASE(memLock);
+        invalidateCache();
+        RELEASE(appendLock);
         return ret;
     }
 };
\ No newline at end of file
@@ -62,4 +62,8 @@ static unsigned long long logReaderPasscodes[4] = {
 // Perform state persisting when your node is misaligned will also make your node misaligned after resuming.
 // Thus, picking various TICK_STORAGE_AUTOSAVE_TICK_PERIOD numbers across AUX nodes is recommended.
 // some suggested prime numbers you can try: 971 977 983 991 997
-#define TICK_STORAGE_AUTOSAVE_TICK_PERIOD 1000
\ No newline at end of file
+#define TICK_STORAGE_AUTOSAVE_TICK_PERIOD 1000
+// Spectrum, universe, and contract states are saved in full (base image) only every NODE_STATE_DELTAS_PER_BASE_IMAGE + 1
+// saves and at the first save of an epoch. In between, only the pages changed since the previous save are written
+// (delta segments), which are replayed on top of the base image when loading. Set 0 to always save the full states.
+#define NODE_STATE_DELTAS_PER_BASE_IMAGE 10
\ No newline at end of file
@@ -19,6 +19,8 @@
 #define USE_SCORE_CACHE 1
 #define SCORE_CACHE_SIZE 2000000 // the larger the better
 #define SCORE_CACHE_COLLISION_RETRIES 20 // number of retries to find entry in cache in case of hash collision
+#define SPECULATIVE_SCORING_QUEUE_LENGTH 1024 // number of solutions per priority that can be queued for scoring before their tick is processed
+#define SPECULATIVE_SCORING_PRIORITY_TICKS 5 // solutions of transactions for the next ticks are scored before the others
 
 // Number of ticks from prior epoch that are kept after seamless epoch transition. These can be requested after transition.
 #define TICKS_TO_KEEP_FROM_PRIOR_EPOCH 100
@@ -31,6 +33,12 @@
 #define TICK_DURATION_FOR_ALLOCATION_MS 750
 #define TRANSACTION_SPARSENESS 1
 
+// Capacity of the pool of pending transactions of non-computor entities (transactions waiting for their scheduled tick).
+// The memory reserved for the pool scales with these numbers. If the pool is full, new transactions are rejected.
+// The number of transactions must be a power of 2.
+#define PENDING_TXS_POOL_MAX_NUMBER_OF_TXS (1ULL << 20)
+#define PENDING_TXS_POOL_ARENA_SIZE (PENDING_TXS_POOL_MAX_NUMBER_OF_TXS * 512ULL)
+
 // Below are 2 variables that are used for auto-F5 feature:
 #define AUTO_FORCE_NEXT_TICK_THRESHOLD 0ULL // Multiplier of TARGET_TICK_DURATION for the system to detect "F5 case" | set to 0 to disable
                                             // to prevent bad actor causing misalignment.
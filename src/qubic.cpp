@@ -36,6 +36,7 @@
 
 #include "K12/kangaroo_twelve_xkcp.h"
 #include "kangaroo_twelve.h"
+#include "kangaroo_twelve_parallel.h"
 #include "four_q.h"
 #include "score.h"
 
@@ -56,6 +57,7 @@
 #include "logging/net_msg_impl.h"
 
 #include "ticking/ticking.h"
+#include "ticking/transfer_batch.h"
 #include "contract_core/qpi_ticking_impl.h"
 #include "vote_counter.h"
 
@@ -65,6 +67,7 @@
 #include "addons/tx_status_request.h"
 
 #include "files/files.h"
+#include "node_state_delta.h"
 #include "mining/mining.h"
 #include "oracles/oracle_machines.h"
 
@@ -131,6 +134,7 @@ static unsigned short ownComputorIndicesMapping[sizeof(computorSeeds) / sizeof(c
 static TickStorage ts;
 static VoteCounter voteCounter;
 static TickData nextTickData;
+static TransferBatch transferBatch;
 
 static m256i uniqueNextTickTransactionDigests[NUMBER_OF_COMPUTORS];
 static unsigned int uniqueNextTickTransactionDigestCounters[NUMBER_OF_COMPUTORS];
@@ -138,14 +142,12 @@ static unsigned int uniqueNextTickTransactionDigestCounters[NUMBER_OF_COMPUTORS]
 static unsigned int resourceTestingDigest = 0;
 
 static unsigned int numberOfTransactions = 0;
-static volatile char entityPendingTransactionsLock = 0;
-static unsigned char* entityPendingTransactions = NULL;
-static unsigned char* entityPendingTransactionDigests = NULL;
-static unsigned int entityPendingTransactionIndices[SPECTRUM_CAPACITY]; // [SPECTRUM_CAPACITY] must be >= than [NUMBER_OF_COMPUTORS * MAX_NUMBER_OF_PENDING_TRANSACTIONS_PER_COMPUTOR]
+static PendingTxsPool pendingTxsPool;
+static unsigned int entityPendingTransactionIndices[PendingTxsPool::maxNumberOfTxs]; // must be >= than [NUMBER_OF_COMPUTORS * MAX_NUMBER_OF_PENDING_TRANSACTIONS_PER_COMPUTOR]
+static_assert(PendingTxsPool::maxNumberOfTxs >= NUMBER_OF_COMPUTORS * MAX_NUMBER_OF_PENDING_TRANSACTIONS_PER_COMPUTOR, "entityPendingTransactionIndices too small");
 static volatile char computorPendingTransactionsLock = 0;
 static unsigned char* computorPendingTransactions = NULL;
 static unsigned char* computorPendingTransactionDigests = NULL;
-static unsigned long long spectrumChangeFlags[SPECTRUM_CAPACITY / (sizeof(unsigned long long) * 8)];
 
 static unsigned long long mainLoopNumerator = 0, mainLoopDenominator = 0;
 static unsigned char contractProcessorState = 0;
@@ -206,6 +208,13 @@ static unsigned long long K12MeasurementsCount = 0;
 static unsigned long long K12MeasurementsSum = 0;
 static volatile char minerScoreArrayLock = 0;
 static SpecialCommandGetMiningScoreRanking<MAX_NUMBER_OF_MINERS> requestMiningScoreRanking;
+#ifdef ENABLE_PROFILING
+static SpecialCommandGetProfilingDataResponse profilingDataResponse; // protected by gProfilingDataCollector.acquireMergedData()
+#endif
+#ifdef ENABLE_LOCK_PROFILING
+static SpecialCommandGetLockProfilingDataResponse lockProfilingDataResponse;
+static volatile char lockProfilingDataResponseLock = 0;
+#endif
 
 // Custom mining related variables and constants
 static unsigned int gCustomMiningSharesCount[NUMBER_OF_COMPUTORS] = { 0 };
@@ -219,6 +228,33 @@ static bool loadMiningSeedFromFile = false;
 static bool loadAllNodeStateFromFile = false;
 #if TICK_STORAGE_AUTOSAVE_MODE
 static unsigned int nextPersistingNodeStateTick = 0;
+
+// Node states are persisted in the background: saveAllNodeStates() takes copy-on-write snapshots of spectrum,
+// universe, and contract states while the tick processor is paused (the cut) and saves the small states. The large
+// files are saved from the snapshots by a request processor in saveNodeStateSnapshots(), while ticks continue to be
+// processed. Finally, the main loop saves the tick storage up to the cut tick in finishSavingAllNodeStates(), which
+// marks the saved states as valid.
+enum NodeStateSnapshotStage
+{
+    NodeStateSnapshotIdle = 0,
+    NodeStateSnapshotPending,   // snapshots taken, waiting for request processor to save them
+    NodeStateSnapshotSaving,    // request processor is saving the snapshots
+    NodeStateSnapshotSaved,     // snapshots saved (or failed), waiting for main loop to finish
+};
+static volatile long nodeStateSnapshotStage = NodeStateSnapshotIdle;
+static bool nodeStateSnapshotsSaved = false;
+static unsigned int nodeStateSnapshotEpoch = 0;
+static unsigned int nodeStateSnapshotTick = 0;
+static unsigned long long nodeStateSnapshotBeginningTick = 0;
+static CHAR16 nodeStateSnapshotDirectory[16];
+static void saveNodeStateSnapshots();
+
+// Spectrum, universe, and contract states are saved as base image followed by delta segments (see node_state_delta.h).
+// nodeStateBaseTick is 0 if the next save has to be a base image, for example after an error.
+static bool nodeStateSnapshotIsDelta = false;
+static unsigned int nodeStateBaseEpoch = 0;
+static unsigned int nodeStateBaseTick = 0;
+static unsigned int nodeStateNumberOfDeltas = 0;
 struct
 {
     Tick etalonTick;
@@ -239,6 +275,8 @@ struct
 } nodeStateBuffer;
 #endif
 static bool saveComputer(CHAR16* directory = NULL);
+static void beginComputerSnapshot(CopyOnWriteSnapshot<contractCount>::CaptureMode mode = CopyOnWriteSnapshot<contractCount>::captureAll);
+static long long saveComputerSnapshot(const CHAR16* contractFileName, const CHAR16* directory);
 static bool saveSystem(CHAR16* directory = NULL);
 static bool loadComputer(CHAR16* directory = NULL, bool forceLoadFromFile = false);
 static bool saveRevenueComponents(CHAR16* directory = NULL);
@@ -415,7 +453,9 @@ static void getComputerDigest(m256i& digest)
                 contractStateLock[digestIndex].acquireRead();
 
                 const unsigned long long startTick = __rdtsc();
-                KangarooTwelve(contractStates[digestIndex], (unsigned int)size, &contractStateDigests[digestIndex], 32);
+                // Only the chunks changed since the last digest are rehashed, many of them with help of the request
+                // processors (see helpWithParallelWork())
+                contractStateDigestCaches[digestIndex].digest(&contractStateDigests[digestIndex], 32);
                 const unsigned long long executionTicks = __rdtsc() - startTick;
 
                 contractStateLock[digestIndex].releaseRead();
@@ -434,18 +474,22 @@ static void getComputerDigest(m256i& digest)
     }
     unsigned int previousLevelBeginning = 0;
     unsigned int numberOfLeafs = MAX_NUMBER_OF_CONTRACTS;
+    KangarooTwelve64To32Batch batch;
     while (numberOfLeafs > 1)
     {
         for (unsigned int i = 0; i < numberOfLeafs; i += 2)
         {
             if (contractStateChangeFlags[i >> 6] & (3ULL << (i & 63)))
             {
-                KangarooTwelve64To32(&contractStateDigests[previousLevelBeginning + i], &contractStateDigests[digestIndex]);
+                batch.add(&contractStateDigests[previousLevelBeginning + i], &contractStateDigests[digestIndex]);
                 contractStateChangeFlags[i >> 6] &= ~(3ULL << (i & 63));
                 contractStateChangeFlags[i >> 7] |= (1ULL << ((i >> 1) & 63));
             }
             digestIndex++;
         }
+        // The next level depends on the digests of this level
+        batch.flush();
+
         previousLevelBeginning += numberOfLeafs;
         numberOfLeafs >>= 1;
     }
@@ -782,6 +826,15 @@ static void processBroadcastComputors(Peer* peer, RequestResponseHeader* header)
     }
 }
 
+// Status of the signature of a broadcast request, which may have been verified in a batch before calling the handler
+// (see verifySignedRequests())
+enum SignatureStatus
+{
+    SignatureNotVerified = 0,
+    SignatureValid,
+    SignatureInvalid,
+};
+
 static bool verifyTickVoteSignature(const unsigned char* publicKey, const unsigned char* messageDigest, const unsigned char* signature, const bool curveVerify = true)
 {
     unsigned int score = _byteswap_ulong(((unsigned int*)signature)[0]);
@@ -793,7 +846,7 @@ static bool verifyTickVoteSignature(const unsigned char* publicKey, const unsign
     return true;
 }
 
-static void processBroadcastTick(Peer* peer, RequestResponseHeader* header)
+static void processBroadcastTick(Peer* peer, RequestResponseHeader* header, SignatureStatus signatureStatus = SignatureNotVerified)
 {
     BroadcastTick* request = header->getPayload<BroadcastTick>();
     if (request->tick.computorIndex < NUMBER_OF_COMPUTORS
@@ -808,11 +861,15 @@ static void processBroadcastTick(Peer* peer, RequestResponseHeader* header)
         && request->tick.millisecond <= 999)
     {
         unsigned char digest[32];
-        request->tick.computorIndex ^= BroadcastTick::type;
-        KangarooTwelve(&request->tick, sizeof(Tick) - SIGNATURE_SIZE, digest, sizeof(digest));
-        request->tick.computorIndex ^= BroadcastTick::type;
-        const bool verifyFourQCurve = true;
-        if (verifyTickVoteSignature(broadcastedComputors.computors.publicKeys[request->tick.computorIndex].m256i_u8, digest, request->tick.signature, verifyFourQCurve))
+        const bool verifyFourQCurve = (signatureStatus == SignatureNotVerified);
+        if (verifyFourQCurve)
+        {
+            request->tick.computorIndex ^= BroadcastTick::type;
+            KangarooTwelve(&request->tick, sizeof(Tick) - SIGNATURE_SIZE, digest, sizeof(digest));
+            request->tick.computorIndex ^= BroadcastTick::type;
+        }
+        if (signatureStatus != SignatureInvalid
+            && verifyTickVoteSignature(broadcastedComputors.computors.publicKeys[request->tick.computorIndex].m256i_u8, digest, request->tick.signature, verifyFourQCurve))
         {
             if (header->isDejavuZero())
             {
@@ -852,7 +909,7 @@ static void processBroadcastTick(Peer* peer, RequestResponseHeader* header)
     }
 }
 
-static void processBroadcastFutureTickData(Peer* peer, RequestResponseHeader* header)
+static void processBroadcastFutureTickData(Peer* peer, RequestResponseHeader* header, SignatureStatus signatureStatus = SignatureNotVerified)
 {
     BroadcastFutureTickData* request = header->getPayload<BroadcastFutureTickData>();
     if (request->tickData.epoch == system.epoch
@@ -884,13 +941,17 @@ static void processBroadcastFutureTickData(Peer* peer, RequestResponseHeader* he
                 }
             }
         }
-        if (ok)
+        if (ok && signatureStatus == SignatureNotVerified)
         {
             unsigned char digest[32];
             request->tickData.computorIndex ^= BroadcastFutureTickData::type;
             KangarooTwelve(&request->tickData, sizeof(TickData) - SIGNATURE_SIZE, digest, sizeof(digest));
             request->tickData.computorIndex ^= BroadcastFutureTickData::type;
-            if (verify(broadcastedComputors.computors.publicKeys[request->tickData.computorIndex].m256i_u8, digest, request->tickData.signature))
+            signatureStatus = verify(broadcastedComputors.computors.publicKeys[request->tickData.computorIndex].m256i_u8, digest, request->tickData.signature) ? SignatureValid : SignatureInvalid;
+        }
+        if (ok)
+        {
+            if (signatureStatus == SignatureValid)
             {
                 if (header->isDejavuZero())
                 {
@@ -949,21 +1010,53 @@ static void processBroadcastFutureTickData(Peer* peer, RequestResponseHeader* he
     }
 }
 
-static void processBroadcastTransaction(Peer* peer, RequestResponseHeader* header)
+// Queue solution of a transaction for scoring in the background (before the tick of the transaction is processed)
+static void queueSpeculativeSolutionScoring(const Transaction* transaction)
+{
+    if (transaction->tick > system.tick
+        && isZero(transaction->destinationPublicKey)
+        && transaction->amount >= MiningSolutionTransaction::minAmount()
+        && transaction->inputType == MiningSolutionTransaction::transactionType()
+        && transaction->inputSize == 32 + 32)
+    {
+        const m256i& solution_miningSeed = *(m256i*)transaction->inputPtr();
+        const m256i& solution_nonce = *(m256i*)(transaction->inputPtr() + 32);
+        m256i data[3] = { transaction->sourcePublicKey, solution_miningSeed, solution_nonce };
+        static_assert(sizeof(data) == 3 * 32, "Unexpected array size");
+        unsigned int flagIndex;
+        KangarooTwelve(data, sizeof(data), &flagIndex, sizeof(flagIndex));
+        if (!(minerSolutionFlags[flagIndex >> 6] & (1ULL << (flagIndex & 63))))
+        {
+            // transactions of the next ticks are likely to be included soon
+            const bool highPriority = (transaction->tick <= system.tick + SPECULATIVE_SCORING_PRIORITY_TICKS);
+            score->addSpeculativeTask(transaction->sourcePublicKey, solution_miningSeed, solution_nonce, highPriority);
+        }
+    }
+}
+
+static void processBroadcastTransaction(Peer* peer, RequestResponseHeader* header, SignatureStatus signatureStatus = SignatureNotVerified)
 {
     Transaction* request = header->getPayload<Transaction>();
     const unsigned int transactionSize = request->totalSize();
     if (request->checkValidity() && transactionSize == header->size() - sizeof(RequestResponseHeader))
     {
         unsigned char digest[32];
-        KangarooTwelve(request, transactionSize - SIGNATURE_SIZE, digest, sizeof(digest));
-        if (verify(request->sourcePublicKey.m256i_u8, digest, request->signaturePtr()))
+        if (signatureStatus == SignatureNotVerified)
+        {
+            KangarooTwelve(request, transactionSize - SIGNATURE_SIZE, digest, sizeof(digest));
+            signatureStatus = verify(request->sourcePublicKey.m256i_u8, digest, request->signaturePtr()) ? SignatureValid : SignatureInvalid;
+        }
+        if (signatureStatus == SignatureValid)
         {
             if (header->isDejavuZero())
             {
                 enqueueResponse(NULL, header);
             }
 
+            // Digest of whole transaction, computed once for the pending transactions and the tick storage
+            m256i transactionDigest;
+            KangarooTwelve(request, transactionSize, &transactionDigest, sizeof(transactionDigest));
+
             const int computorIndex = ::computorIndex(request->sourcePublicKey);
             if (computorIndex >= 0)
             {
@@ -974,30 +1067,21 @@ static void processBroadcastTransaction(Peer* peer, RequestResponseHeader* heade
                     && request->tick < system.initialTick + MAX_NUMBER_OF_TICKS_PER_EPOCH)
                 {
                     copyMem(&computorPendingTransactions[computorIndex * offset * MAX_TRANSACTION_SIZE], request, transactionSize);
-                    KangarooTwelve(request, transactionSize, &computorPendingTransactionDigests[computorIndex * offset * 32ULL], 32);
+                    copyMem(&computorPendingTransactionDigests[computorIndex * offset * 32ULL], &transactionDigest, 32);
                 }
 
                 RELEASE(computorPendingTransactionsLock);
             }
             else
             {
-                const int spectrumIndex = ::spectrumIndex(request->sourcePublicKey);
-                if (spectrumIndex >= 0)
+                if (::spectrumIndex(request->sourcePublicKey) >= 0)
                 {
-                    ACQUIRE(entityPendingTransactionsLock);
-
                     // Pending transactions pool follows the rule: A transaction with a higher tick overwrites previous transaction from the same address.
-                    // The second filter is to avoid accident made by users/devs (setting scheduled tick too high) and get locked until end of epoch.
-                    // It also makes sense that a node doesn't need to store a transaction that is scheduled on a tick that node will never reach.
-                    // Notice: MAX_NUMBER_OF_TICKS_PER_EPOCH is not set globally since every node may have different TARGET_TICK_DURATION time due to memory limitation.
-                    if (((Transaction*)&entityPendingTransactions[spectrumIndex * MAX_TRANSACTION_SIZE])->tick < request->tick
-                        && request->tick < system.initialTick + MAX_NUMBER_OF_TICKS_PER_EPOCH)
+                    // Transactions scheduled for ticks beyond the epoch storage are rejected (see PendingTxsPool::add()).
+                    if (pendingTxsPool.add(request, transactionDigest))
                     {
-                        copyMem(&entityPendingTransactions[spectrumIndex * MAX_TRANSACTION_SIZE], request, transactionSize);
-                        KangarooTwelve(request, transactionSize, &entityPendingTransactionDigests[spectrumIndex * 32ULL], 32);
+                        queueSpeculativeSolutionScoring(request);
                     }
-
-                    RELEASE(entityPendingTransactionsLock);
                 }
             }
 
@@ -1006,21 +1090,15 @@ static void processBroadcastTransaction(Peer* peer, RequestResponseHeader* heade
             if (request->tick == system.tick + 1
                 && ts.tickData[tickIndex].epoch == system.epoch)
             {
-                KangarooTwelve(request, transactionSize, digest, sizeof(digest));
                 auto* tsReqTickTransactionOffsets = ts.tickTransactionOffsets.getByTickIndex(tickIndex);
                 for (unsigned int i = 0; i < NUMBER_OF_TRANSACTIONS_PER_TICK; i++)
                 {
-                    if (digest == ts.tickData[tickIndex].transactionDigests[i])
+                    if (transactionDigest == ts.tickData[tickIndex].transactionDigests[i])
                     {
                         ts.tickTransactions.acquireLock();
                         if (!tsReqTickTransactionOffsets[i])
                         {
-                            if (ts.nextTickTransactionOffset + transactionSize <= ts.tickTransactions.storageSpaceCurrentEpoch)
-                            {
-                                tsReqTickTransactionOffsets[i] = ts.nextTickTransactionOffset;
-                                copyMem(ts.tickTransactions(ts.nextTickTransactionOffset), request, transactionSize);
-                                ts.nextTickTransactionOffset += transactionSize;
-                            }
+                            ts.addTransaction(request->tick, i, request, transactionDigest);
                         }
                         ts.tickTransactions.releaseLock();
                         break;
@@ -1234,9 +1312,23 @@ static void processRequestEntity(Peer* peer, RequestResponseHeader* header)
 
     RequestedEntity* request = header->getPayload<RequestedEntity>();
     respondedEntity.entity.publicKey = request->publicKey;
-    // Inside spectrumIndex already have acquire/release lock
-    respondedEntity.spectrumIndex = spectrumIndex(respondedEntity.entity.publicKey);
     respondedEntity.tick = system.tick;
+
+    // Nothing is locked here, so floods of requests don't slow down the tick processor. The entity may be moved by
+    // reorganizeSpectrum() after looking up its index, which is detected by comparing the public key of the copy.
+    while (true)
+    {
+        respondedEntity.spectrumIndex = spectrumIndex(request->publicKey);
+        if (respondedEntity.spectrumIndex < 0)
+        {
+            break;
+        }
+        readSpectrumRecord(respondedEntity.spectrumIndex, respondedEntity.entity);
+        if (respondedEntity.entity.publicKey == request->publicKey)
+        {
+            break;
+        }
+    }
     if (respondedEntity.spectrumIndex < 0)
     {
         respondedEntity.entity.incomingAmount = 0;
@@ -1250,10 +1342,7 @@ static void processRequestEntity(Peer* peer, RequestResponseHeader* header)
     }
     else
     {
-        copyMem(&respondedEntity.entity, &spectrum[respondedEntity.spectrumIndex], sizeof(EntityRecord));
-        ACQUIRE(spectrumLock);
-        getSiblings<SPECTRUM_DEPTH>(respondedEntity.spectrumIndex, spectrumDigests, respondedEntity.siblings);
-        RELEASE(spectrumLock);
+        readSpectrumDigestSiblings(respondedEntity.spectrumIndex, respondedEntity.siblings);
     }
 
 
@@ -1529,6 +1618,138 @@ static void processCustomMiningDataRequest(Peer* peer, const unsigned long long
     }
 }
 
+#ifdef ENABLE_PROFILING
+// Stream profiling data merged from the tables of all processors in chunks of up to maxNumberOfEntries
+static void processSpecialCommandGetProfilingData(Peer* peer, RequestResponseHeader* header, const SpecialCommand* request)
+{
+    constexpr unsigned int responseHeaderSize = sizeof(SpecialCommandGetProfilingDataResponse) - sizeof(SpecialCommandGetProfilingDataResponse::entries);
+    SpecialCommandGetProfilingDataResponse& response = profilingDataResponse;
+
+    const ProfilingDataTable& merged = gProfilingDataCollector.acquireMergedData();
+    const ProfilingData* dataPtr = merged.getData();
+    response.everIncreasingNonceAndCommandType = (request->everIncreasingNonceAndCommandType & 0xFFFFFFFFFFFFFF) | (SPECIAL_COMMAND_GET_PROFILING_DATA << 56);
+    response.totalNumberOfEntries = merged.getUsedEntryCount();
+    response.firstEntryIndex = 0;
+    response.numberOfEntries = 0;
+    response.padding = 0;
+    for (unsigned int i = 0; i < merged.getSize(); ++i)
+    {
+        const ProfilingData& data = dataPtr[i];
+        if (!data.name)
+            continue;
+
+        SpecialCommandGetProfilingDataResponse::Entry& entry = response.entries[response.numberOfEntries++];
+        setMem(entry.name, sizeof(entry.name), 0);
+        for (unsigned int j = 0; j < sizeof(entry.name) - 1 && data.name[j]; ++j)
+            entry.name[j] = data.name[j];
+        entry.line = data.line;
+        entry.numOfExec = data.numOfExec;
+        entry.runtimeSum = ProfilingDataCollector::ticksToMicroseconds(data.runtimeSum);
+        entry.runtimeMin = ProfilingDataCollector::ticksToMicroseconds(data.runtimeMin);
+        entry.runtimeMax = ProfilingDataCollector::ticksToMicroseconds(data.runtimeMax);
+        entry.runtimeP50 = ProfilingDataCollector::ticksToMicroseconds(ProfilingDataCollector::runtimeQuantile(data, 50, 100));
+        entry.runtimeP99 = ProfilingDataCollector::ticksToMicroseconds(ProfilingDataCollector::runtimeQuantile(data, 99, 100));
+        entry.runtimeP999 = ProfilingDataCollector::ticksToMicroseconds(ProfilingDataCollector::runtimeQuantile(data, 999, 1000));
+
+        if (response.numberOfEntries == SpecialCommandGetProfilingDataResponse::maxNumberOfEntries)
+        {
+            enqueueResponse(peer, responseHeaderSize + response.numberOfEntries * sizeof(entry), SpecialCommand::type, header->dejavu(), &response);
+            response.firstEntryIndex += response.numberOfEntries;
+            response.numberOfEntries = 0;
+        }
+    }
+
+    // last chunk (also sent if there is no data at all)
+    if (response.numberOfEntries || !response.firstEntryIndex)
+    {
+        enqueueResponse(peer, responseHeaderSize + response.numberOfEntries * sizeof(SpecialCommandGetProfilingDataResponse::Entry), SpecialCommand::type, header->dejavu(), &response);
+    }
+    gProfilingDataCollector.releaseMergedData();
+}
+#endif
+
+#ifdef ENABLE_LOCK_PROFILING
+static_assert(sizeof(SpecialCommandGetLockProfilingDataResponse::Entry::spinHistogram) == sizeof(LockProfilingData::spinHistogram), "Histogram size mismatch");
+static_assert(sizeof(SpecialCommandGetLockProfilingDataResponse::Entry::holderSites) / sizeof(SpecialCommandGetLockProfilingDataResponse::HolderSite) == LockProfilingData::maxHolderSites, "Holder site count mismatch");
+
+static void copyLockSite(SpecialCommandGetLockProfilingDataResponse::Site& target, const LockSite* site)
+{
+    setMem(&target, sizeof(target), 0);
+    if (!site)
+        return;
+    unsigned int length = 0;
+    while (site->file[length])
+        ++length;
+    const char* file = (length < sizeof(target.file)) ? site->file : site->file + (length - sizeof(target.file) + 1);
+    for (unsigned int i = 0; i < sizeof(target.file) - 1 && file[i]; ++i)
+        target.file[i] = file[i];
+    target.line = site->line;
+}
+
+// Stream statistics of all locks recorded by gLockProfiler in chunks of up to maxNumberOfEntries
+static void processSpecialCommandGetLockProfilingData(Peer* peer, RequestResponseHeader* header, const SpecialCommand* request)
+{
+    constexpr unsigned int responseHeaderSize = sizeof(SpecialCommandGetLockProfilingDataResponse) - sizeof(SpecialCommandGetLockProfilingDataResponse::entries);
+
+    ACQUIRE(lockProfilingDataResponseLock);
+    SpecialCommandGetLockProfilingDataResponse& response = lockProfilingDataResponse;
+    response.everIncreasingNonceAndCommandType = (request->everIncreasingNonceAndCommandType & 0xFFFFFFFFFFFFFF) | (SPECIAL_COMMAND_GET_LOCK_PROFILING_DATA << 56);
+    response.tscFrequency = frequency;
+    response.totalNumberOfEntries = 0;
+    for (unsigned int i = 0; i < LockProfiler::capacity; ++i)
+    {
+        if (gLockProfiler.getEntry(i).lock)
+            ++response.totalNumberOfEntries;
+    }
+    response.firstEntryIndex = 0;
+    response.numberOfEntries = 0;
+    response.padding = 0;
+
+    // locks registered concurrently are ignored in order to keep the total number of entries
+    for (unsigned int i = 0; i < LockProfiler::capacity && response.firstEntryIndex + response.numberOfEntries < response.totalNumberOfEntries; ++i)
+    {
+        const LockProfilingData& data = gLockProfiler.getEntry(i);
+        if (!data.lock)
+            continue;
+
+        SpecialCommandGetLockProfilingDataResponse::Entry& entry = response.entries[response.numberOfEntries++];
+        setMem(entry.name, sizeof(entry.name), 0);
+        const LockSite* firstSite = data.firstSite;
+        for (unsigned int j = 0; firstSite && j < sizeof(entry.name) - 1 && firstSite->expr[j]; ++j)
+            entry.name[j] = firstSite->expr[j];
+        copyLockSite(entry.firstSite, firstSite);
+        entry.acquireCount = data.acquireCount;
+        entry.contendedCount = data.contendedCount;
+        entry.spinSum = data.spinSum;
+        entry.waitTscSum = data.waitTscSum;
+        entry.waitTscMax = data.waitTscMax;
+        entry.otherHolderSitesWaitTscSum = data.otherHolderSitesWaitTscSum;
+        copyMem(entry.spinHistogram, data.spinHistogram, sizeof(entry.spinHistogram));
+        copyMem(entry.waitTscHistogram, data.waitTscHistogram, sizeof(entry.waitTscHistogram));
+        for (unsigned int j = 0; j < LockProfilingData::maxHolderSites; ++j)
+        {
+            copyLockSite(entry.holderSites[j].site, data.holderSites[j].site);
+            entry.holderSites[j].waitCount = data.holderSites[j].waitCount;
+            entry.holderSites[j].waitTscSum = data.holderSites[j].waitTscSum;
+        }
+
+        if (response.numberOfEntries == SpecialCommandGetLockProfilingDataResponse::maxNumberOfEntries)
+        {
+            enqueueResponse(peer, responseHeaderSize + response.numberOfEntries * sizeof(entry), SpecialCommand::type, header->dejavu(), &response);
+            response.firstEntryIndex += response.numberOfEntries;
+            response.numberOfEntries = 0;
+        }
+    }
+
+    // last chunk (also sent if there is no data at all)
+    if (response.numberOfEntries || !response.firstEntryIndex)
+    {
+        enqueueResponse(peer, responseHeaderSize + response.numberOfEntries * sizeof(SpecialCommandGetLockProfilingDataResponse::Entry), SpecialCommand::type, header->dejavu(), &response);
+    }
+    RELEASE(lockProfilingDataResponseLock);
+}
+#endif
+
 static void processSpecialCommand(Peer* peer, RequestResponseHeader* header)
 {
     SpecialCommand* request = header->getPayload<SpecialCommand>();
@@ -1670,6 +1891,22 @@ static void processSpecialCommand(Peer* peer, RequestResponseHeader* header)
                 enqueueResponse(peer, sizeof(SpecialCommandSetConsoleLoggingModeRequestAndResponse), SpecialCommand::type, header->dejavu(), _request);
             }
             break;
+
+#ifdef ENABLE_PROFILING
+            case SPECIAL_COMMAND_GET_PROFILING_DATA:
+            {
+                processSpecialCommandGetProfilingData(peer, header, request);
+            }
+            break;
+#endif
+
+#ifdef ENABLE_LOCK_PROFILING
+            case SPECIAL_COMMAND_GET_LOCK_PROFILING_DATA:
+            {
+                processSpecialCommandGetLockProfilingData(peer, header, request);
+            }
+            break;
+#endif
             }
         }
     }
@@ -1885,6 +2122,123 @@ static void updateNumberOfTickTransactions()
     ts.tickData.releaseLock();
 }
 
+// Maximum number of consecutive signed broadcast requests that a request processor takes from the queue at once in
+// order to verify their signatures in a batch
+#define SIGNED_REQUEST_BATCH_SIZE 8
+
+static bool isSignedBroadcastRequest(const RequestResponseHeader* request)
+{
+    const unsigned char type = request->type();
+    return type == BROADCAST_TRANSACTION || type == BroadcastTick::type || type == BroadcastFutureTickData::type;
+}
+
+// Requests in the queue can only be recycled in order, so holding a request whose processing takes long would block
+// reusing the queue memory (and the receive buffers of the peers) of all requests after it. Only requests whose
+// handlers are fast and bounded (no more than verifying a signature and sending a small response) are processed in
+// place. All others (such as queries of entities, assets, ticks, logs, and contract functions) are copied to the
+// processor's buffer and released before processing.
+static bool isRequestProcessedInPlace(const RequestResponseHeader* request)
+{
+    switch (request->type())
+    {
+    case ExchangePublicPeers::type:
+    case BroadcastMessage::type:
+    case BroadcastComputors::type:
+    case BroadcastTick::type:
+    case BroadcastFutureTickData::type:
+    case BROADCAST_TRANSACTION:
+    case RequestComputors::type:
+    case REQUEST_CURRENT_TICK_INFO:
+    case RESPOND_CURRENT_TICK_INFO:
+    case REQUEST_SYSTEM_INFO:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Verify the signatures of signed broadcast requests in a batch and set their SignatureStatus, which is passed to the
+// request handlers. Requests failing basic checks are skipped (SignatureNotVerified), because their handlers either
+// drop them without checking the signature or verify the signature themselves.
+static void verifySignedRequests(unsigned int numberOfRequests, RequestResponseHeader* const* headers, SignatureStatus* signatureStatuses)
+{
+    PROFILE_SCOPE();
+
+    ASSERT(numberOfRequests <= SIGNED_REQUEST_BATCH_SIZE);
+    const unsigned char* publicKeys[SIGNED_REQUEST_BATCH_SIZE];
+    const unsigned char* messageDigests[SIGNED_REQUEST_BATCH_SIZE];
+    const unsigned char* signatures[SIGNED_REQUEST_BATCH_SIZE];
+    m256i digests[SIGNED_REQUEST_BATCH_SIZE];
+    unsigned int requestIndices[SIGNED_REQUEST_BATCH_SIZE];
+    bool results[SIGNED_REQUEST_BATCH_SIZE];
+    unsigned int numberOfSignatures = 0;
+
+    for (unsigned int i = 0; i < numberOfRequests; i++)
+    {
+        signatureStatuses[i] = SignatureNotVerified;
+        RequestResponseHeader* header = headers[i];
+        switch (header->type())
+        {
+        case BROADCAST_TRANSACTION:
+        {
+            const Transaction* request = header->getPayload<Transaction>();
+            if (request->checkValidity() && request->totalSize() == header->size() - sizeof(RequestResponseHeader))
+            {
+                KangarooTwelve(request, request->totalSize() - SIGNATURE_SIZE, &digests[numberOfSignatures], sizeof(m256i));
+                publicKeys[numberOfSignatures] = request->sourcePublicKey.m256i_u8;
+                signatures[numberOfSignatures] = request->signaturePtr();
+                requestIndices[numberOfSignatures++] = i;
+            }
+        }
+        break;
+
+        case BroadcastTick::type:
+        {
+            BroadcastTick* request = header->getPayload<BroadcastTick>();
+            if (request->tick.computorIndex < NUMBER_OF_COMPUTORS
+                && request->tick.epoch == system.epoch
+                && request->tick.tick >= system.tick)
+            {
+                request->tick.computorIndex ^= BroadcastTick::type;
+                KangarooTwelve(&request->tick, sizeof(Tick) - SIGNATURE_SIZE, &digests[numberOfSignatures], sizeof(m256i));
+                request->tick.computorIndex ^= BroadcastTick::type;
+                publicKeys[numberOfSignatures] = broadcastedComputors.computors.publicKeys[request->tick.computorIndex].m256i_u8;
+                signatures[numberOfSignatures] = request->tick.signature;
+                requestIndices[numberOfSignatures++] = i;
+            }
+        }
+        break;
+
+        case BroadcastFutureTickData::type:
+        {
+            BroadcastFutureTickData* request = header->getPayload<BroadcastFutureTickData>();
+            if (request->tickData.epoch == system.epoch
+                && request->tickData.tick > system.tick
+                && request->tickData.tick % NUMBER_OF_COMPUTORS == request->tickData.computorIndex)
+            {
+                request->tickData.computorIndex ^= BroadcastFutureTickData::type;
+                KangarooTwelve(&request->tickData, sizeof(TickData) - SIGNATURE_SIZE, &digests[numberOfSignatures], sizeof(m256i));
+                request->tickData.computorIndex ^= BroadcastFutureTickData::type;
+                publicKeys[numberOfSignatures] = broadcastedComputors.computors.publicKeys[request->tickData.computorIndex].m256i_u8;
+                signatures[numberOfSignatures] = request->tickData.signature;
+                requestIndices[numberOfSignatures++] = i;
+            }
+        }
+        break;
+        }
+    }
+
+    for (unsigned int j = 0; j < numberOfSignatures; j++)
+    {
+        messageDigests[j] = digests[j].m256i_u8;
+    }
+    verifyBatch(numberOfSignatures, publicKeys, messageDigests, signatures, results);
+    for (unsigned int j = 0; j < numberOfSignatures; j++)
+    {
+        signatureStatuses[requestIndices[j]] = results[j] ? SignatureValid : SignatureInvalid;
+    }
+}
+
 // Disabling the optimizer for requestProcessor() is a workaround introduced to solve an issue
 // that has been observed in testnets/2024-11-23-release-227-qvault.
 // In this test, the processors calling requestProcessor() were stuck before entering the function.
@@ -1899,84 +2253,113 @@ static void requestProcessor(void* ProcedureArgument)
 
     Processor* processor = (Processor*)ProcedureArgument;
     RequestResponseHeader* header = (RequestResponseHeader*)processor->buffer;
+
+    // Requests taken from the queue that haven't been processed yet (more than one only if signed broadcast requests
+    // have been taken together for verifying their signatures in a batch). They are processed in place in the
+    // queue and released after processing.
+    RequestQueueBatch<decltype(requestQueue), SIGNED_REQUEST_BATCH_SIZE> batchedRequests;
+    SignatureStatus batchedRequestSignatureStatuses[SIGNED_REQUEST_BATCH_SIZE];
+
     while (!shutDownNode)
     {
         checkinTime(processorNumber);
         // in epoch transition, wait here
         if (epochTransitionState)
         {
+            // drop requests taken from the queue before (also their signature status may be outdated after the transition)
+            batchedRequests.releaseAll(requestQueue);
+
             _InterlockedIncrement(&epochTransitionWaitingRequestProcessors);
             BEGIN_WAIT_WHILE(epochTransitionState)
             {
+                // to avoid potential overflow: consume the queue without processing requests
+                unsigned int position;
+                if (requestQueue.tryDequeue(position))
                 {
-                    // to avoid potential overflow: consume the queue without processing requests
-                    ACQUIRE(requestQueueTailLock);
-                    if (requestQueueElementTail == requestQueueElementHead)
-                    {
-                        RELEASE(requestQueueTailLock);
-                    }
-                    else
-                    {
-                        {
-                            RequestResponseHeader* requestHeader = (RequestResponseHeader*)&requestQueueBuffer[requestQueueElements[requestQueueElementTail].offset];
-                            copyMem(header, requestHeader, requestHeader->size());
-                            requestQueueBufferTail += requestHeader->size();
-                        }
+                    requestQueue.release(position);
+                }
 
-                        Peer* peer = requestQueueElements[requestQueueElementTail].peer;
+                // help with parallel work of the epoch transition (such as reorganizing the spectrum)
+                helpWithParallelWork();
 
-                        if (requestQueueBufferTail > REQUEST_QUEUE_BUFFER_SIZE - BUFFER_SIZE)
-                        {
-                            requestQueueBufferTail = 0;
-                        }
-                        requestQueueElementTail++;
-                        RELEASE(requestQueueTailLock);
-                    }
-                }
+#if TICK_STORAGE_AUTOSAVE_MODE
+                // node states saved before the epoch transition need to be completed
+                saveNodeStateSnapshots();
+#endif
             }
             END_WAIT_WHILE();
             _InterlockedDecrement(&epochTransitionWaitingRequestProcessors);
         }
 
-        // try to compute a solution if any is queued and this thread is assigned to compute solution
-        if (solutionProcessorFlags[processorNumber])
+        // Held requests block recycling of all requests enqueued after them (also the receive buffers of the peers
+        // referenced by them), so work that may take long is only done after all of them have been processed.
+        if (batchedRequests.isEmpty())
         {
-            PROFILE_NAMED_SCOPE("requestProcessor(): solution processing");
-            score->tryProcessSolution(processorNumber);
+            // try to compute a solution if any is queued and this thread is assigned to compute solution
+            if (solutionProcessorFlags[processorNumber])
+            {
+                PROFILE_NAMED_SCOPE("requestProcessor(): solution processing");
+                if (!score->tryProcessSolution(processorNumber))
+                {
+                    // no solution of the current tick to process -> score solutions of upcoming ticks in advance
+                    score->tryProcessSpeculativeSolution(processorNumber);
+                }
+            }
+
+            // help with parallel work of the tick processor (such as updating spectrum digests) if there is any
+            helpWithParallelWork();
+
+#if TICK_STORAGE_AUTOSAVE_MODE
+            // save snapshots of node states in the background if requested (blocks this processor until done)
+            saveNodeStateSnapshots();
+#endif
         }
-        
-        if (requestQueueElementTail == requestQueueElementHead)
+
+        if (batchedRequests.isEmpty() && requestQueue.isEmpty())
         {
             _mm_pause();
         }
         else
         {
-            ACQUIRE(requestQueueTailLock);
-
-            if (requestQueueElementTail == requestQueueElementHead)
+            if (batchedRequests.isEmpty())
             {
-                RELEASE(requestQueueTailLock);
+                // Take request from queue (without lock, other processors may take the following requests concurrently).
+                // If it is a signed broadcast request, further requests are taken until the batch is full, the queue
+                // is empty, or a request that isn't a signed broadcast request is taken, in order to verify the
+                // signatures in a batch.
+                const unsigned int numberOfBatchedRequests = batchedRequests.take(requestQueue, isSignedBroadcastRequest);
+
+                if (numberOfBatchedRequests > 1)
+                {
+                    const unsigned long long beginningTick = __rdtsc();
+                    verifySignedRequests(numberOfBatchedRequests, batchedRequests.getRequests(), batchedRequestSignatureStatuses);
+                    queueProcessingNumerator += __rdtsc() - beginningTick;
+                }
+                else
+                {
+                    batchedRequestSignatureStatuses[0] = SignatureNotVerified;
+                }
             }
-            else
+
+            if (!batchedRequests.isEmpty())
             {
                 PROFILE_NAMED_SCOPE("requestProcessor(): request processing");
                 const unsigned long long beginningTick = __rdtsc();
 
-                {
-                    RequestResponseHeader* requestHeader = (RequestResponseHeader*)&requestQueueBuffer[requestQueueElements[requestQueueElementTail].offset];
-                    copyMem(header, requestHeader, requestHeader->size());
-                    requestQueueBufferTail += requestHeader->size();
-                }
-
-                Peer* peer = requestQueueElements[requestQueueElementTail].peer;
+                unsigned int position;
+                const unsigned int batchIndex = batchedRequests.takeNext(position);
+                header = batchedRequests.getRequests()[batchIndex];
+                Peer* peer = requestQueue.getPeer(position);
+                const SignatureStatus signatureStatus = batchedRequestSignatureStatuses[batchIndex];
 
-                if (requestQueueBufferTail > REQUEST_QUEUE_BUFFER_SIZE - BUFFER_SIZE)
+                // requests that may take long to process must not block recycling the queue memory
+                bool releaseAfterProcessing = true;
+                if (!isRequestProcessedInPlace(header))
                 {
-                    requestQueueBufferTail = 0;
+                    header = copyAndReleaseRequest(requestQueue, position, processor->buffer);
+                    releaseAfterProcessing = false;
                 }
-                requestQueueElementTail++;
 
-                RELEASE(requestQueueTailLock);
                 switch (header->type())
                 {
                 case ExchangePublicPeers::type:
@@ -1999,19 +2382,19 @@ static void requestProcessor(void* ProcedureArgument)
 
                 case BroadcastTick::type:
                 {
-                    processBroadcastTick(peer, header);
+                    processBroadcastTick(peer, header, signatureStatus);
                 }
                 break;
 
                 case BroadcastFutureTickData::type:
                 {
-                    processBroadcastFutureTickData(peer, header);
+                    processBroadcastFutureTickData(peer, header, signatureStatus);
                 }
                 break;
 
                 case BROADCAST_TRANSACTION:
                 {
-                    processBroadcastTransaction(peer, header);
+                    processBroadcastTransaction(peer, header, signatureStatus);
                 }
                 break;
 
@@ -2162,6 +2545,11 @@ static void requestProcessor(void* ProcedureArgument)
 
                 }
 
+                if (releaseAfterProcessing)
+                {
+                    requestQueue.release(position);
+                }
+
                 queueProcessingNumerator += __rdtsc() - beginningTick;
                 queueProcessingDenominator++;
 
@@ -2190,6 +2578,7 @@ static void contractProcessor(void*)
             if (system.epoch == contractDescriptions[executedContractIndex].constructionEpoch
                 && system.epoch < contractDescriptions[executedContractIndex].destructionEpoch)
             {
+                beforeContractStateWrite(executedContractIndex);
                 setMem(contractStates[executedContractIndex], contractDescriptions[executedContractIndex].stateSize, 0);
                 QpiContextSystemProcedureCall qpiContext(executedContractIndex, INITIALIZE);
                 qpiContext.call();
@@ -2213,30 +2602,10 @@ static void contractProcessor(void*)
     break;
 
     case BEGIN_TICK:
-    {
-        for (executedContractIndex = 1; executedContractIndex < contractCount; executedContractIndex++)
-        {
-            if (system.epoch >= contractDescriptions[executedContractIndex].constructionEpoch
-                && system.epoch < contractDescriptions[executedContractIndex].destructionEpoch)
-            {
-                QpiContextSystemProcedureCall qpiContext(executedContractIndex, BEGIN_TICK);
-                qpiContext.call();
-            }
-        }
-    }
-    break;
-
     case END_TICK:
     {
-        for (executedContractIndex = contractCount; executedContractIndex-- > 1; )
-        {
-            if (system.epoch >= contractDescriptions[executedContractIndex].constructionEpoch
-                && system.epoch < contractDescriptions[executedContractIndex].destructionEpoch)
-            {
-                QpiContextSystemProcedureCall qpiContext(executedContractIndex, END_TICK);
-                qpiContext.call();
-            }
-        }
+        // isolated procedures run in parallel with help of the request processors
+        runTickSystemProcedures((SystemProcedureID)contractProcessorPhase);
     }
     break;
 
@@ -2795,6 +3164,64 @@ static void processTickTransaction(const Transaction* transaction, const m256i&
     }
 }
 
+// Process the plain QU transfers collected in transferBatch with the same result as calling processTickTransaction()
+// for each of them, but with the spectrum lookups done in parallel. Resets transferBatch.
+static void processTickTransferBatch(unsigned long long processorNumber)
+{
+    PROFILE_SCOPE();
+
+    if (!transferBatch.getNumberOfTransfers())
+        return;
+
+    if (!transferBatch.execute())
+    {
+        // may trigger anti-dust, so process transfers one by one
+        for (unsigned int i = 0; i < transferBatch.getNumberOfTransfers(); i++)
+        {
+            const TransferBatch::Transfer& transfer = transferBatch.getTransfer(i);
+            logger.registerNewTx(transfer.transaction->tick, transfer.transactionIndex);
+            processTickTransaction(transfer.transaction, nextTickData.transactionDigests[transfer.transactionIndex], nextTickData.timelock, processorNumber);
+        }
+        transferBatch.reset();
+        return;
+    }
+
+    for (unsigned int i = 0; i < transferBatch.getNumberOfTransfers(); i++)
+    {
+        const TransferBatch::Transfer& transfer = transferBatch.getTransfer(i);
+        const Transaction* transaction = transfer.transaction;
+        const m256i& transactionDigest = nextTickData.transactionDigests[transfer.transactionIndex];
+        logger.registerNewTx(transaction->tick, transfer.transactionIndex);
+
+        // Same steps as in processTickTransaction() for transactions to entities that are neither system nor contract
+        ts.transactionsDigestAccess.acquireLock();
+        ts.transactionsDigestAccess.insertTransaction(transactionDigest, transaction);
+        ts.transactionsDigestAccess.releaseLock();
+
+        if (transfer.sourceExists)
+        {
+            numberOfTransactions++;
+            bool moneyFlew = false;
+#if ADDON_TX_STATUS_REQUEST
+            txStatusData.tickTxIndexStart[system.tick - system.initialTick + 1] = numberOfTransactions; // qli: part of tx_status_request add-on
+#endif
+            if (transferBatch.commit(i))
+            {
+                const QuTransfer quTransfer = { transaction->sourcePublicKey , transaction->destinationPublicKey , transaction->amount };
+                logger.logQuTransfer(quTransfer);
+                if (transaction->amount)
+                {
+                    moneyFlew = true;
+                }
+            }
+#if ADDON_TX_STATUS_REQUEST
+            saveConfirmedTx(numberOfTransactions - 1, moneyFlew, system.tick, transactionDigest); // qli: save tx
+#endif
+        }
+    }
+    transferBatch.reset();
+}
+
 static void makeAndBroadcastTickVotesTransaction(int i, BroadcastFutureTickData& td, int txSlot)
 {
     PROFILE_NAMED_SCOPE("processTick(): broadcast vote counter tx");
@@ -2820,16 +3247,12 @@ static void makeAndBroadcastTickVotesTransaction(int i, BroadcastFutureTickData&
     auto* tsReqTickTransactionOffsets = ts.tickTransactionOffsets.getByTickIndex(tickIndex);
     if (txSlot < NUMBER_OF_TRANSACTIONS_PER_TICK) // valid slot
     {
-        // TODO: refactor function add transaction to txStorage
         ts.tickTransactions.acquireLock();
         if (!tsReqTickTransactionOffsets[txSlot]) // not yet have value
         {
-            if (ts.nextTickTransactionOffset + transactionSize <= ts.tickTransactions.storageSpaceCurrentEpoch) //have enough space
+            if (ts.addTransaction(td.tickData.tick, txSlot, &payload.transaction, m256i(digest)))
             {
                 td.tickData.transactionDigests[txSlot] = m256i(digest);
-                tsReqTickTransactionOffsets[txSlot] = ts.nextTickTransactionOffset;
-                copyMem(ts.tickTransactions(ts.nextTickTransactionOffset), &payload, transactionSize);
-                ts.nextTickTransactionOffset += transactionSize;
             }
         }
         ts.tickTransactions.releaseLock();
@@ -2858,16 +3281,12 @@ static bool makeAndBroadcastCustomMiningTransaction(int i, BroadcastFutureTickDa
             auto* tsReqTickTransactionOffsets = ts.tickTransactionOffsets.getByTickIndex(tickIndex);
             if (txSlot < NUMBER_OF_TRANSACTIONS_PER_TICK) // valid slot
             {
-                // TODO: refactor function add transaction to txStorage
                 ts.tickTransactions.acquireLock();
                 if (!tsReqTickTransactionOffsets[txSlot]) // not yet have value
                 {
-                    if (ts.nextTickTransactionOffset + transactionSize <= ts.tickTransactions.storageSpaceCurrentEpoch) //have enough space
+                    if (ts.addTransaction(td.tickData.tick, txSlot, &payload.transaction, m256i(digest)))
                     {
                         td.tickData.transactionDigests[txSlot] = m256i(digest);
-                        tsReqTickTransactionOffsets[txSlot] = ts.nextTickTransactionOffset;
-                        copyMem(ts.tickTransactions(ts.nextTickTransactionOffset), &payload, transactionSize);
-                        ts.nextTickTransactionOffset += transactionSize;
                     }
                 }
                 ts.tickTransactions.releaseLock();
@@ -3011,8 +3430,10 @@ static void processTick(unsigned long long processorNumber)
         }
         solutionTotalExecutionTicks = __rdtsc() - solutionProcessStartTick; // for tracking the time processing solutions
 
-        // Process all transaction of the tick
+        // Process all transaction of the tick. Consecutive plain QU transfers are collected and processed as a batch,
+        // the other transactions one by one in between.
         PROFILE_NAMED_SCOPE_BEGIN("processTick(): process transactions");
+        transferBatch.reset();
         for (unsigned int transactionIndex = 0; transactionIndex < NUMBER_OF_TRANSACTIONS_PER_TICK; transactionIndex++)
         {
             if (!isZero(nextTickData.transactionDigests[transactionIndex]))
@@ -3020,8 +3441,16 @@ static void processTick(unsigned long long processorNumber)
                 if (tsCurrentTickTransactionOffsets[transactionIndex])
                 {
                     Transaction* transaction = ts.tickTransactions(tsCurrentTickTransactionOffsets[transactionIndex]);
-                    logger.registerNewTx(transaction->tick, transactionIndex);
-                    processTickTransaction(transaction, nextTickData.transactionDigests[transactionIndex], nextTickData.timelock, processorNumber);
+                    if (TransferBatch::isPlainTransfer(transaction))
+                    {
+                        transferBatch.add(transaction, transactionIndex);
+                    }
+                    else
+                    {
+                        processTickTransferBatch(processorNumber);
+                        logger.registerNewTx(transaction->tick, transactionIndex);
+                        processTickTransaction(transaction, nextTickData.transactionDigests[transactionIndex], nextTickData.timelock, processorNumber);
+                    }
                 }
                 else
                 {
@@ -3032,6 +3461,7 @@ static void processTick(unsigned long long processorNumber)
                 }
             }
         }
+        processTickTransferBatch(processorNumber);
         PROFILE_SCOPE_END();
     }
 
@@ -3043,34 +3473,8 @@ static void processTick(unsigned long long processorNumber)
     PROFILE_SCOPE_END();
 
     PROFILE_NAMED_SCOPE_BEGIN("processTick(): get spectrum digest");
-    unsigned int digestIndex;
     ACQUIRE(spectrumLock);
-    for (digestIndex = 0; digestIndex < SPECTRUM_CAPACITY; digestIndex++)
-    {
-        if (spectrum[digestIndex].latestIncomingTransferTick == system.tick || spectrum[digestIndex].latestOutgoingTransferTick == system.tick)
-        {
-            KangarooTwelve64To32(&spectrum[digestIndex], &spectrumDigests[digestIndex]);
-            spectrumChangeFlags[digestIndex >> 6] |= (1ULL << (digestIndex & 63));
-        }
-    }
-    unsigned int previousLevelBeginning = 0;
-    unsigned int numberOfLeafs = SPECTRUM_CAPACITY;
-    while (numberOfLeafs > 1)
-    {
-        for (unsigned int i = 0; i < numberOfLeafs; i += 2)
-        {
-            if (spectrumChangeFlags[i >> 6] & (3ULL << (i & 63)))
-            {
-                KangarooTwelve64To32(&spectrumDigests[previousLevelBeginning + i], &spectrumDigests[digestIndex]);
-                spectrumChangeFlags[i >> 6] &= ~(3ULL << (i & 63));
-                spectrumChangeFlags[i >> 7] |= (1ULL << ((i >> 1) & 63));
-            }
-            digestIndex++;
-        }
-        previousLevelBeginning += numberOfLeafs;
-        numberOfLeafs >>= 1;
-    }
-    spectrumChangeFlags[0] = 0;
+    updateSpectrumDigests();
 
     etalonTick.saltedSpectrumDigest = spectrumDigests[(SPECTRUM_CAPACITY * 2 - 1) - 1];
     RELEASE(spectrumLock);
@@ -3193,13 +3597,11 @@ static void processTick(unsigned long long processorNumber)
                             if (ts.nextTickTransactionOffset + transactionSize <= ts.tickTransactions.storageSpaceCurrentEpoch)
                             {
                                 ts.tickTransactions.acquireLock();
-                                if (ts.nextTickTransactionOffset + transactionSize <= ts.tickTransactions.storageSpaceCurrentEpoch)
+                                const m256i transactionDigest = &computorPendingTransactionDigests[entityPendingTransactionIndices[index] * 32ULL];
+                                if (ts.addTransaction(pendingTransaction->tick, j, pendingTransaction, transactionDigest))
                                 {
-                                    ts.tickTransactionOffsets(pendingTransaction->tick, j) = ts.nextTickTransactionOffset;
-                                    copyMem(ts.tickTransactions(ts.nextTickTransactionOffset), (void*)pendingTransaction, transactionSize);
-                                    broadcastedFutureTickData.tickData.transactionDigests[j] = &computorPendingTransactionDigests[entityPendingTransactionIndices[index] * 32ULL];
+                                    broadcastedFutureTickData.tickData.transactionDigests[j] = transactionDigest;
                                     j++;
-                                    ts.nextTickTransactionOffset += transactionSize;
                                 }
                                 ts.tickTransactions.releaseLock();
                             }
@@ -3210,17 +3612,15 @@ static void processTick(unsigned long long processorNumber)
 
                     RELEASE(computorPendingTransactionsLock);
 
-                    ACQUIRE(entityPendingTransactionsLock);
+                    pendingTxsPool.acquireLock();
 
                     // Get indices of pending non-computor transactions that are scheduled to be included in tickData
+                    // (only touching the bucket of the target tick)
                     numberOfEntityPendingTransactionIndices = 0;
-                    for (unsigned int k = 0; k < SPECTRUM_CAPACITY; k++)
+                    for (unsigned int k = pendingTxsPool.getFirstTickTxIndex(system.tick + TICK_TRANSACTIONS_PUBLICATION_OFFSET);
+                         k != PendingTxsPool::NO_TX_INDEX; k = pendingTxsPool.getNextTickTxIndex(k))
                     {
-                        const Transaction* tx = ((Transaction*)&entityPendingTransactions[k * MAX_TRANSACTION_SIZE]);
-                        if (tx->tick == system.tick + TICK_TRANSACTIONS_PUBLICATION_OFFSET)
-                        {
-                            entityPendingTransactionIndices[numberOfEntityPendingTransactionIndices++] = k;
-                        }
+                        entityPendingTransactionIndices[numberOfEntityPendingTransactionIndices++] = k;
                     }
 
                     // Randomly select non-computor tx scheduled for the tick until tick is full or all pending tx are included
@@ -3228,7 +3628,7 @@ static void processTick(unsigned long long processorNumber)
                     {
                         const unsigned int index = random(numberOfEntityPendingTransactionIndices);
 
-                        const Transaction* pendingTransaction = ((Transaction*)&entityPendingTransactions[entityPendingTransactionIndices[index] * MAX_TRANSACTION_SIZE]);
+                        const Transaction* pendingTransaction = pendingTxsPool.getTx(entityPendingTransactionIndices[index]);
                         ASSERT(pendingTransaction->tick == system.tick + TICK_TRANSACTIONS_PUBLICATION_OFFSET);
                         {
                             ASSERT(pendingTransaction->checkValidity());
@@ -3236,13 +3636,11 @@ static void processTick(unsigned long long processorNumber)
                             if (ts.nextTickTransactionOffset + transactionSize <= ts.tickTransactions.storageSpaceCurrentEpoch)
                             {
                                 ts.tickTransactions.acquireLock();
-                                if (ts.nextTickTransactionOffset + transactionSize <= ts.tickTransactions.storageSpaceCurrentEpoch)
+                                const m256i& transactionDigest = pendingTxsPool.getDigest(entityPendingTransactionIndices[index]);
+                                if (ts.addTransaction(pendingTransaction->tick, j, pendingTransaction, transactionDigest))
                                 {
-                                    ts.tickTransactionOffsets(pendingTransaction->tick, j) = ts.nextTickTransactionOffset;
-                                    copyMem(ts.tickTransactions(ts.nextTickTransactionOffset), (void*)pendingTransaction, transactionSize);
-                                    broadcastedFutureTickData.tickData.transactionDigests[j] = &entityPendingTransactionDigests[entityPendingTransactionIndices[index] * 32ULL];
+                                    broadcastedFutureTickData.tickData.transactionDigests[j] = transactionDigest;
                                     j++;
-                                    ts.nextTickTransactionOffset += transactionSize;
                                 }
                                 ts.tickTransactions.releaseLock();
                             }
@@ -3251,7 +3649,7 @@ static void processTick(unsigned long long processorNumber)
                         entityPendingTransactionIndices[index] = entityPendingTransactionIndices[--numberOfEntityPendingTransactionIndices];
                     }
 
-                    RELEASE(entityPendingTransactionsLock);
+                    pendingTxsPool.releaseLock();
 
                     {
                         // insert & broadcast vote counter tx
@@ -3441,10 +3839,7 @@ static void beginEpoch()
     {
         ((Transaction*)&computorPendingTransactions[i * MAX_TRANSACTION_SIZE])->tick = 0;
     }
-    for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
-    {
-        ((Transaction*)&entityPendingTransactions[i * MAX_TRANSACTION_SIZE])->tick = 0;
-    }
+    pendingTxsPool.beginEpoch(system.initialTick);
 
     setMem(solutionPublicationTicks, sizeof(solutionPublicationTicks), 0);
     setMem(faultyComputorFlags, sizeof(faultyComputorFlags), 0);
@@ -3463,6 +3858,7 @@ static void beginEpoch()
 
     score->initMemory();
     score->resetTaskQueue();
+    score->resetSpeculativeQueue();
     setMem(minerSolutionFlags, NUMBER_OF_MINER_SOLUTION_FLAGS / 8, 0);
     setMem((void*)minerPublicKeys, sizeof(minerPublicKeys), 0);
     setMem((void*)minerScores, sizeof(minerScores), 0);
@@ -3767,62 +4163,108 @@ static bool invalidateNodeStates(CHAR16* directory)
     return ts.saveInvalidateData(system.epoch, directory);
 }
 
-// can only called from main thread
-static bool saveAllNodeStates()
+// Release the snapshots taken by saveAllNodeStates() without saving them (can only be called from main thread before
+// the snapshots are handed over to the request processors)
+static void discardNodeStateSnapshots()
 {
-    PROFILE_SCOPE();
-
+    spectrumSnapshot.capture(0, snapshotBuffer);
+    universeSnapshot.capture(0, snapshotBuffer);
+    for (unsigned int contractIndex = 0; contractIndex < contractCount; contractIndex++)
+    {
+        contractStateSnapshot.capture(contractIndex, snapshotBuffer);
+    }
+    RELEASE(snapshotBufferLock);
+
+    // the record of changed pages has been reset by taking the snapshots, so the next save needs to be a base image
+    nodeStateBaseTick = 0;
+}
+
+// can only called from main thread
+static bool saveAllNodeStates()
+{
+    PROFILE_SCOPE();
+
     CHAR16 directory[16];
     setText(directory, L"ep");
     appendNumber(directory, system.epoch, false);
 
     logToConsole(L"Start saving node states from main thread");
 
+    // Only one snapshot can be saved at a time. The lock is released by finishSavingAllNodeStates() or on error.
+    if (nodeStateSnapshotStage != NodeStateSnapshotIdle || !TRY_ACQUIRE(snapshotBufferLock))
+    {
+        logToConsole(L"Cannot save node states while another snapshot is being saved");
+        return false;
+    }
+
     // Mark current snapshot metadata as invalid at the beginning.
     // Any reasons make the valid metadata can not be overwritten at the final step will keep this invalid file
     // and make the loadAllNodeStates see this saving as an invalid save.
     if (!invalidateNodeStates(directory))
     {
         logToConsole(L"Failed to init snapshot metadata");
+        RELEASE(snapshotBufferLock);
         return false;
     }
 
-    SPECTRUM_FILE_NAME[sizeof(SPECTRUM_FILE_NAME) / sizeof(SPECTRUM_FILE_NAME[0]) - 4] = L'0';
-    SPECTRUM_FILE_NAME[sizeof(SPECTRUM_FILE_NAME) / sizeof(SPECTRUM_FILE_NAME[0]) - 3] = L'0';
-    SPECTRUM_FILE_NAME[sizeof(SPECTRUM_FILE_NAME) / sizeof(SPECTRUM_FILE_NAME[0]) - 2] = L'0';
-    setText(message, L"Saving spectrum to ");
-    appendText(message, directory); appendText(message, L"/");
-    appendText(message, SPECTRUM_FILE_NAME);
-    logToConsole(message);
-    if (!saveSpectrum(SPECTRUM_FILE_NAME, directory))
+    // Save the full states as base image or only the pages changed since the previous save as delta segments. A delta
+    // is only worth it if it is much smaller than the full states.
+    nodeStateSnapshotIsDelta = false;
+    if (nodeStateBaseTick && nodeStateBaseEpoch == system.epoch && nodeStateNumberOfDeltas < NODE_STATE_DELTAS_PER_BASE_IMAGE)
     {
-        logToConsole(L"Failed to save spectrum");
-        return false;
+        unsigned long long changedPages = spectrumSnapshot.getNumberOfChangedPages(0) + universeSnapshot.getNumberOfChangedPages(0);
+        unsigned long long totalSize = spectrumSnapshot.getRegionSize(0) + universeSnapshot.getRegionSize(0);
+        for (unsigned int contractIndex = 0; contractIndex < contractCount; contractIndex++)
+        {
+            changedPages += contractStateSnapshot.getNumberOfChangedPages(contractIndex);
+            totalSize += contractStateSnapshot.getRegionSize(contractIndex);
+        }
+        nodeStateSnapshotIsDelta = nodeStateDeltaSize(changedPages) < totalSize / 2;
+    }
+    if (nodeStateSnapshotIsDelta)
+    {
+        nodeStateNumberOfDeltas++;
+    }
+    else
+    {
+        nodeStateBaseEpoch = system.epoch;
+        nodeStateBaseTick = system.tick;
+        nodeStateNumberOfDeltas = 0;
     }
 
-    UNIVERSE_FILE_NAME[sizeof(UNIVERSE_FILE_NAME) / sizeof(UNIVERSE_FILE_NAME[0]) - 4] = L'0';
-    UNIVERSE_FILE_NAME[sizeof(UNIVERSE_FILE_NAME) / sizeof(UNIVERSE_FILE_NAME[0]) - 3] = L'0';
-    UNIVERSE_FILE_NAME[sizeof(UNIVERSE_FILE_NAME) / sizeof(UNIVERSE_FILE_NAME[0]) - 2] = L'0';
-    setText(message, L"Saving universe to ");
-    appendText(message, directory); appendText(message, L"/");
-    appendText(message, UNIVERSE_FILE_NAME);
-    logToConsole(message);
-    if (!saveUniverse(UNIVERSE_FILE_NAME, directory))
+    NodeStateDeltaChain deltaChain;
+    deltaChain.epoch = nodeStateBaseEpoch;
+    deltaChain.baseTick = nodeStateBaseTick;
+    deltaChain.numberOfDeltas = nodeStateNumberOfDeltas;
+    deltaChain._padding = 0;
+    CHAR16 DELTA_CHAIN_FILE_NAME[] = L"snapshotDeltaChain";
+    if (save(DELTA_CHAIN_FILE_NAME, sizeof(deltaChain), (unsigned char*)&deltaChain, directory) != sizeof(deltaChain))
     {
-        logToConsole(L"Failed to save universe");
+        logToConsole(L"Failed to save delta chain");
+        nodeStateBaseTick = 0;
+        RELEASE(snapshotBufferLock);
         return false;
     }
 
-    CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 4] = L'0';
-    CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 3] = L'0';
-    CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 2] = L'0';
-    setText(message, L"Saving computer files");
-    logToConsole(message);
-    if (!saveComputer(directory))
+    // Take snapshots of spectrum, universe, and contract states at the cut tick. They are saved in the background
+    // by saveNodeStateSnapshots() after the tick processor has been resumed.
+    nodeStateSnapshotBeginningTick = __rdtsc();
+    if (nodeStateSnapshotIsDelta)
     {
-        logToConsole(L"Failed to save computer");
-        return false;
+        beginSpectrumSnapshot(CopyOnWriteSnapshot<1>::captureChanged);
+        beginUniverseSnapshot(CopyOnWriteSnapshot<1>::captureChanged);
+        beginComputerSnapshot(CopyOnWriteSnapshot<contractCount>::captureChanged);
     }
+    else
+    {
+        beginSpectrumSnapshot(CopyOnWriteSnapshot<1>::captureBase);
+        beginUniverseSnapshot(CopyOnWriteSnapshot<1>::captureBase);
+        beginComputerSnapshot(CopyOnWriteSnapshot<contractCount>::captureBase);
+    }
+    nodeStateSnapshotEpoch = system.epoch;
+    nodeStateSnapshotTick = system.tick;
+    setText(nodeStateSnapshotDirectory, directory);
+
     setText(message, L"Saving system to system.snp");
     logToConsole(message);
 
@@ -3831,6 +4273,7 @@ static bool saveAllNodeStates()
     if (savedSize != sizeof(system))
     {
         logToConsole(L"Failed to save system");
+        discardNodeStateSnapshots();
         return false;
     }
     
@@ -3858,35 +4301,12 @@ static bool saveAllNodeStates()
     if (savedSize != sizeof(nodeStateBuffer))
     {
         logToConsole(L"Failed to save etalon tick and other states");
-        return false;
-    }
-    
-    CHAR16 SPECTRUM_DIGEST_FILE_NAME[] = L"snapshotSpectrumDigest";
-    savedSize = save(SPECTRUM_DIGEST_FILE_NAME, spectrumDigestsSizeInByte, (unsigned char*)spectrumDigests, directory);
-    logToConsole(L"Saving spectrum digests");
-    if (savedSize != spectrumDigestsSizeInByte)
-    {
-        logToConsole(L"Failed to save spectrum digest");
+        discardNodeStateSnapshots();
         return false;
     }
 
-    CHAR16 UNIVERSE_DIGEST_FILE_NAME[] = L"snapshotUniverseDigest";
-    savedSize = save(UNIVERSE_DIGEST_FILE_NAME, assetDigestsSizeInBytes, (unsigned char*)assetDigests, directory);
-    logToConsole(L"Saving universe digests");
-    if (savedSize != assetDigestsSizeInBytes)
-    {
-        logToConsole(L"Failed to save universe digest");
-        return false;
-    }
-
-    CHAR16 COMPUTER_DIGEST_FILE_NAME[] = L"snapshotComputerDigest";
-    savedSize = save(COMPUTER_DIGEST_FILE_NAME, contractStateDigestsSizeInBytes, (unsigned char*)contractStateDigests, directory);
-    logToConsole(L"Saving computer digests");
-    if (savedSize != contractStateDigestsSizeInBytes)
-    {
-        logToConsole(L"Failed to save computer digest");
-        return false;
-    }
+    // Digests of spectrum, universe, and contract states aren't saved, because they would need to be snapshotted
+    // too. They are recomputed by loadAllNodeStates() instead.
 
     CHAR16 MINER_SOL_FLAG_FILE_NAME[] = L"snapshotMinerSolutionFlag";
     logToConsole(L"Saving miner solution flags");
@@ -3894,14 +4314,7 @@ static bool saveAllNodeStates()
     if (savedSize != NUMBER_OF_MINER_SOLUTION_FLAGS / 8)
     {
         logToConsole(L"Failed to save miner solution flag");
-        return false;
-    }
-
-    setText(message, L"Saving tick storage ");
-    logToConsole(message);
-    if (ts.trySaveToFile(system.epoch, system.tick, directory) != 0)
-    {
-        logToConsole(L"Failed to save tick storage");
+        discardNodeStateSnapshots();
         return false;
     }
 
@@ -3909,12 +4322,201 @@ static bool saveAllNodeStates()
     if (!saveStateTxStatus(numberOfTransactions, directory))
     {
         logToConsole(L"Failed to save tx status");
+        discardNodeStateSnapshots();
         return false;
     }
 #endif
 #if ENABLED_LOGGING
     logger.saveCurrentLoggingStates(directory);
 #endif
+
+    // Let a request processor save the snapshots in the background
+    _InterlockedExchange(&nodeStateSnapshotStage, NodeStateSnapshotPending);
+    if (nodeStateSnapshotIsDelta)
+    {
+        setText(message, L"Saving changes of spectrum, universe, and computer in background (delta ");
+        appendNumber(message, nodeStateNumberOfDeltas, FALSE);
+        appendText(message, L" of base image of tick ");
+        appendNumber(message, nodeStateBaseTick, FALSE);
+        appendText(message, L")");
+        logToConsole(message);
+    }
+    else
+    {
+        logToConsole(L"Saving spectrum, universe, and computer in background");
+    }
+
+    return true;
+}
+
+// Save spectrum, universe, and contract files from the snapshots taken by saveAllNodeStates(). Called regularly by
+// request processors, only one of them does the work. Blocks the calling request processor until the files are
+// written by the main loop.
+static void saveNodeStateSnapshots()
+{
+    if (nodeStateSnapshotStage != NodeStateSnapshotPending
+        || _InterlockedCompareExchange(&nodeStateSnapshotStage, NodeStateSnapshotSaving, NodeStateSnapshotPending) != NodeStateSnapshotPending)
+    {
+        return;
+    }
+
+    // The files are saved with epoch suffix "000" (file names are copied, because the globals may be changed by
+    // other processors in the meantime)
+    CHAR16 spectrumFileName[sizeof(SPECTRUM_FILE_NAME) / sizeof(SPECTRUM_FILE_NAME[0])];
+    copyMem(spectrumFileName, SPECTRUM_FILE_NAME, sizeof(spectrumFileName));
+    spectrumFileName[sizeof(spectrumFileName) / sizeof(spectrumFileName[0]) - 4] = L'0';
+    spectrumFileName[sizeof(spectrumFileName) / sizeof(spectrumFileName[0]) - 3] = L'0';
+    spectrumFileName[sizeof(spectrumFileName) / sizeof(spectrumFileName[0]) - 2] = L'0';
+
+    CHAR16 universeFileName[sizeof(UNIVERSE_FILE_NAME) / sizeof(UNIVERSE_FILE_NAME[0])];
+    copyMem(universeFileName, UNIVERSE_FILE_NAME, sizeof(universeFileName));
+    universeFileName[sizeof(universeFileName) / sizeof(universeFileName[0]) - 4] = L'0';
+    universeFileName[sizeof(universeFileName) / sizeof(universeFileName[0]) - 3] = L'0';
+    universeFileName[sizeof(universeFileName) / sizeof(universeFileName[0]) - 2] = L'0';
+
+    CHAR16 contractFileName[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0])];
+    copyMem(contractFileName, CONTRACT_FILE_NAME, sizeof(contractFileName));
+    contractFileName[sizeof(contractFileName) / sizeof(contractFileName[0]) - 4] = L'0';
+    contractFileName[sizeof(contractFileName) / sizeof(contractFileName[0]) - 3] = L'0';
+    contractFileName[sizeof(contractFileName) / sizeof(contractFileName[0]) - 2] = L'0';
+
+    bool saved = true;
+    if (nodeStateSnapshotIsDelta)
+    {
+        // Save the changed pages to files named after the base image with suffix ".d<deltaIndex>". A segment is
+        // saved for each contract, even if nothing has changed, so the loader can tell missing files from no changes.
+        CHAR16 deltaFileName[64];
+        getNodeStateDeltaFileName(deltaFileName, spectrumFileName, nodeStateNumberOfDeltas);
+        saved = saveNodeStateDelta(spectrumSnapshot, 0, snapshotBuffer, nodeStateBaseEpoch, nodeStateBaseTick,
+            nodeStateSnapshotTick, nodeStateNumberOfDeltas, deltaFileName, nodeStateSnapshotDirectory);
+
+        getNodeStateDeltaFileName(deltaFileName, universeFileName, nodeStateNumberOfDeltas);
+        saved = saveNodeStateDelta(universeSnapshot, 0, snapshotBuffer, nodeStateBaseEpoch, nodeStateBaseTick,
+            nodeStateSnapshotTick, nodeStateNumberOfDeltas, deltaFileName, nodeStateSnapshotDirectory) && saved;
+
+        for (unsigned int contractIndex = 0; contractIndex < contractCount; contractIndex++)
+        {
+            contractFileName[sizeof(contractFileName) / sizeof(contractFileName[0]) - 9] = contractIndex / 1000 + L'0';
+            contractFileName[sizeof(contractFileName) / sizeof(contractFileName[0]) - 8] = (contractIndex % 1000) / 100 + L'0';
+            contractFileName[sizeof(contractFileName) / sizeof(contractFileName[0]) - 7] = (contractIndex % 100) / 10 + L'0';
+            contractFileName[sizeof(contractFileName) / sizeof(contractFileName[0]) - 6] = contractIndex % 10 + L'0';
+            getNodeStateDeltaFileName(deltaFileName, contractFileName, nodeStateNumberOfDeltas);
+            saved = saveNodeStateDelta(contractStateSnapshot, contractIndex, snapshotBuffer, nodeStateBaseEpoch, nodeStateBaseTick,
+                nodeStateSnapshotTick, nodeStateNumberOfDeltas, deltaFileName, nodeStateSnapshotDirectory) && saved;
+        }
+    }
+    else
+    {
+        saved = saveSpectrumSnapshot(spectrumFileName, nodeStateSnapshotDirectory);
+        saved = saveUniverseSnapshot(universeFileName, nodeStateSnapshotDirectory) && saved;
+        saved = (saveComputerSnapshot(contractFileName, nodeStateSnapshotDirectory) >= 0) && saved;
+    }
+
+    nodeStateSnapshotsSaved = saved;
+    _InterlockedExchange(&nodeStateSnapshotStage, NodeStateSnapshotSaved);
+}
+
+// Finish saving node states after the snapshots have been saved by saveNodeStateSnapshots() (can only be called from
+// main thread). The tick storage is saved up to the cut tick, which also marks the saved states as valid.
+static void finishSavingAllNodeStates()
+{
+    if (nodeStateSnapshotStage != NodeStateSnapshotSaved)
+    {
+        return;
+    }
+
+    if (nodeStateSnapshotsSaved)
+    {
+        setText(message, L"Saving tick storage ");
+        logToConsole(message);
+        if (ts.trySaveToFile(nodeStateSnapshotEpoch, nodeStateSnapshotTick, nodeStateSnapshotDirectory) != 0)
+        {
+            logToConsole(L"Failed to save tick storage");
+            nodeStateBaseTick = 0;
+        }
+        else
+        {
+            setText(message, L"Complete saving all node states (");
+            appendNumber(message, (__rdtsc() - nodeStateSnapshotBeginningTick) * 1000 / frequency, TRUE);
+            appendText(message, L" ms, ");
+            appendNumber(message, spectrumSnapshot.numberOfCopiedPages + universeSnapshot.numberOfCopiedPages + contractStateSnapshot.numberOfCopiedPages, TRUE);
+            appendText(message, L" pages copied on write in total).");
+            logToConsole(message);
+        }
+    }
+    else
+    {
+        logToConsole(L"Failed to save spectrum, universe, or computer");
+        nodeStateBaseTick = 0;
+    }
+
+    RELEASE(snapshotBufferLock);
+    _InterlockedExchange(&nodeStateSnapshotStage, NodeStateSnapshotIdle);
+}
+
+// Replay the delta segments saved after the base image of spectrum, universe, and contract states, which have been
+// loaded already (with epoch suffix "000"). Snapshots without delta chain file only consist of the base image.
+static bool loadNodeStateDeltas(CHAR16* directory)
+{
+    NodeStateDeltaChain deltaChain;
+    CHAR16 DELTA_CHAIN_FILE_NAME[] = L"snapshotDeltaChain";
+    if (getFileSize(DELTA_CHAIN_FILE_NAME, directory) != sizeof(deltaChain))
+    {
+        return true;
+    }
+    if (load(DELTA_CHAIN_FILE_NAME, sizeof(deltaChain), (unsigned char*)&deltaChain, directory) != sizeof(deltaChain))
+    {
+        logToConsole(L"Failed to load delta chain");
+        return false;
+    }
+    if (!deltaChain.numberOfDeltas)
+    {
+        return true;
+    }
+
+    setText(message, L"Applying ");
+    appendNumber(message, deltaChain.numberOfDeltas, FALSE);
+    appendText(message, L" delta segments to base image of tick ");
+    appendNumber(message, deltaChain.baseTick, FALSE);
+    logToConsole(message);
+
+    CHAR16 deltaFileName[64];
+    for (unsigned int deltaIndex = 1; deltaIndex <= deltaChain.numberOfDeltas; deltaIndex++)
+    {
+        getNodeStateDeltaFileName(deltaFileName, SPECTRUM_FILE_NAME, deltaIndex);
+        bool loaded = loadNodeStateDelta((unsigned char*)spectrum, spectrumSizeInBytes, snapshotBuffer, snapshotBufferSize,
+            deltaChain.epoch, deltaChain.baseTick, deltaIndex, deltaFileName, directory);
+
+        getNodeStateDeltaFileName(deltaFileName, UNIVERSE_FILE_NAME, deltaIndex);
+        loaded = loaded && loadNodeStateDelta((unsigned char*)assets, universeSizeInBytes, snapshotBuffer, snapshotBufferSize,
+            deltaChain.epoch, deltaChain.baseTick, deltaIndex, deltaFileName, directory);
+
+        for (unsigned int contractIndex = 0; loaded && contractIndex < contractCount; contractIndex++)
+        {
+            CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 9] = contractIndex / 1000 + L'0';
+            CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 8] = (contractIndex % 1000) / 100 + L'0';
+            CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 7] = (contractIndex % 100) / 10 + L'0';
+            CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 6] = contractIndex % 10 + L'0';
+            getNodeStateDeltaFileName(deltaFileName, CONTRACT_FILE_NAME, deltaIndex);
+            loaded = loadNodeStateDelta(contractStates[contractIndex], contractDescriptions[contractIndex].stateSize, snapshotBuffer, snapshotBufferSize,
+                deltaChain.epoch, deltaChain.baseTick, deltaIndex, deltaFileName, directory);
+        }
+
+        if (!loaded)
+        {
+            setText(message, L"Failed to load delta segment ");
+            appendText(message, deltaFileName);
+            logToConsole(message);
+            return false;
+        }
+    }
+
+    // update data derived from spectrum and universe
+    updateSpectrumFingerprints(0, SPECTRUM_CAPACITY);
+    updateSpectrumInfo();
+    as.indexLists.rebuild();
+    as.entityLists.rebuild();
+
     return true;
 }
 
@@ -3968,6 +4570,11 @@ static bool loadAllNodeStates()
         return false;
     }
 
+    if (!loadNodeStateDeltas(directory))
+    {
+        return false;
+    }
+
     CHAR16 NODE_STATE_FILE_NAME[] = L"snapshotNodeMiningState";
     long long loadedSize = load(NODE_STATE_FILE_NAME, sizeof(nodeStateBuffer), (unsigned char*)&nodeStateBuffer, directory);
     if (loadedSize != sizeof(nodeStateBuffer))
@@ -4016,34 +4623,14 @@ static bool loadAllNodeStates()
     }
     updateNumberOfTickTransactions();
 
-    setMem(assetChangeFlags, sizeof(assetChangeFlags), 0);
-    setMem(spectrumChangeFlags, sizeof(spectrumChangeFlags), 0);
-    CHAR16 SPECTRUM_DIGEST_FILE_NAME[] = L"snapshotSpectrumDigest";
-    loadedSize = load(SPECTRUM_DIGEST_FILE_NAME, spectrumDigestsSizeInByte, (unsigned char*)spectrumDigests, directory);
-    logToConsole(L"Loading spectrum digests");
-    if (loadedSize != spectrumDigestsSizeInByte)
-    {
-        logToConsole(L"Failed to load spectrum digest");
-        return false;
-    }
-
-    CHAR16 UNIVERSE_DIGEST_FILE_NAME[] = L"snapshotUniverseDigest";
-    loadedSize = load(UNIVERSE_DIGEST_FILE_NAME, assetDigestsSizeInBytes, (unsigned char*)assetDigests, directory);
-    logToConsole(L"Loading universe digests");
-    if (loadedSize != assetDigestsSizeInBytes)
-    {
-        logToConsole(L"Failed to load universe digest");
-        return false;
-    }
-
-    CHAR16 COMPUTER_DIGEST_FILE_NAME[] = L"snapshotComputerDigest";
-    loadedSize = load(COMPUTER_DIGEST_FILE_NAME, contractStateDigestsSizeInBytes, (unsigned char*)contractStateDigests, directory);
-    logToConsole(L"Loading computer digests");
-    if (loadedSize != contractStateDigestsSizeInBytes)
-    {
-        logToConsole(L"Failed to load computer digest");
-        return false;
-    }
+    // Digests of spectrum, universe, and contract states aren't saved with the node states, because the states are
+    // saved from snapshots in the background. Recompute spectrum digests now and mark all assets and contract states
+    // as changed, so their digests are recomputed with the next tick.
+    logToConsole(L"Computing spectrum digests");
+    clearSpectrumDirtyEntities();
+    recomputeSpectrumDigests();
+    setMem(assetChangeFlags, ASSETS_CAPACITY / 8, 0xFF);
+    markAllContractStatesChanged();
 
     CHAR16 MINER_SOL_FLAG_FILE_NAME[] = L"snapshotMinerSolutionFlag";
     logToConsole(L"Loading miner solution flags");
@@ -4257,6 +4844,7 @@ static void prepareNextTickTransactions()
     unsigned long long unknownTransactions[NUMBER_OF_TRANSACTIONS_PER_TICK / 64];
     setMem(unknownTransactions, sizeof(unknownTransactions), 0);
     const auto* tsNextTickTransactionOffsets = ts.tickTransactionOffsets.getByTickIndex(nextTickIndex);
+    const auto* tsNextTickTransactionDigests = ts.tickTransactionDigests.getByTickIndex(nextTickIndex);
     
     // This function maybe called multiple times per tick due to lack of data (txs or votes)
     // Here we do a simple pre scan to check txs via tsNextTickTransactionOffsets (already processed - aka already copying from pendingTransaction array to tickTransaction)
@@ -4271,12 +4859,9 @@ static void prepareNextTickTransactions()
 
             if (tsNextTickTransactionOffsets[i])
             {
-                const Transaction* transaction = ts.tickTransactions(tsNextTickTransactionOffsets[i]);
-                ASSERT(transaction->checkValidity());
-                ASSERT(transaction->tick == nextTick);
-                unsigned char digest[32];
-                KangarooTwelve(transaction, transaction->totalSize(), digest, sizeof(digest));
-                if (digest == nextTickData.transactionDigests[i])
+                ASSERT(ts.tickTransactions(tsNextTickTransactionOffsets[i])->checkValidity());
+                ASSERT(ts.tickTransactions(tsNextTickTransactionOffsets[i])->tick == nextTick);
+                if (tsNextTickTransactionDigests[i] == nextTickData.transactionDigests[i])
                 {
                     numberOfKnownNextTickTransactions++;
                 }
@@ -4304,7 +4889,6 @@ static void prepareNextTickTransactions()
                 ACQUIRE(computorPendingTransactionsLock);
 
                 ASSERT(pendingTransaction->checkValidity());
-                auto* tsPendingTransactionOffsets = ts.tickTransactionOffsets.getByTickInCurrentEpoch(pendingTransaction->tick);
                 for (unsigned int j = 0; j < NUMBER_OF_TRANSACTIONS_PER_TICK; j++)
                 {
                     if (unknownTransactions[j >> 6] & (1ULL << (j & 63)))
@@ -4314,16 +4898,9 @@ static void prepareNextTickTransactions()
                             ts.tickTransactions.acquireLock();
                             // write tx to tick tx storage, no matter if tsNextTickTransactionOffsets[i] is 0 (new tx)
                             // or not (tx with digest that doesn't match tickData needs to be overwritten)
+                            if (ts.addTransaction(pendingTransaction->tick, j, pendingTransaction, nextTickData.transactionDigests[j]))
                             {
-                                const unsigned int transactionSize = pendingTransaction->totalSize();
-                                if (ts.nextTickTransactionOffset + transactionSize <= ts.tickTransactions.storageSpaceCurrentEpoch)
-                                {
-                                    tsPendingTransactionOffsets[j] = ts.nextTickTransactionOffset;
-                                    copyMem(ts.tickTransactions(ts.nextTickTransactionOffset), pendingTransaction, transactionSize);
-                                    ts.nextTickTransactionOffset += transactionSize;
-
-                                    numberOfKnownNextTickTransactions++;
-                                }
+                                numberOfKnownNextTickTransactions++;
                             }
                             ts.tickTransactions.releaseLock();
 
@@ -4337,35 +4914,27 @@ static void prepareNextTickTransactions()
                 RELEASE(computorPendingTransactionsLock);
             }
         }
-        // Checks if any of the missing transactions is available in the entityPendingTransaction and remove unknownTransaction flag if found
-        for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
+        // Checks if any of the missing transactions is available in the pendingTxsPool and remove unknownTransaction flag if found
+        // (only the bucket of nextTick needs to be checked)
+        pendingTxsPool.acquireLock();
+        for (unsigned int i = pendingTxsPool.getFirstTickTxIndex(nextTick); i != PendingTxsPool::NO_TX_INDEX; i = pendingTxsPool.getNextTickTxIndex(i))
         {
-            Transaction* pendingTransaction = (Transaction*)&entityPendingTransactions[i * MAX_TRANSACTION_SIZE];
-            if (pendingTransaction->tick == nextTick)
+            const Transaction* pendingTransaction = pendingTxsPool.getTx(i);
             {
-                ACQUIRE(entityPendingTransactionsLock);
-
+                ASSERT(pendingTransaction->tick == nextTick);
                 ASSERT(pendingTransaction->checkValidity());
-                auto* tsPendingTransactionOffsets = ts.tickTransactionOffsets.getByTickInCurrentEpoch(pendingTransaction->tick);
                 for (unsigned int j = 0; j < NUMBER_OF_TRANSACTIONS_PER_TICK; j++)
                 {
                     if (unknownTransactions[j >> 6] & (1ULL << (j & 63)))
                     {
-                        if (&entityPendingTransactionDigests[i * 32ULL] == nextTickData.transactionDigests[j])
+                        if (pendingTxsPool.getDigest(i) == nextTickData.transactionDigests[j])
                         {
                             ts.tickTransactions.acquireLock();
                             // write tx to tick tx storage, no matter if tsNextTickTransactionOffsets[i] is 0 (new tx)
                             // or not (tx with digest that doesn't match tickData needs to be overwritten)
+                            if (ts.addTransaction(pendingTransaction->tick, j, pendingTransaction, pendingTxsPool.getDigest(i)))
                             {
-                                const unsigned int transactionSize = pendingTransaction->totalSize();
-                                if (ts.nextTickTransactionOffset + transactionSize <= ts.tickTransactions.storageSpaceCurrentEpoch)
-                                {
-                                    tsPendingTransactionOffsets[j] = ts.nextTickTransactionOffset;
-                                    copyMem(ts.tickTransactions(ts.nextTickTransactionOffset), pendingTransaction, transactionSize);
-                                    ts.nextTickTransactionOffset += transactionSize;
-
-                                    numberOfKnownNextTickTransactions++;
-                                }
+                                numberOfKnownNextTickTransactions++;
                             }
                             ts.tickTransactions.releaseLock();
 
@@ -4375,10 +4944,9 @@ static void prepareNextTickTransactions()
                         }
                     }
                 }
-
-                RELEASE(entityPendingTransactionsLock);
             }
         }
+        pendingTxsPool.releaseLock();
 
         // At this point unknownTransactions is set to 1 for all transactions that are unknown
         // Update requestedTickTransactions the list of txs that not exist in memory so the MAIN loop can try to fetch them from peers
@@ -4413,6 +4981,7 @@ static void computeTxBodyDigestBase(const int tick)
 
     const unsigned int tickIndex = ts.tickToIndexCurrentEpoch(tick);
     const auto* tsTransactionOffsets = ts.tickTransactionOffsets.getByTickIndex(tickIndex);
+    const auto* tsTransactionDigests = ts.tickTransactionDigests.getByTickIndex(tickIndex);
 
     for (unsigned int i = 0; i < NUMBER_OF_TRANSACTIONS_PER_TICK; i++)
     {
@@ -4420,17 +4989,14 @@ static void computeTxBodyDigestBase(const int tick)
         {
             // TODO: Optimization to check: We have the ts locked for the whole K12_Update.
             //       It might be worth to copy the transaction and release lock before update the K12 state.
-            // TODO: Here we check each Tx against the nextTickData again (before we did it in prepareNextTickTransactions
-            //       Might be worth to do only do it once.
             ts.tickTransactions.acquireLock();
 
             if (tsTransactionOffsets[i]) {
                 const Transaction* transaction = ts.tickTransactions(tsTransactionOffsets[i]);
 
                 if (transaction->checkValidity() && transaction->tick == tick) {
-                    unsigned char digest[32];
-                    KangarooTwelve(transaction, transaction->totalSize(), digest, sizeof(digest));
-                    if (digest == nextTickData.transactionDigests[i])
+                    // digest was computed when the transaction was added to the tick storage
+                    if (tsTransactionDigests[i] == nextTickData.transactionDigests[i])
                     {
                         int ret = 1;
                         while(ret == 1)
@@ -5059,6 +5625,9 @@ static void tickProcessor(void*)
 
                                 system.tick++;
 
+                                // Pending transactions of past ticks are not needed anymore
+                                pendingTxsPool.discardTicksBefore(system.tick);
+
                                 updateNumberOfTickTransactions();
 
                                 bool isBeginEpoch = false;
@@ -5068,6 +5637,12 @@ static void tickProcessor(void*)
                                     // wait until all request processors are in waiting state
                                     WAIT_WHILE(epochTransitionWaitingRequestProcessors < nRequestProcessorIDs);
 
+#if TICK_STORAGE_AUTOSAVE_MODE
+                                    // node states being saved in the background refer to the current epoch's
+                                    // tick storage, so they need to be completed before it is changed
+                                    WAIT_WHILE(nodeStateSnapshotStage != NodeStateSnapshotIdle);
+#endif
+
                                     // end current epoch
                                     endEpoch();
 
@@ -5224,37 +5799,71 @@ static bool loadComputer(CHAR16* directory, bool forceLoadFromFile)
             logToConsole(message);
         }
     }
+    markAllContractStatesChanged();
     return true;
 }
 
-static bool saveComputer(CHAR16* directory)
+// Take snapshot of all contract states, which is saved by saveComputerSnapshot() (or as delta segments if mode is
+// captureChanged) while procedures are running
+static void beginComputerSnapshot(CopyOnWriteSnapshot<contractCount>::CaptureMode mode)
 {
-    logToConsole(L"Saving contract files...");
-
-    const unsigned long long beginningTick = __rdtsc();
-
-    bool ok = true;
-    unsigned long long totalSize = 0;
-
     for (unsigned int contractIndex = 0; contractIndex < contractCount; contractIndex++)
     {
-        CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 9] = contractIndex / 1000 + L'0';
-        CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 8] = (contractIndex % 1000) / 100 + L'0';
-        CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 7] = (contractIndex % 100) / 10 + L'0';
-        CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 6] = contractIndex % 10 + L'0';
         contractStateLock[contractIndex].acquireRead();
-        long long savedSize = save(CONTRACT_FILE_NAME, contractDescriptions[contractIndex].stateSize, contractStates[contractIndex], directory);
+        contractStateSnapshot.begin(contractIndex, mode);
         contractStateLock[contractIndex].releaseRead();
-        totalSize += savedSize;
+    }
+}
+
+// Save snapshot taken by beginComputerSnapshot() to the contract files, with file names following the pattern of
+// CONTRACT_FILE_NAME (including the epoch suffix). The caller must hold snapshotBufferLock. Can be called by any
+// processor (files are written through asyncSave() if available), but doesn't log to console. Returns total size of
+// the saved files or a negative value on error.
+static long long saveComputerSnapshot(const CHAR16* contractFileName, const CHAR16* directory)
+{
+    CHAR16 fileName[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0])];
+    copyMem(fileName, contractFileName, sizeof(fileName));
+
+    long long totalSize = 0;
+    for (unsigned int contractIndex = 0; contractIndex < contractCount; contractIndex++)
+    {
+        fileName[sizeof(fileName) / sizeof(fileName[0]) - 9] = contractIndex / 1000 + L'0';
+        fileName[sizeof(fileName) / sizeof(fileName[0]) - 8] = (contractIndex % 1000) / 100 + L'0';
+        fileName[sizeof(fileName) / sizeof(fileName[0]) - 7] = (contractIndex % 100) / 10 + L'0';
+        fileName[sizeof(fileName) / sizeof(fileName[0]) - 6] = contractIndex % 10 + L'0';
+        long long savedSize = contractStateSnapshot.captureAndSave(contractIndex, snapshotBuffer, fileName, directory);
         if (savedSize != contractDescriptions[contractIndex].stateSize)
         {
-            ok = false;
-
-            break;
+            // finish capturing the other contracts, so writers don't need to copy pages anymore
+            for (contractIndex++; contractIndex < contractCount; contractIndex++)
+            {
+                contractStateSnapshot.capture(contractIndex, snapshotBuffer);
+            }
+            return -1;
         }
+        totalSize += savedSize;
     }
+    return totalSize;
+}
 
-    if (ok)
+static bool saveComputer(CHAR16* directory)
+{
+    if (!TRY_ACQUIRE(snapshotBufferLock))
+    {
+        logToConsole(L"Cannot save contract files while another snapshot is being saved.");
+        return false;
+    }
+
+    logToConsole(L"Saving contract files...");
+
+    const unsigned long long beginningTick = __rdtsc();
+
+    beginComputerSnapshot();
+    const long long totalSize = saveComputerSnapshot(CONTRACT_FILE_NAME, directory);
+
+    RELEASE(snapshotBufferLock);
+
+    if (totalSize >= 0)
     {
         setNumber(message, totalSize, TRUE);
         appendText(message, L" bytes of the computer data are saved (");
@@ -5313,7 +5922,7 @@ static bool initialize()
     initTimeStampCounter();
 
 #ifdef ENABLE_PROFILING
-    if (!gProfilingDataCollector.init(1024))
+    if (!gProfilingDataCollector.init(128))
     {
         logToConsole(L"gProfilingDataCollector.init() failed!");
         return false;
@@ -5343,11 +5952,8 @@ static bool initialize()
     {
         if (!ts.init())
             return false;
-        if (!allocPoolWithErrorLog(L"entityPendingTransaction buffer", SPECTRUM_CAPACITY * MAX_TRANSACTION_SIZE,(void**)&entityPendingTransactions, __LINE__) ||
-            !allocPoolWithErrorLog(L"entityPendingTransaction buffer", SPECTRUM_CAPACITY * 32ULL,(void**)&entityPendingTransactionDigests , __LINE__))
-        {
+        if (!pendingTxsPool.init())
             return false;
-        }
 
         if (!allocPoolWithErrorLog(L"computorPendingTransactions buffer", NUMBER_OF_COMPUTORS * MAX_NUMBER_OF_PENDING_TRANSACTIONS_PER_COMPUTOR * MAX_TRANSACTION_SIZE, (void**)&computorPendingTransactions, __LINE__) ||
             !allocPoolWithErrorLog(L"computorPendingTransactions buffer", NUMBER_OF_COMPUTORS * MAX_NUMBER_OF_PENDING_TRANSACTIONS_PER_COMPUTOR * 32ULL, (void**)&computorPendingTransactionDigests, __LINE__))
@@ -5356,9 +5962,6 @@ static bool initialize()
         }
         
 
-        setMem(spectrumChangeFlags, sizeof(spectrumChangeFlags), 0);
-
-
         if (!initSpectrum())
             return false;
 
@@ -5372,7 +5975,9 @@ static bool initialize()
         for (unsigned int contractIndex = 0; contractIndex < contractCount; contractIndex++)
         {
             unsigned long long size = contractDescriptions[contractIndex].stateSize;
-            if (!allocPoolWithErrorLog(L"contractStates",  size, (void**)&contractStates[contractIndex], __LINE__))
+            if (!allocPoolWithErrorLog(L"contractStates",  size, (void**)&contractStates[contractIndex], __LINE__)
+                || !contractStateSnapshot.initRegion(contractIndex, contractStates[contractIndex], size)
+                || !contractStateDigestCaches[contractIndex].init(contractStates[contractIndex], size))
             {
                 return false;
             }
@@ -5461,23 +6066,7 @@ static bool initialize()
             {
                 const unsigned long long beginningTick = __rdtsc();
 
-                unsigned int digestIndex;
-                for (digestIndex = 0; digestIndex < SPECTRUM_CAPACITY; digestIndex++)
-                {
-                    KangarooTwelve64To32(&spectrum[digestIndex], &spectrumDigests[digestIndex]);
-                }
-                unsigned int previousLevelBeginning = 0;
-                unsigned int numberOfLeafs = SPECTRUM_CAPACITY;
-                while (numberOfLeafs > 1)
-                {
-                    for (unsigned int i = 0; i < numberOfLeafs; i += 2)
-                    {
-                        KangarooTwelve64To32(&spectrumDigests[previousLevelBeginning + i], &spectrumDigests[digestIndex++]);
-                    }
-
-                    previousLevelBeginning += numberOfLeafs;
-                    numberOfLeafs >>= 1;
-                }
+                recomputeSpectrumDigests();
 
                 setNumber(message, SPECTRUM_CAPACITY * sizeof(EntityRecord), TRUE);
                 appendText(message, L" bytes of the spectrum data are hashed (");
@@ -5537,6 +6126,14 @@ static bool initialize()
     }
 
     initializeContracts();
+    for (unsigned int contractIndex = 1; contractIndex < contractCount; contractIndex++)
+    {
+        if ((contractSystemProcedureIsolated[contractIndex][BEGIN_TICK] || contractSystemProcedureIsolated[contractIndex][END_TICK])
+            && !logger.initDeferredContractMessages(contractIndex))
+        {
+            return false;
+        }
+    }
 
     if (loadMiningSeedFromFile)
     {
@@ -5556,15 +6153,15 @@ static bool initialize()
 
     logToConsole(L"Allocating buffers ...");
     if ((!allocPoolWithErrorLog(L"dejavu0", 536870912, (void**)&dejavu0, __LINE__)) ||
-        (!allocPoolWithErrorLog(L"dejavu1", 536870912, (void**)&dejavu1, __LINE__)))
+        (!allocPoolWithErrorLog(L"dejavu1", 536870912, (void**)&dejavu1, __LINE__)) ||
+        (!allocPoolWithErrorLog(L"wrappedPacketBuffer", RequestResponseHeader::max_size, (void**)&wrappedPacketBuffer, __LINE__)))
     {
         return false;
     }
     setMem((void*)dejavu0, 536870912, 0);
     setMem((void*)dejavu1, 536870912, 0);
 
-    if ((!allocPoolWithErrorLog(L"requestQueueBuffer", REQUEST_QUEUE_BUFFER_SIZE, (void**)&requestQueueBuffer, __LINE__)) ||
-        (!allocPoolWithErrorLog(L"respondQueueBuffer", RESPONSE_QUEUE_BUFFER_SIZE, (void**)&responseQueueBuffer, __LINE__)))
+    if ((!requestQueue.init()) || (!responseQueue.init()))
     {
         return false;
     }
@@ -5706,14 +6303,7 @@ static void deinitialize()
     {
         freePool(computorPendingTransactions);
     }
-    if (entityPendingTransactionDigests)
-    {
-        freePool(entityPendingTransactionDigests);
-    }
-    if (entityPendingTransactions)
-    {
-        freePool(entityPendingTransactions);
-    }
+    pendingTxsPool.deinit();
     ts.deinit();
 
     if (score)
@@ -5733,16 +6323,14 @@ static void deinitialize()
     {
         freePool((void*)dejavu1);
     }
-
-    if (requestQueueBuffer)
+    if (wrappedPacketBuffer)
     {
-        freePool(requestQueueBuffer);
-    }
-    if (responseQueueBuffer)
-    {
-        freePool(responseQueueBuffer);
+        freePool(wrappedPacketBuffer);
     }
 
+    requestQueue.deinit();
+    responseQueue.deinit();
+
     for (unsigned int processorIndex = 0; processorIndex < MAX_NUMBER_OF_PROCESSORS; processorIndex++)
     {
         if (processors[processorIndex].buffer)
@@ -5856,6 +6444,11 @@ static void logInfo()
     appendNumber(message, score->scoreCache.collisionCount(), TRUE);
     appendText(message, L" | Miss ");
     appendNumber(message, score->scoreCache.missCount(), TRUE);
+    appendText(message, L" | Speculative ");
+    appendNumber(message, score->numberOfSpeculativeScores, TRUE);
+    appendText(message, L" (");
+    appendNumber(message, score->numberOfDroppedSpeculativeTasks, TRUE);
+    appendText(message, L" dropped)");
 #endif
     logToConsole(message);
     prevNumberOfProcessedRequests = numberOfProcessedRequests;
@@ -5913,13 +6506,7 @@ static void logInfo()
             numberOfPendingTransactions++;
         }
     }
-    for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
-    {
-        if (((Transaction*)&entityPendingTransactions[i * MAX_TRANSACTION_SIZE])->tick > system.tick)
-        {
-            numberOfPendingTransactions++;
-        }
-    }
+    numberOfPendingTransactions += pendingTxsPool.getNumberOfPendingTxs(system.tick);
     if (nextTickTransactionsSemaphore)
     {
         setText(message, L"?");
@@ -5969,10 +6556,10 @@ static void logInfo()
     appendText(message, L" pending transactions.");
     logToConsole(message);
 
-    unsigned int filledRequestQueueBufferSize = (requestQueueBufferHead >= requestQueueBufferTail) ? (requestQueueBufferHead - requestQueueBufferTail) : (REQUEST_QUEUE_BUFFER_SIZE - (requestQueueBufferTail - requestQueueBufferHead));
-    unsigned int filledResponseQueueBufferSize = (responseQueueBufferHead >= responseQueueBufferTail) ? (responseQueueBufferHead - responseQueueBufferTail) : (RESPONSE_QUEUE_BUFFER_SIZE - (responseQueueBufferTail - responseQueueBufferHead));
-    unsigned int filledRequestQueueLength = (requestQueueElementHead >= requestQueueElementTail) ? (requestQueueElementHead - requestQueueElementTail) : (REQUEST_QUEUE_LENGTH - (requestQueueElementTail - requestQueueElementHead));
-    unsigned int filledResponseQueueLength = (responseQueueElementHead >= responseQueueElementTail) ? (responseQueueElementHead - responseQueueElementTail) : (RESPONSE_QUEUE_LENGTH - (responseQueueElementTail - responseQueueElementHead));
+    unsigned int filledRequestQueueBufferSize = requestQueue.getNumberOfBytes();
+    unsigned long long filledResponseQueueBufferSize = responseQueue.getNumberOfBytes();
+    unsigned int filledRequestQueueLength = requestQueue.getNumberOfRequests();
+    unsigned int filledResponseQueueLength = responseQueue.getNumberOfResponses();
     setNumber(message, filledRequestQueueBufferSize, TRUE);
     appendText(message, L" (");
     appendNumber(message, filledRequestQueueLength, TRUE);
@@ -6028,6 +6615,75 @@ static void logInfo()
 
 }
 
+#ifdef ENABLE_LOCK_PROFILING
+// Print the locks with the highest total waiting time
+static void logLockContention()
+{
+    constexpr unsigned int numberOfLocksToPrint = 5;
+    const LockProfilingData* topLocks[numberOfLocksToPrint] = { nullptr };
+    for (unsigned int i = 0; i < LockProfiler::capacity; ++i)
+    {
+        const LockProfilingData* data = &gLockProfiler.getEntry(i);
+        if (!data->lock || !data->contendedCount)
+            continue;
+        for (unsigned int j = 0; j < numberOfLocksToPrint; ++j)
+        {
+            if (!topLocks[j] || topLocks[j]->waitTscSum < data->waitTscSum)
+            {
+                const LockProfilingData* tmp = topLocks[j];
+                topLocks[j] = data;
+                data = tmp;
+                if (!data)
+                    break;
+            }
+        }
+    }
+
+    setText(message, L"Lock contention (");
+    appendNumber(message, gLockProfiler.getDroppedAcquisitions(), TRUE);
+    appendText(message, L" acquisitions not recorded):");
+    if (!topLocks[0])
+        appendText(message, L" none");
+    logToConsole(message);
+    for (unsigned int i = 0; i < numberOfLocksToPrint && topLocks[i]; ++i)
+    {
+        const LockProfilingData& data = *topLocks[i];
+        const LockSite* firstSite = data.firstSite;
+        const LockProfilingData::HolderSite* topHolderSite = &data.holderSites[0];
+        for (unsigned int j = 1; j < LockProfilingData::maxHolderSites; ++j)
+        {
+            if (topHolderSite->waitTscSum < data.holderSites[j].waitTscSum)
+                topHolderSite = &data.holderSites[j];
+        }
+
+        setText(message, L"  ");
+        appendTextShortenBack(message, (firstSite) ? firstSite->expr : "?", 40);
+        appendText(message, L": ");
+        appendNumber(message, data.acquireCount, TRUE);
+        appendText(message, L" acquired, ");
+        appendNumber(message, data.contendedCount, TRUE);
+        appendText(message, L" contended, waited ");
+        appendNumber(message, data.waitTscSum * 1000 / frequency, TRUE);
+        appendText(message, L" ms (p99 ");
+        appendNumber(message, LockProfilingData::histogramQuantile(data.waitTscHistogram, 99, 100) * 1000000 / frequency, TRUE);
+        appendText(message, L" us, max ");
+        appendNumber(message, data.waitTscMax * 1000000 / frequency, TRUE);
+        appendText(message, L" us), mostly held by ");
+        if (topHolderSite->site)
+        {
+            appendTextShortenFront(message, topHolderSite->site->file, 30);
+            appendText(message, L":");
+            appendNumber(message, topHolderSite->site->line, FALSE);
+        }
+        else
+        {
+            appendText(message, L"?");
+        }
+        logToConsole(message);
+    }
+}
+#endif
+
 static void logHealthStatus()
 {
     setText(message, (isMainMode()) ? L"MAIN" : L"aux");
@@ -6135,6 +6791,8 @@ static void logHealthStatus()
             case ContractErrorTooManyActions: errorMsg = L"TooManyActions"; break;
             // Timeout requires to remove endless loop, speed-up code, or change the timeout
             case ContractErrorTimeout: errorMsg = L"Timeout"; break;
+            // IsolationViolated requires to remove effects outside of the own state from isolated system procedure
+            case ContractErrorIsolationViolated: errorMsg = L"IsolationViolated"; break;
             }
             appendText(message, errorMsg);
         }
@@ -6196,6 +6854,10 @@ static void logHealthStatus()
         }
     }
     logToConsole(message);
+
+#ifdef ENABLE_LOCK_PROFILING
+    logLockContention();
+#endif
 }
 
 static void processKeyPresses()
@@ -6990,29 +7652,26 @@ EFI_STATUS efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* systemTable)
                     }
                 }
 
-                // Add messages from response queue to sending buffer
-                const unsigned short responseQueueElementHead = ::responseQueueElementHead;
-                if (responseQueueElementTail != responseQueueElementHead)
+                // Add messages from response queues of all processors to sending buffer (round-robin, limited to the
+                // responses that are there already, so producers cannot keep the main loop busy)
+                for (unsigned int numberOfResponses = responseQueue.getNumberOfResponses(); numberOfResponses > 0; numberOfResponses--)
                 {
-                    while (responseQueueElementTail != responseQueueElementHead)
+                    Peer* responsePeer;
+                    unsigned int responseShardIndex;
+                    RequestResponseHeader* responseHeader = responseQueue.front(responsePeer, responseShardIndex);
+                    if (!responseHeader)
                     {
-                        RequestResponseHeader* responseHeader = (RequestResponseHeader*)&responseQueueBuffer[responseQueueElements[responseQueueElementTail].offset];
-                        if (responseQueueElements[responseQueueElementTail].peer)
-                        {
-                            push(responseQueueElements[responseQueueElementTail].peer, responseHeader);
-                        }
-                        else
-                        {
-                            pushToSeveral(responseHeader);
-                        }
-                        responseQueueBufferTail += responseHeader->size();
-                        if (responseQueueBufferTail > RESPONSE_QUEUE_BUFFER_SIZE - BUFFER_SIZE)
-                        {
-                            responseQueueBufferTail = 0;
-                        }
-                        // TODO: Place a fence
-                        responseQueueElementTail++;
+                        break;
+                    }
+                    if (responsePeer)
+                    {
+                        push(responsePeer, responseHeader);
                     }
+                    else
+                    {
+                        pushToSeveral(responseHeader);
+                    }
+                    responseQueue.popFront(responseShardIndex);
                 }
 
                 if (systemMustBeSaved)
@@ -7078,23 +7737,19 @@ EFI_STATUS efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* systemTable)
                     }
                 }
 #endif
-                if (requestPersistingNodeState == 1 && persistingNodeStateTickProcWaiting == 1)
+                // The tick processor is paused only while the snapshots are taken and small states are saved. If the
+                // previous node states are still being saved in the background, it waits until they are complete.
+                if (requestPersistingNodeState == 1 && persistingNodeStateTickProcWaiting == 1
+                    && nodeStateSnapshotStage == NodeStateSnapshotIdle)
                 {
-                    // Saving node state takes a lot of time -> Close peer connections before to signal that
-                    // the peers should connect to another node.
-                    for (unsigned int i = 0; i < NUMBER_OF_OUTGOING_CONNECTIONS + NUMBER_OF_INCOMING_CONNECTIONS; i++)
-                    {
-                        closePeer(&peers[i]);
-                    }
-
                     logToConsole(L"Saving node state...");
                     saveAllNodeStates();
 #ifdef ENABLE_PROFILING
                     gProfilingDataCollector.writeToFile();
 #endif
                     requestPersistingNodeState = 0;
-                    logToConsole(L"Complete saving all node states");
                 }
+                finishSavingAllNodeStates();
 #if TICK_STORAGE_AUTOSAVE_MODE == 1
                 if (nextAutoSaveTickUpdated)
                 {
@@ -1608,21 +1608,28 @@ struct ScoreFunction
             return numberOfOutputNeurons + 1; // return invalid score
         }
 
-        int score = 0;
 #if USE_SCORE_CACHE
         unsigned int scoreCacheIndex = scoreCache.getCacheIndex(publicKey, miningSeed, nonce);
-        score = scoreCache.tryFetching(publicKey, miningSeed, nonce, scoreCacheIndex);
+        const int score = scoreCache.tryFetching(publicKey, miningSeed, nonce, scoreCacheIndex);
         if (score >= scoreCache.MIN_VALID_SCORE)
         {
             return score;
         }
-        score = 0;
+#else
+        unsigned int scoreCacheIndex = 0;
 #endif
 
+        return computeAndCacheScore(processor_Number, publicKey, miningSeed, nonce, scoreCacheIndex);
+    }
+
+    // Compute score of solution that isn't in the score cache and add it to the cache (scoreCacheIndex is ignored
+    // without USE_SCORE_CACHE)
+    unsigned int computeAndCacheScore(const unsigned long long processor_Number, const m256i& publicKey, const m256i& miningSeed, const m256i& nonce, unsigned int scoreCacheIndex)
+    {
         const int solutionBufIdx = (int)(processor_Number % solutionBufferCount);
         ACQUIRE(solutionEngineLock[solutionBufIdx]);
 
-        score = computeScore(solutionBufIdx, publicKey, nonce);
+        int score = computeScore(solutionBufIdx, publicKey, nonce);
 
         RELEASE(solutionEngineLock[solutionBufIdx]);
 #if USE_SCORE_CACHE
@@ -1730,7 +1737,8 @@ struct ScoreFunction
         return _nFinished == _nTask;
     }
 
-    void tryProcessSolution(unsigned long long processorNumber)
+    // process a task if there is any, return false if there is none
+    bool tryProcessSolution(unsigned long long processorNumber)
     {
         m256i publicKey;
         m256i miningSeed;
@@ -1741,5 +1749,115 @@ struct ScoreFunction
             (*this)(processorNumber, publicKey, miningSeed, nonce);
             this->finishTask();
         }
+        return res;
+    }
+
+    // Speculative scoring:
+    // Solutions are queued as soon as they are seen (for example when a solution transaction enters the pending pool),
+    // before the tick including them is processed. Solution processors without tick tasks compute the scores in the
+    // background and store them in the score cache, so the tick processor usually finds them there. The queue is
+    // bounded (new solutions are dropped if it is full) and has two priorities: solutions likely to be included soon
+    // are scored first.
+
+    volatile char speculativeQueueLock = 0;
+    struct
+    {
+        m256i publicKey[SPECULATIVE_SCORING_QUEUE_LENGTH];
+        m256i miningSeed[SPECULATIVE_SCORING_QUEUE_LENGTH];
+        m256i nonce[SPECULATIVE_SCORING_QUEUE_LENGTH];
+        unsigned int first;
+        unsigned int count;
+    } speculativeQueue[2]; // 0: high priority, 1: low priority
+    volatile long long numberOfSpeculativeScores;
+    unsigned long long numberOfDroppedSpeculativeTasks;
+
+    void resetSpeculativeQueue()
+    {
+        ACQUIRE(speculativeQueueLock);
+        speculativeQueue[0].first = speculativeQueue[0].count = 0;
+        speculativeQueue[1].first = speculativeQueue[1].count = 0;
+        numberOfSpeculativeScores = 0;
+        numberOfDroppedSpeculativeTasks = 0;
+        RELEASE(speculativeQueueLock);
+    }
+
+    // queue solution for speculative scoring, return false if it is not queued (invalid seed, already cached, or
+    // queue of the priority is full); can call on any thread
+    bool addSpeculativeTask(const m256i& publicKey, const m256i& miningSeed, const m256i& nonce, bool highPriority)
+    {
+#if USE_SCORE_CACHE
+        if (isZero(miningSeed) || miningSeed != currentRandomSeed || scoreCache.contains(publicKey, miningSeed, nonce))
+        {
+            return false;
+        }
+
+        bool result = false;
+        auto& queue = speculativeQueue[highPriority ? 0 : 1];
+        ACQUIRE(speculativeQueueLock);
+        if (queue.count < SPECULATIVE_SCORING_QUEUE_LENGTH)
+        {
+            unsigned int index = (queue.first + queue.count++) % SPECULATIVE_SCORING_QUEUE_LENGTH;
+            queue.publicKey[index] = publicKey;
+            queue.miningSeed[index] = miningSeed;
+            queue.nonce[index] = nonce;
+            result = true;
+        }
+        else
+        {
+            numberOfDroppedSpeculativeTasks++;
+        }
+        RELEASE(speculativeQueueLock);
+        return result;
+#else
+        return false;
+#endif
+    }
+
+    // score one queued solution (high priority first) and store it in the cache, return false if there is none
+    bool tryProcessSpeculativeSolution(unsigned long long processorNumber)
+    {
+        if (!speculativeQueue[0].count && !speculativeQueue[1].count)
+        {
+            return false;
+        }
+
+        m256i publicKey;
+        m256i miningSeed;
+        m256i nonce;
+        bool res = false;
+        ACQUIRE(speculativeQueueLock);
+        for (auto& queue : speculativeQueue)
+        {
+            if (queue.count)
+            {
+                publicKey = queue.publicKey[queue.first];
+                miningSeed = queue.miningSeed[queue.first];
+                nonce = queue.nonce[queue.first];
+                queue.first = (queue.first + 1) % SPECULATIVE_SCORING_QUEUE_LENGTH;
+                queue.count--;
+                res = true;
+                break;
+            }
+        }
+        RELEASE(speculativeQueueLock);
+
+        // skip solution if the seed has changed in the meantime or the score has been cached already
+        if (!res || isZero(miningSeed) || miningSeed != currentRandomSeed)
+        {
+            return res;
+        }
+#if USE_SCORE_CACHE
+        unsigned int scoreCacheIndex = scoreCache.getCacheIndex(publicKey, miningSeed, nonce);
+        if (scoreCache.tryFetching(publicKey, miningSeed, nonce, scoreCacheIndex) >= scoreCache.MIN_VALID_SCORE)
+        {
+            return res;
+        }
+#else
+        unsigned int scoreCacheIndex = 0;
+#endif
+
+        _InterlockedIncrement64(&numberOfSpeculativeScores);
+        computeAndCacheScore(processorNumber, publicKey, miningSeed, nonce, scoreCacheIndex);
+        return res;
     }
 };
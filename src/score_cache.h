@@ -10,11 +10,17 @@
 #include "kangaroo_twelve.h"
 
 /// Cache storing scores for pairs of publicKey and nonce (hash map)
+///
+/// Lookups don't acquire any lock: each entry has a version that is odd while the entry is written, so readers copy
+/// the entry and retry if the version has changed in between. Writers of an entry are serialized by the lock of the
+/// shard the entry belongs to (the cache index modulo numberOfShards). Hit, miss, and collision statistics are counted
+/// per shard to avoid contention on shared counters.
 template <unsigned int size, unsigned int collisionRetries = 20>
 class ScoreCache
 {
     static_assert(collisionRetries < size, "Number of fetch retries in case of collision is too big!");
 public:
+    static constexpr unsigned int numberOfShards = 256;
 
     /// Init cache
     ScoreCache()
@@ -25,12 +31,15 @@ public:
     /// Reset all cache entries
     void reset()
     {
-        ACQUIRE(lock);
+        acquireAllShards();
         setMem((unsigned char*)cache, sizeof(cache), 0);
-        hits = 0;
-        misses = 0;
-        collisions = 0;
-        RELEASE(lock);
+        for (unsigned int i = 0; i < numberOfShards; ++i)
+        {
+            shards[i].hits = 0;
+            shards[i].misses = 0;
+            shards[i].collisions = 0;
+        }
+        releaseAllShards();
     }
 
     /// Return maximum number of entries that can be stored in cache
@@ -39,15 +48,18 @@ public:
         return size;
     }
 
-    /// Get cache index based on hash function
-    unsigned int getCacheIndex(const m256i& publicKey, const m256i& miningSeed, const m256i& nonce)
+    /// Get cache index based on hash function. Public key, mining seed, and nonce are random already, so a cheap mix of
+    /// their 64-bit words (keyed with the mining seed) is sufficient.
+    unsigned int getCacheIndex(const m256i& publicKey, const m256i& miningSeed, const m256i& nonce) const
     {
-        m256i buffer[3] = { publicKey, miningSeed, nonce };
-        unsigned char digest[32];
-        KangarooTwelve(buffer, 96, digest, 32);
-        unsigned int result = *((unsigned long long*)digest) % capacity();
-
-        return result;
+        unsigned long long h = miningSeed.m256i_u64[0] ^ miningSeed.m256i_u64[1] ^ miningSeed.m256i_u64[2] ^ miningSeed.m256i_u64[3];
+        for (int i = 0; i < 4; ++i)
+        {
+            h = (h ^ publicKey.m256i_u64[i]) * 0x9E3779B97F4A7C15ULL;
+            h = (h ^ (h >> 29) ^ nonce.m256i_u64[i]) * 0xC2B2AE3D27D4EB4FULL;
+            h ^= h >> 32;
+        }
+        return (unsigned int)(h % capacity());
     }
 
     static constexpr int MIN_VALID_SCORE = 0;
@@ -58,39 +70,36 @@ public:
     // increments counter of hits, misses, or collisions
     int tryFetching(const m256i& publicKey, const m256i& miningSeed, const m256i& nonce, unsigned int & cacheIndex)
     {
-        int retVal;
+        int retVal = SCORE_CACHE_COLLISION;
         unsigned int tryFetchIdx = cacheIndex % capacity();
-        ACQUIRE(lock);
+        Shard& shard = shards[tryFetchIdx % numberOfShards];
         for (unsigned int i = 0; i < collisionRetries; ++i)
         {
-            const m256i& cachedPublicKey = cache[tryFetchIdx].publicKey;
-            if (isZero(cachedPublicKey))
+            CacheEntry entry;
+            readEntry(tryFetchIdx, entry);
+            if (isZero(entry.publicKey))
             {
                 // miss: data not available in cache yet (entry is empty)
-                misses++;
+                _InterlockedIncrement(&shard.misses);
                 retVal = SCORE_CACHE_MISS;
                 break;
             }
 
-            const m256i& cachedMiningSeed = cache[tryFetchIdx].miningSeed;
-            const m256i& cachedNonce = cache[tryFetchIdx].nonce;
-            if (cachedPublicKey == publicKey && cachedMiningSeed == miningSeed && cachedNonce == nonce)
+            if (entry.publicKey == publicKey && entry.miningSeed == miningSeed && entry.nonce == nonce)
             {
                 // hit: data available in cache -> return score
-                hits++;
-                retVal = cache[tryFetchIdx].score;
+                _InterlockedIncrement(&shard.hits);
+                retVal = entry.score;
                 break;
             }
 
             // collision: other data is mapped to same index -> retry at following index
-            retVal = SCORE_CACHE_COLLISION;
             tryFetchIdx = (tryFetchIdx + 1) % capacity();
         }
-        RELEASE(lock);
 
         if (retVal == SCORE_CACHE_COLLISION)
         {
-            collisions++;
+            _InterlockedIncrement(&shard.collisions);
         }
         else
         {
@@ -99,16 +108,41 @@ public:
         return retVal;
     }
 
+    /// Return if the score of the data is in the cache (without counting a hit or miss)
+    bool contains(const m256i& publicKey, const m256i& miningSeed, const m256i& nonce) const
+    {
+        unsigned int tryFetchIdx = getCacheIndex(publicKey, miningSeed, nonce);
+        for (unsigned int i = 0; i < collisionRetries; ++i)
+        {
+            CacheEntry entry;
+            readEntry(tryFetchIdx, entry);
+            if (isZero(entry.publicKey))
+            {
+                return false;
+            }
+            if (entry.publicKey == publicKey && entry.miningSeed == miningSeed && entry.nonce == nonce)
+            {
+                return true;
+            }
+            tryFetchIdx = (tryFetchIdx + 1) % capacity();
+        }
+        return false;
+    }
+
     /// Add entry to cache (may overwrite existing entry)
     void addEntry(const m256i& publicKey, const m256i& miningSeed, const m256i& nonce, unsigned int cacheIndex, int score)
     {
         cacheIndex %= capacity();
-        ACQUIRE(lock);
-        cache[cacheIndex].publicKey = publicKey;
-        cache[cacheIndex].miningSeed = miningSeed;
-        cache[cacheIndex].nonce = nonce;
-        cache[cacheIndex].score = score;
-        RELEASE(lock);
+        Shard& shard = shards[cacheIndex % numberOfShards];
+        CacheEntry& entry = cache[cacheIndex];
+        ACQUIRE(shard.lock);
+        _InterlockedIncrement(&entry.version);
+        entry.publicKey = publicKey;
+        entry.miningSeed = miningSeed;
+        entry.nonce = nonce;
+        entry.score = score;
+        _InterlockedIncrement(&entry.version);
+        RELEASE(shard.lock);
     }
 
     /// Save score cache to file
@@ -117,9 +151,9 @@ public:
         logToConsole(L"Saving score cache file...");
 
         const unsigned long long beginningTick = __rdtsc();
-        ACQUIRE(lock);
+        acquireAllShards();
         long long savedSize = ::save(filename, sizeof(cache), (unsigned char*)cache, directory);
-        RELEASE(lock);
+        releaseAllShards();
         if (savedSize == sizeof(cache))
         {
             setNumber(message, savedSize, TRUE);
@@ -136,9 +170,14 @@ public:
         bool success = true;
         logToConsole(L"Loading score cache...");
         reset();
-        ACQUIRE(lock);
+        acquireAllShards();
         long long loadedSize = ::load(filename, sizeof(cache), (unsigned char*)cache, directory);
-        RELEASE(lock);
+        // versions are not meaningful in the file (and must be even for readers)
+        for (unsigned int i = 0; i < size; ++i)
+        {
+            cache[i].version = 0;
+        }
+        releaseAllShards();
         if (loadedSize != sizeof(cache))
         {
             if (loadedSize == -1)
@@ -165,19 +204,34 @@ public:
     // Return number of hits (data available in cache when fetched)
     unsigned int hitCount() const
     {
-        return hits;
+        unsigned int count = 0;
+        for (unsigned int i = 0; i < numberOfShards; ++i)
+        {
+            count += (unsigned int)shards[i].hits;
+        }
+        return count;
     }
 
     // Return number of misses (data not in cache yet)
     unsigned int missCount() const
     {
-        return misses;
+        unsigned int count = 0;
+        for (unsigned int i = 0; i < numberOfShards; ++i)
+        {
+            count += (unsigned int)shards[i].misses;
+        }
+        return count;
     }
 
     // Return number of collisions (other data is mapped to same index)
     unsigned int collisionCount() const
     {
-        return collisions;
+        unsigned int count = 0;
+        for (unsigned int i = 0; i < numberOfShards; ++i)
+        {
+            count += (unsigned int)shards[i].collisions;
+        }
+        return count;
     }
 
 private:
@@ -187,16 +241,63 @@ private:
         m256i miningSeed;
         m256i nonce;
         int score;
+        volatile long version; // odd while entry is written (uses former padding, so file layout is unchanged with 32-bit long)
     };
+
+    struct Shard
+    {
+        // lock to serialize writers of the entries of the shard
+        volatile char lock;
+
+        // statistics of hits, misses, and collisions
+        volatile long hits;
+        volatile long misses;
+        volatile long collisions;
+
+        char padding[64 - 4 * sizeof(long)];
+    };
+
+    // Copy entry without lock, retrying while it is written concurrently
+    void readEntry(unsigned int index, CacheEntry& entry) const
+    {
+        CacheEntry& src = const_cast<CacheEntry&>(cache[index]);
+        while (true)
+        {
+            const long version = src.version;
+            if (!(version & 1))
+            {
+                entry.publicKey = src.publicKey;
+                entry.miningSeed = src.miningSeed;
+                entry.nonce = src.nonce;
+                entry.score = src.score;
+                if (_InterlockedCompareExchange(&src.version, 0, 0) == version)
+                {
+                    return;
+                }
+            }
+            _mm_pause();
+        }
+    }
+
+    void acquireAllShards()
+    {
+        for (unsigned int i = 0; i < numberOfShards; ++i)
+        {
+            ACQUIRE(shards[i].lock);
+        }
+    }
+
+    void releaseAllShards()
+    {
+        for (unsigned int i = 0; i < numberOfShards; ++i)
+        {
+            RELEASE(shards[i].lock);
+        }
+    }
     
     // cache entries (set zero or load from a file on init)
     CacheEntry cache[size];
 
-    // lock to prevent race conditions on parallel access
-    volatile char lock = 0;
-
-    // statistics of hits, misses, and collisions
-    unsigned int hits = 0;
-    unsigned int misses = 0;
-    unsigned int collisions = 0;
+    // locks and statistics per shard
+    Shard shards[numberOfShards] = {};
 };
@@ -7,6 +7,8 @@
 #include "platform/time_stamp_counter.h"
 #include "platform/memory.h"
 #include "platform/profiling.h"
+#include "platform/parallel_work.h"
+#include "platform/copy_on_write.h"
 
 #include "network_messages/entity.h"
 
@@ -31,8 +33,354 @@ GLOBAL_VAR_DECL unsigned long long dustThresholdBurnAll GLOBAL_VAR_INIT(0), dust
 GLOBAL_VAR_DECL m256i* spectrumDigests GLOBAL_VAR_INIT(nullptr);
 static constexpr unsigned long long spectrumDigestsSizeInByte = (SPECTRUM_CAPACITY * 2 - 1) * 32ULL;
 
+// Entities changed since the last update of spectrumDigests, recorded by increaseEnergy() and decreaseEnergy().
+// There is one flag bit per entity (also used for the other tree levels in updateSpectrumDigests()) and a list of
+// indices, which is only complete if spectrumDirtyCount <= spectrumDirtyListCapacity.
+static constexpr unsigned long long spectrumDirtyListCapacity = (SPECTRUM_CAPACITY < (1ULL << 20)) ? SPECTRUM_CAPACITY : (1ULL << 20);
+GLOBAL_VAR_DECL unsigned long long* spectrumDirtyFlags GLOBAL_VAR_INIT(nullptr);
+GLOBAL_VAR_DECL unsigned int* spectrumDirtyIndices GLOBAL_VAR_INIT(nullptr);
+GLOBAL_VAR_DECL unsigned long long spectrumDirtyCount GLOBAL_VAR_INIT(0);
+
 GLOBAL_VAR_DECL unsigned long long spectrumReorgTotalExecutionTicks GLOBAL_VAR_INIT(0);
 
+// One-byte fingerprints of the public keys in spectrum (0 for empty slots), so spectrumIndex() and increaseEnergy()
+// can probe a group of slots with a few SIMD instructions instead of comparing the public keys one by one. The
+// fingerprints of the first group of slots are repeated after the last slot, so a group can be loaded at any index.
+static constexpr unsigned int spectrumFingerprintGroupSize = 32;
+GLOBAL_VAR_DECL unsigned char* spectrumFingerprints GLOBAL_VAR_INIT(nullptr);
+
+// Sequence number for lookups without lock, which is odd while reorganizeSpectrum() moves entities
+GLOBAL_VAR_DECL volatile long spectrumMoveSequence GLOBAL_VAR_INIT(0);
+
+// Version of each entity record for reading without lock. Writers (holding spectrumLock) make it odd before changing
+// the record and even again afterwards. Readers retry if it is odd or has changed while copying the record.
+GLOBAL_VAR_DECL volatile long* spectrumRecordVersions GLOBAL_VAR_INIT(nullptr);
+
+// Sequence number for reading spectrumDigests without lock, which is odd while the digests are updated
+GLOBAL_VAR_DECL volatile long spectrumDigestsSequence GLOBAL_VAR_INIT(0);
+
+// Copy-on-write snapshot for saving the spectrum without blocking transfers (region 0 is the spectrum). Records
+// changed before they are saved are copied to a pool of spectrumSnapshotPoolPages pages.
+static constexpr unsigned int spectrumSnapshotPoolPages = 16384;
+GLOBAL_VAR_DECL CopyOnWriteSnapshot<1> spectrumSnapshot;
+
+// Full recomputation of spectrumDigests and reorganization of the spectrum are split into this number of parts, which
+// are processed in parallel
+static constexpr unsigned int spectrumParallelParts = 256;
+static_assert(SPECTRUM_CAPACITY % spectrumParallelParts == 0, "SPECTRUM_CAPACITY must be a multiple of spectrumParallelParts");
+
+// Anti-dust is triggered by increaseEnergy() if the spectrum holds this number of entities (75% of capacity)
+static constexpr unsigned int spectrumAntiDustNumberOfEntities = (SPECTRUM_CAPACITY / 2) + (SPECTRUM_CAPACITY / 4);
+
+
+// Record that the entity at index has been changed, acquire no lock (caller must hold spectrumLock)
+static void markSpectrumEntityDirty(unsigned int index)
+{
+    const unsigned long long flag = 1ULL << (index & 63);
+    if (!(spectrumDirtyFlags[index >> 6] & flag))
+    {
+        spectrumDirtyFlags[index >> 6] |= flag;
+        if (spectrumDirtyCount < spectrumDirtyListCapacity)
+        {
+            spectrumDirtyIndices[spectrumDirtyCount] = index;
+        }
+        spectrumDirtyCount++;
+    }
+}
+
+// Start changing entity record at index, caller must hold spectrumLock
+static inline void beginSpectrumRecordWrite(unsigned int index)
+{
+    spectrumSnapshot.beforeWrite(0, index * sizeof(EntityRecord), sizeof(EntityRecord));
+    _InterlockedIncrement(&spectrumRecordVersions[index]);
+}
+
+// Finish changing entity record at index, caller must hold spectrumLock
+static inline void endSpectrumRecordWrite(unsigned int index)
+{
+    _InterlockedIncrement(&spectrumRecordVersions[index]);
+}
+
+// Copy entity record at index without lock. The copy is never a mix of the record before and after a change.
+static void readSpectrumRecord(unsigned int index, EntityRecord& record)
+{
+    while (true)
+    {
+        const long moveSequence = spectrumMoveSequence;
+        const long version = spectrumRecordVersions[index];
+        if (!((moveSequence | version) & 1))
+        {
+            copyMem(&record, &spectrum[index], sizeof(EntityRecord));
+
+            // interlocked read, so it isn't reordered with copying the record
+            if (_InterlockedCompareExchange(&spectrumRecordVersions[index], 0, 0) == version && spectrumMoveSequence == moveSequence)
+            {
+                return;
+            }
+        }
+        _mm_pause();
+    }
+}
+
+// Copy the siblings of the entity at index in spectrumDigests without lock, consistent with one state of the digests
+static void readSpectrumDigestSiblings(unsigned int index, m256i siblings[SPECTRUM_DEPTH])
+{
+    while (true)
+    {
+        const long sequence = spectrumDigestsSequence;
+        if (!(sequence & 1))
+        {
+            getSiblings<SPECTRUM_DEPTH>(index, spectrumDigests, siblings);
+            if (_InterlockedCompareExchange(&spectrumDigestsSequence, 0, 0) == sequence)
+            {
+                return;
+            }
+        }
+        _mm_pause();
+    }
+}
+
+// Fingerprint of non-zero public key. The slot index is derived from the lowest bits, so other bits are used.
+static inline unsigned char spectrumFingerprint(const m256i& publicKey)
+{
+    const unsigned char fingerprint = publicKey.m256i_u8[8];
+    return fingerprint ? fingerprint : 1;
+}
+
+// Set fingerprints of spectrum[beginIndex, endIndex) from the public keys, acquire no lock
+static void updateSpectrumFingerprints(unsigned int beginIndex, unsigned int endIndex)
+{
+    for (unsigned int i = beginIndex; i < endIndex; i++)
+    {
+        spectrumFingerprints[i] = isZero(spectrum[i].publicKey) ? 0 : spectrumFingerprint(spectrum[i].publicKey);
+    }
+    if (beginIndex < spectrumFingerprintGroupSize)
+    {
+        const unsigned int groupEndIndex = (endIndex < spectrumFingerprintGroupSize) ? endIndex : spectrumFingerprintGroupSize;
+        copyMem(&spectrumFingerprints[SPECTRUM_CAPACITY + beginIndex], &spectrumFingerprints[beginIndex], groupEndIndex - beginIndex);
+    }
+}
+
+// Find the slot of publicKey (non-zero) in spectrum by probing groups of slots. Returns true and the index of the
+// entity if it is found. Otherwise, returns false and the index of the empty slot at which the entity would be
+// inserted. Acquires no lock, so concurrent insertions are fine, because the public key of a new entity is written
+// before its fingerprint (see increaseEnergy()).
+static bool findSpectrumSlot(const m256i& publicKey, unsigned int& index)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i fingerprint = _mm256_set1_epi8((char)spectrumFingerprint(publicKey));
+    unsigned int groupIndex = publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
+
+    // Usually the entity is in its first slot, so load it in parallel to the fingerprints
+    _mm_prefetch((const char*)&spectrum[groupIndex], _MM_HINT_T0);
+
+    while (true)
+    {
+        const __m256i group = _mm256_loadu_si256((const __m256i*)&spectrumFingerprints[groupIndex]);
+        const unsigned int emptyMask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(group, zero));
+        unsigned int matchMask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(group, fingerprint));
+        if (emptyMask)
+        {
+            // The entity can only be before the first empty slot
+            matchMask &= (emptyMask & (0 - emptyMask)) - 1;
+        }
+        while (matchMask)
+        {
+            const unsigned int candidateIndex = (groupIndex + _tzcnt_u32(matchMask)) & (SPECTRUM_CAPACITY - 1);
+            if (spectrum[candidateIndex].publicKey == publicKey)
+            {
+                index = candidateIndex;
+                return true;
+            }
+            matchMask &= matchMask - 1;
+        }
+        if (emptyMask)
+        {
+            index = (groupIndex + _tzcnt_u32(emptyMask)) & (SPECTRUM_CAPACITY - 1);
+            return false;
+        }
+        groupIndex = (groupIndex + spectrumFingerprintGroupSize) & (SPECTRUM_CAPACITY - 1);
+    }
+}
+
+// Forget recorded entity changes, for example after computing all spectrumDigests from scratch, acquire no lock
+static void clearSpectrumDirtyEntities()
+{
+    if (spectrumDirtyCount <= spectrumDirtyListCapacity)
+    {
+        for (unsigned long long i = 0; i < spectrumDirtyCount; i++)
+        {
+            spectrumDirtyFlags[spectrumDirtyIndices[i] >> 6] = 0;
+        }
+    }
+    else
+    {
+        setMem(spectrumDirtyFlags, SPECTRUM_CAPACITY / 8, 0);
+    }
+    spectrumDirtyCount = 0;
+}
+
+// Compute the digests of the subtrees [beginIndex, endIndex) out of spectrumParallelParts subtrees of equal size
+static void recomputeSpectrumSubtreeDigests(void* context, unsigned long long beginIndex, unsigned long long endIndex)
+{
+    for (unsigned long long subtree = beginIndex; subtree < endIndex; subtree++)
+    {
+        unsigned long long subtreeLeafs = SPECTRUM_CAPACITY / spectrumParallelParts;
+        KangarooTwelve64To32xN(&spectrum[subtree * subtreeLeafs], &spectrumDigests[subtree * subtreeLeafs], subtreeLeafs);
+        unsigned long long levelBeginning = 0;
+        unsigned long long numberOfNodes = SPECTRUM_CAPACITY;
+        while (subtreeLeafs > 1)
+        {
+            KangarooTwelve64To32xN(&spectrumDigests[levelBeginning + subtree * subtreeLeafs], &spectrumDigests[levelBeginning + numberOfNodes + subtree * subtreeLeafs / 2], subtreeLeafs / 2);
+            levelBeginning += numberOfNodes;
+            numberOfNodes >>= 1;
+            subtreeLeafs >>= 1;
+        }
+    }
+}
+
+// Hash all spectrumDigests from scratch without changing spectrumDigestsSequence, see recomputeSpectrumDigests()
+static void hashAllSpectrumDigests()
+{
+    runParallelWork(recomputeSpectrumSubtreeDigests, nullptr, spectrumParallelParts, 1);
+
+    unsigned int previousLevelBeginning = 0;
+    unsigned int numberOfLeafs = SPECTRUM_CAPACITY;
+    while (numberOfLeafs > spectrumParallelParts)
+    {
+        previousLevelBeginning += numberOfLeafs;
+        numberOfLeafs >>= 1;
+    }
+    unsigned int digestIndex = previousLevelBeginning + numberOfLeafs;
+    while (numberOfLeafs > 1)
+    {
+        // The pairs of child digests are contiguous, so all nodes of the level are hashed with one call
+        KangarooTwelve64To32xN(&spectrumDigests[previousLevelBeginning], &spectrumDigests[digestIndex], numberOfLeafs / 2);
+        digestIndex += numberOfLeafs / 2;
+
+        previousLevelBeginning += numberOfLeafs;
+        numberOfLeafs >>= 1;
+    }
+}
+
+// Compute all spectrumDigests from scratch (expensive, because it hashes the whole spectrum), acquire no lock.
+// The subtrees are hashed in parallel with the help of idle processors, the remaining top levels by the caller.
+static void recomputeSpectrumDigests()
+{
+    PROFILE_SCOPE();
+
+    _InterlockedIncrement(&spectrumDigestsSequence);
+    hashAllSpectrumDigests();
+    _InterlockedIncrement(&spectrumDigestsSequence);
+}
+
+// Nodes of one tree level to be rehashed by updateSpectrumDigests()
+struct SpectrumDigestLevelUpdate
+{
+    const unsigned int* indices;    // indices of nodes within level
+    const m256i* previousLevel;     // first node of level below or nullptr if level of leafs
+    m256i* level;                   // first node of level
+};
+
+static void updateSpectrumDigestLevel(void* context, unsigned long long beginIndex, unsigned long long endIndex)
+{
+    const SpectrumDigestLevelUpdate* update = (const SpectrumDigestLevelUpdate*)context;
+    KangarooTwelve64To32Batch batch;
+    if (update->previousLevel)
+    {
+        for (unsigned long long i = beginIndex; i < endIndex; i++)
+        {
+            const unsigned int nodeIndex = update->indices[i];
+            batch.add(&update->previousLevel[nodeIndex * 2], &update->level[nodeIndex]);
+        }
+    }
+    else
+    {
+        for (unsigned long long i = beginIndex; i < endIndex; i++)
+        {
+            const unsigned int nodeIndex = update->indices[i];
+            batch.add(&spectrum[nodeIndex], &update->level[nodeIndex]);
+        }
+    }
+    batch.flush();
+}
+
+// Update spectrumDigests after entities have been changed, acquire no lock (caller must hold spectrumLock).
+// Only the paths from the changed leafs to the root are rehashed, level by level. Levels with many changed nodes
+// are hashed in parallel with the help of idle processors.
+static void updateSpectrumDigests()
+{
+    PROFILE_SCOPE();
+
+    constexpr unsigned long long minNodesForParallelHashing = 1024;
+    constexpr unsigned long long nodesPerChunk = 256;
+
+    if (!spectrumDirtyCount)
+    {
+        return;
+    }
+    if (spectrumDirtyCount > spectrumDirtyListCapacity)
+    {
+        // too many changes for incremental update
+        recomputeSpectrumDigests();
+        clearSpectrumDirtyEntities();
+        return;
+    }
+
+    _InterlockedIncrement(&spectrumDigestsSequence);
+
+    SpectrumDigestLevelUpdate update;
+    update.indices = spectrumDirtyIndices;
+    update.previousLevel = nullptr;
+    update.level = spectrumDigests;
+    unsigned long long numberOfDirtyNodes = spectrumDirtyCount;
+    unsigned long long numberOfNodes = SPECTRUM_CAPACITY;
+    while (true)
+    {
+        if (numberOfDirtyNodes >= minNodesForParallelHashing)
+        {
+            runParallelWork(updateSpectrumDigestLevel, &update, numberOfDirtyNodes, nodesPerChunk);
+        }
+        else
+        {
+            updateSpectrumDigestLevel(&update, 0, numberOfDirtyNodes);
+        }
+
+        if (numberOfNodes == 1)
+        {
+            break;
+        }
+
+        // Clear flags of this level and replace the node indices by the indices of the parent nodes (in place and
+        // without duplicates, using the flags of the next level)
+        for (unsigned long long i = 0; i < numberOfDirtyNodes; i++)
+        {
+            spectrumDirtyFlags[spectrumDirtyIndices[i] >> 6] = 0;
+        }
+        unsigned long long numberOfDirtyParents = 0;
+        for (unsigned long long i = 0; i < numberOfDirtyNodes; i++)
+        {
+            const unsigned int parentIndex = spectrumDirtyIndices[i] >> 1;
+            const unsigned long long flag = 1ULL << (parentIndex & 63);
+            if (!(spectrumDirtyFlags[parentIndex >> 6] & flag))
+            {
+                spectrumDirtyFlags[parentIndex >> 6] |= flag;
+                spectrumDirtyIndices[numberOfDirtyParents++] = parentIndex;
+            }
+        }
+        numberOfDirtyNodes = numberOfDirtyParents;
+
+        update.previousLevel = update.level;
+        update.level += numberOfNodes;
+        numberOfNodes >>= 1;
+    }
+
+    // Only the flag of the root is left
+    spectrumDirtyFlags[0] = 0;
+    spectrumDirtyCount = 0;
+
+    _InterlockedIncrement(&spectrumDigestsSequence);
+}
 
 // Update SpectrumInfo data (exensive, because it iterates the whole spectrum), acquire no lock
 static void updateSpectrumInfo(SpectrumInfo& si = spectrumInfo)
@@ -142,53 +490,151 @@ private:
     DustBurning* buf;
 };
 
-// Clean up spectrum hash map, removing all entities with balance 0. Updates spectrumInfo.
-static void reorganizeSpectrum()
+// Insert the entities with balance in spectrum[beginIndex, endIndex) into reorgSpectrum in order of their index.
+// Returns false without inserting the remaining entities if an entity would be placed outside of the region of
+// regionSize slots starting at regionBegin (wrapping around at the end of the hash map).
+static bool reinsertSpectrumEntities(EntityRecord* reorgSpectrum, unsigned int beginIndex, unsigned int endIndex, unsigned int regionBegin, unsigned int regionSize)
 {
-    PROFILE_SCOPE();
-
-    unsigned long long spectrumReorgStartTick = __rdtsc();
-
-    EntityRecord* reorgSpectrum = (EntityRecord*)reorgBuffer;
-    setMem(reorgSpectrum, SPECTRUM_CAPACITY * sizeof(EntityRecord), 0);
-    for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
+    for (unsigned int i = beginIndex; i < endIndex; i++)
     {
         if (spectrum[i].incomingAmount - spectrum[i].outgoingAmount)
         {
             unsigned int index = spectrum[i].publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
-
-        iteration:
-            if (isZero(reorgSpectrum[index].publicKey))
-            {
-                copyMem(&reorgSpectrum[index], &spectrum[i], sizeof(EntityRecord));
-            }
-            else
+            unsigned int regionOffset = (index - regionBegin) & (SPECTRUM_CAPACITY - 1);
+            while (true)
             {
+                if (regionOffset >= regionSize)
+                {
+                    return false;
+                }
+                if (isZero(reorgSpectrum[index].publicKey))
+                {
+                    copyMem(&reorgSpectrum[index], &spectrum[i], sizeof(EntityRecord));
+                    break;
+                }
                 index = (index + 1) & (SPECTRUM_CAPACITY - 1);
-
-                goto iteration;
+                regionOffset = (regionOffset + 1) & (SPECTRUM_CAPACITY - 1);
             }
         }
     }
-    copyMem(spectrum, reorgSpectrum, SPECTRUM_CAPACITY * sizeof(EntityRecord));
+    return true;
+}
 
-    unsigned int digestIndex;
-    for (digestIndex = 0; digestIndex < SPECTRUM_CAPACITY; digestIndex++)
+// Parallel reorganization of the spectrum, see reorganizeSpectrum()
+struct SpectrumReorganization
+{
+    EntityRecord* reorgSpectrum;
+    unsigned int lastEmptySlot;
+    volatile char failed;
+};
+
+// Return index of first empty slot >= beginIndex in spectrum, or lastEmptySlot if there is none before it
+static unsigned int findEmptySpectrumSlot(unsigned int beginIndex, unsigned int lastEmptySlot)
+{
+    for (unsigned int i = beginIndex; i < lastEmptySlot; i++)
     {
-        KangarooTwelve64To32(&spectrum[digestIndex], &spectrumDigests[digestIndex]);
+        if (isZero(spectrum[i].publicKey))
+        {
+            return i;
+        }
     }
-    unsigned int previousLevelBeginning = 0;
-    unsigned int numberOfLeafs = SPECTRUM_CAPACITY;
-    while (numberOfLeafs > 1)
+    return lastEmptySlot;
+}
+
+static void reorganizeSpectrumParts(void* context, unsigned long long beginIndex, unsigned long long endIndex)
+{
+    SpectrumReorganization* reorg = (SpectrumReorganization*)context;
+    for (unsigned long long part = beginIndex; part < endIndex; part++)
     {
-        for (unsigned int i = 0; i < numberOfLeafs; i += 2)
+        // The region of the part starts at an empty slot and ends before the next part's empty slot
+        const unsigned int regionBegin = findEmptySpectrumSlot((unsigned int)(part * (SPECTRUM_CAPACITY / spectrumParallelParts)), reorg->lastEmptySlot);
+        const unsigned int regionEnd = findEmptySpectrumSlot((unsigned int)((part + 1) * (SPECTRUM_CAPACITY / spectrumParallelParts)), reorg->lastEmptySlot);
+        setMem(&reorg->reorgSpectrum[regionBegin], (regionEnd - regionBegin) * sizeof(EntityRecord), 0);
+        if (!reinsertSpectrumEntities(reorg->reorgSpectrum, regionBegin, regionEnd, regionBegin, regionEnd - regionBegin))
         {
-            KangarooTwelve64To32(&spectrumDigests[previousLevelBeginning + i], &spectrumDigests[digestIndex++]);
+            reorg->failed = 1;
         }
+    }
+}
 
-        previousLevelBeginning += numberOfLeafs;
-        numberOfLeafs >>= 1;
+static void copyReorganizedSpectrumParts(void* context, unsigned long long beginIndex, unsigned long long endIndex)
+{
+    const EntityRecord* reorgSpectrum = (const EntityRecord*)context;
+    constexpr unsigned long long partSize = SPECTRUM_CAPACITY / spectrumParallelParts;
+    copyMem(&spectrum[beginIndex * partSize], &reorgSpectrum[beginIndex * partSize], (endIndex - beginIndex) * partSize * sizeof(EntityRecord));
+    updateSpectrumFingerprints((unsigned int)(beginIndex * partSize), (unsigned int)(endIndex * partSize));
+}
+
+// Clean up spectrum hash map, removing all entities with balance 0. Updates spectrumInfo.
+//
+// The result is the same as reinserting all entities with balance in order of their index into an empty hash map.
+// This is done in parallel with the help of idle processors: An empty slot in the spectrum stays empty after removing
+// entities, so the entities between two empty slots are reinserted between these slots independently of all others.
+// Thus, the spectrum is split into regions between empty slots, which are processed in parallel, except for the region
+// wrapping around at the end of the hash map. If an entity unexpectedly does not fit into its region, the whole
+// spectrum is reinserted by the caller.
+static void reorganizeSpectrum()
+{
+    PROFILE_SCOPE();
+
+    unsigned long long spectrumReorgStartTick = __rdtsc();
+
+    SpectrumReorganization reorg;
+    reorg.reorgSpectrum = (EntityRecord*)reorgBuffer;
+    reorg.failed = 0;
+
+    unsigned int firstEmptySlot = findEmptySpectrumSlot(0, SPECTRUM_CAPACITY);
+    reorg.lastEmptySlot = SPECTRUM_CAPACITY;
+    while (reorg.lastEmptySlot > firstEmptySlot + 1 && !isZero(spectrum[reorg.lastEmptySlot - 1].publicKey))
+    {
+        reorg.lastEmptySlot--;
+    }
+    if (firstEmptySlot < SPECTRUM_CAPACITY)
+    {
+        reorg.lastEmptySlot--;
+
+        // Region from the last empty slot wrapping around to the first empty slot (all slots if there is only one empty
+        // slot), entities in order of their index
+        const unsigned int wrappingRegionSize = ((firstEmptySlot - reorg.lastEmptySlot - 1) & (SPECTRUM_CAPACITY - 1)) + 1;
+        setMem(reorg.reorgSpectrum, firstEmptySlot * sizeof(EntityRecord), 0);
+        setMem(&reorg.reorgSpectrum[reorg.lastEmptySlot], (SPECTRUM_CAPACITY - reorg.lastEmptySlot) * sizeof(EntityRecord), 0);
+        if (!reinsertSpectrumEntities(reorg.reorgSpectrum, 0, firstEmptySlot, reorg.lastEmptySlot, wrappingRegionSize)
+            || !reinsertSpectrumEntities(reorg.reorgSpectrum, reorg.lastEmptySlot, SPECTRUM_CAPACITY, reorg.lastEmptySlot, wrappingRegionSize))
+        {
+            reorg.failed = 1;
+        }
+        else
+        {
+            runParallelWork(reorganizeSpectrumParts, &reorg, spectrumParallelParts, 1);
+        }
     }
+    else
+    {
+        // no empty slot
+        reorg.failed = 1;
+    }
+
+    if (reorg.failed)
+    {
+        setMem(reorg.reorgSpectrum, SPECTRUM_CAPACITY * sizeof(EntityRecord), 0);
+        reinsertSpectrumEntities(reorg.reorgSpectrum, 0, SPECTRUM_CAPACITY, 0, SPECTRUM_CAPACITY);
+    }
+
+    // All records may change, so a snapshot being saved needs to keep them (waits for the saver if the pool of the
+    // snapshot is too small)
+    spectrumSnapshot.beforeWrite(0, 0, spectrumSizeInBytes);
+
+    // Entities are moved, so lookups without lock have to wait. Digests don't match the entity indices until they
+    // are recomputed, so reading them without lock has to wait longer.
+    _InterlockedIncrement(&spectrumDigestsSequence);
+    _InterlockedIncrement(&spectrumMoveSequence);
+    runParallelWork(copyReorganizedSpectrumParts, reorg.reorgSpectrum, spectrumParallelParts, 1);
+    _InterlockedIncrement(&spectrumMoveSequence);
+
+    // Entities have been moved, so recorded changes are obsolete and all digests need to be recomputed
+    hashAllSpectrumDigests();
+    _InterlockedIncrement(&spectrumDigestsSequence);
+    clearSpectrumDirtyEntities();
 
     updateSpectrumInfo();
 
@@ -202,31 +648,20 @@ static int spectrumIndex(const m256i& publicKey)
         return -1;
     }
 
-    unsigned int index = publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
-
-    ACQUIRE(spectrumLock);
-
-iteration:
-    if (spectrum[index].publicKey == publicKey)
-    {
-        RELEASE(spectrumLock);
-
-        return index;
-    }
-    else
+    // Lookup without lock, retried if entities have been moved by reorganizeSpectrum() in the meantime
+    while (true)
     {
-        if (isZero(spectrum[index].publicKey))
+        const long sequence = spectrumMoveSequence;
+        if (!(sequence & 1))
         {
-            RELEASE(spectrumLock);
-
-            return -1;
-        }
-        else
-        {
-            index = (index + 1) & (SPECTRUM_CAPACITY - 1);
-
-            goto iteration;
+            unsigned int index;
+            const bool found = findSpectrumSlot(publicKey, index);
+            if (sequence == spectrumMoveSequence)
+            {
+                return found ? index : -1;
+            }
         }
+        _mm_pause();
     }
 }
 
@@ -235,17 +670,28 @@ static long long energy(const int index)
     return spectrum[index].incomingAmount - spectrum[index].outgoingAmount;
 }
 
+// Increase balance of existing entity at index, caller must hold spectrumLock
+static void increaseEnergyOfEntity(unsigned int index, long long amount)
+{
+    beginSpectrumRecordWrite(index);
+    spectrum[index].incomingAmount += amount;
+    spectrum[index].numberOfIncomingTransfers++;
+    spectrum[index].latestIncomingTransferTick = system.tick;
+    endSpectrumRecordWrite(index);
+    markSpectrumEntityDirty(index);
+
+    spectrumInfo.totalAmount += amount;
+}
+
 // Increase balance of entity.
 static void increaseEnergy(const m256i& publicKey, long long amount)
 {
     if (!isZero(publicKey) && amount >= 0)
     {
-        unsigned int index = publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
-
         ACQUIRE(spectrumLock);
 
         // Anti-dust feature: prevent that spectrum fills to more than 75% of capacity to keep hash map lookup fast
-        if (spectrumInfo.numberOfEntities >= (SPECTRUM_CAPACITY / 2) + (SPECTRUM_CAPACITY / 4))
+        if (spectrumInfo.numberOfEntities >= spectrumAntiDustNumberOfEntities)
         {
             // Update anti-dust burn thresholds (and log spectrum stats before burning)
             updateAndAnalzeEntityCategoryPopulations();
@@ -264,7 +710,9 @@ static void increaseEnergy(const m256i& publicKey, long long amount)
                     const unsigned long long balance = spectrum[i].incomingAmount - spectrum[i].outgoingAmount;
                     if (balance <= dustThresholdBurnAll && balance)
                     {
+                        beginSpectrumRecordWrite(i);
                         spectrum[i].outgoingAmount = spectrum[i].incomingAmount;
+                        endSpectrumRecordWrite(i);
 #if LOG_SPECTRUM
                         dbl.addDustBurn(spectrum[i].publicKey, balance);
 #endif
@@ -283,7 +731,9 @@ static void increaseEnergy(const m256i& publicKey, long long amount)
                     {
                         if (++countBurnCanadiates & 1)
                         {
+                            beginSpectrumRecordWrite(i);
                             spectrum[i].outgoingAmount = spectrum[i].incomingAmount;
+                            endSpectrumRecordWrite(i);
 #if LOG_SPECTRUM
                             dbl.addDustBurn(spectrum[i].publicKey, balance);
 #endif
@@ -307,49 +757,61 @@ static void increaseEnergy(const m256i& publicKey, long long amount)
 #endif
         }
 
-    iteration:
-        if (spectrum[index].publicKey == publicKey)
+        unsigned int index;
+        if (findSpectrumSlot(publicKey, index))
         {
-            spectrum[index].incomingAmount += amount;
-            spectrum[index].numberOfIncomingTransfers++;
-            spectrum[index].latestIncomingTransferTick = system.tick;
-
-            spectrumInfo.totalAmount += amount;
+            increaseEnergyOfEntity(index, amount);
         }
         else
         {
-            if (isZero(spectrum[index].publicKey))
+            beginSpectrumRecordWrite(index);
+            spectrum[index].publicKey = publicKey;
+            spectrum[index].incomingAmount = amount;
+            spectrum[index].numberOfIncomingTransfers = 1;
+            spectrum[index].latestIncomingTransferTick = system.tick;
+            endSpectrumRecordWrite(index);
+            markSpectrumEntityDirty(index);
+
+            // Publish entity to lookups without lock after writing its public key
+            ATOMIC_STORE8(((volatile char*)spectrumFingerprints)[index], (char)spectrumFingerprint(publicKey));
+            if (index < spectrumFingerprintGroupSize)
             {
-                spectrum[index].publicKey = publicKey;
-                spectrum[index].incomingAmount = amount;
-                spectrum[index].numberOfIncomingTransfers = 1;
-                spectrum[index].latestIncomingTransferTick = system.tick;
+                ATOMIC_STORE8(((volatile char*)spectrumFingerprints)[SPECTRUM_CAPACITY + index], (char)spectrumFingerprint(publicKey));
+            }
 
-                spectrumInfo.numberOfEntities++;
-                spectrumInfo.totalAmount += amount;
+            spectrumInfo.numberOfEntities++;
+            spectrumInfo.totalAmount += amount;
 
 #if LOG_SPECTRUM
-                if ((spectrumInfo.numberOfEntities & 0x7ffff) == 1)
-                {
-                    // Log spectrum stats when the number of entities hits the next half million
-                    // (== 1 is to avoid duplicate when anti-dust is triggered)
-                    updateAndAnalzeEntityCategoryPopulations();
-                    logSpectrumStats();
-                }
-#endif
-            }
-            else
+            if ((spectrumInfo.numberOfEntities & 0x7ffff) == 1)
             {
-                index = (index + 1) & (SPECTRUM_CAPACITY - 1);
-
-                goto iteration;
+                // Log spectrum stats when the number of entities hits the next half million
+                // (== 1 is to avoid duplicate when anti-dust is triggered)
+                updateAndAnalzeEntityCategoryPopulations();
+                logSpectrumStats();
             }
+#endif
         }
 
         RELEASE(spectrumLock);
     }
 }
 
+// Increase balance of existing entity at index. Does NOT check if index is valid. Unlike increaseEnergy(publicKey, amount),
+// it never burns dust, so it must only be used if the spectrum holds less than spectrumAntiDustNumberOfEntities.
+static void increaseEnergy(const int index, long long amount)
+{
+    if (amount >= 0)
+    {
+        ACQUIRE(spectrumLock);
+
+        ASSERT(spectrumInfo.numberOfEntities < spectrumAntiDustNumberOfEntities);
+        increaseEnergyOfEntity(index, amount);
+
+        RELEASE(spectrumLock);
+    }
+}
+
 // Decrease balance of entity if it is high enough. Does NOT check if index is valid.
 static bool decreaseEnergy(const int index, long long amount)
 {
@@ -359,9 +821,12 @@ static bool decreaseEnergy(const int index, long long amount)
 
         if (energy(index) >= amount)
         {
+            beginSpectrumRecordWrite(index);
             spectrum[index].outgoingAmount += amount;
             spectrum[index].numberOfOutgoingTransfers++;
             spectrum[index].latestOutgoingTransferTick = system.tick;
+            endSpectrumRecordWrite(index);
+            markSpectrumEntityDirty(index);
 
             spectrumInfo.totalAmount -= amount;
 
@@ -387,46 +852,100 @@ static bool loadSpectrum(const CHAR16* fileName = SPECTRUM_FILE_NAME, const CHAR
 
         return false;
     }
+    updateSpectrumFingerprints(0, SPECTRUM_CAPACITY);
+    clearSpectrumDirtyEntities();
     updateSpectrumInfo();
     return true;
 }
 
+// Take snapshot of the current spectrum, which is saved by saveSpectrumSnapshot() (or as delta segment if mode is
+// captureChanged) while transfers continue
+static void beginSpectrumSnapshot(CopyOnWriteSnapshot<1>::CaptureMode mode = CopyOnWriteSnapshot<1>::captureAll)
+{
+    ACQUIRE(spectrumLock);
+    spectrumSnapshot.begin(0, mode);
+    RELEASE(spectrumLock);
+}
+
+// Save snapshot taken by beginSpectrumSnapshot(). The caller must hold snapshotBufferLock. Can be called by any
+// processor (files are written through asyncSave() if available), but doesn't log to console.
+static bool saveSpectrumSnapshot(const CHAR16* fileName, const CHAR16* directory)
+{
+    const long long savedSize = spectrumSnapshot.captureAndSave(0, snapshotBuffer, fileName, directory);
+    return savedSize == SPECTRUM_CAPACITY * sizeof(EntityRecord);
+}
+
 static bool saveSpectrum(const CHAR16* fileName = SPECTRUM_FILE_NAME, const CHAR16* directory = nullptr)
 {
+    if (!TRY_ACQUIRE(snapshotBufferLock))
+    {
+        logToConsole(L"Cannot save spectrum while another snapshot is being saved.");
+        return false;
+    }
+
     logToConsole(L"Saving spectrum file...");
 
     const unsigned long long beginningTick = __rdtsc();
 
-    ACQUIRE(spectrumLock);
-    long long savedSize = save(fileName, SPECTRUM_CAPACITY * sizeof(EntityRecord), (unsigned char*)spectrum, directory);
-    RELEASE(spectrumLock);
+    beginSpectrumSnapshot();
+    const bool saved = saveSpectrumSnapshot(fileName, directory);
 
-    if (savedSize == SPECTRUM_CAPACITY * sizeof(EntityRecord))
+    RELEASE(snapshotBufferLock);
+
+    if (saved)
     {
-        setNumber(message, savedSize, TRUE);
+        setNumber(message, SPECTRUM_CAPACITY * sizeof(EntityRecord), TRUE);
         appendText(message, L" bytes of the spectrum data are saved (");
         appendNumber(message, (__rdtsc() - beginningTick) * 1000000 / frequency, TRUE);
         appendText(message, L" microseconds).");
         logToConsole(message);
-        return true;
     }
-    return false;
+    return saved;
 }
 
 static bool initSpectrum()
 {
     if (!allocPoolWithErrorLog(L"spectrum", spectrumSizeInBytes, (void**)&spectrum, __LINE__)
-        || !allocPoolWithErrorLog(L"spectrumDigests", spectrumDigestsSizeInByte, (void**)&spectrumDigests, __LINE__))
+        || !allocPoolWithErrorLog(L"spectrumDigests", spectrumDigestsSizeInByte, (void**)&spectrumDigests, __LINE__)
+        || !allocPoolWithErrorLog(L"spectrumDirtyFlags", SPECTRUM_CAPACITY / 8, (void**)&spectrumDirtyFlags, __LINE__)
+        || !allocPoolWithErrorLog(L"spectrumDirtyIndices", spectrumDirtyListCapacity * sizeof(unsigned int), (void**)&spectrumDirtyIndices, __LINE__)
+        || !allocPoolWithErrorLog(L"spectrumFingerprints", SPECTRUM_CAPACITY + spectrumFingerprintGroupSize, (void**)&spectrumFingerprints, __LINE__)
+        || !allocPoolWithErrorLog(L"spectrumRecordVersions", SPECTRUM_CAPACITY * sizeof(long), (void**)&spectrumRecordVersions, __LINE__)
+        || !spectrumSnapshot.init(spectrumSnapshotPoolPages)
+        || !spectrumSnapshot.initRegion(0, spectrum, spectrumSizeInBytes))
     {
         return false;
     }
     spectrumLock = 0;
+    spectrumMoveSequence = 0;
+    spectrumDigestsSequence = 0;
+    setMem((void*)spectrumRecordVersions, SPECTRUM_CAPACITY * sizeof(long), 0);
+    setMem(spectrumFingerprints, SPECTRUM_CAPACITY + spectrumFingerprintGroupSize, 0);
+    setMem(spectrumDirtyFlags, SPECTRUM_CAPACITY / 8, 0);
+    spectrumDirtyCount = 0;
 
     return true;
 }
 
 static void deinitSpectrum()
 {
+    spectrumSnapshot.deinit();
+    if (spectrumRecordVersions)
+    {
+        freePool((void*)spectrumRecordVersions);
+    }
+    if (spectrumFingerprints)
+    {
+        freePool(spectrumFingerprints);
+    }
+    if (spectrumDirtyIndices)
+    {
+        freePool(spectrumDirtyIndices);
+    }
+    if (spectrumDirtyFlags)
+    {
+        freePool(spectrumDirtyFlags);
+    }
     if (spectrumDigests)
     {
         freePool(spectrumDigests);
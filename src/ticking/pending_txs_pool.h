@@ -0,0 +1,505 @@
+#pragma once
+
+#include "network_messages/transactions.h"
+
+#include "platform/m256.h"
+#include "platform/memory_util.h"
+#include "platform/concurrency.h"
+#include "platform/debugging.h"
+
+#include "kangaroo_twelve.h"
+#include "public_settings.h"
+
+// Pool of pending transactions of non-computor entities that wait for being included in the tick data of their
+// scheduled tick.
+//
+// Memory scales with the number of pending transactions (PENDING_TXS_POOL_MAX_NUMBER_OF_TXS and
+// PENDING_TXS_POOL_ARENA_SIZE defined in public_settings.h) instead of with SPECTRUM_CAPACITY:
+// - Transactions are stored with their actual size in a memory arena. The arena is organized in granules of 16 bytes.
+//   Freed slots are recycled via one free list per slot size (number of granules).
+// - Transactions are bucketed by scheduled tick (one doubly-linked list per tick of the current epoch), so constructing
+//   tick data only touches the transactions scheduled for the target tick.
+// - An index by source public key (hash map with linear probing) implements the rule that a transaction with a higher
+//   tick replaces the pending transaction of the same source entity.
+//
+// This is a kind of singleton class with only static members (so all instances refer to the same data).
+class PendingTxsPool
+{
+public:
+    // Maximum number of transactions stored in the pool
+    static constexpr unsigned int maxNumberOfTxs = PENDING_TXS_POOL_MAX_NUMBER_OF_TXS;
+
+    // Number of bytes reserved for storing transactions
+    static constexpr unsigned long long arenaSize = PENDING_TXS_POOL_ARENA_SIZE;
+
+    // Returned by tx index iteration functions if there is no (further) transaction
+    static constexpr unsigned int NO_TX_INDEX = 0xffffffff;
+
+private:
+    static constexpr unsigned long long granuleSize = 16;
+    static constexpr unsigned int maxGranulesPerTx = (unsigned int)((MAX_TRANSACTION_SIZE + granuleSize - 1) / granuleSize);
+    static constexpr unsigned long long NO_ARENA_OFFSET = 0xffffffffffffffffULL;
+
+    // Number of slots in hash map source public key -> tx index (2^N, load factor <= 0.5)
+    static constexpr unsigned long long sourceIndexLength = 2ULL * maxNumberOfTxs;
+
+    static_assert(maxNumberOfTxs > 0 && maxNumberOfTxs < NO_TX_INDEX && (maxNumberOfTxs & (maxNumberOfTxs - 1)) == 0, "PENDING_TXS_POOL_MAX_NUMBER_OF_TXS must be a power of 2");
+    static_assert(arenaSize % granuleSize == 0 && arenaSize >= MAX_TRANSACTION_SIZE, "Invalid PENDING_TXS_POOL_ARENA_SIZE");
+
+    struct TxEntry
+    {
+        unsigned long long arenaOffset;
+        unsigned int tick;
+        unsigned int prevInTick;            // NO_TX_INDEX if first in tick bucket
+        unsigned int nextInTick;            // NO_TX_INDEX if last in tick bucket, next free entry if unused
+        unsigned int granules;
+    };
+
+    // Allocated transaction arena with arenaSize bytes
+    inline static unsigned char* arenaPtr = nullptr;
+
+    // Allocated array of maxNumberOfTxs entries
+    inline static TxEntry* txEntriesPtr = nullptr;
+
+    // Allocated array of maxNumberOfTxs digests (K12 of full transaction including signature)
+    inline static m256i* txDigestsPtr = nullptr;
+
+    // Allocated hash map with sourceIndexLength slots, each containing a tx index or NO_TX_INDEX
+    inline static unsigned int* sourceIndexPtr = nullptr;
+
+    // Allocated arrays with MAX_NUMBER_OF_TICKS_PER_EPOCH elements: first tx index and number of txs per tick
+    inline static unsigned int* tickBucketHeadsPtr = nullptr;
+    inline static unsigned int* tickBucketSizesPtr = nullptr;
+
+    // Free lists of arena slots, indexed by number of granules (the next offset is stored in the free slot itself)
+    inline static unsigned long long arenaFreeLists[maxGranulesPerTx + 1];
+
+    // Arena bytes that have never been used yet start at this offset
+    inline static unsigned long long arenaBumpOffset = 0;
+
+    // Entries that have never been used yet start at this index, freed entries are linked via nextInTick
+    inline static unsigned int entriesBumpIndex = 0;
+    inline static unsigned int freeEntriesHead = NO_TX_INDEX;
+
+    // Tick range of the current epoch and first tick that has not been discarded yet
+    inline static unsigned int tickBegin = 0;
+    inline static unsigned int tickEnd = 0;
+    inline static unsigned int firstKeptTick = 0;
+
+    // Statistics
+    inline static unsigned int numberOfTxs = 0;
+    inline static unsigned long long numberOfBytes = 0;
+    inline static unsigned long long numberOfRejectedTxs = 0;
+
+    // Lock for securing all data of the pool
+    inline static volatile char lock = 0;
+
+    static unsigned long long sourceIndexHome(const m256i& publicKey)
+    {
+        return publicKey.m256i_u32[0] & (sourceIndexLength - 1);
+    }
+
+    static Transaction* txPtr(unsigned int txIndex)
+    {
+        return (Transaction*)(arenaPtr + txEntriesPtr[txIndex].arenaOffset);
+    }
+
+    // Return slot in source index containing the tx of publicKey, or the empty slot where it would be inserted.
+    static unsigned long long findSourceSlot(const m256i& publicKey)
+    {
+        unsigned long long slot = sourceIndexHome(publicKey);
+        while (sourceIndexPtr[slot] != NO_TX_INDEX && txPtr(sourceIndexPtr[slot])->sourcePublicKey != publicKey)
+            slot = (slot + 1) & (sourceIndexLength - 1);
+        return slot;
+    }
+
+    // Remove slot from source index, shifting back following entries of the probe sequence (no tombstones needed).
+    static void eraseSourceSlot(unsigned long long slot)
+    {
+        unsigned long long next = slot;
+        while (true)
+        {
+            next = (next + 1) & (sourceIndexLength - 1);
+            const unsigned int txIndex = sourceIndexPtr[next];
+            if (txIndex == NO_TX_INDEX)
+                break;
+            const unsigned long long home = sourceIndexHome(txPtr(txIndex)->sourcePublicKey);
+            // move entry to slot if home is not cyclically in (slot, next]
+            const bool homeInRange = (slot <= next) ? (slot < home && home <= next) : (slot < home || home <= next);
+            if (!homeInRange)
+            {
+                sourceIndexPtr[slot] = txIndex;
+                slot = next;
+            }
+        }
+        sourceIndexPtr[slot] = NO_TX_INDEX;
+    }
+
+    static unsigned long long allocArenaSlot(unsigned int& granules)
+    {
+        // exact fit from free list
+        if (arenaFreeLists[granules] != NO_ARENA_OFFSET)
+        {
+            const unsigned long long offset = arenaFreeLists[granules];
+            arenaFreeLists[granules] = *(unsigned long long*)(arenaPtr + offset);
+            return offset;
+        }
+
+        // unused space at end of arena
+        if (arenaBumpOffset + granules * granuleSize <= arenaSize)
+        {
+            const unsigned long long offset = arenaBumpOffset;
+            arenaBumpOffset += granules * granuleSize;
+            return offset;
+        }
+
+        // larger slot from free list (keeps its size in order to be returned to the right list)
+        for (unsigned int g = granules + 1; g <= maxGranulesPerTx; ++g)
+        {
+            if (arenaFreeLists[g] != NO_ARENA_OFFSET)
+            {
+                const unsigned long long offset = arenaFreeLists[g];
+                arenaFreeLists[g] = *(unsigned long long*)(arenaPtr + offset);
+                granules = g;
+                return offset;
+            }
+        }
+
+        return NO_ARENA_OFFSET;
+    }
+
+    static void freeArenaSlot(unsigned long long offset, unsigned int granules)
+    {
+        *(unsigned long long*)(arenaPtr + offset) = arenaFreeLists[granules];
+        arenaFreeLists[granules] = offset;
+    }
+
+    static unsigned int allocEntry()
+    {
+        if (freeEntriesHead != NO_TX_INDEX)
+        {
+            const unsigned int txIndex = freeEntriesHead;
+            freeEntriesHead = txEntriesPtr[txIndex].nextInTick;
+            return txIndex;
+        }
+        if (entriesBumpIndex < maxNumberOfTxs)
+            return entriesBumpIndex++;
+        return NO_TX_INDEX;
+    }
+
+    // Remove tx from tick bucket and free its memory. Caller needs to remove it from source index before.
+    static void releaseTx(unsigned int txIndex)
+    {
+        TxEntry& entry = txEntriesPtr[txIndex];
+        const unsigned int bucket = entry.tick - tickBegin;
+        if (entry.prevInTick != NO_TX_INDEX)
+            txEntriesPtr[entry.prevInTick].nextInTick = entry.nextInTick;
+        else
+            tickBucketHeadsPtr[bucket] = entry.nextInTick;
+        if (entry.nextInTick != NO_TX_INDEX)
+            txEntriesPtr[entry.nextInTick].prevInTick = entry.prevInTick;
+        tickBucketSizesPtr[bucket]--;
+
+        numberOfTxs--;
+        numberOfBytes -= txPtr(txIndex)->totalSize();
+
+        freeArenaSlot(entry.arenaOffset, entry.granules);
+        entry.tick = 0;
+        entry.nextInTick = freeEntriesHead;
+        freeEntriesHead = txIndex;
+    }
+
+    // Reset pool to empty state without freeing buffers
+    static void reset()
+    {
+        setMem(sourceIndexPtr, sourceIndexLength * sizeof(unsigned int), 0xff);
+        setMem(tickBucketHeadsPtr, MAX_NUMBER_OF_TICKS_PER_EPOCH * sizeof(unsigned int), 0xff);
+        setMem(tickBucketSizesPtr, MAX_NUMBER_OF_TICKS_PER_EPOCH * sizeof(unsigned int), 0);
+        setMem(arenaFreeLists, sizeof(arenaFreeLists), 0xff);
+        arenaBumpOffset = 0;
+        entriesBumpIndex = 0;
+        freeEntriesHead = NO_TX_INDEX;
+        numberOfTxs = 0;
+        numberOfBytes = 0;
+    }
+
+public:
+    // Init at node startup
+    static bool init()
+    {
+        if (!allocPoolWithErrorLog(L"pendingTxsPool.arena", arenaSize, (void**)&arenaPtr, __LINE__)
+            || !allocPoolWithErrorLog(L"pendingTxsPool.txEntries", maxNumberOfTxs * sizeof(TxEntry), (void**)&txEntriesPtr, __LINE__)
+            || !allocPoolWithErrorLog(L"pendingTxsPool.txDigests", maxNumberOfTxs * sizeof(m256i), (void**)&txDigestsPtr, __LINE__)
+            || !allocPoolWithErrorLog(L"pendingTxsPool.sourceIndex", sourceIndexLength * sizeof(unsigned int), (void**)&sourceIndexPtr, __LINE__)
+            || !allocPoolWithErrorLog(L"pendingTxsPool.tickBucketHeads", MAX_NUMBER_OF_TICKS_PER_EPOCH * sizeof(unsigned int), (void**)&tickBucketHeadsPtr, __LINE__)
+            || !allocPoolWithErrorLog(L"pendingTxsPool.tickBucketSizes", MAX_NUMBER_OF_TICKS_PER_EPOCH * sizeof(unsigned int), (void**)&tickBucketSizesPtr, __LINE__))
+        {
+            return false;
+        }
+
+        lock = 0;
+        tickBegin = 0;
+        tickEnd = 0;
+        firstKeptTick = 0;
+        numberOfRejectedTxs = 0;
+        reset();
+
+        return true;
+    }
+
+    // Cleanup at node shutdown
+    static void deinit()
+    {
+        if (arenaPtr)
+        {
+            freePool(arenaPtr);
+            arenaPtr = nullptr;
+        }
+        if (txEntriesPtr)
+        {
+            freePool(txEntriesPtr);
+            txEntriesPtr = nullptr;
+        }
+        if (txDigestsPtr)
+        {
+            freePool(txDigestsPtr);
+            txDigestsPtr = nullptr;
+        }
+        if (sourceIndexPtr)
+        {
+            freePool(sourceIndexPtr);
+            sourceIndexPtr = nullptr;
+        }
+        if (tickBucketHeadsPtr)
+        {
+            freePool(tickBucketHeadsPtr);
+            tickBucketHeadsPtr = nullptr;
+        }
+        if (tickBucketSizesPtr)
+        {
+            freePool(tickBucketSizesPtr);
+            tickBucketSizesPtr = nullptr;
+        }
+    }
+
+    // Begin new epoch, discarding all pending transactions. Only transactions scheduled for ticks in
+    // [newInitialTick, newInitialTick + MAX_NUMBER_OF_TICKS_PER_EPOCH) are accepted afterwards.
+    static void beginEpoch(unsigned int newInitialTick)
+    {
+        ACQUIRE(lock);
+        reset();
+        tickBegin = newInitialTick;
+        tickEnd = newInitialTick + MAX_NUMBER_OF_TICKS_PER_EPOCH;
+        firstKeptTick = newInitialTick;
+        RELEASE(lock);
+    }
+
+    // Add transaction to the pool (transaction is assumed to be valid and verified). Returns true if the transaction
+    // has been added, false if it has been rejected.
+    // A transaction with a higher tick overwrites the previous transaction from the same address.
+    // Transactions scheduled beyond the end of the epoch storage are rejected, avoiding that accidents made by users/devs
+    // (setting scheduled tick too high) keep the transaction locked until end of epoch. It also makes sense that a node
+    // doesn't need to store a transaction that is scheduled on a tick that the node will never reach.
+    // Notice: MAX_NUMBER_OF_TICKS_PER_EPOCH is not set globally since every node may have different TARGET_TICK_DURATION
+    // time due to memory limitation.
+    static bool add(const Transaction* tx)
+    {
+        ASSERT(tx->checkValidity());
+        const unsigned int tick = tx->tick;
+        if (tick < firstKeptTick || tick >= tickEnd)
+            return false;
+
+        // Compute digest outside of lock
+        m256i digest;
+        KangarooTwelve(tx, tx->totalSize(), &digest, sizeof(digest));
+        return add(tx, digest);
+    }
+
+    // Add transaction with its digest K12(tx, tx->totalSize()) that has already been computed by the caller (see above).
+    static bool add(const Transaction* tx, const m256i& digest)
+    {
+        ASSERT(tx->checkValidity());
+        const unsigned int tick = tx->tick;
+        const unsigned int transactionSize = tx->totalSize();
+
+        ACQUIRE(lock);
+
+        if (tick < firstKeptTick || tick >= tickEnd)
+        {
+            RELEASE(lock);
+            return false;
+        }
+
+        unsigned long long sourceSlot = findSourceSlot(tx->sourcePublicKey);
+        const unsigned int oldTxIndex = sourceIndexPtr[sourceSlot];
+        if (oldTxIndex != NO_TX_INDEX && txEntriesPtr[oldTxIndex].tick >= tick)
+        {
+            RELEASE(lock);
+            return false;
+        }
+
+        // allocate before releasing an older transaction of the same source, which is kept if the new one doesn't fit
+        unsigned int granules = (unsigned int)((transactionSize + granuleSize - 1) / granuleSize);
+        const unsigned int txIndex = allocEntry();
+        const unsigned long long arenaOffset = (txIndex != NO_TX_INDEX) ? allocArenaSlot(granules) : NO_ARENA_OFFSET;
+        if (arenaOffset == NO_ARENA_OFFSET)
+        {
+            if (txIndex != NO_TX_INDEX)
+            {
+                txEntriesPtr[txIndex].nextInTick = freeEntriesHead;
+                freeEntriesHead = txIndex;
+            }
+            numberOfRejectedTxs++;
+            RELEASE(lock);
+            return false;
+        }
+
+        if (oldTxIndex != NO_TX_INDEX)
+        {
+            // replace older transaction of the same source
+            eraseSourceSlot(sourceSlot);
+            releaseTx(oldTxIndex);
+            sourceSlot = findSourceSlot(tx->sourcePublicKey);
+        }
+
+        copyMem(arenaPtr + arenaOffset, tx, transactionSize);
+        txDigestsPtr[txIndex] = digest;
+
+        const unsigned int bucket = tick - tickBegin;
+        TxEntry& entry = txEntriesPtr[txIndex];
+        entry.arenaOffset = arenaOffset;
+        entry.granules = granules;
+        entry.tick = tick;
+        entry.prevInTick = NO_TX_INDEX;
+        entry.nextInTick = tickBucketHeadsPtr[bucket];
+        if (entry.nextInTick != NO_TX_INDEX)
+            txEntriesPtr[entry.nextInTick].prevInTick = txIndex;
+        tickBucketHeadsPtr[bucket] = txIndex;
+        tickBucketSizesPtr[bucket]++;
+
+        sourceIndexPtr[sourceSlot] = txIndex;
+
+        numberOfTxs++;
+        numberOfBytes += transactionSize;
+
+        RELEASE(lock);
+
+        return true;
+    }
+
+    // Discard all transactions scheduled for ticks < tick, which are not needed anymore.
+    static void discardTicksBefore(unsigned int tick)
+    {
+        ACQUIRE(lock);
+        if (tick > tickEnd)
+            tick = tickEnd;
+        for (; firstKeptTick < tick; ++firstKeptTick)
+        {
+            const unsigned int bucket = firstKeptTick - tickBegin;
+            while (tickBucketHeadsPtr[bucket] != NO_TX_INDEX)
+            {
+                const unsigned int txIndex = tickBucketHeadsPtr[bucket];
+                eraseSourceSlot(findSourceSlot(txPtr(txIndex)->sourcePublicKey));
+                releaseTx(txIndex);
+            }
+        }
+        RELEASE(lock);
+    }
+
+    // Acquire lock, which is required for accessing the transactions of a tick with the functions below.
+    static void acquireLock()
+    {
+        ACQUIRE(lock);
+    }
+
+    static void releaseLock()
+    {
+        RELEASE(lock);
+    }
+
+    // Return number of transactions scheduled for tick. Caller needs to hold lock.
+    static unsigned int getNumberOfTickTxs(unsigned int tick)
+    {
+        if (tick < firstKeptTick || tick >= tickEnd)
+            return 0;
+        return tickBucketSizesPtr[tick - tickBegin];
+    }
+
+    // Return index of first transaction scheduled for tick or NO_TX_INDEX. Caller needs to hold lock.
+    static unsigned int getFirstTickTxIndex(unsigned int tick)
+    {
+        if (tick < firstKeptTick || tick >= tickEnd)
+            return NO_TX_INDEX;
+        return tickBucketHeadsPtr[tick - tickBegin];
+    }
+
+    // Return index of next transaction scheduled for the same tick or NO_TX_INDEX. Caller needs to hold lock.
+    static unsigned int getNextTickTxIndex(unsigned int txIndex)
+    {
+        ASSERT(txIndex < maxNumberOfTxs);
+        return txEntriesPtr[txIndex].nextInTick;
+    }
+
+    // Return transaction of index. Caller needs to hold lock.
+    static const Transaction* getTx(unsigned int txIndex)
+    {
+        ASSERT(txIndex < maxNumberOfTxs && txEntriesPtr[txIndex].tick);
+        return txPtr(txIndex);
+    }
+
+    // Return digest (K12 of full transaction) of index. Caller needs to hold lock.
+    static const m256i& getDigest(unsigned int txIndex)
+    {
+        ASSERT(txIndex < maxNumberOfTxs && txEntriesPtr[txIndex].tick);
+        return txDigestsPtr[txIndex];
+    }
+
+    // Return number of transactions scheduled for ticks > tick (without acquiring lock, may be inaccurate)
+    static unsigned int getNumberOfPendingTxs(unsigned int tick)
+    {
+        unsigned int count = numberOfTxs;
+        for (unsigned int t = firstKeptTick; t <= tick && t < tickEnd; ++t)
+            count -= tickBucketSizesPtr[t - tickBegin];
+        return count;
+    }
+
+    // Return total size of stored transactions in bytes
+    static unsigned long long getNumberOfBytes()
+    {
+        return numberOfBytes;
+    }
+
+    // Return number of transactions that have been rejected because the pool was full
+    static unsigned long long getNumberOfRejectedTxs()
+    {
+        return numberOfRejectedTxs;
+    }
+
+    // Useful for debugging, but expensive: check that everything is as expected.
+    static void checkStateConsistencyWithAssert()
+    {
+        unsigned int countedTxs = 0;
+        unsigned long long countedBytes = 0;
+        for (unsigned int tick = firstKeptTick; tick < tickEnd; ++tick)
+        {
+            unsigned int countedTickTxs = 0;
+            unsigned int prevIndex = NO_TX_INDEX;
+            for (unsigned int txIndex = tickBucketHeadsPtr[tick - tickBegin]; txIndex != NO_TX_INDEX; txIndex = txEntriesPtr[txIndex].nextInTick)
+            {
+                const Transaction* tx = txPtr(txIndex);
+                ASSERT(txEntriesPtr[txIndex].tick == tick);
+                ASSERT(txEntriesPtr[txIndex].prevInTick == prevIndex);
+                ASSERT(tx->tick == tick);
+                ASSERT(tx->checkValidity());
+                ASSERT(sourceIndexPtr[findSourceSlot(tx->sourcePublicKey)] == txIndex);
+                prevIndex = txIndex;
+                countedTickTxs++;
+                countedBytes += tx->totalSize();
+            }
+            ASSERT(countedTickTxs == tickBucketSizesPtr[tick - tickBegin]);
+            countedTxs += countedTickTxs;
+        }
+        ASSERT(countedTxs == numberOfTxs);
+        ASSERT(countedBytes == numberOfBytes);
+    }
+};
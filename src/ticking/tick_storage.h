@@ -8,6 +8,7 @@
 #include "platform/console_logging.h"
 #include "platform/debugging.h"
 
+#include "kangaroo_twelve.h"
 #include "public_settings.h"
 
 #if TICK_STORAGE_AUTOSAVE_MODE
@@ -28,6 +29,7 @@ constexpr unsigned short INVALIDATED_TICK_DATA = 0xffff;
 // - ticks (one Tick struct per tick and Computor)
 // - tickTransactions (continuous buffer efficiently storing the variable-size transactions)
 // - tickTransactionOffsets (offsets of transactions in buffer, order in tickTransactions may differ)
+// - tickTransactionDigests (digests of transactions, next to each offset, computed once when adding the transaction)
 // - nextTickTransactionOffset (offset of next transition to be added)
 class TickStorage
 {
@@ -50,6 +52,8 @@ private:
     static constexpr unsigned long long tickTransactionOffsetsSizeCurrentEpoch = tickTransactionOffsetsLengthCurrentEpoch * sizeof(unsigned long long);
     static constexpr unsigned long long tickTransactionOffsetsSizePreviousEpoch = tickTransactionOffsetsLengthPreviousEpoch * sizeof(unsigned long long);
     static constexpr unsigned long long tickTransactionOffsetsSize = tickTransactionOffsetsLength * sizeof(unsigned long long);
+    static constexpr unsigned long long tickTransactionDigestsSizeCurrentEpoch = tickTransactionOffsetsLengthCurrentEpoch * sizeof(m256i);
+    static constexpr unsigned long long tickTransactionDigestsSize = tickTransactionOffsetsLength * sizeof(m256i);
 
 
     // Tick number range of current epoch storage
@@ -72,6 +76,9 @@ private:
     // Allocated tickTransactionOffsets buffer with tickTransactionOffsetsLength elements (includes current and previous epoch data)
     inline static unsigned long long* tickTransactionOffsetsPtr = nullptr;
 
+    // Allocated tickTransactionDigests buffer with tickTransactionOffsetsLength elements (includes current and previous epoch data)
+    inline static m256i* tickTransactionDigestsPtr = nullptr;
+
     // Tick data of previous epoch. Points to tickData + MAX_NUMBER_OF_TICKS_PER_EPOCH
     inline static TickData* oldTickDataPtr = nullptr;
 
@@ -93,7 +100,7 @@ private:
     // One lock per computor for securing ticks element in current tick (only the tick system.tick is written)
     inline static volatile char ticksLocks[NUMBER_OF_COMPUTORS];
 
-    // Lock for securing tickTransactions and tickTransactionOffsets
+    // Lock for securing tickTransactions, tickTransactionOffsets, and tickTransactionDigests
     inline static volatile char tickTransactionsLock = 0;
 
     // Lock for securing tickTransactions and tickTransactionsDigestPtr
@@ -408,6 +415,17 @@ public:
             initMetaData(epoch);
             return 2;
         }
+
+        // digests aren't saved, because they can be recomputed from the transactions
+        logToConsole(L"Computing transaction digests...");
+        for (unsigned long long i = 0; i < nTick * NUMBER_OF_TRANSACTIONS_PER_TICK; i++)
+        {
+            if (tickTransactionOffsetsPtr[i])
+            {
+                const Transaction* transaction = tickTransactions(tickTransactionOffsetsPtr[i]);
+                KangarooTwelve(transaction, transaction->totalSize(), &tickTransactionDigestsPtr[i], sizeof(m256i));
+            }
+        }
         return 0;
     }
 
@@ -447,6 +465,7 @@ public:
             || !allocPoolWithErrorLog(L"tickPtr", ticksSize, (void**)&ticksPtr, __LINE__)
             || !allocPoolWithErrorLog(L"tickTransactionPtr", tickTransactionsSize, (void**)&tickTransactionsPtr, __LINE__)
             || !allocPoolWithErrorLog(L"tickTransactionOffset", tickTransactionOffsetsSize, (void**)&tickTransactionOffsetsPtr, __LINE__)
+            || !allocPoolWithErrorLog(L"tickTransactionDigests", tickTransactionDigestsSize, (void**)&tickTransactionDigestsPtr, __LINE__)
             || !allocPoolWithErrorLog(L"tickTransactionsDigestPtr", tickTransactionOffsetsLengthCurrentEpoch * sizeof(TransactionsDigestAccess::HashMapEntry), (void**)&tickTransactionsDigestPtr, __LINE__))
         {
             return false;
@@ -490,6 +509,11 @@ public:
             freePool(tickTransactionOffsetsPtr);
         }
 
+        if (tickTransactionDigestsPtr)
+        {
+            freePool(tickTransactionDigestsPtr);
+        }
+
         if (tickTransactionsPtr)
         {
             freePool(tickTransactionsPtr);
@@ -546,6 +570,7 @@ public:
                 {
                     const unsigned long long* tickOffsets = TickTransactionOffsetsAccess::getByTickInCurrentEpoch(tickId);
                     unsigned long long* tickOffsetsPrevEp = TickTransactionOffsetsAccess::getByTickInPreviousEpoch(tickId);
+                    copyMem(TickTransactionDigestsAccess::getByTickInPreviousEpoch(tickId), TickTransactionDigestsAccess::getByTickInCurrentEpoch(tickId), NUMBER_OF_TRANSACTIONS_PER_TICK * sizeof(m256i));
                     for (unsigned int transactionIdx = 0; transactionIdx < NUMBER_OF_TRANSACTIONS_PER_TICK; ++transactionIdx)
                     {
                         const unsigned long long offset = tickOffsets[transactionIdx];
@@ -587,6 +612,7 @@ public:
             setMem(tickDataPtr, MAX_NUMBER_OF_TICKS_PER_EPOCH * sizeof(TickData), 0);
             setMem(ticksPtr, ticksLengthCurrentEpoch * sizeof(Tick), 0);
             setMem(tickTransactionOffsetsPtr, tickTransactionOffsetsSizeCurrentEpoch, 0);
+            setMem(tickTransactionDigestsPtr, tickTransactionDigestsSizeCurrentEpoch, 0);
             setMem(tickTransactionsPtr, tickTransactionsSizeCurrentEpoch, 0);
         }
         else
@@ -595,6 +621,7 @@ public:
             setMem(tickDataPtr, tickDataSize, 0);
             setMem(ticksPtr, ticksSize, 0);
             setMem(tickTransactionOffsetsPtr, tickTransactionOffsetsSize, 0);
+            setMem(tickTransactionDigestsPtr, tickTransactionDigestsSize, 0);
             setMem(tickTransactionsPtr, tickTransactionsSize, 0);
             oldTickBegin = 0;
             oldTickEnd = 0;
@@ -637,6 +664,7 @@ public:
         ASSERT(ticksPtr != nullptr);
         ASSERT(tickTransactionsPtr != nullptr);
         ASSERT(tickTransactionOffsetsPtr != nullptr);
+        ASSERT(tickTransactionDigestsPtr != nullptr);
         ASSERT(oldTickDataPtr == tickDataPtr + MAX_NUMBER_OF_TICKS_PER_EPOCH);
         ASSERT(oldTicksPtr == ticksPtr + ticksLengthCurrentEpoch);
         ASSERT(oldTickTransactionsPtr == tickTransactionsPtr + tickTransactionsSizeCurrentEpoch);
@@ -929,6 +957,41 @@ public:
         }
     } tickTransactionOffsets;
 
+    // Struct for structured, convenient access via ".tickTransactionDigests". The digest K12(transaction, totalSize())
+    // is stored next to each offset in tickTransactionOffsets and only valid if the offset is not 0.
+    struct TickTransactionDigestsAccess
+    {
+        // Return pointer to digest array of transactions by tick index independent of epoch (checking index with ASSERT)
+        inline static m256i* getByTickIndex(unsigned int tickIndex)
+        {
+            ASSERT(tickIndex < tickDataLength);
+            return tickTransactionDigestsPtr + (tickIndex * NUMBER_OF_TRANSACTIONS_PER_TICK);
+        }
+
+        // Return pointer to digest array of transactions of tick in current epoch by tick (checking tick with ASSERT)
+        inline static m256i* getByTickInCurrentEpoch(unsigned int tick)
+        {
+            ASSERT(tickInCurrentEpochStorage(tick));
+            const unsigned int tickIndex = tickToIndexCurrentEpoch(tick);
+            return getByTickIndex(tickIndex);
+        }
+
+        // Return pointer to digest array of transactions of tick in previous epoch by tick (checking tick with ASSERT)
+        inline static m256i* getByTickInPreviousEpoch(unsigned int tick)
+        {
+            ASSERT(tickInPreviousEpochStorage(tick));
+            const unsigned int tickIndex = tickToIndexPreviousEpoch(tick);
+            return getByTickIndex(tickIndex);
+        }
+
+        // Return reference to digest by tick and transaction in current epoch (checking inputs with ASSERT)
+        inline m256i& operator()(unsigned int tick, unsigned int transaction)
+        {
+            ASSERT(transaction < NUMBER_OF_TRANSACTIONS_PER_TICK);
+            return getByTickInCurrentEpoch(tick)[transaction];
+        }
+    } tickTransactionDigests;
+
     // Offset of next free space in tick transaction storage
     inline static unsigned long long nextTickTransactionOffset = FIRST_TICK_TRANSACTION_OFFSET;
 
@@ -962,6 +1025,26 @@ public:
         }
     } tickTransactions;
 
+    // Copy transaction to the storage of the current epoch and set offset and digest of the transaction slot of the
+    // tick, replacing the transaction that may already be in the slot. The digest K12(transaction, totalSize()) has to
+    // be computed (or verified) by the caller. Caller must hold the tickTransactions lock. Returns false if the storage
+    // space is exhausted.
+    static bool addTransaction(unsigned int tick, unsigned int transactionIndex, const Transaction* transaction, const m256i& digest)
+    {
+        ASSERT(transactionIndex < NUMBER_OF_TRANSACTIONS_PER_TICK);
+        ASSERT(transaction->checkValidity());
+        const unsigned int transactionSize = transaction->totalSize();
+        if (nextTickTransactionOffset + transactionSize > tickTransactionsSizeCurrentEpoch)
+        {
+            return false;
+        }
+        TickTransactionOffsetsAccess::getByTickInCurrentEpoch(tick)[transactionIndex] = nextTickTransactionOffset;
+        TickTransactionDigestsAccess::getByTickInCurrentEpoch(tick)[transactionIndex] = digest;
+        copyMem(TickTransactionsAccess::ptr(nextTickTransactionOffset), transaction, transactionSize);
+        nextTickTransactionOffset += transactionSize;
+        return true;
+    }
+
     // Struct for access the transaction using its digest. It contains the offset in tickTransactionsPtr
     struct TransactionsDigestAccess
     {
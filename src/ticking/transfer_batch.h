@@ -0,0 +1,214 @@
+#pragma once
+
+#include "network_messages/common_def.h"
+#include "network_messages/transactions.h"
+
+#include "platform/m256.h"
+#include "platform/memory.h"
+#include "platform/parallel_work.h"
+#include "platform/debugging.h"
+
+#include "spectrum/spectrum.h"
+
+// Batch of consecutive plain QU transfers of a tick, executed with the same result as processing them one after another.
+//
+// Plain transfers are transactions to entities that are neither the system nor a contract. Their only effect is
+// changing the balances of source and destination, so their read and write sets are known before execution. This is
+// used to split the execution into:
+// 1. Collecting the transfers with add() and mapping the public keys to batch-local accounts (read/write set entries).
+// 2. Looking up all accounts in the spectrum in parallel, which is the costly part (cache misses in the hash map).
+// 3. Resolving the outcome of each transfer in tick order on the batch-local balances. Transfers with conflicting
+//    accounts see the balances left by the transfers before them.
+// 4. Committing the transfers in tick order with commit(), which writes the spectrum records by index and checks the
+//    outcome.
+// The lookups are only valid if the spectrum isn't reorganized during the batch. Thus, execute() refuses batches that
+// may trigger anti-dust by creating new entities. These have to be processed one by one.
+class TransferBatch
+{
+public:
+    // Maximum number of transfers in a batch
+    static constexpr unsigned int capacity = NUMBER_OF_TRANSACTIONS_PER_TICK;
+
+    // Minimum number of accounts for looking them up in parallel (otherwise overhead dominates)
+    static constexpr unsigned int parallelMinAccounts = 64;
+
+    struct Transfer
+    {
+        const Transaction* transaction;
+        unsigned int transactionIndex;
+        unsigned short sourceAccount;
+        unsigned short destinationAccount;
+        bool sourceExists;  // false if source isn't in spectrum, so the transaction is ignored
+        bool success;       // balance of source was high enough
+    };
+
+private:
+    static constexpr unsigned int accountCapacity = 2 * capacity;
+    static constexpr unsigned int accountTableSize = 2 * accountCapacity;
+    static_assert((accountTableSize & (accountTableSize - 1)) == 0, "accountTableSize must be a power of 2");
+
+    struct Account
+    {
+        m256i publicKey;
+        int spectrumIndex;  // -1 if the entity isn't in spectrum yet
+        bool exists;        // batch-local state
+        long long balance;  // batch-local state
+    };
+
+    Transfer transfers[capacity];
+    Account accounts[accountCapacity];
+    unsigned short accountTable[accountTableSize]; // account index + 1, 0 if empty
+    unsigned int numberOfTransfers;
+    unsigned int numberOfAccounts;
+    long spectrumMoveSequenceOfLookups;
+
+    // Return index of account of publicKey, adding it if it isn't in batch yet
+    unsigned short account(const m256i& publicKey)
+    {
+        unsigned int slot = (publicKey.m256i_u32[0] ^ publicKey.m256i_u32[5]) & (accountTableSize - 1);
+        while (accountTable[slot])
+        {
+            const unsigned short accountIndex = accountTable[slot] - 1;
+            if (accounts[accountIndex].publicKey == publicKey)
+                return accountIndex;
+            slot = (slot + 1) & (accountTableSize - 1);
+        }
+        ASSERT(numberOfAccounts < accountCapacity);
+        accounts[numberOfAccounts].publicKey = publicKey;
+        accountTable[slot] = (unsigned short)(numberOfAccounts + 1);
+        return (unsigned short)numberOfAccounts++;
+    }
+
+    // Parallel work function looking up the accounts [beginIndex, endIndex) in spectrum
+    static void lookUpAccounts(void* context, unsigned long long beginIndex, unsigned long long endIndex)
+    {
+        Account* accounts = (Account*)context;
+        for (unsigned long long i = beginIndex; i < endIndex; ++i)
+        {
+            Account& account = accounts[i];
+            account.spectrumIndex = ::spectrumIndex(account.publicKey);
+            account.exists = (account.spectrumIndex >= 0);
+            account.balance = (account.exists) ? energy(account.spectrumIndex) : 0;
+        }
+    }
+
+public:
+    // Return if the transaction is a plain QU transfer that may be added to a batch
+    static bool isPlainTransfer(const Transaction* transaction)
+    {
+        // Destination must neither be the system (zero) nor a contract (only lowest 64 bits may be non-zero, see
+        // processTickTransaction())
+        m256i maskedDestinationPublicKey = transaction->destinationPublicKey;
+        maskedDestinationPublicKey.m256i_u64[0] = 0;
+        return !isZero(maskedDestinationPublicKey);
+    }
+
+    // Remove all transfers
+    void reset()
+    {
+        numberOfTransfers = 0;
+        numberOfAccounts = 0;
+        setMem(accountTable, sizeof(accountTable), 0);
+    }
+
+    unsigned int getNumberOfTransfers() const
+    {
+        return numberOfTransfers;
+    }
+
+    const Transfer& getTransfer(unsigned int transferIndex) const
+    {
+        ASSERT(transferIndex < numberOfTransfers);
+        return transfers[transferIndex];
+    }
+
+    // Add plain transfer (see isPlainTransfer()) to the end of the batch. Returns false if batch is full.
+    bool add(const Transaction* transaction, unsigned int transactionIndex)
+    {
+        ASSERT(isPlainTransfer(transaction));
+        ASSERT(transaction->checkValidity());
+        if (numberOfTransfers >= capacity)
+            return false;
+        Transfer& transfer = transfers[numberOfTransfers++];
+        transfer.transaction = transaction;
+        transfer.transactionIndex = transactionIndex;
+        transfer.sourceAccount = account(transaction->sourcePublicKey);
+        transfer.destinationAccount = account(transaction->destinationPublicKey);
+        return true;
+    }
+
+    // Look up accounts and resolve the outcome of all transfers. Must be called by the thread processing the tick
+    // (spectrum must not change until all transfers are committed). Returns false if the transfers may trigger
+    // anti-dust, which requires to process them one by one.
+    bool execute()
+    {
+        spectrumMoveSequenceOfLookups = spectrumMoveSequence;
+        if (numberOfAccounts >= parallelMinAccounts)
+            runParallelWork(lookUpAccounts, accounts, numberOfAccounts, 32);
+        else
+            lookUpAccounts(accounts, 0, numberOfAccounts);
+
+        // Each new entity may trigger anti-dust, which reorganizes the spectrum and burns balances
+        unsigned int numberOfNewEntities = 0;
+        for (unsigned int i = 0; i < numberOfAccounts; ++i)
+        {
+            if (!accounts[i].exists)
+                ++numberOfNewEntities;
+        }
+        if (spectrumInfo.numberOfEntities + numberOfNewEntities >= spectrumAntiDustNumberOfEntities)
+            return false;
+
+        // Resolve outcomes in tick order like decreaseEnergy() / increaseEnergy() of processTickTransaction()
+        for (unsigned int i = 0; i < numberOfTransfers; ++i)
+        {
+            Transfer& transfer = transfers[i];
+            Account& source = accounts[transfer.sourceAccount];
+            Account& destination = accounts[transfer.destinationAccount];
+            const long long amount = transfer.transaction->amount;
+            transfer.sourceExists = source.exists;
+            transfer.success = source.exists && source.balance >= amount;
+            if (transfer.success)
+            {
+                source.balance -= amount;
+                destination.balance += amount;
+                destination.exists = true;
+            }
+        }
+        return true;
+    }
+
+    // Apply changes of transfer to spectrum and return if it succeeded. Must be called for all transfers with
+    // sourceExists in the order of the batch after execute() returned true.
+    bool commit(unsigned int transferIndex)
+    {
+        ASSERT(transferIndex < numberOfTransfers);
+        ASSERT(spectrumMoveSequence == spectrumMoveSequenceOfLookups);
+        const Transfer& transfer = transfers[transferIndex];
+        ASSERT(transfer.sourceExists);
+        if (!transfer.success)
+            return false;
+
+        const long long amount = transfer.transaction->amount;
+        Account& source = accounts[transfer.sourceAccount];
+        if (source.spectrumIndex < 0)
+        {
+            // created by previous transfer of batch
+            source.spectrumIndex = ::spectrumIndex(source.publicKey);
+        }
+        const bool decreased = decreaseEnergy(source.spectrumIndex, amount);
+        ASSERT(decreased);
+
+        Account& destination = accounts[transfer.destinationAccount];
+        if (destination.spectrumIndex < 0)
+        {
+            // create entity, the index of which is only known afterwards
+            increaseEnergy(destination.publicKey, amount);
+            destination.spectrumIndex = ::spectrumIndex(destination.publicKey);
+        }
+        else
+        {
+            increaseEnergy(destination.spectrumIndex, amount);
+        }
+        return decreased;
+    }
+};
@@ -33,6 +33,7 @@ public:
     {
         memset(assets, 0, ASSETS_CAPACITY * sizeof(assets[0]));
         as.indexLists.reset();
+        as.entityLists.reset();
     }
 
     static void checkAssetsConsistency(bool printInfo = false)
@@ -118,6 +119,22 @@ public:
             EXPECT_EQ(it1->second, it2->second);
         }
 
+        // check that the list of each entity contains all its ownership and possession records
+        for (int index = 0; index < ASSETS_CAPACITY; index++)
+        {
+            if (assets[index].varStruct.ownership.type != OWNERSHIP && assets[index].varStruct.possession.type != POSSESSION)
+                continue;
+            const m256i& publicKey = assets[index].varStruct.ownership.publicKey;
+            bool found = false;
+            for (unsigned int recordIdx = entityLists.firstIdx(publicKey); recordIdx != NO_ASSET_INDEX; recordIdx = entityLists.nextIdx[recordIdx])
+            {
+                EXPECT_LT(recordIdx, ASSETS_CAPACITY);
+                EXPECT_EQ(assets[recordIdx].varStruct.ownership.publicKey, publicKey);
+                found = found || (recordIdx == index);
+            }
+            EXPECT_TRUE(found);
+        }
+
         // check that number of owned and possessed shares are equal for each issuance
         issuanceIdx = indexLists.issuancesFirstIdx;
         while (issuanceIdx != NO_ASSET_INDEX)
@@ -2,6 +2,9 @@
 
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <string>
+#include <vector>
 
 #include "contract_testing.h"
 
@@ -100,6 +103,22 @@ public:
     {
         return this->prevPostAcquireSharesInput;
     }
+
+    void setIsolatedTickProcedures(uint32 numberOfMessages, bool violateIsolation)
+    {
+        this->isolatedTickNumberOfMessages = numberOfMessages;
+        this->isolatedTickViolateIsolation = violateIsolation;
+    }
+};
+
+class StateCheckerTestExampleC : public TESTEXC
+{
+public:
+    void setIsolatedTickProcedures(uint32 numberOfMessages, bool violateIsolation)
+    {
+        this->isolatedTickNumberOfMessages = numberOfMessages;
+        this->isolatedTickViolateIsolation = violateIsolation;
+    }
 };
 
 class ContractTestingTestEx : protected ContractTesting
@@ -143,6 +162,11 @@ public:
         return (StateCheckerTestExampleB*)contractStates[TESTEXB_CONTRACT_INDEX];
     }
 
+    StateCheckerTestExampleC* getStateTestExampleC()
+    {
+        return (StateCheckerTestExampleC*)contractStates[TESTEXC_CONTRACT_INDEX];
+    }
+
     sint64 issueAssetQx(const Asset& asset, sint64 numberOfShares, uint64 unitOfMeasurement, sint8 numberOfDecimalPlaces)
     {
         QX::IssueAsset_input input{ asset.assetName, numberOfShares, unitOfMeasurement, numberOfDecimalPlaces };
@@ -1326,3 +1350,151 @@ TEST(ContractTestEx, BurnAssets)
         EXPECT_EQ(1000000 - 100, numberOfShares(asset, { USER1, QX_CONTRACT_INDEX }, { USER1, QX_CONTRACT_INDEX }));
     }
 }
+
+struct ContractExecParallelWorkHelpers
+{
+    std::atomic<bool> stop;
+    std::vector<std::thread> threads;
+
+    ContractExecParallelWorkHelpers(unsigned int numberOfThreads) : stop(false)
+    {
+        for (unsigned int i = 0; i < numberOfThreads; ++i)
+        {
+            threads.emplace_back([this]()
+                {
+                    while (!stop)
+                    {
+                        helpWithParallelWork();
+                        std::this_thread::yield();
+                    }
+                });
+        }
+    }
+
+    ~ContractExecParallelWorkHelpers()
+    {
+        stop = true;
+        for (auto& thread : threads)
+            thread.join();
+    }
+};
+
+// Reference of runTickSystemProcedures(): call BEGIN_TICK / END_TICK of all active contracts one after another
+static void callTickSystemProceduresOneByOne(SystemProcedureID systemProcId)
+{
+    for (unsigned int i = 1; i < contractCount; i++)
+    {
+        const unsigned int contractIndex = (systemProcId == BEGIN_TICK) ? i : contractCount - i;
+        if (system.epoch >= contractDescriptions[contractIndex].constructionEpoch
+            && system.epoch < contractDescriptions[contractIndex].destructionEpoch)
+        {
+            QpiContextSystemProcedureCall qpiContext(contractIndex, systemProcId);
+            qpiContext.call();
+        }
+    }
+}
+
+// Get log events starting at logId without their log ID (for comparing the events of different runs)
+static std::vector<std::string> getLogEventsWithoutId(unsigned long long& logId)
+{
+    std::vector<std::string> events;
+    while (true)
+    {
+        qLogger::BlobInfo bi = logger.logBuf.getBlobInfo(logId);
+        if (bi.startIndex < 0 || bi.length <= 0)
+            break;
+        std::string event(bi.length, 0);
+        logger.logBuf.getMany(event.data(), bi.startIndex, bi.length);
+        event.erase(10, 8);
+        events.push_back(event);
+        ++logId;
+    }
+    return events;
+}
+
+TEST(ContractTestEx, IsolatedTickProceduresInParallel)
+{
+    ContractTestingTestEx test;
+    const unsigned int testContracts[] = { TESTEXA_CONTRACT_INDEX, TESTEXB_CONTRACT_INDEX, TESTEXC_CONTRACT_INDEX, TESTEXD_CONTRACT_INDEX, QX_CONTRACT_INDEX };
+    system.epoch = 0;
+    for (unsigned int contractIndex : testContracts)
+        system.epoch = std::max<unsigned short>(system.epoch, contractDescriptions[contractIndex].constructionEpoch);
+    EXPECT_TRUE(logger.initDeferredContractMessages(TESTEXB_CONTRACT_INDEX));
+    EXPECT_TRUE(logger.initDeferredContractMessages(TESTEXC_CONTRACT_INDEX));
+
+    // log an event first, because probing the end of the log with getLogEventsWithoutId() requires a non-empty log
+    struct
+    {
+        unsigned int _contractIndex;
+        unsigned int _type;
+        sint8 _terminator;
+    } firstMessage{};
+    logger.__logContractInfoMessage(0, firstMessage);
+    unsigned long long logId = 0;
+    getLogEventsWithoutId(logId);
+
+    // number of messages of TESTEXB and TESTEXC per procedure (more than 3000 exceed the deferred message buffer),
+    // and whether they abort by violating isolation after logging
+    const struct
+    {
+        uint32 numberOfMessagesB, numberOfMessagesC;
+        bool violateIsolationB, violateIsolationC;
+    } configs[] = {
+        { 0, 0, false, false },
+        { 10, 20, false, false },
+        { 10, 4000, false, false },
+        { 4000, 10, false, false },
+        { 5000, 4000, false, false },
+        { 100, 4000, false, true },
+        { 4000, 100, true, false },
+        { 5000, 4000, true, true },
+    };
+    for (const auto& config : configs)
+    {
+        test.getStateTestExampleB()->setIsolatedTickProcedures(config.numberOfMessagesB, config.violateIsolationB);
+        test.getStateTestExampleC()->setIsolatedTickProcedures(config.numberOfMessagesC, config.violateIsolationC);
+
+        std::vector<std::vector<unsigned char>> statesBefore;
+        for (unsigned int contractIndex : testContracts)
+            statesBefore.emplace_back(contractStates[contractIndex], contractStates[contractIndex] + contractDescriptions[contractIndex].stateSize);
+
+        // run all one after another
+        callTickSystemProceduresOneByOne(BEGIN_TICK);
+        callTickSystemProceduresOneByOne(END_TICK);
+        const std::vector<std::string> expectedLogEvents = getLogEventsWithoutId(logId);
+        EXPECT_GE(expectedLogEvents.size(), 2 * (config.numberOfMessagesB + config.numberOfMessagesC));
+        std::vector<m256i> expectedStateDigests;
+        for (unsigned int contractIndex : testContracts)
+        {
+            m256i digest;
+            KangarooTwelve(contractStates[contractIndex], contractDescriptions[contractIndex].stateSize, &digest, 32);
+            expectedStateDigests.push_back(digest);
+        }
+        EXPECT_EQ(contractError[TESTEXB_CONTRACT_INDEX], (unsigned int)(config.violateIsolationB ? ContractErrorIsolationViolated : NoContractError));
+        EXPECT_EQ(contractError[TESTEXC_CONTRACT_INDEX], (unsigned int)(config.violateIsolationC ? ContractErrorIsolationViolated : NoContractError));
+
+        // restore states and run isolated procedures in parallel
+        for (unsigned int i = 0; i < std::size(testContracts); ++i)
+            copyMem(contractStates[testContracts[i]], statesBefore[i].data(), statesBefore[i].size());
+        contractError[TESTEXB_CONTRACT_INDEX] = NoContractError;
+        contractError[TESTEXC_CONTRACT_INDEX] = NoContractError;
+        {
+            ContractExecParallelWorkHelpers helpers(3);
+            runTickSystemProcedures(BEGIN_TICK);
+            runTickSystemProcedures(END_TICK);
+        }
+        const std::vector<std::string> logEvents = getLogEventsWithoutId(logId);
+        EXPECT_EQ(logEvents.size(), expectedLogEvents.size());
+        EXPECT_TRUE(logEvents == expectedLogEvents);
+        for (unsigned int i = 0; i < std::size(testContracts); ++i)
+        {
+            m256i digest;
+            KangarooTwelve(contractStates[testContracts[i]], contractDescriptions[testContracts[i]].stateSize, &digest, 32);
+            EXPECT_EQ(digest, expectedStateDigests[i]);
+        }
+        EXPECT_EQ(contractError[TESTEXB_CONTRACT_INDEX], (unsigned int)(config.violateIsolationB ? ContractErrorIsolationViolated : NoContractError));
+        EXPECT_EQ(contractError[TESTEXC_CONTRACT_INDEX], (unsigned int)(config.violateIsolationC ? ContractErrorIsolationViolated : NoContractError));
+        contractError[TESTEXB_CONTRACT_INDEX] = NoContractError;
+        contractError[TESTEXC_CONTRACT_INDEX] = NoContractError;
+    }
+}
@@ -62,6 +62,7 @@ public:
     {
         initSpectrum();
         memset(spectrum, 0, spectrumSizeInBytes);
+        updateSpectrumFingerprints(0, SPECTRUM_CAPACITY);
         updateSpectrumInfo();
     }
 
@@ -69,7 +70,8 @@ public:
     {
         initAssets();
         memset(assets, 0, universeSizeInBytes);
-        as.indexLists.reset();
+        as.indexLists.reset();
+        as.entityLists.reset();
     }
 
     template <typename InputType, typename OutputType>
@@ -0,0 +1,309 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/platform/copy_on_write.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+
+typedef CopyOnWriteSnapshot<2> TestSnapshot;
+static constexpr unsigned long long pageSize = TestSnapshot::pageSize;
+
+static void fillRegion(std::vector<unsigned long long>& region, unsigned long long value)
+{
+    for (unsigned long long i = 0; i < region.size(); ++i)
+        region[i] = value + i;
+}
+
+static void checkCapturedRegion(const std::vector<unsigned long long>& captured, unsigned long long value)
+{
+    for (unsigned long long i = 0; i < captured.size(); ++i)
+    {
+        EXPECT_EQ(captured[i], value + i);
+        if (captured[i] != value + i)
+            break;
+    }
+}
+
+TEST(TestCoreCopyOnWrite, WritesDuringCapture)
+{
+    // two regions, the second one with a partial last page
+    std::vector<unsigned long long> region0(8 * pageSize / 8), region1((3 * pageSize + 24) / 8);
+    std::vector<unsigned long long> captured0(region0.size()), captured1(region1.size());
+    fillRegion(region0, 1000);
+    fillRegion(region1, 2000);
+
+    auto snapshot = std::make_unique<TestSnapshot>();
+    EXPECT_TRUE(snapshot->init(16));
+    EXPECT_TRUE(snapshot->initRegion(0, region0.data(), region0.size() * 8));
+    EXPECT_TRUE(snapshot->initRegion(1, region1.data(), region1.size() * 8));
+    EXPECT_FALSE(snapshot->isCapturing(0));
+
+    // writes without running capture don't copy pages
+    snapshot->beforeWrite(0, 0, region0.size() * 8);
+    EXPECT_EQ(snapshot->numberOfCopiedPages, 0);
+
+    snapshot->begin(0);
+    snapshot->begin(1);
+    EXPECT_TRUE(snapshot->isCapturing(0));
+    EXPECT_TRUE(snapshot->isCapturing(1));
+
+    // change some values spanning page boundaries and the partial last page
+    snapshot->beforeWrite(0, pageSize - 8, 16);
+    region0[pageSize / 8 - 1] = 0;
+    region0[pageSize / 8] = 0;
+    snapshot->beforeWrite(0, 5 * pageSize + 8, 8);
+    region0[5 * pageSize / 8 + 1] = 0;
+    snapshot->beforeWrite(1, 3 * pageSize + 16, 8);
+    region1[region1.size() - 1] = 0;
+    EXPECT_EQ(snapshot->numberOfCopiedPages, 4);
+
+    // writing again to copied pages doesn't copy again
+    snapshot->beforeWrite(0, pageSize, 8);
+    region0[pageSize / 8] = 1;
+    EXPECT_EQ(snapshot->numberOfCopiedPages, 4);
+
+    // captured data is the state at begin()
+    snapshot->capture(0, (unsigned char*)captured0.data());
+    snapshot->capture(1, (unsigned char*)captured1.data());
+    EXPECT_FALSE(snapshot->isCapturing(0));
+    EXPECT_FALSE(snapshot->isCapturing(1));
+    checkCapturedRegion(captured0, 1000);
+    checkCapturedRegion(captured1, 2000);
+
+    // after capture, writes don't copy pages anymore
+    snapshot->beforeWrite(0, 0, region0.size() * 8);
+    EXPECT_EQ(snapshot->numberOfCopiedPages, 4);
+
+    // second snapshot reuses the pool and contains the changes
+    fillRegion(region0, 3000);
+    snapshot->begin(0);
+    snapshot->beforeWrite(0, 0, region0.size() * 8);
+    fillRegion(region0, 4000);
+    EXPECT_EQ(snapshot->numberOfCopiedPages, 12);
+    snapshot->capture(0, (unsigned char*)captured0.data());
+    checkCapturedRegion(captured0, 3000);
+
+    snapshot->deinit();
+}
+
+TEST(TestCoreCopyOnWrite, CaptureChangedPages)
+{
+    // region with a partial last page
+    std::vector<unsigned long long> region((6 * pageSize + 40) / 8), captured(region.size());
+    std::vector<unsigned int> pageIndices(7);
+    std::vector<unsigned char> pageData(7 * pageSize);
+    fillRegion(region, 100);
+
+    auto snapshot = std::make_unique<TestSnapshot>();
+    EXPECT_TRUE(snapshot->init(16));
+    EXPECT_TRUE(snapshot->initRegion(0, region.data(), region.size() * 8));
+
+    // base capture resets the record of changed pages
+    snapshot->beforeWrite(0, 0, 8);
+    EXPECT_EQ(snapshot->getNumberOfChangedPages(0), 1);
+    snapshot->begin(0, TestSnapshot::captureBase);
+    EXPECT_EQ(snapshot->getNumberOfChangedPages(0), 0);
+    EXPECT_EQ(snapshot->getNumberOfCapturedPages(0), 7);
+    snapshot->capture(0, (unsigned char*)captured.data());
+    checkCapturedRegion(captured, 100);
+
+    // change pages 1, 4, and the partial last page 6
+    snapshot->beforeWrite(0, pageSize + 8, 8);
+    region[pageSize / 8 + 1] = 0;
+    snapshot->beforeWrite(0, 4 * pageSize, 16);
+    region[4 * pageSize / 8] = 0;
+    snapshot->beforeWrite(0, 6 * pageSize + 32, 8);
+    region[region.size() - 1] = 0;
+    EXPECT_EQ(snapshot->getNumberOfChangedPages(0), 3);
+
+    // capture the changes, while pages 4 (changed) and 5 (unchanged) are written again
+    snapshot->begin(0, TestSnapshot::captureChanged);
+    EXPECT_EQ(snapshot->getNumberOfCapturedPages(0), 3);
+    EXPECT_EQ(snapshot->getNumberOfChangedPages(0), 0);
+    snapshot->beforeWrite(0, 4 * pageSize + 8, 8);
+    region[4 * pageSize / 8 + 1] = 0;
+    snapshot->beforeWrite(0, 5 * pageSize, 8);
+    region[5 * pageSize / 8] = 0;
+    EXPECT_EQ(snapshot->numberOfCopiedPages, 1);
+    snapshot->captureChangedPages(0, pageIndices.data(), pageData.data());
+    EXPECT_FALSE(snapshot->isCapturing(0));
+
+    EXPECT_EQ(pageIndices[0], 1);
+    EXPECT_EQ(pageIndices[1], 4);
+    EXPECT_EQ(pageIndices[2], 6);
+    const unsigned long long* page1 = (const unsigned long long*)pageData.data();
+    const unsigned long long* page4 = (const unsigned long long*)(pageData.data() + pageSize);
+    const unsigned long long* page6 = (const unsigned long long*)(pageData.data() + 2 * pageSize);
+    EXPECT_EQ(page1[0], 100 + pageSize / 8);
+    EXPECT_EQ(page1[1], 0);
+    EXPECT_EQ(page4[0], 0);
+    EXPECT_EQ(page4[1], 101 + 4 * pageSize / 8);
+    EXPECT_EQ(page6[3], 103 + 6 * pageSize / 8);
+    EXPECT_EQ(page6[4], 0);
+    EXPECT_EQ(page6[5], 0);
+
+    // writes during the capture are part of the next delta
+    EXPECT_EQ(snapshot->getNumberOfChangedPages(0), 2);
+
+    // applying the delta to the base capture results in the state at begin()
+    std::vector<unsigned long long> expected = region;
+    expected[4 * pageSize / 8 + 1] = 101 + 4 * pageSize / 8;
+    expected[5 * pageSize / 8] = 100 + 5 * pageSize / 8;
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+        const unsigned long long offset = pageIndices[i] * pageSize;
+        const unsigned long long bytes = std::min(pageSize, region.size() * 8 - offset);
+        memcpy((unsigned char*)captured.data() + offset, pageData.data() + i * pageSize, bytes);
+    }
+    for (unsigned long long i = 0; i < region.size(); ++i)
+    {
+        EXPECT_EQ(captured[i], expected[i]);
+        if (captured[i] != expected[i])
+            break;
+    }
+
+    snapshot->deinit();
+}
+
+TEST(TestCoreCopyOnWrite, WriterWaitsIfPoolIsExhausted)
+{
+    std::vector<unsigned long long> region(64 * pageSize / 8), captured(region.size());
+    fillRegion(region, 1);
+
+    auto snapshot = std::make_unique<TestSnapshot>();
+    EXPECT_TRUE(snapshot->init(4));
+    EXPECT_TRUE(snapshot->initRegion(0, region.data(), region.size() * 8));
+    snapshot->begin(0);
+
+    // writer changes the whole region, but only 4 pages fit into the pool -> has to wait for capture
+    std::thread writer([&]()
+        {
+            snapshot->beforeWrite(0, 0, region.size() * 8);
+            fillRegion(region, 5);
+        });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    snapshot->capture(0, (unsigned char*)captured.data());
+    writer.join();
+
+    checkCapturedRegion(captured, 1);
+    checkCapturedRegion(region, 5);
+    EXPECT_GE(snapshot->numberOfCopiedPages, 4);
+    EXPECT_GT(snapshot->numberOfWaitsForSaver, 0);
+
+    snapshot->deinit();
+}
+
+TEST(TestCoreCopyOnWrite, ConcurrentWritersAndCapture)
+{
+    // each writer increments values in its own set of slots
+    constexpr unsigned int numberOfWriters = 3;
+    constexpr unsigned long long numberOfSlots = 1024 * pageSize / 8;
+    std::vector<unsigned long long> region(numberOfSlots, 0), captured(numberOfSlots);
+
+    auto snapshot = std::make_unique<TestSnapshot>();
+    EXPECT_TRUE(snapshot->init(64));
+    EXPECT_TRUE(snapshot->initRegion(0, region.data(), region.size() * 8));
+
+    volatile char lock = 0;
+    std::atomic<bool> stop = false;
+    std::vector<std::thread> writers;
+    for (unsigned int w = 0; w < numberOfWriters; ++w)
+    {
+        writers.emplace_back([&, w]()
+            {
+                unsigned long long random = w + 1;
+                while (!stop)
+                {
+                    random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+                    const unsigned long long slot = ((random >> 20) % (numberOfSlots / numberOfWriters)) * numberOfWriters + w;
+
+                    // like spectrum writers, which hold spectrumLock while changing records
+                    ACQUIRE(lock);
+                    snapshot->beforeWrite(0, slot * 8, 8);
+                    region[slot]++;
+                    RELEASE(lock);
+                }
+            });
+    }
+
+    for (int round = 0; round < 20; ++round)
+    {
+        // take the cut while holding the lock (no writes in progress) and remember the state expected in snapshot
+        ACQUIRE(lock);
+        std::vector<unsigned long long> expected = region;
+        snapshot->begin(0);
+        RELEASE(lock);
+
+        snapshot->capture(0, (unsigned char*)captured.data());
+        for (unsigned long long i = 0; i < numberOfSlots; ++i)
+        {
+            EXPECT_EQ(captured[i], expected[i]);
+            if (captured[i] != expected[i])
+                break;
+        }
+    }
+
+    stop = true;
+    for (auto& writer : writers)
+        writer.join();
+
+    snapshot->deinit();
+}
+
+TEST(TestCoreCopyOnWrite, DISABLED_PerformanceWriteLatency)
+{
+    // region of 256 MB, written at random positions (like transfers changing spectrum records)
+    constexpr unsigned long long regionSize = 256ULL * 1024 * 1024;
+    constexpr unsigned long long numberOfWrites = 2000000;
+    std::vector<unsigned long long> region(regionSize / 8, 1), captured(regionSize / 8);
+
+    auto snapshot = std::make_unique<TestSnapshot>();
+    EXPECT_TRUE(snapshot->init(16384));
+    EXPECT_TRUE(snapshot->initRegion(0, region.data(), regionSize));
+
+    for (bool capturing : { false, true })
+    {
+        std::atomic<bool> captureDone = !capturing;
+        std::thread saver;
+        if (capturing)
+        {
+            snapshot->begin(0);
+            saver = std::thread([&]()
+                {
+                    snapshot->capture(0, (unsigned char*)captured.data());
+                    captureDone = true;
+                });
+        }
+
+        unsigned long long random = 1, maxLatency = 0, writes = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        while (writes < numberOfWrites || !captureDone)
+        {
+            random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+            const unsigned long long slot = (random >> 20) % (regionSize / 8);
+            auto writeStart = std::chrono::high_resolution_clock::now();
+            snapshot->beforeWrite(0, slot * 8, 8);
+            region[slot]++;
+            const unsigned long long latency = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - writeStart).count();
+            if (latency > maxLatency)
+                maxLatency = latency;
+            ++writes;
+        }
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start);
+        if (capturing)
+            saver.join();
+
+        std::cout << (capturing ? "with capture:    " : "without capture: ") << writes << " writes in " << duration.count()
+            << " ms, max latency " << maxLatency / 1000 << " us, " << snapshot->numberOfCopiedPages << " pages copied, "
+            << snapshot->numberOfWaitsForSaver << " waits for saver" << std::endl;
+    }
+
+    snapshot->deinit();
+}
@@ -7,8 +7,11 @@
 #include <lib/platform_common/qintrin.h>
 #include "gtest/gtest.h"
 
+#include <atomic>
 #include <chrono>
 #include <iostream>
+#include <thread>
+#include <vector>
 
 static constexpr int ID_SIZE = 61;
 static inline void getIDChar(const unsigned char* key, char* identity, bool isLowerCase)
@@ -262,3 +265,156 @@ TEST(TestFourQ, TestSign)
         }
     }
 }
+
+TEST(TestFourQ, TestVerifyBatch)
+{
+#ifdef __AVX512F__
+    initAVX512FourQConstants();
+#endif
+
+    constexpr unsigned int numberOfSignatures = 2 * VERIFY_BATCH_SIZE + 5;
+    unsigned char publicKeys[numberOfSignatures][32];
+    unsigned char messageDigests[numberOfSignatures][32];
+    unsigned char signatures[numberOfSignatures][64];
+    const unsigned char* publicKeyPtrs[numberOfSignatures];
+    const unsigned char* messageDigestPtrs[numberOfSignatures];
+    const unsigned char* signaturePtrs[numberOfSignatures];
+    bool results[numberOfSignatures];
+
+    for (unsigned int i = 0; i < numberOfSignatures; ++i)
+    {
+        unsigned char subseed[32], privateKey[32];
+        for (unsigned int k = 0; k < 32; ++k)
+        {
+            subseed[k] = (unsigned char)(i * 31 + k * 7 + 1);
+            messageDigests[i][k] = (unsigned char)(i * 17 + k * 3);
+        }
+        getPrivateKey(subseed, privateKey);
+        getPublicKey(privateKey, publicKeys[i]);
+        sign(subseed, publicKeys[i], messageDigests[i], signatures[i]);
+
+        publicKeyPtrs[i] = publicKeys[i];
+        messageDigestPtrs[i] = messageDigests[i];
+        signaturePtrs[i] = signatures[i];
+    }
+
+    // all valid
+    verifyBatch(numberOfSignatures, publicKeyPtrs, messageDigestPtrs, signaturePtrs, results);
+    for (unsigned int i = 0; i < numberOfSignatures; ++i)
+    {
+        EXPECT_TRUE(results[i]) << " at [" << i << "]";
+    }
+
+    // make some invalid in different ways
+    messageDigests[1][0] ^= 1;
+    signatures[3][0] ^= 1;
+    signatures[4][40] ^= 1;
+    signatures[5][63] = 1;
+    publicKeys[6][15] |= 0x80;
+    publicKeys[7][3] ^= 0x10;
+    publicKeyPtrs[8] = publicKeys[9];
+    for (unsigned int k = 0; k < 32; ++k)
+        signatures[numberOfSignatures - 1][k] = 0;
+
+    verifyBatch(numberOfSignatures, publicKeyPtrs, messageDigestPtrs, signaturePtrs, results);
+    for (unsigned int i = 0; i < numberOfSignatures; ++i)
+    {
+        EXPECT_EQ(results[i], verify(publicKeyPtrs[i], messageDigestPtrs[i], signaturePtrs[i])) << " at [" << i << "]";
+    }
+    EXPECT_TRUE(results[0]);
+    EXPECT_FALSE(results[1]);
+    EXPECT_TRUE(results[2]);
+    for (unsigned int i = 3; i <= 8; ++i)
+    {
+        EXPECT_FALSE(results[i]) << " at [" << i << "]";
+    }
+    EXPECT_FALSE(results[numberOfSignatures - 1]);
+
+    // batches smaller than VERIFY_BATCH_SIZE
+    for (unsigned int count = 0; count <= 3; ++count)
+    {
+        verifyBatch(count, publicKeyPtrs + 1, messageDigestPtrs + 1, signaturePtrs + 1, results);
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            EXPECT_EQ(results[i], verify(publicKeyPtrs[i + 1], messageDigestPtrs[i + 1], signaturePtrs[i + 1])) << " at [" << i << "]";
+        }
+    }
+}
+
+TEST(TestFourQ, DISABLED_PerformanceVerifyBatch)
+{
+#ifdef __AVX512F__
+    initAVX512FourQConstants();
+#endif
+
+    constexpr unsigned int numberOfSignatures = 64 * VERIFY_BATCH_SIZE;
+    static unsigned char publicKeys[numberOfSignatures][32];
+    static unsigned char messageDigests[numberOfSignatures][32];
+    static unsigned char signatures[numberOfSignatures][64];
+    static const unsigned char* publicKeyPtrs[numberOfSignatures];
+    static const unsigned char* messageDigestPtrs[numberOfSignatures];
+    static const unsigned char* signaturePtrs[numberOfSignatures];
+
+    for (unsigned int i = 0; i < numberOfSignatures; ++i)
+    {
+        unsigned char subseed[32], privateKey[32];
+        for (unsigned int k = 0; k < 32; ++k)
+        {
+            subseed[k] = (unsigned char)(i * 13 + k * 5 + 3);
+            messageDigests[i][k] = (unsigned char)(i * 11 + k);
+        }
+        getPrivateKey(subseed, privateKey);
+        getPublicKey(privateKey, publicKeys[i]);
+        sign(subseed, publicKeys[i], messageDigests[i], signatures[i]);
+
+        publicKeyPtrs[i] = publicKeys[i];
+        messageDigestPtrs[i] = messageDigests[i];
+        signaturePtrs[i] = signatures[i];
+    }
+
+    // Each thread verifies all signatures, once one by one and once in batches
+    const unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int numberOfThreads : { 1u, 8u, 16u, 32u })
+    {
+        if (numberOfThreads > maxThreads && numberOfThreads != 1)
+            continue;
+
+        for (bool batched : { false, true })
+        {
+            std::atomic<unsigned long long> numberOfValid = 0;
+            auto threadFunc = [&]()
+            {
+                unsigned long long valid = 0;
+                if (batched)
+                {
+                    bool results[VERIFY_BATCH_SIZE];
+                    for (unsigned int i = 0; i < numberOfSignatures; i += VERIFY_BATCH_SIZE)
+                    {
+                        verifyBatch(VERIFY_BATCH_SIZE, publicKeyPtrs + i, messageDigestPtrs + i, signaturePtrs + i, results);
+                        for (unsigned int j = 0; j < VERIFY_BATCH_SIZE; ++j)
+                            valid += results[j];
+                    }
+                }
+                else
+                {
+                    for (unsigned int i = 0; i < numberOfSignatures; ++i)
+                        valid += verify(publicKeyPtrs[i], messageDigestPtrs[i], signaturePtrs[i]);
+                }
+                numberOfValid += valid;
+            };
+
+            auto startTime = std::chrono::high_resolution_clock::now();
+            std::vector<std::thread> threads;
+            for (unsigned int t = 0; t < numberOfThreads; ++t)
+                threads.emplace_back(threadFunc);
+            for (auto& thread : threads)
+                thread.join();
+            auto durationMicroSec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - startTime).count();
+
+            EXPECT_EQ(numberOfValid, (unsigned long long)numberOfThreads * numberOfSignatures);
+            const double verifiedPerSec = double(numberOfThreads) * numberOfSignatures * 1e6 / double(durationMicroSec);
+            std::cout << (batched ? "verifyBatch()" : "verify()     ") << " with " << numberOfThreads << " threads: "
+                << verifiedPerSec << " signatures/sec" << std::endl;
+        }
+    }
+}
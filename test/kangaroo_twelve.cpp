@@ -2,12 +2,17 @@
 
 #include "../src/K12/kangaroo_twelve_xkcp.h"
 #include "../src/kangaroo_twelve.h"
+#include "../src/kangaroo_twelve_parallel.h"
 #include "../src/platform/memory.h"
 #include <lib/platform_common/qintrin.h>
 #include "gtest/gtest.h"
 
+#include <atomic>
 #include <chrono>
 #include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
 
 
 TEST(TestCoreK12, PerformanceDigest32Of1GB)
@@ -90,3 +95,255 @@ TEST(TestCoreK12, CompareK12Implementations)
     ASSERT_EQ(memcmp(outputArrayXKCP, outputArray, outputN), 0);
     delete [] inputPtr;
 }
+
+static void fillRandom(unsigned char* data, size_t size, unsigned long long seed)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        data[i] = (unsigned char)(seed >> 56);
+    }
+}
+
+TEST(TestCoreK12, KangarooTwelve64To32xN)
+{
+    constexpr unsigned int maxInputN = 3 * K12_64TO32_LANES + 3;
+    unsigned char input[maxInputN * 64];
+    unsigned char output[maxInputN * 32 + 32];
+    unsigned char expectedOutput[maxInputN * 32];
+    fillRandom(input, sizeof(input), 42);
+
+    for (unsigned int i = 0; i < maxInputN; ++i)
+    {
+        KangarooTwelve64To32(input + i * 64, expectedOutput + i * 32);
+
+        // scalar implementation must match general K12
+        unsigned char k12Output[32];
+        KangarooTwelve(input + i * 64, 64, k12Output, 32);
+        EXPECT_EQ(memcmp(k12Output, expectedOutput + i * 32, 32), 0);
+    }
+
+    // contiguous inputs, check that nothing is written after the last output
+    for (unsigned int inputN = 0; inputN <= maxInputN; ++inputN)
+    {
+        memset(output, 0xcd, sizeof(output));
+        KangarooTwelve64To32xN(input, output, inputN);
+        EXPECT_EQ(memcmp(output, expectedOutput, inputN * 32), 0) << "inputN " << inputN;
+        for (unsigned int i = inputN * 32; i < sizeof(output); ++i)
+            EXPECT_EQ(output[i], 0xcd);
+    }
+
+    // scattered inputs and outputs in reverse order
+    for (unsigned int inputN = 0; inputN <= maxInputN; ++inputN)
+    {
+        memset(output, 0, sizeof(output));
+        KangarooTwelve64To32Batch batch;
+        for (unsigned int i = 0; i < inputN; ++i)
+            batch.add(input + (maxInputN - 1 - i) * 64, output + i * 32);
+        batch.flush();
+        for (unsigned int i = 0; i < inputN; ++i)
+            EXPECT_EQ(memcmp(output + i * 32, expectedOutput + (maxInputN - 1 - i) * 32, 32), 0) << "inputN " << inputN << ", i " << i;
+    }
+
+    // output overwriting own input, as when hashing a tree level in place
+    memcpy(output, input, 64);
+    KangarooTwelve64To32xN(output, output, 1);
+    EXPECT_EQ(memcmp(output, expectedOutput, 32), 0);
+}
+
+TEST(TestCoreK12, DISABLED_PerformanceKangarooTwelve64To32xN)
+{
+    constexpr size_t nodeN = 1 << 22;
+    unsigned char* input = new unsigned char[nodeN * 64];
+    unsigned char* output = new unsigned char[nodeN * 32];
+    unsigned char* expectedOutput = new unsigned char[nodeN * 32];
+    fillRandom(input, nodeN * 64, 1);
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < nodeN; ++i)
+        KangarooTwelve64To32(input + i * 64, expectedOutput + i * 32);
+    auto durationMicroSec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - startTime);
+    std::cout << "KangarooTwelve64To32: " << nodeN * 1e6 / durationMicroSec.count() << " nodes/sec" << std::endl;
+
+    startTime = std::chrono::high_resolution_clock::now();
+    KangarooTwelve64To32xN(input, output, nodeN);
+    durationMicroSec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - startTime);
+    std::cout << "KangarooTwelve64To32xN with " << K12_64TO32_LANES << " lanes: " << nodeN * 1e6 / durationMicroSec.count() << " nodes/sec" << std::endl;
+
+    EXPECT_EQ(memcmp(output, expectedOutput, nodeN * 32), 0);
+
+    delete[] input;
+    delete[] output;
+    delete[] expectedOutput;
+}
+
+// Idle processors helping with parallel work (like the request processors in the node)
+struct K12ParallelWorkHelpers
+{
+    std::atomic<bool> stop;
+    std::vector<std::thread> threads;
+
+    K12ParallelWorkHelpers(unsigned int numberOfThreads) : stop(false)
+    {
+        for (unsigned int i = 0; i < numberOfThreads; ++i)
+        {
+            threads.emplace_back([this]()
+                {
+                    while (!stop)
+                    {
+                        helpWithParallelWork();
+                        std::this_thread::yield();
+                    }
+                });
+        }
+    }
+
+    ~K12ParallelWorkHelpers()
+    {
+        stop = true;
+        for (auto& thread : threads)
+            thread.join();
+    }
+};
+
+TEST(TestCoreK12, KangarooTwelveLeavesxLanes)
+{
+    std::vector<unsigned char> leaves(K12_64TO32_LANES * K12_chunkSize);
+    fillRandom(leaves.data(), leaves.size(), 7);
+    unsigned char cvs[K12_64TO32_LANES * 32];
+    KangarooTwelveLeavesxLanes(leaves.data(), cvs);
+    for (unsigned int i = 0; i < K12_64TO32_LANES; ++i)
+    {
+        unsigned char expectedCv[32];
+        KangarooTwelveLeaf(leaves.data() + i * K12_chunkSize, K12_chunkSize, expectedCv);
+        EXPECT_EQ(memcmp(cvs + i * 32, expectedCv, 32), 0) << "leaf " << i;
+    }
+}
+
+TEST(TestCoreK12, KangarooTwelveParallel)
+{
+    // sizes around the serial threshold, leaf boundaries, and rounds of parallel work
+    constexpr unsigned long long chunk = K12_chunkSize;
+    const unsigned long long sizes[] = { 100, K12_parallelMinInputSize - 1, K12_parallelMinInputSize, K12_parallelMinInputSize + 1,
+        65 * chunk - 1, 65 * chunk, 65 * chunk + 1, 66 * chunk - 167, 66 * chunk - 168, 66 * chunk - 169,
+        (K12_parallelLeavesPerRound + 1) * chunk, (K12_parallelLeavesPerRound + 1) * chunk + 3, 3 * K12_parallelLeavesPerRound * chunk + 12345 };
+    std::vector<unsigned char> input(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+    fillRandom(input.data(), input.size(), 3);
+
+    for (unsigned int numberOfHelpers : { 0u, 3u })
+    {
+        K12ParallelWorkHelpers helpers(numberOfHelpers);
+        for (unsigned long long size : sizes)
+        {
+            unsigned char expected[32], output[32];
+            KangarooTwelve(input.data(), (unsigned int)size, expected, sizeof(expected));
+            KangarooTwelveParallel(input.data(), size, output, sizeof(output));
+            EXPECT_EQ(memcmp(output, expected, 32), 0) << "size " << size << ", helpers " << numberOfHelpers;
+        }
+    }
+}
+
+TEST(TestCoreK12, DISABLED_PerformanceKangarooTwelveParallel)
+{
+    constexpr unsigned long long size = 256ULL * 1024 * 1024;
+    std::vector<unsigned char> input(size);
+    fillRandom(input.data(), size, 5);
+
+    unsigned char expected[32], output[32];
+    auto startTime = std::chrono::high_resolution_clock::now();
+    KangarooTwelve(input.data(), (unsigned int)size, expected, sizeof(expected));
+    auto durationMilliSec = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - startTime);
+    std::cout << "KangarooTwelve of 256 MB: " << durationMilliSec.count() << " ms" << std::endl;
+
+    const unsigned int hardwareThreads = std::max(std::thread::hardware_concurrency(), 2u);
+    for (unsigned int numberOfHelpers : { 0u, 1u, 3u, 7u, 15u, 31u })
+    {
+        if (numberOfHelpers >= hardwareThreads)
+            break;
+        K12ParallelWorkHelpers helpers(numberOfHelpers);
+        startTime = std::chrono::high_resolution_clock::now();
+        KangarooTwelveParallel(input.data(), size, output, sizeof(output));
+        durationMilliSec = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - startTime);
+        std::cout << "KangarooTwelveParallel of 256 MB with " << numberOfHelpers << " helpers: " << durationMilliSec.count() << " ms" << std::endl;
+        EXPECT_EQ(memcmp(output, expected, 32), 0);
+    }
+}
+
+TEST(TestCoreK12, KangarooTwelveLeafCache)
+{
+    constexpr unsigned long long chunk = K12_chunkSize;
+    for (unsigned long long size : { 100ull, chunk - 1, chunk, chunk + 1, 2 * chunk, 3 * chunk + 5, 100 * chunk + 200, 300 * chunk })
+    {
+        std::vector<unsigned char> region(size);
+        fillRandom(region.data(), size, size);
+        KangarooTwelveLeafCache cache;
+        ASSERT_TRUE(cache.init(region.data(), size));
+
+        unsigned char expected[32], output[32];
+        KangarooTwelve(region.data(), (unsigned int)size, expected, sizeof(expected));
+        cache.digest(output, sizeof(output));
+        EXPECT_EQ(memcmp(output, expected, 32), 0) << "size " << size;
+        EXPECT_EQ(cache.getNumberOfDirtyLeaves(), 0u);
+
+        // change bytes in first chunk, in the middle, across a chunk boundary, at the end, and in a large range
+        std::mt19937_64 gen(size);
+        for (unsigned int round = 0; round < 20; ++round)
+        {
+            unsigned long long offset = gen() % size;
+            unsigned long long count = 1 + gen() % ((round % 5 == 4) ? 80 * chunk : 64);
+            if (round == 0)
+                offset = 0;
+            if (round == 1)
+                offset = size - 1;
+            if (offset + count > size)
+                count = size - offset;
+            cache.markDirty(offset, count);
+            for (unsigned long long i = offset; i < offset + count; ++i)
+                region[i] ^= (unsigned char)(gen() | 1);
+
+            KangarooTwelve(region.data(), (unsigned int)size, expected, sizeof(expected));
+            cache.digest(output, sizeof(output));
+            EXPECT_EQ(memcmp(output, expected, 32), 0) << "size " << size << ", offset " << offset << ", count " << count;
+        }
+
+        cache.markAllDirty();
+        cache.digest(output, sizeof(output));
+        EXPECT_EQ(memcmp(output, expected, 32), 0) << "size " << size;
+        cache.deinit();
+    }
+}
+
+TEST(TestCoreK12, DISABLED_PerformanceKangarooTwelveLeafCache)
+{
+    constexpr unsigned long long size = 256ULL * 1024 * 1024;
+    std::vector<unsigned char> region(size);
+    fillRandom(region.data(), size, 9);
+    KangarooTwelveLeafCache cache;
+    ASSERT_TRUE(cache.init(region.data(), size));
+    K12ParallelWorkHelpers helpers(std::min(std::max(std::thread::hardware_concurrency(), 2u), 8u) - 1);
+
+    unsigned char expected[32], output[32];
+    auto startTime = std::chrono::high_resolution_clock::now();
+    cache.digest(output, sizeof(output));
+    auto durationMicroSec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - startTime);
+    std::cout << "Initial digest of 256 MB: " << durationMicroSec.count() << " us" << std::endl;
+
+    // change 64 bytes at random positions per "tick"
+    std::mt19937_64 gen(1);
+    for (unsigned int changes : { 1u, 10u, 100u, 1000u })
+    {
+        for (unsigned int i = 0; i < changes; ++i)
+        {
+            const unsigned long long offset = gen() % (size - 64);
+            cache.markDirty(offset, 64);
+            region[offset] ^= 1;
+        }
+        startTime = std::chrono::high_resolution_clock::now();
+        cache.digest(output, sizeof(output));
+        durationMicroSec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - startTime);
+        std::cout << "Digest of 256 MB after " << changes << " changes of 64 bytes: " << durationMicroSec.count() << " us" << std::endl;
+    }
+    KangarooTwelve(region.data(), (unsigned int)size, expected, sizeof(expected));
+    EXPECT_EQ(memcmp(output, expected, 32), 0);
+    cache.deinit();
+}
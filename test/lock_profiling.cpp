@@ -0,0 +1,179 @@
+#define NO_UEFI
+#define ENABLE_LOCK_PROFILING
+
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "platform/concurrency.h"
+
+static const LockProfilingData* findLockProfilingData(volatile char& lock)
+{
+    for (unsigned int i = 0; i < LockProfiler::capacity; ++i)
+    {
+        if (gLockProfiler.getEntry(i).lock == &lock)
+            return &gLockProfiler.getEntry(i);
+    }
+    return nullptr;
+}
+
+static unsigned long long histogramSum(const unsigned long long* histogram)
+{
+    unsigned long long sum = 0;
+    for (unsigned int i = 0; i < LockProfilingData::histogramSize; ++i)
+        sum += histogram[i];
+    return sum;
+}
+
+TEST(TestCoreLockProfiling, HistogramBuckets)
+{
+    EXPECT_EQ(LockProfilingData::histogramBucket(0), 0);
+    EXPECT_EQ(LockProfilingData::histogramBucket(1), 1);
+    EXPECT_EQ(LockProfilingData::histogramBucket(2), 2);
+    EXPECT_EQ(LockProfilingData::histogramBucket(3), 2);
+    EXPECT_EQ(LockProfilingData::histogramBucket(4), 3);
+    EXPECT_EQ(LockProfilingData::histogramBucket(1023), 10);
+    EXPECT_EQ(LockProfilingData::histogramBucket(1024), 11);
+    EXPECT_EQ(LockProfilingData::histogramBucket(0xffffffffffffffffllu), LockProfilingData::histogramSize - 1);
+
+    unsigned long long histogram[LockProfilingData::histogramSize] = { 0 };
+    EXPECT_EQ(LockProfilingData::histogramQuantile(histogram, 1, 2), 0);
+    for (unsigned long long value = 0; value < 1000; ++value)
+        ++histogram[LockProfilingData::histogramBucket(value)];
+    EXPECT_EQ(LockProfilingData::histogramQuantile(histogram, 1, 1000), 0);
+    EXPECT_EQ(LockProfilingData::histogramQuantile(histogram, 1, 2), 511);
+    EXPECT_EQ(LockProfilingData::histogramQuantile(histogram, 99, 100), 1023);
+}
+
+TEST(TestCoreLockProfiling, UncontendedAndContended)
+{
+    static volatile char testLock = 0;
+    for (int i = 0; i < 10; ++i)
+    {
+        ACQUIRE(testLock);
+        RELEASE(testLock);
+    }
+
+    const LockProfilingData* data = findLockProfilingData(testLock);
+    ASSERT_NE(data, nullptr);
+    ASSERT_NE(data->firstSite, nullptr);
+    EXPECT_STREQ(data->firstSite->expr, "testLock");
+    EXPECT_EQ(data->acquireCount, 10);
+    EXPECT_EQ(data->contendedCount, 0);
+
+    // other thread holds lock while this one waits
+    std::atomic<bool> holding(false);
+    const LockSite* holderSite = nullptr;
+    std::thread holder([&]()
+        {
+            ACQUIRE(testLock);
+            holderSite = data->holder;
+            holding = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            RELEASE(testLock);
+        });
+    while (!holding)
+        std::this_thread::yield();
+    ACQUIRE(testLock);
+    RELEASE(testLock);
+    holder.join();
+
+    EXPECT_EQ(data->acquireCount, 12);
+    EXPECT_EQ(data->contendedCount, 1);
+    EXPECT_GT(data->spinSum, 0);
+    EXPECT_GT(data->waitTscSum, 0);
+    EXPECT_EQ(data->waitTscMax, data->waitTscSum);
+    EXPECT_EQ(histogramSum(data->spinHistogram), 1);
+    EXPECT_EQ(histogramSum(data->waitTscHistogram), 1);
+    EXPECT_EQ(data->holderSites[0].site, holderSite);
+    EXPECT_EQ(data->holderSites[0].waitCount, 1);
+    EXPECT_EQ(data->holderSites[0].waitTscSum, data->waitTscSum);
+    EXPECT_EQ(data->holderSites[1].site, nullptr);
+}
+
+TEST(TestCoreLockProfiling, ManyThreads)
+{
+    static volatile char counterLock = 0;
+    static unsigned long long counter = 0;
+    constexpr unsigned int numberOfThreads = 4;
+    constexpr unsigned int iterations = 100000;
+
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < numberOfThreads; ++t)
+    {
+        threads.emplace_back([]()
+            {
+                for (unsigned int i = 0; i < iterations; ++i)
+                {
+                    ACQUIRE(counterLock);
+                    ++counter;
+                    RELEASE(counterLock);
+                }
+            });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    const LockProfilingData* data = findLockProfilingData(counterLock);
+    ASSERT_NE(data, nullptr);
+    EXPECT_EQ(counter, numberOfThreads * iterations);
+    EXPECT_EQ(data->acquireCount, numberOfThreads * iterations);
+    EXPECT_EQ(histogramSum(data->spinHistogram), data->contendedCount);
+    EXPECT_EQ(histogramSum(data->waitTscHistogram), data->contendedCount);
+    unsigned long long holderWaitCount = 0;
+    for (unsigned int i = 0; i < LockProfilingData::maxHolderSites; ++i)
+        holderWaitCount += data->holderSites[i].waitCount;
+    EXPECT_EQ(holderWaitCount, data->contendedCount);
+    EXPECT_EQ(gLockProfiler.getDroppedAcquisitions(), 0);
+}
+
+TEST(TestCoreLockProfiling, FullTable)
+{
+    // separate profiler to keep gLockProfiler usable for the other tests
+    std::unique_ptr<LockProfiler> profiler = std::make_unique<LockProfiler>();
+    static const LockSite site = { "locks[i]", __FILE__, __LINE__ };
+    std::vector<char> locks(LockProfiler::capacity * LockProfiler::maxProbes * 8);
+
+    // maxProbes locks with the same home index occupy the entries that are checked for another lock with this index
+    volatile char* missingLock = &locks[0];
+    const unsigned int home = LockProfiler::homeIndex(missingLock);
+    std::vector<volatile char*> collidingLocks;
+    for (size_t i = 1; i < locks.size() && collidingLocks.size() < LockProfiler::maxProbes; ++i)
+    {
+        if (LockProfiler::homeIndex(&locks[i]) == home)
+        {
+            collidingLocks.push_back(&locks[i]);
+            EXPECT_NE(profiler->getData(&locks[i], &site), nullptr);
+        }
+    }
+    ASSERT_EQ(collidingLocks.size(), LockProfiler::maxProbes);
+    for (unsigned int i = 0; i < LockProfiler::maxProbes; ++i)
+        EXPECT_EQ(profiler->getEntry((home + i) % LockProfiler::capacity).lock, collidingLocks[i]);
+
+    // lookup gives up after maxProbes entries although the next entry is free
+    EXPECT_EQ(profiler->getData(missingLock, &site), nullptr);
+    EXPECT_EQ(profiler->getDroppedAcquisitions(), 1);
+    EXPECT_EQ(profiler->getEntry((home + LockProfiler::maxProbes) % LockProfiler::capacity).lock, nullptr);
+    for (unsigned int i = 0; i < LockProfiler::maxProbes; ++i)
+        EXPECT_EQ(profiler->getData(collidingLocks[i], &site), &profiler->getEntry((home + i) % LockProfiler::capacity));
+
+    // fill whole table: registered locks are still found, others are counted as dropped
+    unsigned long long dropped = profiler->getDroppedAcquisitions();
+    for (size_t i = 1; i < locks.size(); ++i)
+    {
+        if (!profiler->getData(&locks[i], &site))
+            ++dropped;
+    }
+    for (unsigned int i = 0; i < LockProfiler::capacity; ++i)
+    {
+        volatile char* lock = profiler->getEntry(i).lock;
+        ASSERT_NE(lock, nullptr);
+        EXPECT_EQ(profiler->getData(lock, &site), &profiler->getEntry(i));
+    }
+    EXPECT_EQ(profiler->getDroppedAcquisitions(), dropped);
+    EXPECT_EQ(profiler->getData(missingLock, &site), nullptr);
+    EXPECT_EQ(profiler->getDroppedAcquisitions(), dropped + 1);
+}
@@ -9,6 +9,8 @@
 #include "private_settings.h"
 #undef LOG_SPECTRUM
 #define LOG_SPECTRUM 1
+#undef LOG_CONTRACT_INFO_MESSAGES
+#define LOG_CONTRACT_INFO_MESSAGES 1
 
 // also reduce size of logging tx index by reducing maximum number of ticks per epoch
 #include "public_settings.h"
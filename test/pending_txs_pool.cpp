@@ -0,0 +1,226 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/public_settings.h"
+#undef MAX_NUMBER_OF_TICKS_PER_EPOCH
+#define MAX_NUMBER_OF_TICKS_PER_EPOCH 50
+#undef PENDING_TXS_POOL_MAX_NUMBER_OF_TXS
+#define PENDING_TXS_POOL_MAX_NUMBER_OF_TXS 256
+#undef PENDING_TXS_POOL_ARENA_SIZE
+#define PENDING_TXS_POOL_ARENA_SIZE (256 * 300)
+#include "../src/ticking/pending_txs_pool.h"
+
+#include <random>
+
+
+class TestPendingTxsPool : public PendingTxsPool
+{
+    unsigned char transactionBuffer[MAX_TRANSACTION_SIZE];
+public:
+    TestPendingTxsPool()
+    {
+        EXPECT_TRUE(init());
+    }
+
+    ~TestPendingTxsPool()
+    {
+        deinit();
+    }
+
+    // Create transaction with given source and tick in internal buffer and try to add it
+    bool addTransaction(const m256i& source, unsigned int tick, unsigned int inputSize, long long amount = 10)
+    {
+        EXPECT_TRUE(inputSize <= MAX_INPUT_SIZE);
+        Transaction* transaction = (Transaction*)transactionBuffer;
+        transaction->sourcePublicKey = source;
+        transaction->destinationPublicKey = m256i(tick, inputSize, amount, 0);
+        transaction->amount = amount;
+        transaction->tick = tick;
+        transaction->inputType = 0;
+        transaction->inputSize = inputSize;
+        for (unsigned int i = 0; i < inputSize + SIGNATURE_SIZE; ++i)
+            transaction->inputPtr()[i] = (unsigned char)(i + tick);
+        return add(transaction);
+    }
+
+    // Return number of transactions of tick found by iterating the bucket (and check that all have the correct tick)
+    unsigned int countTickTxs(unsigned int tick)
+    {
+        unsigned int count = 0;
+        acquireLock();
+        for (unsigned int i = getFirstTickTxIndex(tick); i != NO_TX_INDEX; i = getNextTickTxIndex(i))
+        {
+            const Transaction* tx = getTx(i);
+            EXPECT_EQ(tx->tick, tick);
+            m256i digest;
+            KangarooTwelve(tx, tx->totalSize(), &digest, sizeof(digest));
+            EXPECT_EQ(digest, getDigest(i));
+            ++count;
+        }
+        EXPECT_EQ(count, getNumberOfTickTxs(tick));
+        releaseLock();
+        return count;
+    }
+
+    // Return tick of pending transaction of source or 0 if there is none
+    unsigned int findTickOfSource(const m256i& source, unsigned int firstTick, unsigned int endTick)
+    {
+        unsigned int foundTick = 0;
+        acquireLock();
+        for (unsigned int tick = firstTick; tick < endTick; ++tick)
+        {
+            for (unsigned int i = getFirstTickTxIndex(tick); i != NO_TX_INDEX; i = getNextTickTxIndex(i))
+            {
+                if (getTx(i)->sourcePublicKey == source)
+                {
+                    EXPECT_EQ(foundTick, 0u);
+                    foundTick = tick;
+                }
+            }
+        }
+        releaseLock();
+        return foundTick;
+    }
+};
+
+
+TEST(TestCorePendingTxsPool, AddAndIterateByTick)
+{
+    TestPendingTxsPool pool;
+    const unsigned int firstTick = 1000;
+    pool.beginEpoch(firstTick);
+
+    std::mt19937_64 gen64(42);
+    unsigned int expectedCount[MAX_NUMBER_OF_TICKS_PER_EPOCH] = { 0 };
+    for (unsigned int i = 0; i < 100; ++i)
+    {
+        m256i source(gen64(), gen64(), gen64(), gen64());
+        const unsigned int tickOffset = gen64() % MAX_NUMBER_OF_TICKS_PER_EPOCH;
+        EXPECT_TRUE(pool.addTransaction(source, firstTick + tickOffset, gen64() % 300));
+        expectedCount[tickOffset]++;
+        pool.checkStateConsistencyWithAssert();
+    }
+
+    for (unsigned int tickOffset = 0; tickOffset < MAX_NUMBER_OF_TICKS_PER_EPOCH; ++tickOffset)
+    {
+        EXPECT_EQ(pool.countTickTxs(firstTick + tickOffset), expectedCount[tickOffset]);
+    }
+    EXPECT_EQ(pool.getNumberOfPendingTxs(firstTick - 1), 100u);
+    EXPECT_EQ(pool.getNumberOfPendingTxs(firstTick), 100u - expectedCount[0]);
+}
+
+TEST(TestCorePendingTxsPool, HigherTickReplacesOlderTx)
+{
+    TestPendingTxsPool pool;
+    const unsigned int firstTick = 1000;
+    pool.beginEpoch(firstTick);
+
+    m256i source1(1, 2, 3, 4), source2(5, 6, 7, 8);
+    EXPECT_TRUE(pool.addTransaction(source1, firstTick + 5, 10));
+    EXPECT_TRUE(pool.addTransaction(source2, firstTick + 5, 20));
+
+    // same or lower tick does not replace
+    EXPECT_FALSE(pool.addTransaction(source1, firstTick + 5, 30));
+    EXPECT_FALSE(pool.addTransaction(source1, firstTick + 3, 30));
+    EXPECT_EQ(pool.findTickOfSource(source1, firstTick, firstTick + MAX_NUMBER_OF_TICKS_PER_EPOCH), firstTick + 5);
+
+    // higher tick replaces
+    EXPECT_TRUE(pool.addTransaction(source1, firstTick + 7, 40));
+    EXPECT_EQ(pool.findTickOfSource(source1, firstTick, firstTick + MAX_NUMBER_OF_TICKS_PER_EPOCH), firstTick + 7);
+    EXPECT_EQ(pool.findTickOfSource(source2, firstTick, firstTick + MAX_NUMBER_OF_TICKS_PER_EPOCH), firstTick + 5);
+    EXPECT_EQ(pool.countTickTxs(firstTick + 5), 1u);
+    EXPECT_EQ(pool.countTickTxs(firstTick + 7), 1u);
+    pool.checkStateConsistencyWithAssert();
+}
+
+TEST(TestCorePendingTxsPool, ReplacementKeepsOlderTxIfArenaIsFull)
+{
+    TestPendingTxsPool pool;
+    const unsigned int firstTick = 1000;
+    pool.beginEpoch(firstTick);
+
+    m256i source(1, 2, 3, 4);
+    EXPECT_TRUE(pool.addTransaction(source, firstTick + 5, 0));
+
+    // fill arena with large transactions of other sources
+    unsigned int added = 0;
+    while (added < PendingTxsPool::maxNumberOfTxs && pool.addTransaction(m256i(5, 6, 7, added), firstTick + 3, MAX_INPUT_SIZE))
+        ++added;
+    EXPECT_LT(added, PendingTxsPool::maxNumberOfTxs);
+    EXPECT_EQ(pool.getNumberOfRejectedTxs(), 1u);
+    const unsigned int count = pool.getNumberOfPendingTxs(0);
+    const unsigned long long bytes = pool.getNumberOfBytes();
+
+    // larger transaction of higher tick doesn't fit, so the older transaction of the source is kept
+    EXPECT_FALSE(pool.addTransaction(source, firstTick + 7, MAX_INPUT_SIZE));
+    EXPECT_EQ(pool.getNumberOfRejectedTxs(), 2u);
+    EXPECT_EQ(pool.findTickOfSource(source, firstTick, firstTick + MAX_NUMBER_OF_TICKS_PER_EPOCH), firstTick + 5);
+    EXPECT_EQ(pool.countTickTxs(firstTick + 5), 1u);
+    EXPECT_EQ(pool.getNumberOfPendingTxs(0), count);
+    EXPECT_EQ(pool.getNumberOfBytes(), bytes);
+    pool.checkStateConsistencyWithAssert();
+
+    // replacing works after memory has been freed
+    pool.discardTicksBefore(firstTick + 4);
+    EXPECT_TRUE(pool.addTransaction(source, firstTick + 7, MAX_INPUT_SIZE));
+    EXPECT_EQ(pool.findTickOfSource(source, firstTick + 4, firstTick + MAX_NUMBER_OF_TICKS_PER_EPOCH), firstTick + 7);
+    EXPECT_EQ(pool.countTickTxs(firstTick + 5), 0u);
+    EXPECT_EQ(pool.getNumberOfPendingTxs(0), 1u);
+    pool.checkStateConsistencyWithAssert();
+}
+
+TEST(TestCorePendingTxsPool, RejectTicksOutOfRange)
+{
+    TestPendingTxsPool pool;
+    const unsigned int firstTick = 1000;
+    pool.beginEpoch(firstTick);
+
+    m256i source(1, 2, 3, 4);
+    EXPECT_FALSE(pool.addTransaction(source, firstTick - 1, 0));
+    EXPECT_FALSE(pool.addTransaction(source, firstTick + MAX_NUMBER_OF_TICKS_PER_EPOCH, 0));
+    EXPECT_TRUE(pool.addTransaction(source, firstTick + MAX_NUMBER_OF_TICKS_PER_EPOCH - 1, 0));
+
+    // discarded ticks are not accepted anymore
+    pool.discardTicksBefore(firstTick + 10);
+    EXPECT_FALSE(pool.addTransaction(m256i(5, 6, 7, 8), firstTick + 9, 0));
+    EXPECT_TRUE(pool.addTransaction(m256i(5, 6, 7, 8), firstTick + 10, 0));
+    pool.checkStateConsistencyWithAssert();
+}
+
+TEST(TestCorePendingTxsPool, DiscardAndReuseMemory)
+{
+    TestPendingTxsPool pool;
+    const unsigned int firstTick = 1000;
+    pool.beginEpoch(firstTick);
+
+    std::mt19937_64 gen64(1234);
+    for (unsigned int round = 0; round < MAX_NUMBER_OF_TICKS_PER_EPOCH - 1; ++round)
+    {
+        // fill pool until rejected because it is full
+        unsigned int added = 0;
+        for (unsigned int i = 0; i < 2 * PendingTxsPool::maxNumberOfTxs; ++i)
+        {
+            m256i source(gen64(), gen64(), gen64(), gen64());
+            const unsigned int tick = firstTick + round + (unsigned int)(gen64() % (MAX_NUMBER_OF_TICKS_PER_EPOCH - round));
+            if (pool.addTransaction(source, tick, gen64() % MAX_INPUT_SIZE))
+                ++added;
+        }
+        EXPECT_GT(pool.getNumberOfRejectedTxs(), 0u);
+        EXPECT_LE(pool.getNumberOfBytes(), PendingTxsPool::arenaSize);
+        pool.checkStateConsistencyWithAssert();
+
+        // discard one tick, freeing memory for the next round
+        const unsigned int countBefore = pool.getNumberOfPendingTxs(0);
+        const unsigned int countDiscarded = pool.countTickTxs(firstTick + round);
+        pool.discardTicksBefore(firstTick + round + 1);
+        EXPECT_EQ(pool.countTickTxs(firstTick + round), 0u);
+        EXPECT_EQ(pool.getNumberOfPendingTxs(0), countBefore - countDiscarded);
+        pool.checkStateConsistencyWithAssert();
+    }
+
+    pool.beginEpoch(firstTick + MAX_NUMBER_OF_TICKS_PER_EPOCH);
+    EXPECT_EQ(pool.getNumberOfPendingTxs(0), 0u);
+    EXPECT_EQ(pool.getNumberOfBytes(), 0u);
+    pool.checkStateConsistencyWithAssert();
+}
@@ -6,6 +6,9 @@
 #include "../src/platform/custom_stack.h"
 #include "../src/platform/profiling.h"
 
+#include <thread>
+#include <vector>
+
 TEST(TestCoreReadWriteLock, SimpleSingleThread)
 {
     ReadWriteLock l;
@@ -324,3 +327,105 @@ TEST(TestCoreProfiling, CheckTicksToMicroseconds)
     checkTicksToMicroseconds(2, 0xffffffffffffffffllu, 12345);
     checkTicksToMicroseconds(2, 0xffffffffffffffffllu, 123456);
 }
+
+TEST(TestCoreProfiling, HistogramBuckets)
+{
+    unsigned int prevBucket = 0;
+    for (unsigned long long ticks = 0; ticks < (1ull << 20); ticks += 1 + ticks / 64)
+    {
+        const unsigned int bucket = ProfilingData::histogramBucket(ticks);
+        EXPECT_GE(bucket, prevBucket);
+        EXPECT_LE(ticks, ProfilingData::histogramBucketMax(bucket));
+        if (bucket > 0)
+            EXPECT_GT(ticks, ProfilingData::histogramBucketMax(bucket - 1));
+        // relative resolution of 25%
+        EXPECT_LE(ProfilingData::histogramBucketMax(bucket) - ticks, ticks / 4);
+        prevBucket = bucket;
+    }
+    EXPECT_EQ(ProfilingData::histogramBucket(0xffffffffffffffffllu), ProfilingData::histogramSize - 1);
+    EXPECT_EQ(ProfilingData::histogramBucket(1ull << 42), ProfilingData::histogramSize - 1);
+}
+
+TEST(TestCoreProfiling, MergeTablesAndQuantiles)
+{
+    static const char* name = "MergeTablesAndQuantiles";
+    ProfilingDataTable tables[3];
+    for (unsigned long long ticks = 1; ticks <= 10000; ++ticks)
+        tables[ticks % 2].addMeasurement(name, 1, ticks);
+    tables[0].addMeasurement(name, 2, 123);
+    EXPECT_TRUE(tables[0].mergeInto(tables[2]));
+    EXPECT_TRUE(tables[1].mergeInto(tables[2]));
+    EXPECT_EQ(tables[2].getUsedEntryCount(), 2);
+
+    const ProfilingData* entry = nullptr;
+    for (unsigned int i = 0; i < tables[2].getSize(); ++i)
+    {
+        if (tables[2].getData()[i].name == name && tables[2].getData()[i].line == 1)
+            entry = &tables[2].getData()[i];
+    }
+    ASSERT_NE(entry, nullptr);
+    EXPECT_EQ(entry->numOfExec, 10000);
+    EXPECT_EQ(entry->runtimeSum, 10000 * 10001 / 2);
+    EXPECT_EQ(entry->runtimeMin, 1);
+    EXPECT_EQ(entry->runtimeMax, 10000);
+
+    // quantiles are upper bounds with the resolution of the histogram
+    for (unsigned long long permille : { 1, 500, 900, 990, 999, 1000 })
+    {
+        const unsigned long long exact = 10 * permille;
+        const unsigned long long quantile = ProfilingDataCollector::runtimeQuantile(*entry, permille, 1000);
+        EXPECT_GE(quantile, exact);
+        EXPECT_LE(quantile, exact + exact / 4);
+    }
+    EXPECT_EQ(ProfilingDataCollector::runtimeQuantile(*entry, 1, 1), 10000);
+
+    for (auto& table : tables)
+        table.deinit();
+}
+
+TEST(TestCoreProfiling, ConcurrentMeasurementsAndMerge)
+{
+    static const char* name = "ConcurrentMeasurementsAndMerge";
+    constexpr unsigned int numberOfThreads = 4;
+    constexpr unsigned int measurementsPerThread = 100000;
+    gProfilingDataCollector.clear();
+
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < numberOfThreads; ++t)
+    {
+        threads.emplace_back([]()
+            {
+                for (unsigned int i = 0; i < measurementsPerThread; ++i)
+                    gProfilingDataCollector.addMeasurement(name, __LINE__, 100, 100 + i % 1000);
+            });
+    }
+
+    // merging while measuring must not lose or corrupt measurements
+    for (unsigned int i = 0; i < 10; ++i)
+    {
+        gProfilingDataCollector.acquireMergedData();
+        gProfilingDataCollector.releaseMergedData();
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    const ProfilingDataTable& merged = gProfilingDataCollector.acquireMergedData();
+    unsigned long long numOfExec = 0, histogramSum = 0;
+    for (unsigned int i = 0; i < merged.getSize(); ++i)
+    {
+        const ProfilingData& data = merged.getData()[i];
+        if (data.name == name)
+        {
+            numOfExec += data.numOfExec;
+            for (unsigned int j = 0; j < ProfilingData::histogramSize; ++j)
+                histogramSum += data.histogram[j];
+            EXPECT_EQ(data.runtimeMin, 0);
+            EXPECT_EQ(data.runtimeMax, 999);
+        }
+    }
+    gProfilingDataCollector.releaseMergedData();
+    EXPECT_EQ(numOfExec, numberOfThreads * measurementsPerThread);
+    EXPECT_EQ(histogramSum, numOfExec);
+
+    gProfilingDataCollector.deinit();
+}
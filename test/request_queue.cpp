@@ -0,0 +1,578 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/network_core/request_queue.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+
+// Test request: header followed by id and payload bytes derived from the id
+static constexpr unsigned int maxTestRequestSize = sizeof(RequestResponseHeader) + sizeof(unsigned long long) + 256;
+
+static unsigned int testRequestSize(unsigned long long id)
+{
+    return sizeof(RequestResponseHeader) + sizeof(unsigned long long) + (unsigned int)((id * 7) % 257);
+}
+
+static void makeTestRequest(unsigned char* buffer, unsigned long long id)
+{
+    RequestResponseHeader* header = (RequestResponseHeader*)buffer;
+    const unsigned int size = testRequestSize(id);
+    header->checkAndSetSize(size);
+    header->setType((unsigned char)id);
+    header->setDejavu((unsigned int)id);
+    *(unsigned long long*)(buffer + sizeof(RequestResponseHeader)) = id;
+    for (unsigned int i = sizeof(RequestResponseHeader) + sizeof(unsigned long long); i < size; ++i)
+        buffer[i] = (unsigned char)(id + i);
+}
+
+// Check request content and return its id
+static unsigned long long checkTestRequest(const RequestResponseHeader* header)
+{
+    const unsigned char* buffer = (const unsigned char*)header;
+    const unsigned long long id = *(const unsigned long long*)(buffer + sizeof(RequestResponseHeader));
+    EXPECT_EQ(header->size(), testRequestSize(id));
+    EXPECT_EQ(header->type(), (unsigned char)id);
+    EXPECT_EQ(header->dejavu(), (unsigned int)id);
+    for (unsigned int i = sizeof(RequestResponseHeader) + sizeof(unsigned long long); i < header->size(); ++i)
+    {
+        if (buffer[i] != (unsigned char)(id + i))
+        {
+            ADD_FAILURE() << "Corrupted payload of request " << id;
+            break;
+        }
+    }
+    return id;
+}
+
+template <unsigned int queueLength, unsigned int bufferSize>
+class TestRequestQueue : public RequestQueue<queueLength, bufferSize>
+{
+public:
+    TestRequestQueue()
+    {
+        EXPECT_TRUE(this->init());
+    }
+
+    ~TestRequestQueue()
+    {
+        this->deinit();
+    }
+
+    bool enqueueTestRequest(unsigned long long id)
+    {
+        unsigned char buffer[maxTestRequestSize];
+        makeTestRequest(buffer, id);
+        return this->enqueue((Peer*)(id + 1), (RequestResponseHeader*)buffer);
+    }
+};
+
+
+TEST(TestCoreRequestQueue, EnqueueDequeueFifo)
+{
+    TestRequestQueue<16, 4096> queue;
+    unsigned int position;
+
+    EXPECT_TRUE(queue.isEmpty());
+    EXPECT_FALSE(queue.tryDequeue(position));
+
+    for (unsigned long long id = 0; id < 10; ++id)
+        EXPECT_TRUE(queue.enqueueTestRequest(id));
+    EXPECT_FALSE(queue.isEmpty());
+    EXPECT_EQ(queue.getNumberOfRequests(), 10u);
+
+    for (unsigned long long id = 0; id < 10; ++id)
+    {
+        EXPECT_TRUE(queue.tryDequeue(position));
+        EXPECT_EQ(checkTestRequest(queue.getRequest(position)), id);
+        EXPECT_EQ(queue.getPeer(position), (Peer*)(id + 1));
+        queue.release(position);
+    }
+    EXPECT_TRUE(queue.isEmpty());
+    EXPECT_FALSE(queue.tryDequeue(position));
+    EXPECT_EQ(queue.getNumberOfRequests(), 0u);
+    EXPECT_EQ(queue.getNumberOfBytes(), 0u);
+}
+
+TEST(TestCoreRequestQueue, FullQueueAndOutOfOrderRelease)
+{
+    TestRequestQueue<8, 4096> queue;
+    unsigned int positions[8];
+
+    // element ring is full after 8 requests
+    for (unsigned long long id = 0; id < 8; ++id)
+        EXPECT_TRUE(queue.enqueueTestRequest(id));
+    EXPECT_FALSE(queue.enqueueTestRequest(8));
+
+    for (unsigned int i = 0; i < 8; ++i)
+        EXPECT_TRUE(queue.tryDequeue(positions[i]));
+
+    // releasing later requests doesn't free space before the first one is released
+    for (unsigned int i = 7; i >= 1; --i)
+        queue.release(positions[i]);
+    EXPECT_EQ(queue.getNumberOfRequests(), 8u);
+    EXPECT_FALSE(queue.enqueueTestRequest(8));
+
+    // releasing the first one recycles all of them
+    queue.release(positions[0]);
+    EXPECT_EQ(queue.getNumberOfRequests(), 0u);
+    EXPECT_EQ(queue.getNumberOfBytes(), 0u);
+    for (unsigned long long id = 8; id < 16; ++id)
+        EXPECT_TRUE(queue.enqueueTestRequest(id));
+}
+
+TEST(TestCoreRequestQueue, ByteBufferWrapAround)
+{
+    // buffer is full much earlier than element ring
+    TestRequestQueue<1024, 1024> queue;
+    unsigned long long nextEnqueueId = 0, nextDequeueId = 0;
+    for (unsigned int round = 0; round < 1000; ++round)
+    {
+        while (queue.enqueueTestRequest(nextEnqueueId))
+            ++nextEnqueueId;
+        EXPECT_LE(queue.getNumberOfBytes(), 1024u);
+        EXPECT_GT(queue.getNumberOfRequests(), 0u);
+
+        // dequeue some (at least one), requests are contiguous even if they wrap around the end of the buffer
+        for (unsigned int i = 0; i <= round % 3 && nextDequeueId < nextEnqueueId; ++i)
+        {
+            unsigned int position;
+            EXPECT_TRUE(queue.tryDequeue(position));
+            EXPECT_EQ(checkTestRequest(queue.getRequest(position)), nextDequeueId);
+            queue.release(position);
+            ++nextDequeueId;
+        }
+    }
+}
+
+TEST(TestCoreRequestQueue, EnqueueReference)
+{
+    TestRequestQueue<8, 1024> queue;
+    unsigned char requests[3][maxTestRequestSize];
+    volatile unsigned int releasedPosition = 0;
+    unsigned int positions[4];
+
+    // referenced requests are processed in place and don't use the byte buffer, copied ones are mixed in
+    for (unsigned long long id = 0; id < 3; ++id)
+        makeTestRequest(requests[id], id);
+    EXPECT_TRUE(queue.enqueueReference((Peer*)1, (RequestResponseHeader*)requests[0], &releasedPosition, 10));
+    EXPECT_TRUE(queue.enqueueTestRequest(100));
+    EXPECT_TRUE(queue.enqueueReference((Peer*)3, (RequestResponseHeader*)requests[1], &releasedPosition, 20));
+    EXPECT_TRUE(queue.enqueueReference((Peer*)3, (RequestResponseHeader*)requests[2], &releasedPosition, 30));
+    EXPECT_EQ(queue.getNumberOfBytes(), testRequestSize(100));
+
+    for (unsigned int i = 0; i < 4; ++i)
+        EXPECT_TRUE(queue.tryDequeue(positions[i]));
+    EXPECT_EQ(queue.getRequest(positions[0]), (RequestResponseHeader*)requests[0]);
+    EXPECT_EQ(checkTestRequest(queue.getRequest(positions[1])), 100u);
+    EXPECT_EQ(queue.getRequest(positions[2]), (RequestResponseHeader*)requests[1]);
+    EXPECT_EQ(queue.getPeer(positions[3]), (Peer*)3);
+
+    // released position is only set when the element is recycled, which happens in order
+    queue.release(positions[2]);
+    EXPECT_EQ(releasedPosition, 0u);
+    queue.release(positions[0]);
+    EXPECT_EQ(releasedPosition, 10u);
+    queue.release(positions[1]);
+    EXPECT_EQ(releasedPosition, 20u);
+    queue.release(positions[3]);
+    EXPECT_EQ(releasedPosition, 30u);
+    EXPECT_EQ(queue.getNumberOfRequests(), 0u);
+    EXPECT_EQ(queue.getNumberOfBytes(), 0u);
+}
+
+// Run producers and consumers concurrently and check that every request is dequeued exactly once and not corrupted
+template <class Queue>
+static void runStressTest(Queue& queue, unsigned int numberOfProducers, unsigned int numberOfConsumers, unsigned long long requestsPerProducer)
+{
+    const unsigned long long totalRequests = numberOfProducers * requestsPerProducer;
+    std::vector<std::atomic<unsigned char>> received(totalRequests);
+    std::atomic<unsigned long long> numberOfDequeued(0);
+
+    std::vector<std::thread> threads;
+    for (unsigned int p = 0; p < numberOfProducers; ++p)
+    {
+        threads.emplace_back([&, p]()
+            {
+                for (unsigned long long i = 0; i < requestsPerProducer; ++i)
+                {
+                    const unsigned long long id = p * requestsPerProducer + i;
+                    while (!queue.enqueueTestRequest(id))
+                        std::this_thread::yield();
+                }
+            });
+    }
+    for (unsigned int c = 0; c < numberOfConsumers; ++c)
+    {
+        threads.emplace_back([&, c]()
+            {
+                // hold a few requests like the request processors do when batching signed requests
+                unsigned int held[4];
+                unsigned int numberOfHeld = 0;
+                while (numberOfDequeued.load() < totalRequests || numberOfHeld)
+                {
+                    unsigned int position;
+                    if (numberOfHeld < (c % 4) + 1 && queue.tryDequeue(position))
+                    {
+                        const unsigned long long id = checkTestRequest(queue.getRequest(position));
+                        EXPECT_EQ(queue.getPeer(position), (Peer*)(id + 1));
+                        if (id < totalRequests)
+                            received[id]++;
+                        else
+                            ADD_FAILURE() << "Invalid request id " << id;
+                        held[numberOfHeld++] = position;
+                        numberOfDequeued++;
+                    }
+                    else if (numberOfHeld)
+                    {
+                        // release in reverse order
+                        queue.release(held[--numberOfHeld]);
+                    }
+                    else
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    for (unsigned long long id = 0; id < totalRequests; ++id)
+        EXPECT_EQ(received[id].load(), 1) << "request " << id;
+    EXPECT_TRUE(queue.isEmpty());
+    EXPECT_EQ(queue.getNumberOfRequests(), 0u);
+    EXPECT_EQ(queue.getNumberOfBytes(), 0u);
+}
+
+TEST(TestCoreRequestQueue, StressMultipleProducersAndConsumers)
+{
+    TestRequestQueue<256, 16384> queue;
+    runStressTest(queue, 1, 4, 100000);
+    runStressTest(queue, 3, 5, 50000);
+    runStressTest(queue, 4, 1, 50000);
+}
+
+
+static bool takeAll(const RequestResponseHeader*)
+{
+    return true;
+}
+
+TEST(TestCoreRequestQueue, Batch)
+{
+    typedef TestRequestQueue<16, 4096> Queue;
+    Queue queue;
+    RequestQueueBatch<Queue, 4> batch;
+    EXPECT_TRUE(batch.isEmpty());
+    EXPECT_EQ(batch.take(queue, takeAll), 0u);
+
+    // taking stops if the batch is full or the request taken last isn't accepted
+    for (unsigned long long id = 0; id < 10; ++id)
+        EXPECT_TRUE(queue.enqueueTestRequest(id));
+    EXPECT_EQ(batch.take(queue, takeAll), 4u);
+    for (unsigned long long id = 0; id < 4; ++id)
+    {
+        EXPECT_FALSE(batch.isEmpty());
+        unsigned int position;
+        EXPECT_EQ(batch.takeNext(position), id);
+        EXPECT_EQ(checkTestRequest(batch.getRequests()[id]), id);
+        EXPECT_EQ(queue.getRequest(position), batch.getRequests()[id]);
+        queue.release(position);
+    }
+    EXPECT_TRUE(batch.isEmpty());
+    EXPECT_EQ(queue.getNumberOfRequests(), 6u);
+    EXPECT_EQ(batch.take(queue, [](const RequestResponseHeader* request) { return checkTestRequest(request) != 5; }), 2u);
+
+    // requests not passed on are dropped
+    unsigned int position;
+    EXPECT_EQ(batch.takeNext(position), 0u);
+    queue.release(position);
+    batch.releaseAll(queue);
+    EXPECT_TRUE(batch.isEmpty());
+    EXPECT_EQ(queue.getNumberOfRequests(), 4u);
+}
+
+TEST(TestCoreRequestQueue, BatchDoesNotBlockRecyclingDuringLongWork)
+{
+    // Consumers behave like requestProcessor(): they take batches, and the first consumer does long work (such as
+    // computing a score) after its batch, but only if it doesn't hold requests. Otherwise the queue cannot recycle the
+    // requests after the held ones, so the producer cannot enqueue all requests while the long work waits for it. The
+    // other consumers keep processing requests meanwhile.
+    typedef TestRequestQueue<16, 4096> Queue;
+    Queue queue;
+    constexpr unsigned long long numberOfRequests = 20000;
+    std::atomic<unsigned long long> numberOfProcessed(0);
+    std::atomic<bool> producerDone(false);
+    std::atomic<unsigned int> numberOfLongWorks(0), numberOfBlockedLongWorks(0);
+
+    // start with full queue and the first consumer holding a full batch
+    unsigned long long nextId = 0;
+    while (queue.enqueueTestRequest(nextId))
+        ++nextId;
+    std::vector<RequestQueueBatch<Queue, 8>> batches(3);
+    EXPECT_EQ(batches[0].take(queue, takeAll), 8u);
+
+    std::vector<std::thread> consumers;
+    for (unsigned int c = 0; c < 3; ++c)
+    {
+        consumers.emplace_back([&, c]()
+            {
+                RequestQueueBatch<Queue, 8>& batch = batches[c];
+                bool longWorkDone = false;
+                bool tookBatch = (batch.size() > 1);
+                while (numberOfProcessed < numberOfRequests)
+                {
+                    if (c == 0 && batch.isEmpty() && tookBatch && !longWorkDone)
+                    {
+                        // long work waits until the producer is done (with timeout to report failure)
+                        auto start = std::chrono::steady_clock::now();
+                        while (!producerDone && std::chrono::steady_clock::now() - start < std::chrono::seconds(10))
+                            std::this_thread::yield();
+                        if (!producerDone)
+                            numberOfBlockedLongWorks++;
+                        numberOfLongWorks++;
+                        longWorkDone = true;
+                    }
+                    if (batch.isEmpty())
+                    {
+                        if (!batch.take(queue, takeAll))
+                        {
+                            std::this_thread::yield();
+                            continue;
+                        }
+                        tookBatch = (batch.size() > 1);
+                    }
+                    unsigned int position;
+                    const unsigned int index = batch.takeNext(position);
+                    checkTestRequest(batch.getRequests()[index]);
+                    queue.release(position);
+                    numberOfProcessed++;
+                }
+            });
+    }
+
+    for (unsigned long long id = nextId; id < numberOfRequests; ++id)
+    {
+        while (!queue.enqueueTestRequest(id))
+            std::this_thread::yield();
+    }
+    producerDone = true;
+    for (auto& consumer : consumers)
+        consumer.join();
+
+    EXPECT_EQ(numberOfLongWorks, 1u);
+    EXPECT_EQ(numberOfBlockedLongWorks, 0u);
+    EXPECT_EQ(numberOfProcessed, numberOfRequests);
+    EXPECT_EQ(queue.getNumberOfRequests(), 0u);
+}
+
+TEST(TestCoreRequestQueue, SlowRequestDoesNotBlockRecycling)
+{
+    // Like requestProcessor(): a request whose processing may take long is copied out of the queue and released before
+    // processing. So the queue can recycle the requests after it while the slow handler runs, which waits until the
+    // producer has enqueued all requests (with timeout to report failure).
+    typedef TestRequestQueue<16, 4096> Queue;
+    Queue queue;
+    constexpr unsigned long long numberOfRequests = 2000;
+    std::atomic<unsigned long long> numberOfProcessed(0);
+    std::atomic<bool> producerDone(false);
+    std::atomic<bool> slowRequestBlocked(false);
+
+    unsigned long long nextId = 0;
+    while (queue.enqueueTestRequest(nextId))
+        ++nextId;
+    unsigned int slowPosition;
+    ASSERT_TRUE(queue.tryDequeue(slowPosition));
+
+    std::thread slowConsumer([&]()
+        {
+            std::vector<unsigned char> buffer(maxTestRequestSize);
+            const RequestResponseHeader* request = copyAndReleaseRequest(queue, slowPosition, buffer.data());
+            auto start = std::chrono::steady_clock::now();
+            while (!producerDone && std::chrono::steady_clock::now() - start < std::chrono::seconds(10))
+                std::this_thread::yield();
+            slowRequestBlocked = !producerDone;
+            EXPECT_EQ(checkTestRequest(request), 0u);
+            numberOfProcessed++;
+        });
+    std::thread fastConsumer([&]()
+        {
+            while (numberOfProcessed < numberOfRequests)
+            {
+                unsigned int position;
+                if (!queue.tryDequeue(position))
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+                checkTestRequest(queue.getRequest(position));
+                queue.release(position);
+                numberOfProcessed++;
+            }
+        });
+
+    for (unsigned long long id = nextId; id < numberOfRequests; ++id)
+    {
+        while (!queue.enqueueTestRequest(id))
+            std::this_thread::yield();
+    }
+    producerDone = true;
+    slowConsumer.join();
+    fastConsumer.join();
+
+    EXPECT_FALSE(slowRequestBlocked);
+    EXPECT_EQ(numberOfProcessed, numberOfRequests);
+    EXPECT_EQ(queue.getNumberOfRequests(), 0u);
+}
+
+// Reference implementation of the former queue: one lock for all consumers, request copied to the consumer's
+// buffer while holding the lock
+struct LockedTestRequestQueue
+{
+    static constexpr unsigned int queueLength = 65536;
+    static constexpr unsigned int bufferSize = 1 << 24;
+    unsigned char* buffer;
+    struct { unsigned int offset; } elements[queueLength];
+    volatile unsigned int bufferHead = 0, bufferTail = 0;
+    volatile unsigned short elementHead = 0, elementTail = 0;
+    volatile char tailLock = 0;
+
+    LockedTestRequestQueue() { buffer = new unsigned char[bufferSize]; }
+    ~LockedTestRequestQueue() { delete[] buffer; }
+
+    bool enqueue(const RequestResponseHeader* request)
+    {
+        if ((bufferHead >= bufferTail || bufferHead + request->size() < bufferTail) && (unsigned short)(elementHead + 1) != elementTail)
+        {
+            elements[elementHead].offset = bufferHead;
+            copyMem(&buffer[bufferHead], request, request->size());
+            bufferHead += request->size();
+            if (bufferHead > bufferSize - maxTestRequestSize)
+                bufferHead = 0;
+            elementHead++;
+            return true;
+        }
+        return false;
+    }
+
+    bool tryDequeue(unsigned char* targetBuffer)
+    {
+        ACQUIRE(tailLock);
+        if (elementTail == elementHead)
+        {
+            RELEASE(tailLock);
+            return false;
+        }
+        const RequestResponseHeader* request = (RequestResponseHeader*)&buffer[elements[elementTail].offset];
+        copyMem(targetBuffer, request, request->size());
+        bufferTail += request->size();
+        if (bufferTail > bufferSize - maxTestRequestSize)
+            bufferTail = 0;
+        elementTail++;
+        RELEASE(tailLock);
+        return true;
+    }
+};
+
+TEST(TestCoreRequestQueue, DISABLED_PerformanceContention)
+{
+    constexpr unsigned long long numberOfRequests = 2000000;
+    const unsigned int hardwareThreads = std::max(std::thread::hardware_concurrency(), 2u);
+
+    // prepare requests
+    std::vector<unsigned char> requests(numberOfRequests / 1000 * maxTestRequestSize);
+    for (unsigned long long i = 0; i < numberOfRequests / 1000; ++i)
+        makeTestRequest(&requests[i * maxTestRequestSize], i);
+
+    for (unsigned int numberOfConsumers : { 1u, 4u, 8u, 16u, 31u })
+    {
+        if (numberOfConsumers >= hardwareThreads && numberOfConsumers > 1)
+            break;
+
+        std::atomic<unsigned long long> consumed;
+
+        // lock-free queue: consumers process requests in place
+        double lockFreeMillisec;
+        {
+            auto queue = std::make_unique<TestRequestQueue<65536, (1 << 24)>>();
+            consumed = 0;
+            auto start = std::chrono::high_resolution_clock::now();
+            std::vector<std::thread> threads;
+            for (unsigned int c = 0; c < numberOfConsumers; ++c)
+            {
+                threads.emplace_back([&]()
+                    {
+                        unsigned long long checksum = 0;
+                        while (consumed.load(std::memory_order_relaxed) < numberOfRequests)
+                        {
+                            unsigned int position;
+                            if (queue->tryDequeue(position))
+                            {
+                                checksum += queue->getRequest(position)->dejavu();
+                                queue->release(position);
+                                consumed++;
+                            }
+                            else
+                                _mm_pause();
+                        }
+                        EXPECT_NE(checksum, 1);
+                    });
+            }
+            for (unsigned long long i = 0; i < numberOfRequests; ++i)
+            {
+                const RequestResponseHeader* request = (const RequestResponseHeader*)&requests[(i % (numberOfRequests / 1000)) * maxTestRequestSize];
+                while (!queue->enqueue(nullptr, request))
+                    _mm_pause();
+            }
+            for (auto& thread : threads)
+                thread.join();
+            lockFreeMillisec = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+
+        // former queue: consumers copy requests to their buffer under lock
+        double lockedMillisec;
+        {
+            auto queue = std::make_unique<LockedTestRequestQueue>();
+            consumed = 0;
+            auto start = std::chrono::high_resolution_clock::now();
+            std::vector<std::thread> threads;
+            for (unsigned int c = 0; c < numberOfConsumers; ++c)
+            {
+                threads.emplace_back([&]()
+                    {
+                        unsigned long long checksum = 0;
+                        std::vector<unsigned char> buffer(maxTestRequestSize);
+                        while (consumed.load(std::memory_order_relaxed) < numberOfRequests)
+                        {
+                            if (queue->tryDequeue(buffer.data()))
+                            {
+                                checksum += ((RequestResponseHeader*)buffer.data())->dejavu();
+                                consumed++;
+                            }
+                            else
+                                _mm_pause();
+                        }
+                        EXPECT_NE(checksum, 1);
+                    });
+            }
+            for (unsigned long long i = 0; i < numberOfRequests; ++i)
+            {
+                const RequestResponseHeader* request = (const RequestResponseHeader*)&requests[(i % (numberOfRequests / 1000)) * maxTestRequestSize];
+                while (!queue->enqueue(request))
+                    _mm_pause();
+            }
+            for (auto& thread : threads)
+                thread.join();
+            lockedMillisec = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+
+        std::cout << numberOfConsumers << " consumers: lock-free queue " << (unsigned long long)(numberOfRequests / lockFreeMillisec * 1000)
+            << " requests/s, locked queue " << (unsigned long long)(numberOfRequests / lockedMillisec * 1000) << " requests/s" << std::endl;
+    }
+}
@@ -0,0 +1,294 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/network_core/response_queue.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+
+// Test response: header followed by id and payload bytes derived from the id
+static constexpr unsigned int maxTestResponseSize = sizeof(RequestResponseHeader) + sizeof(unsigned long long) + 256;
+
+static unsigned int testResponseSize(unsigned long long id)
+{
+    return sizeof(RequestResponseHeader) + sizeof(unsigned long long) + (unsigned int)((id * 7) % 257);
+}
+
+static void makeTestResponse(unsigned char* buffer, unsigned long long id)
+{
+    RequestResponseHeader* header = (RequestResponseHeader*)buffer;
+    const unsigned int size = testResponseSize(id);
+    header->checkAndSetSize(size);
+    header->setType((unsigned char)id);
+    header->setDejavu((unsigned int)id);
+    *(unsigned long long*)(buffer + sizeof(RequestResponseHeader)) = id;
+    for (unsigned int i = sizeof(RequestResponseHeader) + sizeof(unsigned long long); i < size; ++i)
+        buffer[i] = (unsigned char)(id + i);
+}
+
+// Check response content and return its id
+static unsigned long long checkTestResponse(const RequestResponseHeader* header)
+{
+    const unsigned char* buffer = (const unsigned char*)header;
+    const unsigned long long id = *(const unsigned long long*)(buffer + sizeof(RequestResponseHeader));
+    EXPECT_EQ(header->size(), testResponseSize(id));
+    EXPECT_EQ(header->type(), (unsigned char)id);
+    EXPECT_EQ(header->dejavu(), (unsigned int)id);
+    for (unsigned int i = sizeof(RequestResponseHeader) + sizeof(unsigned long long); i < header->size(); ++i)
+    {
+        if (buffer[i] != (unsigned char)(id + i))
+        {
+            ADD_FAILURE() << "Corrupted payload of response " << id;
+            break;
+        }
+    }
+    return id;
+}
+
+template <unsigned int numberOfShards, unsigned int shardLength, unsigned int shardBufferSize>
+class TestResponseQueue : public ResponseQueue<numberOfShards, shardLength, shardBufferSize>
+{
+public:
+    TestResponseQueue()
+    {
+        EXPECT_TRUE(this->init());
+    }
+
+    ~TestResponseQueue()
+    {
+        this->deinit();
+    }
+
+    bool enqueueTestResponse(unsigned int shardIndex, unsigned long long id)
+    {
+        unsigned char buffer[maxTestResponseSize];
+        makeTestResponse(buffer, id);
+        return this->enqueue(shardIndex, (Peer*)(id + 1), (RequestResponseHeader*)buffer);
+    }
+
+    // Dequeue response and return its id (-1 if queue is empty)
+    unsigned long long dequeueTestResponse()
+    {
+        Peer* peer;
+        unsigned int shardIndex;
+        const RequestResponseHeader* response = this->front(peer, shardIndex);
+        if (!response)
+            return (unsigned long long)-1;
+        const unsigned long long id = checkTestResponse(response);
+        EXPECT_EQ(peer, (Peer*)(id + 1));
+        this->popFront(shardIndex);
+        return id;
+    }
+};
+
+
+TEST(TestCoreResponseQueue, FifoPerShardAndRoundRobin)
+{
+    TestResponseQueue<3, 16, 4096> queue;
+    EXPECT_EQ(queue.dequeueTestResponse(), (unsigned long long)-1);
+
+    // shard 0: 0, 1, 2; shard 2: 10, 11
+    for (unsigned long long id : { 0, 1, 2 })
+        EXPECT_TRUE(queue.enqueueTestResponse(0, id));
+    for (unsigned long long id : { 10, 11 })
+        EXPECT_TRUE(queue.enqueueTestResponse(2, id));
+    EXPECT_EQ(queue.getNumberOfResponses(), 5u);
+
+    // shards are taken in turn, responses of each shard in order
+    for (unsigned long long id : { 0, 10, 1, 11, 2 })
+        EXPECT_EQ(queue.dequeueTestResponse(), id);
+    EXPECT_EQ(queue.dequeueTestResponse(), (unsigned long long)-1);
+    EXPECT_EQ(queue.getNumberOfResponses(), 0u);
+    EXPECT_EQ(queue.getNumberOfBytes(), 0u);
+}
+
+TEST(TestCoreResponseQueue, FullShardDoesNotBlockOthers)
+{
+    TestResponseQueue<2, 8, 4096> queue;
+
+    // element ring of shard 0 is full after 8 responses, shard 1 still accepts responses
+    for (unsigned long long id = 0; id < 8; ++id)
+        EXPECT_TRUE(queue.enqueueTestResponse(0, id));
+    EXPECT_FALSE(queue.enqueueTestResponse(0, 8));
+    EXPECT_TRUE(queue.enqueueTestResponse(1, 100));
+
+    EXPECT_EQ(queue.dequeueTestResponse(), 0u);
+    EXPECT_TRUE(queue.enqueueTestResponse(0, 8));
+    EXPECT_EQ(queue.dequeueTestResponse(), 100u);
+    for (unsigned long long id = 1; id <= 8; ++id)
+        EXPECT_EQ(queue.dequeueTestResponse(), id);
+}
+
+TEST(TestCoreResponseQueue, ReserveCommitAndCancel)
+{
+    TestResponseQueue<1, 16, 1024> queue;
+    unsigned int shardIndex = 0;
+
+    // reserve more than needed, serialize in place, commit actual size
+    RequestResponseHeader* response = queue.reserve(shardIndex, (Peer*)2, 1000);
+    ASSERT_NE(response, nullptr);
+    makeTestResponse((unsigned char*)response, 1);
+    queue.commit(shardIndex);
+    EXPECT_EQ(queue.getNumberOfBytes(), testResponseSize(1));
+
+    // cancelled response isn't visible
+    response = queue.reserve(shardIndex, (Peer*)3, 100);
+    ASSERT_NE(response, nullptr);
+    queue.cancel(shardIndex);
+    EXPECT_EQ(queue.getNumberOfResponses(), 1u);
+
+    // too large
+    EXPECT_EQ(queue.reserve(shardIndex, nullptr, 1025), nullptr);
+
+    EXPECT_EQ(queue.dequeueTestResponse(), 1u);
+    EXPECT_EQ(queue.dequeueTestResponse(), (unsigned long long)-1);
+}
+
+TEST(TestCoreResponseQueue, ByteBufferWrapAround)
+{
+    // buffer is full much earlier than element ring
+    TestResponseQueue<1, 1024, 1024> queue;
+    unsigned long long nextEnqueueId = 0, nextDequeueId = 0;
+    for (unsigned int round = 0; round < 1000; ++round)
+    {
+        while (queue.enqueueTestResponse(0, nextEnqueueId))
+            ++nextEnqueueId;
+        EXPECT_LE(queue.getNumberOfBytes(), 1024u);
+        EXPECT_GT(queue.getNumberOfResponses(), 0u);
+
+        // dequeue some (at least one), responses are contiguous even if they wrap around the end of the buffer
+        for (unsigned int i = 0; i <= round % 3 && nextDequeueId < nextEnqueueId; ++i)
+        {
+            EXPECT_EQ(queue.dequeueTestResponse(), nextDequeueId);
+            ++nextDequeueId;
+        }
+    }
+}
+
+TEST(TestCoreResponseQueue, StressProducersAndConsumer)
+{
+    // more producers than shards, so some of them share a shard
+    constexpr unsigned int numberOfProducers = 6;
+    constexpr unsigned long long responsesPerProducer = 50000;
+    constexpr unsigned long long totalResponses = numberOfProducers * responsesPerProducer;
+    auto queue = std::make_unique<TestResponseQueue<4, 64, 4096>>();
+    std::vector<unsigned char> received(totalResponses, 0);
+    std::vector<unsigned long long> lastIdOfProducer(numberOfProducers, (unsigned long long)-1);
+
+    std::vector<std::thread> producers;
+    for (unsigned int p = 0; p < numberOfProducers; ++p)
+    {
+        producers.emplace_back([&, p]()
+            {
+                const unsigned int shardIndex = queue->shardOfProcessor(p);
+                for (unsigned long long i = 0; i < responsesPerProducer; ++i)
+                {
+                    const unsigned long long id = p * responsesPerProducer + i;
+                    if (i % 2)
+                    {
+                        while (!queue->enqueueTestResponse(shardIndex, id))
+                            std::this_thread::yield();
+                    }
+                    else
+                    {
+                        // serialize in place
+                        RequestResponseHeader* response;
+                        while (!(response = queue->reserve(shardIndex, (Peer*)(id + 1), maxTestResponseSize)))
+                            std::this_thread::yield();
+                        makeTestResponse((unsigned char*)response, id);
+                        queue->commit(shardIndex);
+                    }
+                }
+            });
+    }
+
+    // single consumer, responses of each producer have to arrive in order
+    for (unsigned long long numberOfDequeued = 0; numberOfDequeued < totalResponses; )
+    {
+        const unsigned long long id = queue->dequeueTestResponse();
+        if (id == (unsigned long long)-1)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        ASSERT_LT(id, totalResponses);
+        received[id]++;
+        const unsigned int p = (unsigned int)(id / responsesPerProducer);
+        EXPECT_TRUE(lastIdOfProducer[p] == (unsigned long long)-1 || lastIdOfProducer[p] < id);
+        lastIdOfProducer[p] = id;
+        ++numberOfDequeued;
+    }
+    for (auto& producer : producers)
+        producer.join();
+
+    for (unsigned long long id = 0; id < totalResponses; ++id)
+        EXPECT_EQ(received[id], 1) << "response " << id;
+    EXPECT_EQ(queue->getNumberOfResponses(), 0u);
+    EXPECT_EQ(queue->getNumberOfBytes(), 0u);
+}
+
+TEST(TestCoreResponseQueue, DISABLED_PerformanceContention)
+{
+    constexpr unsigned long long responsesPerProducer = 500000;
+    const unsigned int hardwareThreads = std::max(std::thread::hardware_concurrency(), 2u);
+
+    std::vector<unsigned char> responses(1000 * maxTestResponseSize);
+    for (unsigned long long i = 0; i < 1000; ++i)
+        makeTestResponse(&responses[i * maxTestResponseSize], i);
+
+    for (unsigned int numberOfProducers : { 1u, 4u, 8u, 16u, 31u })
+    {
+        if (numberOfProducers >= hardwareThreads && numberOfProducers > 1)
+            break;
+
+        // one shard (like the former queue with a single lock) vs. one shard per producer
+        for (bool sharded : { false, true })
+        {
+            auto queue = std::make_unique<TestResponseQueue<32, 8192, (1 << 22)>>();
+            std::atomic<unsigned int> finishedProducers = 0;
+            auto start = std::chrono::high_resolution_clock::now();
+            std::vector<std::thread> producers;
+            for (unsigned int p = 0; p < numberOfProducers; ++p)
+            {
+                producers.emplace_back([&, p]()
+                    {
+                        const unsigned int shardIndex = (sharded) ? queue->shardOfProcessor(p) : 0;
+                        for (unsigned long long i = 0; i < responsesPerProducer; ++i)
+                        {
+                            const RequestResponseHeader* response = (const RequestResponseHeader*)&responses[(i % 1000) * maxTestResponseSize];
+                            while (!queue->enqueue(shardIndex, nullptr, response))
+                                _mm_pause();
+                        }
+                        finishedProducers++;
+                    });
+            }
+            unsigned long long checksum = 0;
+            while (finishedProducers.load() < numberOfProducers || queue->getNumberOfResponses())
+            {
+                Peer* peer;
+                unsigned int shardIndex;
+                const RequestResponseHeader* response = queue->front(peer, shardIndex);
+                if (response)
+                {
+                    checksum += response->dejavu();
+                    queue->popFront(shardIndex);
+                }
+                else
+                    _mm_pause();
+            }
+            for (auto& producer : producers)
+                producer.join();
+            EXPECT_NE(checksum, 1);
+            const double millisec = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+            std::cout << numberOfProducers << " producers, " << (sharded ? "sharded queue: " : "single shard:  ")
+                << (unsigned long long)(numberOfProducers * responsesPerProducer / millisec * 1000) << " responses/s" << std::endl;
+        }
+    }
+}
@@ -3,8 +3,13 @@
 #include "gtest/gtest.h"
 
 #include "../src/score_cache.h"
+#include "../src/score.h"
 
+#include <atomic>
+#include <memory>
 #include <random>
+#include <thread>
+#include <vector>
 
 
 template <unsigned int cacheCapacity>
@@ -199,3 +204,162 @@ TEST(TestQubicScoreCache, RandomSeeds80pctFilled) {
     testCacheRandomSeeds<200000>(80);     // non-prime number as cache size
     testCacheRandomSeeds<199999>(80);     // prime number as cache size
 }
+
+TEST(TestQubicScoreCache, ContainsDoesNotCount) {
+    auto cache = std::make_unique<ScoreCache<1000>>();
+    m256i publicKey(1, 2, 3, 4), miningSeed(5, 6, 7, 8), nonce(9, 10, 11, 12);
+    EXPECT_FALSE(cache->contains(publicKey, miningSeed, nonce));
+
+    unsigned int idx = cache->getCacheIndex(publicKey, miningSeed, nonce);
+    cache->addEntry(publicKey, miningSeed, nonce, idx, 42);
+    EXPECT_TRUE(cache->contains(publicKey, miningSeed, nonce));
+    EXPECT_FALSE(cache->contains(publicKey, miningSeed, m256i(9, 10, 11, 13)));
+    EXPECT_EQ(cache->hitCount(), 0);
+    EXPECT_EQ(cache->missCount(), 0);
+    EXPECT_EQ(cache->collisionCount(), 0);
+}
+
+TEST(TestQubicScoreCache, ConcurrentStress) {
+    // Readers and writers access a small cache concurrently, so entries are overwritten while they are read. Scores are
+    // derived from the key, so a torn read would return a wrong score for the key.
+    constexpr unsigned int numberOfThreads = 8;
+    constexpr unsigned int operationsPerThread = 200000;
+    constexpr unsigned int numberOfKeys = 5000;
+    auto cache = std::make_unique<ScoreCache<4096, 8>>();
+    const m256i miningSeed(7, 7, 7, 7);
+    auto keyPublicKey = [](unsigned int k) { return m256i(k + 1, k * 3, k ^ 0x5555, 99); };
+    auto keyNonce = [](unsigned int k) { return m256i(k * 7, k + 13, 0, k); };
+    auto keyScore = [](unsigned int k) { return (int)(k * 31 % 1000); };
+
+    std::atomic<unsigned int> wrongScores = 0;
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < numberOfThreads; ++t)
+    {
+        threads.emplace_back([&, t]()
+            {
+                std::mt19937 gen(t);
+                for (unsigned int i = 0; i < operationsPerThread; ++i)
+                {
+                    const unsigned int k = gen() % numberOfKeys;
+                    const m256i publicKey = keyPublicKey(k), nonce = keyNonce(k);
+                    unsigned int idx = cache->getCacheIndex(publicKey, miningSeed, nonce);
+                    const int score = cache->tryFetching(publicKey, miningSeed, nonce, idx);
+                    if (score >= cache->MIN_VALID_SCORE)
+                    {
+                        if (score != keyScore(k))
+                            wrongScores++;
+                    }
+                    else
+                    {
+                        cache->addEntry(publicKey, miningSeed, nonce, idx, keyScore(k));
+                    }
+                }
+            });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    EXPECT_EQ(wrongScores.load(), 0u);
+    EXPECT_EQ(cache->hitCount() + cache->missCount() + cache->collisionCount(), numberOfThreads * operationsPerThread);
+    EXPECT_GT(cache->hitCount(), 0u);
+
+    // all entries are consistent after the concurrent writes
+    for (unsigned int k = 0; k < numberOfKeys; ++k)
+    {
+        const m256i publicKey = keyPublicKey(k), nonce = keyNonce(k);
+        unsigned int idx = cache->getCacheIndex(publicKey, miningSeed, nonce);
+        const int score = cache->tryFetching(publicKey, miningSeed, nonce, idx);
+        EXPECT_TRUE(score < cache->MIN_VALID_SCORE || score == keyScore(k));
+    }
+}
+
+TEST(TestQubicScoreCache, SpeculativeQueue) {
+    // Small score function parameters. The mining seed is changed before processing most solutions, so they are
+    // skipped as outdated without computing the score.
+    typedef ScoreFunction<64, 64, 50, 64, 178, 50, 36, 1> ScoreFunctionType;
+    auto score = std::make_unique_for_overwrite<ScoreFunctionType>();
+    score->initMemory();
+    score->resetSpeculativeQueue();
+    const m256i miningSeed(1, 2, 3, 4), otherSeed(9, 9, 9, 9);
+    const m256i publicKey(5, 6, 7, 8);
+    auto nonce = [](unsigned int i) { return m256i(i, 11, 12, 13); };
+    constexpr unsigned int length = SPECULATIVE_SCORING_QUEUE_LENGTH;
+    auto& highPriorityLane = score->speculativeQueue[0];
+    auto& lowPriorityLane = score->speculativeQueue[1];
+    score->currentRandomSeed = miningSeed;
+
+    // solutions with zero or outdated seed and solutions already in the score cache are not queued
+    EXPECT_FALSE(score->addSpeculativeTask(publicKey, m256i::zero(), nonce(0), true));
+    EXPECT_FALSE(score->addSpeculativeTask(publicKey, otherSeed, nonce(0), true));
+    const m256i cachedNonce = nonce(3 * length);
+    score->scoreCache.addEntry(publicKey, miningSeed, cachedNonce, score->scoreCache.getCacheIndex(publicKey, miningSeed, cachedNonce), 7);
+    EXPECT_FALSE(score->addSpeculativeTask(publicKey, miningSeed, cachedNonce, true));
+    EXPECT_FALSE(score->tryProcessSpeculativeSolution(0));
+
+    // fill low priority lane, further low priority tasks are dropped
+    for (unsigned int i = 0; i < length; ++i)
+        EXPECT_TRUE(score->addSpeculativeTask(publicKey, miningSeed, nonce(i), false));
+    EXPECT_FALSE(score->addSpeculativeTask(publicKey, miningSeed, nonce(length), false));
+    EXPECT_EQ(score->numberOfDroppedSpeculativeTasks, 1);
+
+    // high priority lane is independent of the full low priority lane
+    for (unsigned int i = 0; i < length; ++i)
+        EXPECT_TRUE(score->addSpeculativeTask(publicKey, miningSeed, nonce(length + i), true));
+    EXPECT_FALSE(score->addSpeculativeTask(publicKey, miningSeed, nonce(2 * length), true));
+    EXPECT_EQ(score->numberOfDroppedSpeculativeTasks, 2);
+    EXPECT_EQ(highPriorityLane.count, length);
+    EXPECT_EQ(lowPriorityLane.count, length);
+
+    // high priority lane is taken first, in FIFO order
+    score->currentRandomSeed = otherSeed;
+    for (unsigned int i = 0; i < length; ++i)
+    {
+        ASSERT_GT(highPriorityLane.count, 0u);
+        EXPECT_TRUE(highPriorityLane.nonce[highPriorityLane.first] == nonce(length + i));
+        EXPECT_TRUE(score->tryProcessSpeculativeSolution(0));
+        EXPECT_EQ(lowPriorityLane.count, length);
+    }
+    EXPECT_EQ(highPriorityLane.count, 0u);
+
+    // then the low priority lane
+    EXPECT_TRUE(lowPriorityLane.nonce[lowPriorityLane.first] == nonce(0));
+    EXPECT_TRUE(score->tryProcessSpeculativeSolution(0));
+    EXPECT_EQ(lowPriorityLane.count, length - 1);
+    EXPECT_EQ(score->numberOfSpeculativeScores, 0);
+
+    // freed slot can be used again (wrapping around in the ring buffer), new high priority task is taken first
+    score->currentRandomSeed = miningSeed;
+    EXPECT_TRUE(score->addSpeculativeTask(publicKey, miningSeed, nonce(length), false));
+    EXPECT_FALSE(score->addSpeculativeTask(publicKey, miningSeed, nonce(length + 1), false));
+    EXPECT_EQ(score->numberOfDroppedSpeculativeTasks, 3);
+    EXPECT_TRUE(score->addSpeculativeTask(publicKey, miningSeed, nonce(2 * length), true));
+    score->currentRandomSeed = otherSeed;
+    EXPECT_TRUE(highPriorityLane.nonce[highPriorityLane.first] == nonce(2 * length));
+    EXPECT_TRUE(score->tryProcessSpeculativeSolution(0));
+    EXPECT_EQ(highPriorityLane.count, 0u);
+    EXPECT_EQ(lowPriorityLane.count, length);
+
+    // reset empties both lanes and clears the counters
+    score->currentRandomSeed = miningSeed;
+    EXPECT_TRUE(score->addSpeculativeTask(publicKey, miningSeed, nonce(2 * length + 1), true));
+    score->resetSpeculativeQueue();
+    EXPECT_EQ(highPriorityLane.count, 0u);
+    EXPECT_EQ(lowPriorityLane.count, 0u);
+    EXPECT_EQ(score->numberOfDroppedSpeculativeTasks, 0);
+    EXPECT_EQ(score->numberOfSpeculativeScores, 0);
+    EXPECT_FALSE(score->tryProcessSpeculativeSolution(0));
+    EXPECT_TRUE(score->addSpeculativeTask(publicKey, miningSeed, nonce(0), false));
+    EXPECT_EQ(lowPriorityLane.count, 1u);
+
+    // only solutions that are actually scored are counted: cached solution is skipped, new one is computed and cached
+    score->initMiningData(miningSeed);
+    score->scoreCache.addEntry(publicKey, miningSeed, nonce(0), score->scoreCache.getCacheIndex(publicKey, miningSeed, nonce(0)), 7);
+    EXPECT_TRUE(score->tryProcessSpeculativeSolution(0));
+    EXPECT_EQ(score->numberOfSpeculativeScores, 0);
+    EXPECT_TRUE(score->addSpeculativeTask(publicKey, miningSeed, nonce(1), true));
+    EXPECT_TRUE(score->tryProcessSpeculativeSolution(0));
+    EXPECT_EQ(score->numberOfSpeculativeScores, 1);
+    unsigned int idx = score->scoreCache.getCacheIndex(publicKey, miningSeed, nonce(1));
+    EXPECT_GE(score->scoreCache.tryFetching(publicKey, miningSeed, nonce(1), idx), score->scoreCache.MIN_VALID_SCORE);
+    EXPECT_FALSE(score->tryProcessSpeculativeSolution(0));
+}
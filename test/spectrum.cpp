@@ -4,8 +4,11 @@
 
 #include "gtest/gtest.h"
 
+#include <atomic>
 #include <chrono>
 #include <random>
+#include <thread>
+#include <vector>
 
 #include "logging_test.h"
 #include "spectrum/spectrum.h"
@@ -147,6 +150,8 @@ struct SpectrumTest : public LoggingTest
     void clearSpectrum()
     {
         memset(spectrum, 0, spectrumSizeInBytes);
+        updateSpectrumFingerprints(0, SPECTRUM_CAPACITY);
+        clearSpectrumDirtyEntities();
         updateSpectrumInfo();
     }
 
@@ -407,3 +412,445 @@ TEST(TestCoreSpectrum, AntiDustEdgeCaseHugeBinZeroBalance)
     test.afterAntiDust();
 }
 
+
+// Idle processors helping with parallel work (like the request processors in the node)
+struct ParallelWorkHelpers
+{
+    std::atomic<bool> stop;
+    std::vector<std::thread> threads;
+
+    ParallelWorkHelpers(unsigned int numberOfThreads) : stop(false)
+    {
+        for (unsigned int i = 0; i < numberOfThreads; ++i)
+        {
+            threads.emplace_back([this]()
+                {
+                    while (!stop)
+                    {
+                        helpWithParallelWork();
+                        std::this_thread::yield();
+                    }
+                });
+        }
+    }
+
+    ~ParallelWorkHelpers()
+    {
+        stop = true;
+        for (auto& thread : threads)
+            thread.join();
+    }
+};
+
+// Check that incrementally updated digests equal digests computed from scratch (comparing hash of all digests)
+static void checkSpectrumDigests()
+{
+    m256i updatedRoot = spectrumDigests[(SPECTRUM_CAPACITY * 2 - 1) - 1];
+    m256i updatedDigestsHash, recomputedDigestsHash;
+    KangarooTwelve(spectrumDigests, spectrumDigestsSizeInByte, &updatedDigestsHash, sizeof(m256i));
+    recomputeSpectrumDigests();
+    KangarooTwelve(spectrumDigests, spectrumDigestsSizeInByte, &recomputedDigestsHash, sizeof(m256i));
+    EXPECT_EQ(updatedRoot, spectrumDigests[(SPECTRUM_CAPACITY * 2 - 1) - 1]);
+    EXPECT_EQ(updatedDigestsHash, recomputedDigestsHash);
+}
+
+TEST(TestCoreSpectrum, IncrementalDigestUpdate)
+{
+    SpectrumTest test(42);
+    recomputeSpectrumDigests();
+    ParallelWorkHelpers helpers(3);
+
+    // number of changed entities per tick: none, few (serial hashing), many (parallel hashing)
+    const unsigned int transfersPerTick[] = { 0, 7, 20000 };
+    m256i richId(1, 2, 3, 4);
+    increaseEnergy(richId, 1000000000000llu);
+    for (unsigned int transfers : transfersPerTick)
+    {
+        ++system.tick;
+        for (unsigned int i = 0; i < transfers; ++i)
+        {
+            // mix of new entities and existing entities
+            const m256i destination = (i % 3) ? m256i(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64()) : m256i(i % 100, 5, 6, 7);
+            EXPECT_TRUE(transfer(richId, destination, 1 + i % 1000));
+        }
+        updateSpectrumDigests();
+        EXPECT_EQ(spectrumDirtyCount, 0);
+        checkSpectrumDigests();
+    }
+
+    // more changes than the dirty list can hold
+    ++system.tick;
+    for (unsigned long long i = 0; i < spectrumDirtyListCapacity + 10; ++i)
+        increaseEnergy(m256i(i, 8, 9, 10), 1);
+    EXPECT_GT(spectrumDirtyCount, spectrumDirtyListCapacity);
+    updateSpectrumDigests();
+    EXPECT_EQ(spectrumDirtyCount, 0);
+    EXPECT_TRUE(isZero(spectrumDirtyFlags, SPECTRUM_CAPACITY / 8));
+    checkSpectrumDigests();
+
+    // changes after reorganizing the spectrum
+    ++system.tick;
+    increaseEnergy(m256i(11, 12, 13, 14), 1);
+    reorganizeSpectrum();
+    EXPECT_EQ(spectrumDirtyCount, 0);
+    increaseEnergy(m256i(15, 12, 13, 14), 1);
+    updateSpectrumDigests();
+    checkSpectrumDigests();
+    EXPECT_TRUE(isZero(spectrumDirtyFlags, SPECTRUM_CAPACITY / 8));
+}
+
+TEST(TestCoreSpectrum, DISABLED_PerformanceIncrementalDigestUpdate)
+{
+    SpectrumTest test(1234);
+    m256i richId(1, 2, 3, 4);
+    increaseEnergy(richId, 1000000000000llu);
+    for (unsigned int i = 0; i < 1000000; ++i)
+        increaseEnergy(m256i(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64()), 1000);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    recomputeSpectrumDigests();
+    clearSpectrumDirtyEntities();
+    auto fullMicrosec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "Full recomputation of spectrum digests: " << fullMicrosec << " microseconds" << std::endl;
+
+    const unsigned int numberOfHelpers = std::min(std::thread::hardware_concurrency(), 32u) - 1;
+    for (unsigned int helperCount : { 0u, 3u, 7u, 15u, 31u })
+    {
+        if (helperCount > numberOfHelpers)
+            break;
+        ParallelWorkHelpers helpers(helperCount);
+        for (unsigned int changedEntities : { 100u, 1000u, 10000u, 100000u })
+        {
+            ++system.tick;
+            for (unsigned int i = 0; i < changedEntities; ++i)
+                transfer(richId, m256i(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64()), 1);
+
+            start = std::chrono::high_resolution_clock::now();
+            updateSpectrumDigests();
+            auto incrementalMicrosec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+            std::cout << "Incremental update with " << helperCount << " helpers after changing " << changedEntities
+                << " entities: " << incrementalMicrosec << " microseconds" << std::endl;
+        }
+    }
+}
+
+// Serial reorganization as done before parallelization, writing the reorganized spectrum to reorgSpectrum
+static void referenceReorganizeSpectrum(EntityRecord* reorgSpectrum)
+{
+    memset(reorgSpectrum, 0, SPECTRUM_CAPACITY * sizeof(EntityRecord));
+    for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
+    {
+        if (spectrum[i].incomingAmount - spectrum[i].outgoingAmount)
+        {
+            unsigned int index = spectrum[i].publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
+            while (!isZero(reorgSpectrum[index].publicKey))
+                index = (index + 1) & (SPECTRUM_CAPACITY - 1);
+            reorgSpectrum[index] = spectrum[i];
+        }
+    }
+}
+
+// Serial computation of the root of the spectrum digest tree, using buffer of SPECTRUM_CAPACITY digests
+static m256i referenceSpectrumDigestRoot(m256i* buffer)
+{
+    for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
+        KangarooTwelve64To32(&spectrum[i], &buffer[i]);
+    for (unsigned int numberOfNodes = SPECTRUM_CAPACITY / 2; numberOfNodes >= 1; numberOfNodes /= 2)
+    {
+        for (unsigned int i = 0; i < numberOfNodes; i++)
+            KangarooTwelve64To32(&buffer[i * 2], &buffer[i]);
+    }
+    return buffer[0];
+}
+
+// Check that parallel reorganization and digest computation give the same result as the serial reference
+static void checkParallelReorganization()
+{
+    m256i expectedSpectrumHash, spectrumHash;
+    referenceReorganizeSpectrum((EntityRecord*)reorgBuffer);
+    KangarooTwelve(reorgBuffer, spectrumSizeInBytes, &expectedSpectrumHash, sizeof(m256i));
+
+    reorganizeSpectrum();
+    KangarooTwelve(spectrum, spectrumSizeInBytes, &spectrumHash, sizeof(m256i));
+    EXPECT_EQ(spectrumHash, expectedSpectrumHash);
+
+    EXPECT_EQ(spectrumDigests[(SPECTRUM_CAPACITY * 2 - 1) - 1], referenceSpectrumDigestRoot((m256i*)reorgBuffer));
+}
+
+TEST(TestCoreSpectrum, ParallelReorganization)
+{
+    SpectrumTest test(4321);
+    ParallelWorkHelpers helpers(3);
+
+    // random entities and entities in a cluster of the hash map that wraps around at the end
+    for (unsigned int i = 0; i < SPECTRUM_CAPACITY / 3; ++i)
+        increaseEnergy(m256i(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64()), 1 + test.rnd64() % 1000);
+    for (unsigned int i = 0; i < 30; ++i)
+        increaseEnergy(m256i(SPECTRUM_CAPACITY - 1 - (i % 3), i + 1, 2, 3), 1 + i);
+    EXPECT_FALSE(isZero(spectrum[0].publicKey));
+    EXPECT_FALSE(isZero(spectrum[SPECTRUM_CAPACITY - 1].publicKey));
+
+    // remove about half of the entities
+    for (unsigned int i = 0; i < SPECTRUM_CAPACITY; ++i)
+    {
+        if (test.rnd64() & 1)
+            spectrum[i].outgoingAmount = spectrum[i].incomingAmount;
+    }
+    checkParallelReorganization();
+
+    // entity that is not placed according to linear probing, so the whole spectrum is reinserted serially
+    unsigned int index = SPECTRUM_CAPACITY / 2;
+    while (!isZero(spectrum[index].publicKey))
+        ++index;
+    spectrum[index].publicKey = m256i(index - SPECTRUM_CAPACITY / 4, 4, 5, 6);
+    spectrum[index].incomingAmount = 100;
+    checkParallelReorganization();
+}
+
+TEST(TestCoreSpectrum, DISABLED_PerformanceParallelReorganization)
+{
+    SpectrumTest test(5678);
+    for (unsigned int i = 0; i < SPECTRUM_CAPACITY / 2; ++i)
+        increaseEnergy(m256i(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64()), 1 + test.rnd64() % 1000);
+
+    const unsigned int numberOfHelpers = std::min(std::thread::hardware_concurrency(), 32u) - 1;
+    for (unsigned int helperCount : { 0u, 3u, 7u, 15u, 31u })
+    {
+        if (helperCount > numberOfHelpers)
+            break;
+        ParallelWorkHelpers helpers(helperCount);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        reorganizeSpectrum();
+        auto microsec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+        std::cout << "Reorganization of spectrum (including digests) with " << helperCount << " helpers: " << microsec << " microseconds" << std::endl;
+
+        start = std::chrono::high_resolution_clock::now();
+        recomputeSpectrumDigests();
+        microsec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+        std::cout << "Full recomputation of spectrum digests with " << helperCount << " helpers: " << microsec << " microseconds" << std::endl;
+    }
+}
+
+// Lookup by comparing public keys one by one, as done before introducing fingerprints
+static int referenceSpectrumIndex(const m256i& publicKey)
+{
+    if (isZero(publicKey))
+        return -1;
+    unsigned int index = publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
+    ACQUIRE(spectrumLock);
+    while (!(spectrum[index].publicKey == publicKey))
+    {
+        if (isZero(spectrum[index].publicKey))
+        {
+            RELEASE(spectrumLock);
+            return -1;
+        }
+        index = (index + 1) & (SPECTRUM_CAPACITY - 1);
+    }
+    RELEASE(spectrumLock);
+    return index;
+}
+
+// Check fingerprints and that all entities are found at their index
+static void checkSpectrumIndex()
+{
+    for (unsigned int i = 0; i < SPECTRUM_CAPACITY; ++i)
+    {
+        if (isZero(spectrum[i].publicKey))
+        {
+            EXPECT_EQ(spectrumFingerprints[i], 0);
+        }
+        else
+        {
+            EXPECT_EQ(spectrumFingerprints[i], spectrumFingerprint(spectrum[i].publicKey));
+            EXPECT_EQ(spectrumIndex(spectrum[i].publicKey), (int)i);
+        }
+    }
+    for (unsigned int i = 0; i < spectrumFingerprintGroupSize; ++i)
+        EXPECT_EQ(spectrumFingerprints[SPECTRUM_CAPACITY + i], spectrumFingerprints[i]);
+}
+
+TEST(TestCoreSpectrum, SpectrumIndexWithFingerprints)
+{
+    SpectrumTest test(777);
+    EXPECT_EQ(spectrumIndex(m256i::zero()), -1);
+    EXPECT_EQ(spectrumIndex(m256i(1, 2, 3, 4)), -1);
+
+    // Random entities and a cluster of entities with the same slot index and fingerprint that wraps around at the
+    // end of the hash map and is longer than a group of slots
+    for (unsigned int i = 0; i < SPECTRUM_CAPACITY / 4; ++i)
+        increaseEnergy(m256i(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64()), 1 + test.rnd64() % 1000);
+    for (unsigned int i = 0; i < 2 * spectrumFingerprintGroupSize; ++i)
+        increaseEnergy(m256i(SPECTRUM_CAPACITY - 5, 7 + (i << 8), 8, 9), 1);
+    checkSpectrumIndex();
+
+    // Entities that are not in spectrum, including some with the same slot index and fingerprint as the cluster
+    for (unsigned int i = 0; i < 10000; ++i)
+    {
+        const m256i publicKey(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64());
+        EXPECT_EQ(spectrumIndex(publicKey), referenceSpectrumIndex(publicKey));
+    }
+    for (unsigned int i = 2 * spectrumFingerprintGroupSize; i < 3 * spectrumFingerprintGroupSize; ++i)
+        EXPECT_EQ(spectrumIndex(m256i(SPECTRUM_CAPACITY - 5, 7 + (i << 8), 8, 9)), -1);
+
+    // Remove about half of the entities
+    for (unsigned int i = 0; i < SPECTRUM_CAPACITY; ++i)
+    {
+        if (test.rnd64() & 1)
+            spectrum[i].outgoingAmount = spectrum[i].incomingAmount;
+    }
+    reorganizeSpectrum();
+    checkSpectrumIndex();
+}
+
+TEST(TestCoreSpectrum, SpectrumIndexConcurrentLookups)
+{
+    SpectrumTest test(888);
+    std::vector<m256i> publicKeys;
+    for (unsigned int i = 0; i < 100000; ++i)
+    {
+        publicKeys.emplace_back(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64());
+        increaseEnergy(publicKeys.back(), 1000);
+    }
+
+    // Look up entities while others are inserted and the spectrum is reorganized
+    std::atomic<bool> stop(false);
+    std::atomic<unsigned long long> notFound(0), lookups(0);
+    std::vector<std::thread> readers;
+    for (unsigned int t = 0; t < 2; ++t)
+    {
+        readers.emplace_back([&, t]()
+            {
+                unsigned long long i = t;
+                while (!stop)
+                {
+                    const m256i& publicKey = publicKeys[(i += 7) % publicKeys.size()];
+                    if (spectrumIndex(publicKey) < 0)
+                        ++notFound;
+                    ++lookups;
+                }
+            });
+    }
+    for (unsigned int round = 0; round < 5; ++round)
+    {
+        for (unsigned int i = 0; i < 100000; ++i)
+            increaseEnergy(m256i(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64()), 0);
+        reorganizeSpectrum();
+    }
+    stop = true;
+    for (auto& reader : readers)
+        reader.join();
+
+    EXPECT_GT(lookups, 0);
+    EXPECT_EQ(notFound, 0);
+    checkSpectrumIndex();
+}
+
+TEST(TestCoreSpectrum, SpectrumRecordsConcurrentReads)
+{
+    SpectrumTest test(1234);
+    system.tick = 1;
+    std::vector<m256i> publicKeys;
+    for (unsigned int i = 0; i < 1000; ++i)
+    {
+        publicKeys.emplace_back(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64());
+        increaseEnergy(publicKeys.back(), 1000);
+    }
+    updateSpectrumDigests();
+
+    // Read records and digests without lock while records are changed, digests are updated, and the spectrum is
+    // reorganized. Each copy of a record has to be consistent.
+    std::atomic<bool> stop(false);
+    std::atomic<unsigned long long> inconsistent(0), reads(0);
+    std::vector<std::thread> readers;
+    for (unsigned int t = 0; t < 2; ++t)
+    {
+        readers.emplace_back([&, t]()
+            {
+                unsigned long long i = t;
+                EntityRecord record;
+                m256i siblings[SPECTRUM_DEPTH];
+                while (!stop)
+                {
+                    const m256i& publicKey = publicKeys[(i += 7) % publicKeys.size()];
+                    int index;
+                    do
+                    {
+                        index = spectrumIndex(publicKey);
+                        if (index < 0)
+                            break;
+                        readSpectrumRecord(index, record);
+                    } while (record.publicKey != publicKey);
+                    if (index < 0 || record.incomingAmount != record.numberOfIncomingTransfers * 1000
+                        || record.latestIncomingTransferTick != record.numberOfIncomingTransfers)
+                        ++inconsistent;
+                    else
+                        readSpectrumDigestSiblings(index, siblings);
+                    ++reads;
+                }
+            });
+    }
+    for (unsigned int round = 0; round < 20; ++round)
+    {
+        for (unsigned int i = 0; i < 20000; ++i)
+        {
+            const m256i& publicKey = publicKeys[test.rnd64() % publicKeys.size()];
+            system.tick = energy(spectrumIndex(publicKey)) / 1000 + 1;
+            increaseEnergy(publicKey, 1000);
+        }
+        updateSpectrumDigests();
+        if (round % 5 == 4)
+            reorganizeSpectrum();
+    }
+    stop = true;
+    for (auto& reader : readers)
+        reader.join();
+
+    EXPECT_GT(reads, 0);
+    EXPECT_EQ(inconsistent, 0);
+    checkSpectrumDigests();
+}
+
+TEST(TestCoreSpectrum, DISABLED_PerformanceSpectrumIndex)
+{
+    SpectrumTest test(999);
+    constexpr unsigned int lookupCount = 1000000;
+    std::vector<m256i> existingKeys, missingKeys;
+    for (unsigned int i = 0; i < lookupCount; ++i)
+        missingKeys.emplace_back(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64());
+
+    // 75% is the maximum load before anti-dust cleans the spectrum
+    for (unsigned int loadPercent : { 25u, 50u, 75u })
+    {
+        const unsigned int entityCount = (unsigned int)(SPECTRUM_CAPACITY * loadPercent / 100) - 1;
+        while (spectrumInfo.numberOfEntities < entityCount)
+        {
+            const m256i publicKey(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64());
+            increaseEnergy(publicKey, 1);
+            if (existingKeys.size() < lookupCount)
+                existingKeys.push_back(publicKey);
+            else
+                existingKeys[test.rnd64() % lookupCount] = publicKey;
+        }
+
+        for (const auto* keys : { &existingKeys, &missingKeys })
+        {
+            long long checksum = 0, referenceChecksum = 0;
+            auto start = std::chrono::high_resolution_clock::now();
+            for (const m256i& publicKey : *keys)
+                referenceChecksum += referenceSpectrumIndex(publicKey);
+            auto referenceNanosec = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start).count();
+
+            start = std::chrono::high_resolution_clock::now();
+            for (const m256i& publicKey : *keys)
+                checksum += spectrumIndex(publicKey);
+            auto nanosec = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start).count();
+
+            EXPECT_EQ(checksum, referenceChecksum);
+            std::cout << "Spectrum lookup of " << ((keys == &existingKeys) ? "existing" : "missing") << " entities at "
+                << loadPercent << "% load: " << double(nanosec) / keys->size() << " ns with fingerprints, "
+                << double(referenceNanosec) / keys->size() << " ns comparing public keys" << std::endl;
+        }
+    }
+}
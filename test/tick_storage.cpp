@@ -28,16 +28,12 @@ public:
         transaction->inputType = 0;
         transaction->tick = tick;
 
-        unsigned int transactionSize = transaction->totalSize();
+        m256i digest;
+        KangarooTwelve(transaction, transaction->totalSize(), &digest, sizeof(digest));
 
-        auto* offsets = tickTransactionOffsets.getByTickInCurrentEpoch(tick);
-        if (nextTickTransactionOffset + transactionSize <= tickTransactions.storageSpaceCurrentEpoch)
-        {
-            EXPECT_EQ(offsets[transactionIdx], 0);
-            offsets[transactionIdx] = nextTickTransactionOffset;
-            copyMem(tickTransactions(nextTickTransactionOffset), transaction, transactionSize);
-            nextTickTransactionOffset += transactionSize;
-        }
+        const auto* offsets = tickTransactionOffsets.getByTickInCurrentEpoch(tick);
+        EXPECT_EQ(offsets[transactionIdx], 0);
+        TickStorage::addTransaction(tick, transactionIdx, transaction, digest);
     }
 };
 
@@ -105,6 +101,7 @@ void checkTick(unsigned int tick, unsigned int seed, unsigned short maxTransacti
     // check transactions of tick
     {
         const auto* offsets = previousEpoch ? ts.tickTransactionOffsets.getByTickInPreviousEpoch(tick) : ts.tickTransactionOffsets.getByTickInCurrentEpoch(tick);
+        const auto* digests = previousEpoch ? ts.tickTransactionDigests.getByTickInPreviousEpoch(tick) : ts.tickTransactionDigests.getByTickInCurrentEpoch(tick);
         unsigned int transactionNum = gen32() % (maxTransactions + 1);
         unsigned int orderMode = gen32() % 2;
         unsigned int transactionSlot;
@@ -127,6 +124,11 @@ void checkTick(unsigned int tick, unsigned int seed, unsigned short maxTransacti
             EXPECT_TRUE(tp->checkValidity());
             EXPECT_EQ(tp->tick, tick);
             EXPECT_EQ((int)tp->inputSize, expectedInputSize);
+
+            // check digest stored with transaction
+            m256i digest;
+            KangarooTwelve(tp, tp->totalSize(), &digest, sizeof(digest));
+            EXPECT_EQ(digests[transactionSlot], digest);
         }
     }
 }
@@ -0,0 +1,321 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "logging_test.h"
+#include "spectrum/spectrum.h"
+#include "ticking/transfer_batch.h"
+
+struct TransferBatchTest : public LoggingTest
+{
+    std::mt19937_64 rnd64;
+    std::vector<m256i> entities;
+    std::vector<Transaction> transactions;
+
+    TransferBatchTest(unsigned long long seed)
+    {
+        rnd64.seed(seed);
+        EXPECT_TRUE(initSpectrum());
+        EXPECT_TRUE(initCommonBuffers());
+        system.tick = 15700000;
+    }
+
+    ~TransferBatchTest()
+    {
+        deinitSpectrum();
+        deinitCommonBuffers();
+    }
+
+    m256i randomPublicKey()
+    {
+        return m256i(rnd64(), rnd64(), rnd64(), rnd64());
+    }
+
+    // Fill spectrum with numberOfEntities random entities (the first ones are remembered for transfers)
+    void fillSpectrum(unsigned int numberOfEntities, unsigned int numberOfRememberedEntities)
+    {
+        setMem(spectrum, spectrumSizeInBytes, 0);
+        updateSpectrumFingerprints(0, SPECTRUM_CAPACITY);
+        clearSpectrumDirtyEntities();
+        updateSpectrumInfo();
+        entities.clear();
+        for (unsigned int i = 0; i < numberOfEntities; ++i)
+        {
+            const m256i publicKey = randomPublicKey();
+            increaseEnergy(publicKey, 1 + rnd64() % 10000);
+            if (i < numberOfRememberedEntities)
+                entities.push_back(publicKey);
+        }
+    }
+
+    // Generate transfers between remembered entities, new entities, and entities that are not in spectrum. Chains
+    // of transfers make the outcome depend on the order.
+    void generateTransfers(unsigned int numberOfTransfers)
+    {
+        transactions.resize(numberOfTransfers);
+        std::vector<m256i> newEntities;
+        for (unsigned int i = 0; i < numberOfTransfers; ++i)
+        {
+            Transaction& transaction = transactions[i];
+            const unsigned int kind = rnd64() % 16;
+            if (kind == 0)
+            {
+                // source not in spectrum (unless created before)
+                transaction.sourcePublicKey = randomPublicKey();
+            }
+            else if (kind <= 2 && !newEntities.empty())
+            {
+                // source created by previous transfer
+                transaction.sourcePublicKey = newEntities[rnd64() % newEntities.size()];
+            }
+            else if (kind <= 4 && i)
+            {
+                // source is destination of previous transfer
+                transaction.sourcePublicKey = transactions[i - 1 - rnd64() % ((i < 8) ? i : 8)].destinationPublicKey;
+            }
+            else
+            {
+                transaction.sourcePublicKey = entities[rnd64() % entities.size()];
+            }
+
+            const unsigned int destinationKind = rnd64() % 16;
+            if (destinationKind == 0)
+            {
+                transaction.destinationPublicKey = randomPublicKey();
+                newEntities.push_back(transaction.destinationPublicKey);
+            }
+            else if (destinationKind == 1)
+            {
+                transaction.destinationPublicKey = transaction.sourcePublicKey;
+            }
+            else
+            {
+                transaction.destinationPublicKey = entities[rnd64() % entities.size()];
+            }
+
+            transaction.amount = (rnd64() % 8) ? rnd64() % 10000 : 0;
+            transaction.tick = system.tick;
+            transaction.inputType = 0;
+            transaction.inputSize = 0;
+        }
+    }
+
+    // Process transfers one by one like processTickTransaction(), return outcome per transfer (-1: ignored, 0: failed,
+    // 1: succeeded)
+    std::vector<int> processSequentially()
+    {
+        std::vector<int> outcomes;
+        for (const Transaction& transaction : transactions)
+        {
+            const int index = spectrumIndex(transaction.sourcePublicKey);
+            if (index < 0)
+            {
+                outcomes.push_back(-1);
+                continue;
+            }
+            if (decreaseEnergy(index, transaction.amount))
+            {
+                increaseEnergy(transaction.destinationPublicKey, transaction.amount);
+                outcomes.push_back(1);
+            }
+            else
+            {
+                outcomes.push_back(0);
+            }
+        }
+        return outcomes;
+    }
+
+    // Process transfers as batch like processTickTransferBatch(), return outcome per transfer (see above)
+    std::vector<int> processBatch(TransferBatch& batch)
+    {
+        std::vector<int> outcomes;
+        batch.reset();
+        for (unsigned int i = 0; i < transactions.size(); ++i)
+        {
+            EXPECT_TRUE(TransferBatch::isPlainTransfer(&transactions[i]));
+            EXPECT_TRUE(batch.add(&transactions[i], i));
+        }
+        EXPECT_TRUE(batch.execute());
+        for (unsigned int i = 0; i < batch.getNumberOfTransfers(); ++i)
+        {
+            const TransferBatch::Transfer& transfer = batch.getTransfer(i);
+            EXPECT_EQ(transfer.transactionIndex, i);
+            if (!transfer.sourceExists)
+                outcomes.push_back(-1);
+            else
+                outcomes.push_back(batch.commit(i) ? 1 : 0);
+        }
+        return outcomes;
+    }
+
+    // Return records of all entities involved in the transfers
+    std::vector<EntityRecord> getRecords()
+    {
+        std::vector<EntityRecord> records;
+        for (const Transaction& transaction : transactions)
+        {
+            for (const m256i* publicKey : { &transaction.sourcePublicKey, &transaction.destinationPublicKey })
+            {
+                const int index = spectrumIndex(*publicKey);
+                EntityRecord record;
+                if (index >= 0)
+                    record = spectrum[index];
+                else
+                    setMem(&record, sizeof(record), 0);
+                records.push_back(record);
+            }
+        }
+        return records;
+    }
+};
+
+// Threads calling helpWithParallelWork() like idle request processors
+struct TransferBatchParallelWorkHelpers
+{
+    std::atomic<bool> stop;
+    std::vector<std::thread> threads;
+
+    TransferBatchParallelWorkHelpers(unsigned int numberOfThreads) : stop(false)
+    {
+        for (unsigned int i = 0; i < numberOfThreads; ++i)
+        {
+            threads.emplace_back([this]()
+                {
+                    while (!stop)
+                    {
+                        helpWithParallelWork();
+                        std::this_thread::yield();
+                    }
+                });
+        }
+    }
+
+    ~TransferBatchParallelWorkHelpers()
+    {
+        stop = true;
+        for (auto& thread : threads)
+            thread.join();
+    }
+};
+
+TEST(TestCoreTransferBatch, IsPlainTransfer)
+{
+    Transaction transaction;
+    transaction.sourcePublicKey = m256i(1, 2, 3, 4);
+    transaction.destinationPublicKey = m256i(5, 6, 7, 8);
+    EXPECT_TRUE(TransferBatch::isPlainTransfer(&transaction));
+
+    // system and contracts
+    transaction.destinationPublicKey = m256i::zero();
+    EXPECT_FALSE(TransferBatch::isPlainTransfer(&transaction));
+    transaction.destinationPublicKey = m256i(1, 0, 0, 0);
+    EXPECT_FALSE(TransferBatch::isPlainTransfer(&transaction));
+    transaction.destinationPublicKey = m256i(5000, 0, 0, 0);
+    EXPECT_FALSE(TransferBatch::isPlainTransfer(&transaction));
+
+    transaction.destinationPublicKey = m256i(0, 0, 0, 1);
+    EXPECT_TRUE(TransferBatch::isPlainTransfer(&transaction));
+}
+
+TEST(TestCoreTransferBatch, SameResultAsSequentialProcessing)
+{
+    TransferBatchTest test(42);
+    auto batch = std::make_unique<TransferBatch>();
+    TransferBatchParallelWorkHelpers helpers(3);
+
+    for (unsigned int round = 0; round < 20; ++round)
+    {
+        // few remembered entities for many conflicts in some rounds
+        const unsigned int numberOfTransfers = 1 + (unsigned int)(test.rnd64() % TransferBatch::capacity);
+        const unsigned int numberOfEntities = (round & 1) ? 10 : 5000;
+        const unsigned long long seed = test.rnd64();
+
+        test.rnd64.seed(seed);
+        test.fillSpectrum(20000, numberOfEntities);
+        test.generateTransfers(numberOfTransfers);
+        const std::vector<int> expectedOutcomes = test.processSequentially();
+        const std::vector<EntityRecord> expectedRecords = test.getRecords();
+        const SpectrumInfo expectedInfo = spectrumInfo;
+
+        test.rnd64.seed(seed);
+        test.fillSpectrum(20000, numberOfEntities);
+        test.generateTransfers(numberOfTransfers);
+        const std::vector<int> outcomes = test.processBatch(*batch);
+        const std::vector<EntityRecord> records = test.getRecords();
+
+        EXPECT_EQ(outcomes, expectedOutcomes);
+        EXPECT_EQ(spectrumInfo.numberOfEntities, expectedInfo.numberOfEntities);
+        EXPECT_EQ(spectrumInfo.totalAmount, expectedInfo.totalAmount);
+        ASSERT_EQ(records.size(), expectedRecords.size());
+        for (unsigned int i = 0; i < records.size(); ++i)
+            EXPECT_EQ(memcmp(&records[i], &expectedRecords[i], sizeof(EntityRecord)), 0) << "round " << round << ", record " << i;
+    }
+}
+
+TEST(TestCoreTransferBatch, RefuseBatchThatMayTriggerAntiDust)
+{
+    TransferBatchTest test(43);
+    auto batch = std::make_unique<TransferBatch>();
+    test.fillSpectrum(1000, 1000);
+    test.generateTransfers(100);
+
+    // batch creates new entities
+    batch->reset();
+    for (unsigned int i = 0; i < test.transactions.size(); ++i)
+        EXPECT_TRUE(batch->add(&test.transactions[i], i));
+    const unsigned int numberOfEntities = spectrumInfo.numberOfEntities;
+    spectrumInfo.numberOfEntities = spectrumAntiDustNumberOfEntities - 1;
+    EXPECT_FALSE(batch->execute());
+
+    spectrumInfo.numberOfEntities = numberOfEntities;
+    EXPECT_TRUE(batch->execute());
+
+    // batch is full at capacity
+    batch->reset();
+    for (unsigned int i = 0; i < TransferBatch::capacity; ++i)
+        EXPECT_TRUE(batch->add(&test.transactions[i % test.transactions.size()], i));
+    EXPECT_FALSE(batch->add(&test.transactions[0], 0));
+}
+
+TEST(TestCoreTransferBatch, DISABLED_PerformanceTransferBatch)
+{
+    TransferBatchTest test(44);
+    auto batch = std::make_unique<TransferBatch>();
+    const unsigned int hardwareThreads = std::max(std::thread::hardware_concurrency(), 2u);
+    TransferBatchParallelWorkHelpers helpers(std::min(hardwareThreads, 8u) - 1);
+
+    // many entities for realistic cache misses
+    test.fillSpectrum(SPECTRUM_CAPACITY / 2, 1000000);
+    constexpr unsigned int numberOfTicks = 200;
+    long long sequentialNanosec = 0, batchNanosec = 0;
+    for (unsigned int tick = 0; tick < numberOfTicks; ++tick)
+    {
+        test.generateTransfers(TransferBatch::capacity);
+
+        // alternate order, so both see cold caches
+        for (unsigned int i = 0; i < 2; ++i)
+        {
+            const bool useBatch = (i ^ tick) & 1;
+            auto start = std::chrono::high_resolution_clock::now();
+            if (useBatch)
+                test.processBatch(*batch);
+            else
+                test.processSequentially();
+            const long long nanosec = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start).count();
+            (useBatch ? batchNanosec : sequentialNanosec) += nanosec;
+        }
+    }
+
+    std::cout << "Processing " << TransferBatch::capacity << " transfers: " << sequentialNanosec / numberOfTicks / 1000
+        << " us one by one, " << batchNanosec / numberOfTicks / 1000 << " us as batch with " << helpers.threads.size()
+        << " helpers" << std::endl;
+}
@@ -5,7 +5,9 @@
 #include "../src/public_settings.h"
 #include "../src/platform/virtual_memory.h"
 
+#include <atomic>
 #include <random>
+#include <thread>
 
 TEST(TestVirtualMemory, TestVirtualMemory_NativeChar) {
     initFilesystem();
@@ -235,5 +237,111 @@ TEST(TestVirtualMemory, TestVirtualMemory_SpecialCases) {
         EXPECT_TRUE(memcmp(fetcher.data(), arr.data() + offset, test_len) == 0);
     }
 
+    test_vm.deinit();
+}
+
+TEST(TestVirtualMemory, TestVirtualMemory_ConcurrentReadersAndAppender) {
+    initFilesystem();
+    registerAsynFileIO(NULL);
+    const unsigned long long name_u64 = 987654321;
+    const unsigned long long pageDir = 0;
+    const unsigned long long pageCap = 1009;
+    // few cache pages, so readers evict pages used by each other
+    VirtualMemory<unsigned long long, name_u64, pageDir, pageCap, 4> test_vm;
+    test_vm.init();
+    const unsigned long long N = 300000;
+    auto value = [](unsigned long long index) { return index * 0x9E3779B97F4A7C15ULL + 1; };
+
+    std::atomic<bool> stop(false);
+    std::atomic<unsigned long long> numberOfReads(0), numberOfMismatches(0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; t++)
+    {
+        readers.emplace_back([&, t]()
+            {
+                std::mt19937_64 rnd64(t);
+                std::vector<unsigned long long> fetcher;
+                unsigned long long scanPos = 0;
+                while (!stop)
+                {
+                    const unsigned long long size = test_vm.size();
+                    if (size < pageCap)
+                    {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    unsigned long long offset, length;
+                    if (t == 0)
+                    {
+                        // sequential scan, triggering read ahead
+                        offset = (scanPos + pageCap >= size) ? 0 : scanPos;
+                        length = pageCap;
+                        scanPos = offset + length;
+                    }
+                    else
+                    {
+                        offset = rnd64() % size;
+                        length = 1 + rnd64() % std::min(size - offset, 3 * pageCap);
+                    }
+                    if (t == 2 && length == 1)
+                    {
+                        if (test_vm[offset] != value(offset))
+                            numberOfMismatches++;
+                    }
+                    else
+                    {
+                        fetcher.resize(length);
+                        test_vm.getMany(fetcher.data(), offset, length);
+                        for (unsigned long long i = 0; i < length; i++)
+                        {
+                            if (fetcher[i] != value(offset + i))
+                            {
+                                numberOfMismatches++;
+                                break;
+                            }
+                        }
+                    }
+                    numberOfReads++;
+                }
+            });
+    }
+
+    // append in batches of random size, covering single items, page boundaries and multiple pages
+    std::mt19937_64 rnd64(42);
+    std::vector<unsigned long long> batch;
+    for (unsigned long long pos = 0; pos < N; )
+    {
+        const unsigned long long n_item = std::min(N - pos, (rnd64() % 4 == 0) ? 1 : 1 + rnd64() % (3 * pageCap));
+        if (n_item == 1)
+        {
+            test_vm.append(value(pos));
+        }
+        else
+        {
+            batch.resize(n_item);
+            for (unsigned long long i = 0; i < n_item; i++)
+                batch[i] = value(pos + i);
+            EXPECT_EQ(test_vm.appendMany(batch.data(), n_item), n_item * sizeof(unsigned long long));
+        }
+        pos += n_item;
+    }
+    stop = true;
+    for (auto& reader : readers)
+        reader.join();
+    EXPECT_EQ(test_vm.size(), N);
+    EXPECT_GT(numberOfReads, 0);
+    EXPECT_EQ(numberOfMismatches, 0);
+
+    // full sequential scan after appending
+    std::vector<unsigned long long> fetcher(N);
+    EXPECT_EQ(test_vm.getMany(fetcher.data(), 0, N), N * sizeof(unsigned long long));
+    for (unsigned long long i = 0; i < N; i++)
+    {
+        if (fetcher[i] != value(i))
+        {
+            EXPECT_EQ(fetcher[i], value(i)) << "index " << i;
+            break;
+        }
+    }
     test_vm.deinit();
 }
\ No newline at end of file